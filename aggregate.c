@@ -0,0 +1,236 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+#include <arpa/inet.h>
+
+#include "andwatch.h"
+
+
+// Number of entries in an aggregate table, and the number of ways (entries
+// per set). Both must be powers of 2.
+#define AGGREGATE_ENTRIES       (256)
+#define AGGREGATE_WAYS          (4)
+
+// Length of an IPv6 prefix that is grouped (bytes)
+#define AGGREGATE_PREFIX_LEN    (8)
+
+
+// Group IPv6 addresses by hardware address and prefix
+unsigned int                    aggregate_enabled = 0;
+
+
+// Hardware address and IPv6 prefix pair
+typedef struct aggregate_entry
+{
+    // Prefix (the first 64 bits of the address)
+    unsigned char               prefix[AGGREGATE_PREFIX_LEN];
+
+    // Hardware address
+    struct ether_addr           hwaddr;
+
+    // Time the pair was last seen (zero indicates an unused entry)
+    time_t                      utime;
+} aggregate_entry_t;
+
+
+//
+// Table of hardware address and IPv6 prefix pairs recently seen
+//
+// NB: The table is set associative. When a set is full, the entry seen
+//     longest ago is evicted, and is read from the database if it is seen
+//     again. The table is only allocated when the first pair is seen.
+//
+struct aggregate
+{
+    aggregate_entry_t           entries[AGGREGATE_ENTRIES];
+};
+
+
+
+//
+// Find the entry for a hardware address and prefix
+//
+// NB: If the pair is not in the table, the entry to be replaced is returned
+//     with found set to 0. The table is created on first use.
+//
+static aggregate_entry_t * aggregate_find(
+    aggregate_t **              table,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    int *                       found)
+{
+    aggregate_t *               aggregate;
+    aggregate_entry_t *         set;
+    aggregate_entry_t *         victim;
+    uint32_t                    h = 2166136261U;
+    unsigned int                i;
+
+    aggregate = *table;
+    if (aggregate == NULL)
+    {
+        aggregate = calloc(1, sizeof(aggregate_t));
+        if (aggregate == NULL)
+        {
+            fatal("cannot allocate memory for aggregate table\n");
+        }
+        *table = aggregate;
+    }
+
+    // Find the set (FNV-1a over the prefix and hardware address)
+    for (i = 0; i < AGGREGATE_PREFIX_LEN; i++)
+    {
+        h = (h ^ addr->s6_addr[i]) * 16777619U;
+    }
+    for (i = 0; i < sizeof(*hwaddr); i++)
+    {
+        h = (h ^ hwaddr->ether_addr_octet[i]) * 16777619U;
+    }
+    h ^= h >> 16;
+    set = &aggregate->entries[(h & (AGGREGATE_ENTRIES / AGGREGATE_WAYS - 1)) * AGGREGATE_WAYS];
+
+    // Find the entry, or the entry to be replaced
+    victim = &set[0];
+    for (i = 0; i < AGGREGATE_WAYS; i++)
+    {
+        if (set[i].utime &&
+            memcmp(set[i].prefix, addr->s6_addr, AGGREGATE_PREFIX_LEN) == 0 &&
+            memcmp(&set[i].hwaddr, hwaddr, sizeof(*hwaddr)) == 0)
+        {
+            *found = 1;
+            return &set[i];
+        }
+        if (set[i].utime < victim->utime)
+        {
+            victim = &set[i];
+        }
+    }
+
+    *found = 0;
+    return victim;
+}
+
+
+//
+// Check whether an IPv6 address is grouped by hardware address and prefix
+//
+// NB: Link local addresses are not grouped. Each interface has a single link
+//     local address, which is mapped in the same manner as an IPv4 address.
+//
+// Returns 1 if the address is grouped, or 0 if not
+//
+int aggregate_applies(
+    const struct in6_addr *     addr)
+{
+    return (aggregate_enabled && !IN6_IS_ADDR_LINKLOCAL(addr));
+}
+
+
+//
+// Get the text of the /64 prefix of an IPv6 address
+//
+char * aggregate_prefix(
+    const struct in6_addr *     addr,
+    char *                      prefix,
+    size_t                      prefix_len)
+{
+    struct in6_addr             network;
+
+    memset(&network, 0, sizeof(network));
+    memcpy(network.s6_addr, addr->s6_addr, AGGREGATE_PREFIX_LEN);
+    (void) inet_ntop(AF_INET6, &network, prefix, prefix_len);
+
+    return prefix;
+}
+
+
+//
+// Check whether a hardware address has been seen with an address in a prefix
+//
+// NB: If the pair is not in the table, the database is consulted.
+//
+// Returns 1 if the pair has been seen since the expire time, or 0 if not
+//
+int aggregate_known(
+    shard_t *                   shard,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      expire_time)
+{
+    aggregate_entry_t *         entry;
+    char                        prefix_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    time_t                      utime;
+    int                         found;
+
+    entry = aggregate_find(&shard->aggregate, addr, hwaddr, &found);
+    if (found)
+    {
+        return (entry->utime > expire_time);
+    }
+
+    utime = db_addr6_get_prefix_utime(shard->read_db,
+                                      aggregate_prefix(addr, prefix_str, sizeof(prefix_str)),
+                                      eth_ntop(hwaddr, hwaddr_str, sizeof(hwaddr_str)));
+    if (utime <= expire_time)
+    {
+        return 0;
+    }
+
+    memcpy(entry->prefix, addr->s6_addr, AGGREGATE_PREFIX_LEN);
+    entry->hwaddr = *hwaddr;
+    entry->utime = utime;
+    return 1;
+}
+
+
+//
+// Note that a hardware address has been seen with an address in a prefix
+//
+void aggregate_add(
+    shard_t *                   shard,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      now)
+{
+    aggregate_entry_t *         entry;
+    int                         found;
+
+    entry = aggregate_find(&shard->aggregate, addr, hwaddr, &found);
+    if (found == 0)
+    {
+        memcpy(entry->prefix, addr->s6_addr, AGGREGATE_PREFIX_LEN);
+        entry->hwaddr = *hwaddr;
+    }
+    entry->utime = now;
+}
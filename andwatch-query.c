@@ -33,6 +33,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
 
 #include "andwatch.h"
 
@@ -43,6 +45,8 @@ const char *                    progname;
 db_iptype                       iptype = DB_IPTYPE_ANY;
 const char *                    addr = NULL;
 static unsigned int             all = 0;
+static unsigned int             groups = 0;
+static unsigned int             snapshots = 0;
 
 
 //
@@ -52,10 +56,12 @@ __attribute__ ((noreturn))
 static void usage(void)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  %s [-h] [-a] [-4 | -6] [-L dir] ifname [ipaddr | hwaddr]\n", progname);
+    fprintf(stderr, "  %s [-h] [-a | -g | -s] [-4 | -6] [-L dir] ifname [ipaddr | hwaddr]\n", progname);
     fprintf(stderr, "  options:\n");
     fprintf(stderr, "    -h display usage\n");
     fprintf(stderr, "    -a select all records instead of just the last one\n");
+    fprintf(stderr, "    -g select IPv6 address groups by hardware address and prefix\n");
+    fprintf(stderr, "    -s select the mappings held in the andwatchd snapshots rather than the database\n");
     fprintf(stderr, "    -4 select IPv4 records only\n");
     fprintf(stderr, "    -6 select IPv6 records only\n");
     fprintf(stderr, "    -L directory for library files (default: %s)\n", LIB_DIR);
@@ -70,13 +76,19 @@ static void parse_args(
 
     progname = argv[0];
 
-    while((opt = getopt(argc, argv, "ha46L:")) != -1)
+    while((opt = getopt(argc, argv, "hags46L:")) != -1)
     {
         switch (opt)
         {
         case 'a':
             all = 1;
             break;
+        case 'g':
+            groups = 1;
+            break;
+        case 's':
+            snapshots = 1;
+            break;
         case '4':
             iptype = DB_IPTYPE_4;
             break;
@@ -92,7 +104,7 @@ static void parse_args(
     }
 
     // Ensure we have the correct number of parameters
-    if (argc < optind + 1 || argc > optind + 2)
+    if (argc < optind + 1 || argc > optind + 2 || all + groups + snapshots > 1)
     {
         usage();
     }
@@ -117,6 +129,68 @@ static void parse_args(
 
 
 
+//
+// Query the mappings held in the snapshots of an interface
+//
+// NB: The header of each snapshot is shown, followed by its entries. A
+//     snapshot that is damaged or of an unknown version is reported.
+//
+static void snapshot_query(void)
+{
+    snapshot_t                  snapshot;
+    const snapshot_header_t *   header;
+    const snapshot_entry_t *    entry;
+    char                        date_str[32];
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    char                        filename[ANDWATCH_PATH_BUFFER];
+    unsigned int                workers = 1;
+    unsigned int                i;
+    uint64_t                    j;
+    time_t                      t;
+
+    for (i = 0; i < workers; i++)
+    {
+        if (snapshot_map(ifname, i, &snapshot) != 0)
+        {
+            snapshot_filename(filename, sizeof(filename), ifname, i);
+            fatal("snapshot %s is not available\n", filename);
+        }
+        header = snapshot.header;
+        workers = header->workers;
+
+        t = (time_t) header->time;
+        strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("# snapshot %s worker %u of %u: written %s, %llu entries, ipmap rowid %lld\n",
+               ifname, header->worker, header->workers, date_str,
+               (unsigned long long) header->count, (long long) header->max_rowid);
+
+        for (j = 0; j < header->count; j++)
+        {
+            entry = &snapshot.entries[j];
+            if (iptype != DB_IPTYPE_ANY && entry->iptype != iptype)
+            {
+                continue;
+            }
+
+            (void) inet_ntop((entry->iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, entry->addr, ipaddr_str, sizeof(ipaddr_str));
+            (void) eth_ntop((const struct ether_addr *) entry->hwaddr, hwaddr_str, sizeof(hwaddr_str));
+            if (addr && strcasecmp(addr, ipaddr_str) != 0 && strcasecmp(addr, hwaddr_str) != 0)
+            {
+                continue;
+            }
+
+            t = (time_t) entry->utime;
+            strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S", localtime(&t));
+            printf("%s %s %s %lld%s\n", date_str, ipaddr_str, hwaddr_str, (long long) entry->rowid,
+                   (entry->flags & SNAPSHOT_ENTRY_DIRTY) ? " (pending)" : "");
+        }
+
+        snapshot_unmap(&snapshot);
+    }
+}
+
+
 //
 // Main
 //
@@ -129,12 +203,26 @@ int main(
     // Handle command line args
     parse_args(argc, argv);
 
+    // Query the snapshots
+    if (snapshots)
+    {
+        snapshot_query();
+        exit(EXIT_SUCCESS);
+    }
+
     // Open the ipmap database and attach the malist database
     db = db_ipmap_open(ifname, DB_READ_ONLY);
     db_ma_attach(db);
 
     // Run the query
-    db_ipmap_query(db, iptype, all, addr);
+    if (groups)
+    {
+        db_addr6_query(db, addr);
+    }
+    else
+    {
+        db_ipmap_query(db, iptype, all, addr);
+    }
 
     // Close the database
     db_close(db);
@@ -33,7 +33,11 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <signal.h>
 #include <net/ethernet.h>
+#include <netinet/in.h>
 #include <sqlite3.h>
 #include <pcap.h>
 
@@ -51,7 +55,7 @@
 
 // Buffer size for various strings
 #define ANDWATCH_PATH_BUFFER    (1024)
-#define ANDWATCH_SQL_BUFFER     (1024)
+#define ANDWATCH_SQL_BUFFER     (2048)
 
 // MA database and table names
 #define MA_DB_NAME              "ma_db"
@@ -65,6 +69,7 @@
 #define DB_SUFFIX               ".sqlite"
 #define CSV_SUFFIX              ".csv"
 #define TMP_SUFFIX              ".tmp"
+#define SNAPSHOT_SUFFIX         ".snapshot"
 
 //
 // Notes on snapshot length for pcap:
@@ -88,9 +93,77 @@
 //
 #define PCAP_SNAPLEN            (128)
 
+// Minimum snapshot length when learning hostnames
+//
+// NB: DHCP messages carry their options after a fixed header of 240 bytes,
+//     and mDNS responses may be as large as the MTU.
+//
+#define HOSTNAME_SNAPLEN        (1514)
+
 // Filter for pcap
 #define PCAP_FILTER_USER_MAX    (100)
 
+// Filter read from a filter file
+#define PCAP_FILTER_FILE_MAX    (4096)
+
+// Number of packets per transaction when replaying a capture file
+#define REPLAY_BATCH_SIZE       (50000)
+
+// Default block size (KB) and block retire timeout (ms) for ring capture
+#define RING_BLOCK_SIZE         (256)
+#define RING_TIMEOUT            (100)
+
+// Number of ip addresses held by the dedup filter for each ring, and the
+// maximum dedup window (seconds)
+#define RING_DEDUP_ENTRIES      (65536)
+#define RING_DEDUP_WINDOW_MAX   (3600)
+
+// Maximum number of capture workers
+#define CAPTURE_WORKERS_MAX     (64)
+
+// Default packet rate (per second) from a single hardware address above
+// which the packets of the source are shed
+#define STORM_THRESHOLD         (1000)
+
+// Number of VLAN ids, and the maximum number of VLAN tags parsed on a trunk
+#define VLAN_ID_COUNT           (4096)
+#define VLAN_TAGS_MAX           (2)
+
+// Maximum length of the VLAN suffix of an interface name (".4095.4095")
+#define VLAN_SUFFIX_MAX         (10)
+
+// 802.1ad service VLAN tag
+#ifndef ETHERTYPE_QINQ
+#define ETHERTYPE_QINQ          (0x88a8)
+#endif
+
+// Time (seconds) to wait for a successor during an upgrade, and the name of
+// the environment variable holding the upgrade socket of a successor
+#define UPGRADE_TIMEOUT         (30)
+#define UPGRADE_ENV             "ANDWATCH_UPGRADE_FD"
+
+// Default size (records) of the database writer queue, and the maximum
+// number of records written in a single transaction
+#define WRITER_QUEUE_SIZE       (16384)
+#define WRITER_BATCH_SIZE       (1000)
+
+// Default interval (seconds) at which the update time of an unchanged
+// mapping is refreshed, and the limits of the interval
+#define UPDATE_INTERVAL         (28800)
+#define UPDATE_INTERVAL_MIN     (60)
+#define UPDATE_INTERVAL_MAX     (43200)
+
+// Maximum time (seconds) a refreshed update time is held before it is
+// written, and the maximum number of rows set by a single update
+#define UPDATE_FLUSH_INTERVAL   (300)
+#define UPDATE_BATCH_SIZE       (64)
+
+// Interval (seconds) at which a snapshot of each address cache is written
+#define SNAPSHOT_INTERVAL       (3600)
+
+// Time (ms) to wait for a locked database
+#define DB_BUSY_TIMEOUT         (5000)
+
 // Ethernet address string length
 #define ETH_ADDRSTRLEN          (18)
 
@@ -125,20 +198,463 @@ typedef struct ipmap_current {
     // Row ID in the table
     long                        rowid;
 
-    // Number seconds since last update
-    long                        age;
+    // Time of last update
+    time_t                      utime;
 
     // Current hardware address
     char                        hwaddr_str[ETH_ADDRSTRLEN];
 } ipmap_current_t;
 
+// Callback for each ip address loaded from an ipmap database
+typedef void (*ipmap_load_callback_t)(
+    void *                      context,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const ipmap_current_t *     current);
+
+// Callback for each changed ip address loaded from an ipmap database
+typedef void (*ipmap_changed_callback_t)(
+    void *                      context,
+    db_iptype                   iptype,
+    const char *                ipaddr);
+
+
+// Network address of either type
+typedef union ip_addr
+{
+    struct in_addr              ipv4;
+    struct in6_addr             ipv6;
+} ip_addr_t;
+
+
+// Cache entry holding the current state of an ip address
+typedef struct cache_entry
+{
+    // IP address type (DB_IPTYPE_ANY indicates an unused entry)
+    db_iptype                   iptype;
+
+    // IP address
+    ip_addr_t                   addr;
+
+    // Current hardware address
+    struct ether_addr           hwaddr;
+
+    // IP address has multiple owners (the owners are held in the owner table,
+    // and hwaddr is the owner seen most recently)
+    uint8_t                     multiple;
+
+    // IPv6 address is grouped by hardware address and prefix (the mappings
+    // are held in the addr6 table)
+    uint8_t                     aggregated;
+
+    // Update time has been refreshed, but not yet written
+    uint8_t                     dirty;
+
+    // Entry has been referenced since last passed by the eviction clock
+    uint8_t                     referenced;
+
+    // Position of the writer queue after the last write for the entry
+    unsigned long               sequence;
+
+    // Row ID of the current row in the table
+    long                        rowid;
+
+    // Time of last update of the current row
+    time_t                      utime;
+} cache_entry_t;
+
+
+// Cache of current ip address state (opaque)
+typedef struct cache            cache_t;
+
+// Cache statistics
+typedef struct cache_stats
+{
+    unsigned long               entries;
+    unsigned long               bytes;
+    unsigned long               lookups;
+    unsigned long               hits;
+    unsigned long               evictions;
+} cache_stats_t;
+
+// Snapshot file header
+//
+// NB: A snapshot holds the mappings of the address cache of a capture worker
+//     for an interface, as a header followed by the entries in host byte
+//     order. The checksum is the FNV-1a hash of the entries followed by the
+//     header (with the checksum zero). Every ipmap row added after the
+//     snapshot was taken has a row id above max_rowid.
+//
+typedef struct snapshot_header
+{
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint32_t                    header_size;
+    uint32_t                    entry_size;
+    uint32_t                    worker;
+    uint32_t                    workers;
+    int64_t                     time;
+    int64_t                     max_rowid;
+    uint64_t                    count;
+    uint64_t                    checksum;
+} snapshot_header_t;
+
+// Snapshot file entry
+typedef struct snapshot_entry
+{
+    int64_t                     rowid;
+    int64_t                     utime;
+    uint8_t                     addr[16];
+    uint8_t                     hwaddr[6];
+    uint8_t                     iptype;
+    uint8_t                     flags;
+} snapshot_entry_t;
+
+// Snapshot entry flags
+#define SNAPSHOT_ENTRY_DIRTY    (0x01)
+
+// Mapped snapshot file
+typedef struct snapshot
+{
+    void *                      map;
+    size_t                      size;
+    const snapshot_header_t *   header;
+    const snapshot_entry_t *    entries;
+} snapshot_t;
+
+// Snapshot being written (opaque)
+typedef struct snapshot_writer  snapshot_writer_t;
+
+// An owner of an ip address with multiple owners
+typedef struct owner_entry
+{
+    // IP address type (DB_IPTYPE_ANY indicates an unused entry)
+    db_iptype                   iptype;
+
+    // IP address
+    ip_addr_t                   addr;
+
+    // Hardware address
+    struct ether_addr           hwaddr;
+
+    // Time the owner was last written (zero if not known)
+    time_t                      utime;
+} owner_entry_t;
+
+// Table of the owners of ip addresses with multiple owners (opaque)
+typedef struct owners           owners_t;
+
+// Memory mapped capture ring (opaque)
+typedef struct ring             ring_t;
+
+// Recent observations of ip addresses (opaque)
+typedef struct observe          observe_t;
+
+// Storm detection for a capture (opaque)
+typedef struct storm            storm_t;
+
+// Table of new IPv6 addresses on probation (opaque)
+typedef struct probation        probation_t;
+
+// Table of hostnames recently learned (opaque)
+typedef struct hostnames        hostnames_t;
+
+// Table of hardware address and IPv6 prefix pairs recently seen (opaque)
+typedef struct aggregate        aggregate_t;
+
+// Class of IPv6 address for probation
+typedef enum probation_class
+{
+    PROBATION_LINK_LOCAL = 0,
+    PROBATION_ULA = 1,
+    PROBATION_GLOBAL = 2,
+    PROBATION_CLASSES = 3
+} probation_class;
+
+// Admission requirement for a class of IPv6 address
+typedef struct probation_config
+{
+    // Number of times an address must be seen
+    unsigned int                count;
+
+    // Or, the time over which an address must be seen (seconds, 0 if not used)
+    unsigned int                secs;
+} probation_config_t;
+
+// Classification of an ARP or neighbor discovery packet
+typedef enum observe_class
+{
+    OBSERVE_PROBE,                      // ARP probe (sender address zero)
+    OBSERVE_DAD,                        // IPv6 DAD solicitation (source address unspecified)
+    OBSERVE_ANNOUNCE,                   // ARP announcement or unsolicited neighbor advertisement
+    OBSERVE_GRATUITOUS,                 // Gratuitous ARP reply
+    OBSERVE_REQUEST,                    // ARP request or neighbor solicitation
+    OBSERVE_REPLY                       // ARP reply or solicited neighbor advertisement
+} observe_class;
+
+// Result of observing a packet
+typedef enum observe_result
+{
+    OBSERVE_UPDATE,                     // Update the mapping
+    OBSERVE_COLLAPSE,                   // Repeat of a recent observation
+    OBSERVE_TENTATIVE,                  // Probe of an address that is not yet claimed
+    OBSERVE_DEFEND                      // Claim of an address being probed by another host
+} observe_result;
+
+// Kernel neighbor table source (opaque)
+typedef struct neigh            neigh_t;
+
+
+// Monitored interface
+typedef struct iface
+{
+    // Interface name
+    const char *                name;
+
+    // Ipmap database connection (writer thread)
+    sqlite3 *                   db;
+
+    // Database transaction is open (writer thread)
+    int                         transaction;
+    struct iface *              transaction_next;
+
+    // Interfaces for the VLANs on a trunk, indexed by VLAN id (created on
+    // first use under the VLAN mutex)
+    struct iface **             vlans;
+
+    // Row ID to be used for the next insert
+    //
+    // NB: The following are shared by the capture workers, and are
+    //     accessed atomically.
+    long                        next_rowid;
+
+    // Rows updated at or before this time have been expired
+    time_t                      expire_time;
+
+    // Next time database maintenance should be performed
+    time_t                      next_maintenance_time;
+
+    // The owner and addr6 tables may have rows (set when the database is
+    // opened, and when a row is first submitted to the writer)
+    int                         owner_rows;
+    int                         addr6_rows;
+
+    // Capture workers holding a shard of the interface (bit mask)
+    uint64_t                    workers;
+
+    // Expire time acknowledged by each capture worker, and the time rows
+    // have been deleted to (writer thread)
+    time_t                      expire_acked[CAPTURE_WORKERS_MAX];
+    time_t                      delete_time;
+} iface_t;
+
+
+// Record queue (opaque)
+typedef struct queue            queue_t;
+
+
+// State of a capture ring handed to a successor on upgrade
+typedef struct ring_handoff
+{
+    uint32_t                    block_size;
+    uint32_t                    block_count;
+    uint32_t                    block_index;
+    uint32_t                    fanout;
+} ring_handoff_t;
+
+
+// Capture source
+typedef enum capture_source
+{
+    CAPTURE_PCAP = 0,
+    CAPTURE_RING = 1,
+    CAPTURE_NEIGH = 2
+} capture_source;
+
+
+// Configuration that must match for a successor to adopt the captures of
+// its predecessor on upgrade
+typedef struct upgrade_config
+{
+    uint32_t                    workers;
+    uint32_t                    ifaces;
+    uint32_t                    source;
+    uint32_t                    vlan_trunk;
+    uint32_t                    snaplen;
+    uint32_t                    dedup;
+} upgrade_config_t;
+
+
+// Capture shard
+//
+// NB: A shard holds the capture state of one interface for one capture
+//     worker. With multiple workers, packets are distributed across the
+//     workers by sender address, so each shard holds a distinct subset of
+//     the ip addresses seen on the interface.
+typedef struct shard
+{
+    // Interface
+    iface_t *                   iface;
+
+    // Capture handle (only one of pcap, ring or neigh is used)
+    pcap_t *                    pcap;
+    ring_t *                    ring;
+    neigh_t *                   neigh;
+
+    // Ipmap database connection for reading
+    sqlite3 *                   read_db;
+
+    // Cache of current ip address mappings
+    cache_t *                   cache;
+
+    // Recent observations, for collapsing probe and announcement bursts
+    observe_t *                 observe;
+
+    // Storm detection (capture shards only, NULL if disabled)
+    storm_t *                   storm;
+
+    // New IPv6 addresses on probation (NULL until first used)
+    probation_t *               probation;
+
+    // Hostnames recently learned (NULL until first used)
+    hostnames_t *               hostnames;
+
+    // Owners of ip addresses with multiple owners (NULL until first used)
+    owners_t *                  owners;
+
+    // Hardware address and IPv6 prefix pairs (NULL until first used)
+    aggregate_t *               aggregate;
+
+    // Queue to the database writer
+    queue_t *                   queue;
+
+    // Ring holding the dedup filter of the shard, and the VLAN ids of the
+    // shard in the keys of the filter (NULL if the filter is not used)
+    ring_t *                    dedup;
+    uint32_t                    dedup_vlans;
+
+    // Shards for the VLANs on a trunk, indexed by VLAN id, and the list of
+    // VLAN shards created (capture worker)
+    struct shard **             vlans;
+    struct shard *              vlan_list;
+    struct shard *              vlan_next;
+
+    // Time of the most recent packet
+    time_t                      packet_time;
+
+    // Timestamp of the most recent packet captured, and on upgrade, of the
+    // last packet processed by the predecessor (capture shards)
+    struct timeval              capture_time;
+    struct timeval              resume_time;
+
+    // Time the cache has been expired to
+    time_t                      expire_time;
+
+    // Time the pending update times are next written, and the time the
+    // oldest pending update time became pending (zero if none)
+    time_t                      flush_time;
+    time_t                      dirty_time;
+
+    // Time the next snapshot of the cache is written
+    time_t                      snapshot_time;
+
+    // Capture worker of the shard, and the number of workers
+    unsigned int                worker;
+    unsigned int                workers;
+
+    // Statistics
+    unsigned long               packets;
+    unsigned long               inserts;
+    unsigned long               updates;
+    unsigned long               collapsed;
+    unsigned long               shed;
+    unsigned long               held;
+    unsigned long               learned;
+} shard_t;
+
+
+// Database writer record type
+typedef enum record_type
+{
+    RECORD_INSERT = 0,
+    RECORD_UTIME = 1,
+    RECORD_MAINTENANCE = 2,
+    RECORD_HOSTNAME = 3,
+    RECORD_OWNER_INSERT = 4,
+    RECORD_OWNER_UTIME = 5,
+    RECORD_ADDR6_INSERT = 6,
+    RECORD_ADDR6_UTIME = 7
+} record_type;
+
+// Database writer record
+typedef struct record
+{
+    // Record type
+    record_type                 type;
+
+    // IP address type
+    db_iptype                   iptype;
+
+    // Interface
+    iface_t *                   iface;
+
+    // IP address
+    ip_addr_t                   addr;
+
+    // New and previous hardware address (insert, owner insert and addr6 insert)
+    struct ether_addr           hwaddr;
+    struct ether_addr           old_hwaddr;
+    int                         old_valid;
+
+    // Time of the observation (maintenance: expire time)
+    struct timeval              timestamp;
+
+    // Row ID to insert (maintenance: capture worker)
+    long                        rowid;
+
+    // Row IDs to update (update time, freed by the writer)
+    long *                      rowids;
+    unsigned int                rowid_count;
+
+    // Learned hostname (hostname, freed by the writer)
+    char *                      hostname;
+} record_t;
+
+// Queue statistics
+typedef struct queue_stats
+{
+    unsigned long               size;
+    unsigned long               depth;
+    unsigned long               high_water;
+    unsigned long               overflows;
+} queue_stats_t;
+
+
+// Alternate output for log messages
+typedef void (*logger_output_t)(int priority, const char * format, va_list args);
+
 
 // Command line variables/flags
 extern unsigned int             flag_syslog;
+extern logger_output_t          logger_output;
 extern const char *             lib_dir;
 extern const char *             ifname;
 extern const char *             notify_cmd;
+extern unsigned int             notify_enabled;
+extern sqlite3 *                ma_db;
+extern volatile sig_atomic_t    writer_report_requested;
+extern volatile sig_atomic_t    report_generation;
+extern volatile sig_atomic_t    interface_reload_requested;
+extern volatile sig_atomic_t    upgrade_requested;
+extern volatile sig_atomic_t    terminate_requested;
 extern long                     delete_days;
+extern long                     update_interval;
+extern unsigned long            cache_limit;
+extern unsigned int             vlan_trunk;
+extern unsigned long            storm_threshold;
+extern probation_config_t       probation_config[PROBATION_CLASSES];
+extern unsigned int             hostname_enabled;
+extern unsigned int             aggregate_enabled;
 
 //
 // Global functions
@@ -150,6 +666,23 @@ extern void logger(
     const char *                format,
     ...);
 
+__attribute__ ((format (printf, 1, 0)))
+extern void vlogger(
+    const char *                format,
+    va_list                     args);
+
+// Log for abnormal events caused by packets, rate limited by message
+__attribute__ ((format (printf, 1, 2)))
+extern void logger_limited(
+    const char *                format,
+    ...);
+
+// Report messages suppressed by rate limiting on the calling thread
+extern void logger_summary(void);
+
+// Start the asynchronous log thread
+extern void logger_start(void);
+
 // Fatal error
 __attribute__ ((noreturn, format (printf, 1, 2)))
 extern void fatal(
@@ -162,6 +695,17 @@ extern void safe_strncpy(
     const char *                src,
     size_t                      limit);
 
+// Convert an ethernet address to printable (text) form
+extern const char * eth_ntop(
+    const struct ether_addr *   eth_addr,
+    char *                      buf,
+    size_t                      buflen);
+
+// Convert a printable (text) ethernet address to binary
+extern int eth_pton(
+    const char *                str,
+    struct ether_addr *         eth_addr);
+
 // Do a reverse lookup on a network address
 extern void reverse_naddr(
     int                         type,
@@ -180,21 +724,215 @@ extern void reverse_paddr(
 extern pcap_t * interface_open(
     const char *                interface,
     const int                   snaplen,
-    const int                   promisc);
+    const int                   promisc,
+    const unsigned int          timeout);
 
-// Start a pcap session
-extern void interface_loop(
+// Open a capture file for replay
+extern pcap_t * interface_open_offline(
+    const char *                filename);
+
+// Replay a capture file
+extern void interface_replay(
+    shard_t *                   shard,
+    pcap_handler                callback);
+
+// Compile the capture filter
+extern void interface_compile(
+    pcap_t *                    pcap,
+    const char *                user_filter,
+    struct bpf_program *        program);
+
+// Set the capture filter for a pcap session
+extern void interface_setfilter(
     pcap_t *                    pcap,
-    const char *                filter,
+    const char *                user_filter);
+
+// Set the filter and start capture for a shard
+extern void interface_start(
+    shard_t *                   shard);
+
+// Set the user filter
+extern void interface_filter_init(
+    const char *                user_filter,
+    const char *                filename);
+
+// Reload the user filter and the exclusions
+extern void interface_reload(void);
+
+// Process the packets waiting in the pcap session of a shard
+extern void interface_drain(
+    shard_t *                   shard,
+    pcap_handler                callback);
+
+// Set the filter for a capture adopted from a predecessor
+extern void interface_resume(
+    shard_t *                   shard);
+
+// Run the capture loop for a set of shards
+extern void interface_loop(
+    shard_t *                   shards,
+    unsigned int                count,
+    unsigned int                batch_size,
+    pcap_handler                callback);
+
+// Open a TPACKET_V3 ring on an interface
+extern ring_t * ring_open(
+    const char *                interface,
+    const int                   snaplen,
+    const int                   promisc,
+    const unsigned int          block_size,
+    const unsigned int          timeout,
+    const unsigned int          fanout,
+    const unsigned int          dedup_window);
+
+// Attach the capture filter and start capture on a ring
+extern void ring_start(
+    ring_t *                    ring,
+    const char *                user_filter);
+
+// Set the capture filter for a ring
+extern void ring_setfilter(
+    ring_t *                    ring,
+    const char *                user_filter);
+
+// Get the state of a ring to hand to a successor
+extern int ring_handoff(
+    ring_t *                    ring,
+    ring_handoff_t *            handoff,
+    int *                       fds);
+
+// Adopt a ring handed over by a predecessor
+extern ring_t * ring_adopt(
+    const char *                interface,
+    const int                   snaplen,
+    const ring_handoff_t *      handoff,
+    const int *                 fds,
+    unsigned int                fd_count);
+
+// Get the selectable file descriptor for a ring
+extern int ring_get_fd(
+    ring_t *                    ring);
+
+// Process the frames in all blocks ready in a ring
+extern int ring_dispatch(
+    ring_t *                    ring,
     pcap_handler                callback,
     void *                      closure);
 
+// Remove an ip address from the dedup filter of a ring
+extern void ring_forget(
+    ring_t *                    ring,
+    uint32_t                    vlans,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Load the dedup socket filter
+extern int ebpf_dedup_open(
+    const int                   snaplen,
+    const unsigned int          window,
+    const unsigned int          entries,
+    const unsigned int          trunk,
+    int *                       map_fd_ret);
+
+// Remove an ip address from the dedup map
+extern void ebpf_dedup_forget(
+    const int                   map_fd,
+    const uint32_t              vlans,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Load the exclusion file and generate the exclusion program
+extern void exclude_load(
+    const char *                filename);
+
+// Reload the exclusion file
+extern int exclude_reload(void);
+
+// Revert the replacement of the exclusion program by the last reload
+extern void exclude_revert(void);
+
+// Apply the exclusion program to a compiled capture filter
+extern int exclude_apply(
+    struct bpf_program *        program);
+
+// Is an exclusion program in use
+extern int exclude_enabled(void);
+
+// Open a kernel neighbor table source for an interface
+extern neigh_t * neigh_open(
+    const char *                interface);
+
+// Adopt a kernel neighbor table source handed over by a predecessor
+extern neigh_t * neigh_adopt(
+    const char *                interface,
+    int                         fd);
+
+// Start the kernel neighbor table source
+extern void neigh_start(
+    neigh_t *                   neigh);
+
+// Get the selectable file descriptor for a kernel neighbor table source
+extern int neigh_get_fd(
+    neigh_t *                   neigh);
+
+// Process the messages ready on a kernel neighbor table source
+extern int neigh_dispatch(
+    neigh_t *                   neigh,
+    shard_t *                   shard);
+
 // Pcap callback for processing packets
 extern void pcap_packet_callback(
     u_char *                    closure,
     const struct pcap_pkthdr *  pkghdr,
     const unsigned char *       bytes);
 
+// Process a neighbor observed in the kernel neighbor table
+extern void packet_neighbor(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    const struct timeval *      timestamp);
+
+// Get the shard for a VLAN on a trunk
+extern shard_t * packet_vlan_shard(
+    shard_t *                   shard,
+    unsigned int                vid);
+
+// Load the current mappings for an interface into the caches of its shards
+extern void packet_load(
+    shard_t *                   shard,
+    unsigned int                workers,
+    unsigned int                stride);
+
+// Report the cache statistics for a shard and its VLANs
+extern void packet_report(
+    shard_t *                   shard);
+
+// Schedule database maintenance for a shard and its VLANs if it is due
+extern void packet_maintenance(
+    shard_t *                   shard);
+
+// Write the pending update times of a quiet shard and its VLANs
+extern int packet_idle(
+    shard_t *                   shard,
+    time_t                      now);
+
+// Write the pending update times for a shard and its VLANs
+extern void packet_flush(
+    shard_t *                   shard);
+
+// Write a snapshot of the cache of a shard if one is due
+extern void packet_snapshot(
+    shard_t *                   shard,
+    unsigned int                force);
+
+// Restore the caches of the shards for an interface from their snapshots
+extern int packet_restore(
+    shard_t *                   shard,
+    unsigned int                workers,
+    unsigned int                stride);
+
 // Open an ipmap database
 extern sqlite3 * db_ipmap_open(
     const char *                db_name,
@@ -238,6 +976,7 @@ extern void db_ma_insert(
 // Insert an entry in an ipmap database
 extern void db_ipmap_insert(
     sqlite3 *                   db,
+    long                        rowid,
     db_iptype                   iptype,
     const char *                ipaddr,
     const char *                hwaddr,
@@ -247,6 +986,24 @@ extern void db_ipmap_delete_old(
     sqlite3 *                   db,
     time_t                      time);
 
+// Get the highest row id in an ipmap database
+extern long db_ipmap_get_max_rowid(
+    sqlite3 *                   db);
+
+// Load the current (last) values for all ip addresses
+extern unsigned long db_ipmap_load_current(
+    sqlite3 *                   db,
+    int                         recent,
+    ipmap_load_callback_t       callback,
+    void *                      context);
+
+// Load the ip addresses that have changed since a given row
+extern unsigned long db_ipmap_load_changed(
+    sqlite3 *                   db,
+    long                        rowid,
+    ipmap_changed_callback_t    callback,
+    void *                      context);
+
 // Get the current (last) values for an ip address
 extern void db_ipmap_get_current(
     sqlite3 *                   db,
@@ -254,10 +1011,95 @@ extern void db_ipmap_get_current(
     const char *                ipaddr,
     ipmap_current_t *           current);
 
-// Set the update time for a row
-extern void db_ipmap_set_utime(
+// Set the update time for a set of rows
+extern void db_ipmap_set_utimes(
+    sqlite3 *                   db,
+    const long *                rowids,
+    unsigned int                count,
+    time_t                      time);
+
+// Record an owner of an ip address with multiple owners
+extern void db_owner_set(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    const struct timeval *      timeval);
+
+// Check whether the owner table has any rows
+extern int db_owner_any(
+    sqlite3 *                   db);
+
+// Get the owner of an ip address with multiple owners seen most recently
+extern void db_owner_get_current(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    ipmap_current_t *           current);
+
+// Get the update time of an owner of an ip address
+extern time_t db_owner_get_utime(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr);
+
+// Delete owners older than a given time
+extern void db_owner_delete_old(
+    sqlite3 *                   db,
+    time_t                      time);
+
+// Record an IPv6 address grouped by hardware address and prefix
+extern void db_addr6_set(
+    sqlite3 *                   db,
+    const char *                ipaddr,
+    const char *                prefix,
+    const char *                hwaddr,
+    const struct timeval *      timeval,
+    int                         change);
+
+// Check whether the addr6 table has any rows
+extern int db_addr6_any(
+    sqlite3 *                   db);
+
+// Get the current mapping of an IPv6 address grouped by hardware address and prefix
+extern void db_addr6_get_current(
+    sqlite3 *                   db,
+    const char *                ipaddr,
+    ipmap_current_t *           current);
+
+// Get the time a hardware address was last seen with an address in a prefix
+extern time_t db_addr6_get_prefix_utime(
+    sqlite3 *                   db,
+    const char *                prefix,
+    const char *                hwaddr);
+
+// Delete grouped IPv6 addresses older than a given time
+extern void db_addr6_delete_old(
+    sqlite3 *                   db,
+    time_t                      time);
+
+// Set the learned hostname for an ip address and hardware address
+extern void db_hostname_set(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    const char *                hostname,
+    time_t                      time);
+
+// Get the learned hostname for an ip address and hardware address
+extern int db_hostname_get(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    char *                      hostname,
+    size_t                      hostname_len);
+
+// Delete learned hostnames older than a given time
+extern void db_hostname_delete_old(
     sqlite3 *                   db,
-    long                        rowid,
     time_t                      time);
 
 // Lookup the organization name for a mac address
@@ -281,14 +1123,267 @@ extern void db_ipmap_query(
     const unsigned int          all,
     const char *                ipaddr);
 
+// Query the IPv6 addresses grouped by hardware address and prefix
+extern void db_addr6_query(
+    sqlite3 *                   db,
+    const char *                addr);
+
+// Create a cache for a capture worker
+extern cache_t * cache_create(
+    unsigned int                worker);
+
+// Lookup the cache entry for an ip address
+extern cache_entry_t * cache_lookup(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Insert (or find) the cache entry for an ip address
+extern cache_entry_t * cache_insert(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Delete the cache entry for an ip address
+extern int cache_delete(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Remove cache entries with an update time at or before a given time
+extern void cache_expire(
+    cache_t *                   cache,
+    time_t                      time);
+
+// Check whether the last write for a cache entry is committed
+extern int cache_written(
+    const cache_t *             cache,
+    const cache_entry_t *       entry);
+
+// Check whether a cache has reached its memory limit
+extern int cache_full(
+    const cache_t *             cache);
+
+// Set the position of the writer queue up to which writes are committed
+extern void cache_set_committed(
+    cache_t *                   cache,
+    unsigned long               committed);
+
+// Get the statistics for a cache
+extern void cache_stats(
+    const cache_t *             cache,
+    cache_stats_t *             stats);
+
+// Get the next entry in a cache
+extern cache_entry_t * cache_next(
+    cache_t *                   cache,
+    unsigned long *             index);
+
+// Get the file name of the snapshot of a capture worker for an interface
+extern void snapshot_filename(
+    char *                      filename,
+    size_t                      len,
+    const char *                name,
+    unsigned int                worker);
+
+// Create a snapshot
+extern snapshot_writer_t * snapshot_create(
+    const char *                name,
+    unsigned int                worker);
+
+// Add an entry to a snapshot
+extern void snapshot_add(
+    snapshot_writer_t *         writer,
+    const snapshot_entry_t *    entry);
+
+// Complete a snapshot
+extern void snapshot_commit(
+    snapshot_writer_t *         writer,
+    const snapshot_header_t *   header);
+
+// Map the snapshot of a capture worker for an interface
+extern int snapshot_map(
+    const char *                name,
+    unsigned int                worker,
+    snapshot_t *                snapshot);
+
+// Unmap a snapshot
+extern void snapshot_unmap(
+    snapshot_t *                snapshot);
+
+// Create an observation table
+extern observe_t * observe_create(void);
+
+// Observe a packet for an ip address
+extern observe_result observe_packet(
+    observe_t *                 observe,
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr,
+    observe_class               class,
+    time_t                      time,
+    struct ether_addr *         other);
+
+// Forget the observation of an ip address
+extern void observe_forget(
+    observe_t *                 observe,
+    db_iptype                   iptype,
+    const void *                addr);
+
+// Create storm detection for a capture
+extern storm_t * storm_create(
+    const char *                ifname);
+
+// Count a packet from a source hardware address
+extern int storm_packet(
+    storm_t *                   storm,
+    const struct ether_addr *   hwaddr,
+    time_t                      now);
+
+// Parse a probation requirement (class:count[:secs])
+extern int probation_parse(
+    const char *                spec);
+
+// Check admission of a new IPv6 address
+extern int probation_admit(
+    probation_t **              table,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      now);
+
+// Parse a multiple owner address or prefix (ipaddr[/len] or hwaddr[/len])
+extern int owner_parse(
+    const char *                spec);
+
+// Check whether a mapping indicates an ip address with multiple owners
+extern int owner_is_multiple(
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr);
+
+// Find the owner entry for an ip address and hardware address
+extern owner_entry_t * owner_lookup(
+    owners_t **                 table,
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr);
+
+// Check whether an IPv6 address is grouped by hardware address and prefix
+extern int aggregate_applies(
+    const struct in6_addr *     addr);
+
+// Get the text of the /64 prefix of an IPv6 address
+extern char * aggregate_prefix(
+    const struct in6_addr *     addr,
+    char *                      prefix,
+    size_t                      prefix_len);
+
+// Check whether a hardware address has been seen with an address in a prefix
+extern int aggregate_known(
+    shard_t *                   shard,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      expire_time);
+
+// Note that a hardware address has been seen with an address in a prefix
+extern void aggregate_add(
+    shard_t *                   shard,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      now);
+
+// Process a UDP packet carrying a hostname announcement
+extern int hostname_packet(
+    shard_t *                   shard,
+    uint16_t                    eth_type,
+    const struct ether_addr *   eth_src_addr,
+    const unsigned char *       packet,
+    unsigned int                packet_len,
+    unsigned int                shed,
+    const struct timeval *      timestamp);
+
 // Change notifications
 extern void change_notification(
-    sqlite3 *                   db,
+    const char *                ifname,
     const struct timeval *      timeval,
     int                         af_type,
     const void *                addr,
+    const char *                learned_hostname,
     const char *                ipaddr,
     const char *                new_hwaddr,
     const char *                old_hwaddr);
 
+// Create a record queue
+extern queue_t * queue_create(
+    unsigned long               size);
+
+// Add a record to a queue
+extern int queue_push(
+    queue_t *                   queue,
+    const record_t *            record);
+
+// Remove a record from a queue
+extern int queue_pop(
+    queue_t *                   queue,
+    record_t *                  record);
+
+// Get the position of the next record to be added to a queue
+extern unsigned long queue_position(
+    queue_t *                   queue);
+
+// Mark all records removed from a queue as committed
+extern void queue_commit(
+    queue_t *                   queue);
+
+// Get the position up to which records in a queue are committed
+extern unsigned long queue_committed(
+    queue_t *                   queue);
+
+// Get the statistics for a queue
+extern void queue_stats(
+    queue_t *                   queue,
+    queue_stats_t *             stats);
+
+// Start the database writer thread
+extern void writer_start(
+    unsigned int                queue_count,
+    unsigned long               queue_size,
+    unsigned int                batch_size,
+    int                         wait_when_full);
+
+// Get a queue to the database writer
+extern queue_t * writer_get_queue(
+    unsigned int                index);
+
+// Submit a record to the database writer
+extern int writer_submit(
+    queue_t *                   queue,
+    const record_t *            record);
+
+// Wake the database writer
+extern void writer_signal(void);
+
+// Wait for the database writer to write all queued records
+extern void writer_flush(void);
+
+// Stop the database writer thread after writing all queued records
+extern void writer_stop(void);
+
+// Report database writer statistics
+extern void writer_report(void);
+
+// Hand the captures and state to a successor
+extern int upgrade_start(
+    char * const                argv[],
+    const upgrade_config_t *    config,
+    shard_t *                   shards,
+    unsigned int                count);
+
+// Adopt the captures and state of a predecessor
+extern void upgrade_receive(
+    int                         sock,
+    const upgrade_config_t *    config,
+    shard_t *                   shards,
+    unsigned int                count);
+
 #endif
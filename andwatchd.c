@@ -36,6 +36,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/file.h>
+#include <pthread.h>
 
 #include "andwatch.h"
 
@@ -43,19 +44,54 @@
 // Command line variables/flags
 static const char *             progname;
 static unsigned int             foreground = 0;
+static unsigned int             async_logging = 0;
 static unsigned int             promisc = 0;
 static const char *             pidfile_name = NULL;
 static const char *             user_filter = NULL;
+static const char *             filter_file = NULL;
+static const char *             exclude_file = NULL;
 static int                      snaplen = PCAP_SNAPLEN;
+static unsigned int             ring_capture = 0;
+static unsigned int             neigh_source = 0;
+static unsigned int             ring_block_size = RING_BLOCK_SIZE;
+static unsigned int             capture_timeout = 0;
+static unsigned int             batch_size = 0;
+static unsigned long            queue_size = WRITER_QUEUE_SIZE;
+static unsigned int             worker_count = 1;
+static unsigned int             dedup_window = 0;
+static const char *             replay_file = NULL;
+static char * const *           saved_argv = NULL;
+
+// Upgrade socket of a successor (-1 if not a successor)
+static int                      upgrade_fd = -1;
+
+// Monitored interfaces
+static iface_t *                ifaces = NULL;
+static unsigned int             iface_count = 0;
+
+// Capture shards (iface_count shards for each worker)
+static shard_t *                shards = NULL;
+
+// Capture workers are running
+static volatile sig_atomic_t    capturing = 0;
 
 
 //
 // Termination handler
 //
-__attribute__ ((noreturn))
+// NB: Once capture has started, termination is left to the main thread so
+//     that pending last seen times are written. A second signal exits
+//     immediately.
+//
 static void term_handler(
     int                         signum)
 {
+    if (capturing && terminate_requested == 0)
+    {
+        terminate_requested = signum;
+        return;
+    }
+
     // Remove the pid file if in use
     if (pidfile_name)
     {
@@ -66,6 +102,40 @@ static void term_handler(
 }
 
 
+//
+// Statistics report handler
+//
+static void report_handler(
+    __attribute__ ((unused))
+    int                         signum)
+{
+    writer_report_requested = 1;
+    report_generation++;
+}
+
+
+//
+// Reload handler
+//
+static void reload_handler(
+    __attribute__ ((unused))
+    int                         signum)
+{
+    interface_reload_requested = 1;
+}
+
+
+//
+// Upgrade handler
+//
+static void upgrade_handler(
+    __attribute__ ((unused))
+    int                         signum)
+{
+    upgrade_requested = 1;
+}
+
+
 
 //
 // Create pid file
@@ -174,20 +244,45 @@ __attribute__ ((noreturn))
 static void usage(void)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  %s [-h] [-f] [-s] [-n cmd] [-p file] [-F filter] [-L dir] [-O days] [-P] [-S len] ifname\n", progname);
+    fprintf(stderr, "  %s [-h] [-f] [-s] [-A] [-n cmd] [-p file] [-F filter | -E file] [-X file] [-L dir] [-O days] [-u secs] [-C kbytes] [-P] [-S len] [-R] [-B kbytes] [-T msec] [-b count] [-q count] [-W count] [-D secs] [-M pps] [-U class:count[:secs]] [-G addr[/len]] [-I] [-H] [-V] [-N] [-r file] ifname [ifname ...]\n", progname);
     fprintf(stderr, "  options:\n");
     fprintf(stderr, "    -h display usage\n");
     fprintf(stderr, "    -f run in foreground\n");
     fprintf(stderr, "    -s log notifications via syslog\n");
+    fprintf(stderr, "    -A log from a background thread\n");
     fprintf(stderr, "    -n notify command\n");
     fprintf(stderr, "    -p process id file name\n");
     fprintf(stderr, "    -F additional pcap filter (max %d bytes)\n", PCAP_FILTER_USER_MAX);
+    fprintf(stderr, "    -E additional pcap filter read from a file (max %d bytes)\n", PCAP_FILTER_FILE_MAX);
+    fprintf(stderr, "    -X exclusion file of ip addresses, prefixes and hardware addresses\n");
     fprintf(stderr, "    -L directory for database files (default: %s)\n", LIB_DIR);
     fprintf(stderr, "    -O number of days before deleting old records (default: %u)\n", DELETE_DAYS);
+    fprintf(stderr, "    -u seconds between updates of the last seen time of an unchanged record (default: %u, min %u, max %u)\n",
+            UPDATE_INTERVAL, UPDATE_INTERVAL_MIN, UPDATE_INTERVAL_MAX);
+    fprintf(stderr, "    -C limit the address caches of each capture worker, across its interfaces and VLANs, to kbytes, evicting the least recently seen (default: no limit, min 64)\n");
     fprintf(stderr, "    -P enable promiscuous mode\n");
     fprintf(stderr, "    -S pcap snaplen (default/minimum: %u)\n", PCAP_SNAPLEN);
+    fprintf(stderr, "    -R capture using a memory mapped ring (Linux only)\n");
+    fprintf(stderr, "    -B ring block size in kbytes (default: %u)\n", RING_BLOCK_SIZE);
+    fprintf(stderr, "    -T capture buffer timeout in milliseconds (default: immediate for pcap, %u for ring)\n", RING_TIMEOUT);
+    fprintf(stderr, "    -b process up to count packets per wakeup, and write up to count records per database transaction (default: %u records)\n", WRITER_BATCH_SIZE);
+    fprintf(stderr, "    -q size of the database writer queue in records (default: %u)\n", WRITER_QUEUE_SIZE);
+    fprintf(stderr, "    -W number of capture workers, distributed by sender address (requires -R, max %u)\n", CAPTURE_WORKERS_MAX);
+    fprintf(stderr, "    -D drop unchanged packets for an address within secs of the last (eBPF, requires -R, max %u)\n", RING_DEDUP_WINDOW_MAX);
+    fprintf(stderr, "    -M shed packets from a hardware address above pps packets per second (default: %u, 0 disables)\n", STORM_THRESHOLD);
+    fprintf(stderr, "    -U admit a new IPv6 address of class (link-local, ula or global) once seen count times, or again after secs\n");
+    fprintf(stderr, "    -G ip address, hardware address or prefix with multiple owners, such as a redundant gateway (may be repeated)\n");
+    fprintf(stderr, "    -I group IPv6 addresses by hardware address and /64 prefix, notifying only for a new pair\n");
+    fprintf(stderr, "    -H learn hostnames from DHCP and mDNS for notifications and queries\n");
+    fprintf(stderr, "    -V monitor a VLAN trunk, with a database for each VLAN (ifname.vid)\n");
+    fprintf(stderr, "    -N monitor the kernel neighbor table rather than capturing packets (Linux only)\n");
+    fprintf(stderr, "    -r replay a capture file into the database for ifname and exit (notifies only with -n)\n");
     fprintf(stderr, "  \nNotes:\n");
     fprintf(stderr, "    The notify command is invoked as: cmd date_time ifname hostname ipaddr new_hwaddr new_hwaddr_org old_hwaddr old_hwaddr_org\n");
+    fprintf(stderr, "    Sending SIGTERM or SIGINT writes pending last seen times and exits\n");
+    fprintf(stderr, "    Sending SIGUSR1 logs the database writer queue and address cache statistics\n");
+    fprintf(stderr, "    Sending SIGHUP reloads the filter file and the exclusion file\n");
+    fprintf(stderr, "    Sending SIGUSR2 upgrades by handing capture and state to a new andwatchd process\n");
     fprintf(stderr, "    For details on tcpdump/pcap filter formats, see https://www.tcpdump.org/manpages/pcap-filter.7.html\n");
 
     exit(EXIT_FAILURE);
@@ -199,10 +294,13 @@ static void parse_args(
 {
     int                         opt;
     char *                      p;
+    unsigned int                i;
+    unsigned int                j;
 
     progname = argv[0];
+    saved_argv = argv;
 
-    while((opt = getopt(argc, argv, "hfsn:p:F:L:O:PS:")) != -1)
+    while((opt = getopt(argc, argv, "hfsAn:p:F:E:X:L:O:u:C:PS:RB:T:b:q:W:D:M:U:G:IHVNr:")) != -1)
     {
         switch (opt)
         {
@@ -212,6 +310,9 @@ static void parse_args(
         case 's':
             flag_syslog = 1;
             break;
+        case 'A':
+            async_logging = 1;
+            break;
         case 'n':
             notify_cmd = optarg;
             break;
@@ -225,6 +326,12 @@ static void parse_args(
                 usage();
             }
             break;
+        case 'E':
+            filter_file = optarg;
+            break;
+        case 'X':
+            exclude_file = optarg;
+            break;
         case 'L':
             lib_dir = optarg;
             break;
@@ -235,6 +342,21 @@ static void parse_args(
                 usage();
             }
             break;
+        case 'u':
+            update_interval = strtol(optarg, &p, 10);
+            if (*p != '\0' || update_interval < UPDATE_INTERVAL_MIN || update_interval > UPDATE_INTERVAL_MAX)
+            {
+                usage();
+            }
+            break;
+        case 'C':
+            cache_limit = strtoul(optarg, &p, 10);
+            if (*p != '\0' || cache_limit < 64 || cache_limit > 16777216)
+            {
+                usage();
+            }
+            cache_limit *= 1024;
+            break;
         case 'P':
             promisc = 1;
             break;
@@ -245,23 +367,374 @@ static void parse_args(
                 usage();
             }
             break;
+        case 'R':
+            ring_capture = 1;
+            break;
+        case 'B':
+            ring_block_size = strtoul(optarg, &p, 10);
+            if (*p != '\0' || ring_block_size < 4 || ring_block_size > 65536)
+            {
+                usage();
+            }
+            break;
+        case 'T':
+            capture_timeout = strtoul(optarg, &p, 10);
+            if (*p != '\0' || capture_timeout < 1 || capture_timeout > 10000)
+            {
+                usage();
+            }
+            break;
+        case 'b':
+            batch_size = strtoul(optarg, &p, 10);
+            if (*p != '\0' || batch_size < 1 || batch_size > 1000000)
+            {
+                usage();
+            }
+            break;
+        case 'q':
+            queue_size = strtoul(optarg, &p, 10);
+            if (*p != '\0' || queue_size < 64 || queue_size > 16777216)
+            {
+                usage();
+            }
+            break;
+        case 'W':
+            worker_count = strtoul(optarg, &p, 10);
+            if (*p != '\0' || worker_count < 1 || worker_count > CAPTURE_WORKERS_MAX)
+            {
+                usage();
+            }
+            break;
+        case 'D':
+            dedup_window = strtoul(optarg, &p, 10);
+            if (*p != '\0' || dedup_window < 1 || dedup_window > RING_DEDUP_WINDOW_MAX)
+            {
+                usage();
+            }
+            break;
+        case 'M':
+            storm_threshold = strtoul(optarg, &p, 10);
+            if (*p != '\0')
+            {
+                usage();
+            }
+            break;
+        case 'U':
+            if (probation_parse(optarg) != 0)
+            {
+                usage();
+            }
+            break;
+        case 'G':
+            if (owner_parse(optarg) != 0)
+            {
+                usage();
+            }
+            break;
+        case 'I':
+            aggregate_enabled = 1;
+            break;
+        case 'H':
+            hostname_enabled = 1;
+            break;
+        case 'V':
+            vlan_trunk = 1;
+            break;
+        case 'N':
+            neigh_source = 1;
+            break;
+        case 'r':
+            replay_file = optarg;
+            foreground = 1;
+            break;
         default:
             usage();
         }
     }
 
     // Ensure we have the correct number of parameters
-    if (argc != optind + 1)
+    if (argc < optind + 1)
+    {
+        usage();
+    }
+
+    // Replay is for a single interface, and notifies only if a notify command is given
+    if (replay_file)
+    {
+        if (argc != optind + 1)
+        {
+            usage();
+        }
+        notify_enabled = (notify_cmd != NULL);
+    }
+
+    // The filter is given directly or read from a file
+    if (user_filter && filter_file)
+    {
+        usage();
+    }
+
+    // Multiple capture workers and the dedup filter require ring capture
+    if ((worker_count > 1 || dedup_window) && (ring_capture == 0 || replay_file))
     {
         usage();
     }
-    ifname = argv[optind];
 
-    // Safty check: Ensure the library path and interface name are not too long
-    if (ANDWATCH_PATH_BUFFER <= strlen(lib_dir) + sizeof("/") + strlen(ifname) + sizeof(DB_SUFFIX))
+    // The kernel neighbor table replaces packet capture
+    if (neigh_source && (ring_capture || replay_file || vlan_trunk || user_filter || filter_file || exclude_file || promisc))
     {
-        fatal("db_filename (%s/%s%s) exceeds maximum length of %d\n",
-            lib_dir, ifname, DB_SUFFIX, ANDWATCH_PATH_BUFFER);
+        usage();
+    }
+
+    // Hostnames are learned from packets that the dedup filter does not pass,
+    // and that are larger than the default snaplen
+    if (hostname_enabled)
+    {
+        if (neigh_source || dedup_window)
+        {
+            usage();
+        }
+        if (snaplen < HOSTNAME_SNAPLEN)
+        {
+            snaplen = HOSTNAME_SNAPLEN;
+        }
+    }
+
+    // Allocate the interfaces
+    iface_count = argc - optind;
+    ifaces = calloc(iface_count, sizeof(iface_t));
+    if (ifaces == NULL)
+    {
+        fatal("cannot allocate memory for interfaces\n");
+    }
+
+    for (i = 0; i < iface_count; i++)
+    {
+        ifaces[i].name = argv[optind + i];
+
+        // Safty check: Ensure the library path and interface name are not too long
+        // NB: On a trunk, the name of each VLAN has a suffix (ifname.vid)
+        if (ANDWATCH_PATH_BUFFER <= strlen(lib_dir) + sizeof("/") + strlen(ifaces[i].name) + sizeof(DB_SUFFIX) +
+                                    (vlan_trunk ? VLAN_SUFFIX_MAX : 0))
+        {
+            fatal("db_filename (%s/%s%s) exceeds maximum length of %d\n",
+                lib_dir, ifaces[i].name, DB_SUFFIX, ANDWATCH_PATH_BUFFER);
+        }
+
+        // Safety check: Ensure the interface is not listed twice
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(ifaces[i].name, ifaces[j].name) == 0)
+            {
+                fatal("interface %s specified more than once\n", ifaces[i].name);
+            }
+        }
+    }
+}
+
+
+//
+// Total the rows inserted and update time changes for a shard and its VLANs
+//
+static void shard_totals(
+    const shard_t *             shard,
+    unsigned long *             inserts,
+    unsigned long *             updates,
+    unsigned long *             collapsed,
+    unsigned long *             shed,
+    unsigned long *             held,
+    unsigned long *             learned)
+{
+    const shard_t *             vlan;
+
+    *inserts += shard->inserts;
+    *updates += shard->updates;
+    *collapsed += shard->collapsed;
+    *shed += shard->shed;
+    *held += shard->held;
+    *learned += shard->learned;
+    for (vlan = shard->vlan_list; vlan; vlan = vlan->vlan_next)
+    {
+        shard_totals(vlan, inserts, updates, collapsed, shed, held, learned);
+    }
+}
+
+
+//
+// Replay a capture file and report a summary
+//
+static void replay(void)
+{
+    shard_t *                   shard = &shards[0];
+    struct timespec             start;
+    struct timespec             end;
+    double                      elapsed;
+    unsigned long               inserts = 0;
+    unsigned long               updates = 0;
+    unsigned long               collapsed = 0;
+    unsigned long               shed = 0;
+    unsigned long               held = 0;
+    unsigned long               learned = 0;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+    interface_replay(shard, pcap_packet_callback);
+    writer_stop();
+    packet_snapshot(shard, 1);
+    (void) clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (elapsed <= 0.0)
+    {
+        elapsed = 1e-9;
+    }
+    shard_totals(shard, &inserts, &updates, &collapsed, &shed, &held, &learned);
+
+    printf("replay of %s for %s complete\n", replay_file, shard->iface->name);
+    printf("  packets:        %lu\n", shard->packets);
+    printf("  elapsed:        %.3f seconds\n", elapsed);
+    printf("  packets/sec:    %.0f\n", (double) shard->packets / elapsed);
+    printf("  rows inserted:  %lu\n", inserts);
+    printf("  utime updates:  %lu\n", updates);
+    printf("  collapsed:      %lu\n", collapsed);
+    printf("  shed:           %lu\n", shed);
+    printf("  on probation:   %lu\n", held);
+    printf("  hostnames:      %lu\n", learned);
+    writer_report();
+    packet_report(shard);
+}
+
+
+//
+// Capture worker thread
+//
+static void * worker_main(
+    void *                      arg)
+{
+    interface_loop((shard_t *) arg, iface_count, batch_size, pcap_packet_callback);
+    return NULL;
+}
+
+
+//
+// Describe the configuration that must match across an upgrade
+//
+static void upgrade_config(
+    upgrade_config_t *          config)
+{
+    memset(config, 0, sizeof(*config));
+    config->workers = worker_count;
+    config->ifaces = iface_count;
+    config->source = neigh_source ? CAPTURE_NEIGH : ring_capture ? CAPTURE_RING : CAPTURE_PCAP;
+    config->vlan_trunk = vlan_trunk;
+    config->snaplen = (uint32_t) snaplen;
+    config->dedup = dedup_window ? 1 : 0;
+}
+
+
+//
+// Start the capture workers
+//
+// NB: The main thread runs the first worker. The other workers are started
+//     with all signals blocked so that signals are handled by the main thread.
+//     When an upgrade is requested, all workers return from interface_loop,
+//     and capture resumes if the successor does not take over.
+//
+__attribute__ ((noreturn))
+static void start_workers(void)
+{
+    pthread_t                   threads[CAPTURE_WORKERS_MAX];
+    upgrade_config_t            config;
+    sigset_t                    sigset;
+    sigset_t                    old_sigset;
+    unsigned int                i;
+    int                         pidfile_fd;
+    int                         r;
+
+    upgrade_config(&config);
+
+    // Set the filters and start capture
+    if (upgrade_fd != -1)
+    {
+        upgrade_receive(upgrade_fd, &config, shards, worker_count * iface_count);
+
+        // NB: The pid file is held by the predecessor until the handoff completes
+        if (pidfile_name)
+        {
+            pidfile_fd = open(pidfile_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (pidfile_fd == -1)
+            {
+                fatal("open of pid file %s failed: %s\n", pidfile_name, strerror(errno));
+            }
+            write_pidfile(pidfile_fd);
+        }
+    }
+    else
+    {
+        for (i = 0; i < worker_count * iface_count; i++)
+        {
+            interface_start(&shards[i]);
+        }
+    }
+
+    while (1)
+    {
+        (void) sigfillset(&sigset);
+        (void) pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+        for (i = 1; i < worker_count; i++)
+        {
+            r = pthread_create(&threads[i], NULL, worker_main, &shards[i * iface_count]);
+            if (r != 0)
+            {
+                fatal("cannot create capture worker thread: %s\n", strerror(r));
+            }
+        }
+        (void) pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+
+        capturing = 1;
+        interface_loop(&shards[0], iface_count, batch_size, pcap_packet_callback);
+        for (i = 1; i < worker_count; i++)
+        {
+            (void) pthread_join(threads[i], NULL);
+        }
+
+        // Write the pending last seen times
+        // NB: The workers have stopped, so their queues may be used here
+        for (i = 0; i < worker_count * iface_count; i++)
+        {
+            packet_flush(&shards[i]);
+        }
+
+        // Terminate
+        if (terminate_requested)
+        {
+            for (i = 0; i < worker_count * iface_count; i++)
+            {
+                packet_report(&shards[i]);
+            }
+            writer_stop();
+
+            // NB: All records have been written, so the snapshots are complete
+            for (i = 0; i < worker_count * iface_count; i++)
+            {
+                packet_snapshot(&shards[i], 1);
+            }
+            if (pidfile_name)
+            {
+                (void) unlink(pidfile_name);
+            }
+            logger("exiting on signal %d\n", (int) terminate_requested);
+            exit(EXIT_SUCCESS);
+        }
+
+        // Hand over to the successor
+        if (upgrade_start(saved_argv, &config, shards, worker_count * iface_count))
+        {
+            logger("upgrade: exiting in favor of the successor\n");
+            exit(EXIT_SUCCESS);
+        }
+
+        logger("upgrade failed: resuming capture\n");
+        upgrade_requested = 0;
     }
 }
 
@@ -273,25 +746,118 @@ int main(
     int                         argc,
     char * const                argv[])
 {
-    pcap_t *                    pcap;
-    sqlite3 *                   db;
+    iface_t *                   iface;
+    shard_t *                   shard;
+    unsigned int                i;
+    unsigned int                w;
     int                         pidfile_fd = -1;
     pid_t                       pid;
     struct sigaction            act;
+    const char *                env;
+    char *                      p;
 
     // Handle command line args
     parse_args(argc, argv);
 
-    // Open the pcap interface
-    pcap = interface_open(ifname, snaplen, promisc);
+    // Are we the successor in an upgrade?
+    env = getenv(UPGRADE_ENV);
+    if (env)
+    {
+        upgrade_fd = (int) strtol(env, &p, 10);
+        if (*p != '\0' || upgrade_fd < 0 || replay_file)
+        {
+            fatal("invalid upgrade environment %s=%s\n", UPGRADE_ENV, env);
+        }
+        (void) unsetenv(UPGRADE_ENV);
+    }
+
+    // Load the filter and the exclusions
+    interface_filter_init(user_filter, filter_file);
+    if (exclude_file)
+    {
+        exclude_load(exclude_file);
+    }
+
+    // Allocate the shards
+    shards = calloc(worker_count * iface_count, sizeof(shard_t));
+    if (shards == NULL)
+    {
+        fatal("cannot allocate memory for shards\n");
+    }
+
+    // Open the capture interfaces
+    //
+    // NB: With multiple workers, each worker has its own ring on each
+    //     interface, and the rings for an interface form a fanout group.
+    //     In an upgrade, rings and neighbor sockets are handed over by the
+    //     predecessor, while pcap sessions are opened to overlap its own.
+    for (w = 0; w < worker_count; w++)
+    {
+        for (i = 0; i < iface_count; i++)
+        {
+            iface = &ifaces[i];
+            shard = &shards[w * iface_count + i];
+            shard->iface = iface;
+            shard->worker = w;
+            shard->workers = worker_count;
+            iface->workers |= 1ULL << w;
+
+            if (replay_file)
+            {
+                shard->pcap = interface_open_offline(replay_file);
+            }
+            else if (upgrade_fd != -1 && (neigh_source || ring_capture))
+            {
+                continue;
+            }
+            else if (neigh_source)
+            {
+                shard->neigh = neigh_open(iface->name);
+            }
+            else if (ring_capture)
+            {
+                shard->ring = ring_open(iface->name, snaplen, promisc, ring_block_size * 1024,
+                                        capture_timeout ? capture_timeout : RING_TIMEOUT,
+                                        worker_count > 1,
+                                        dedup_window);
+            }
+            else
+            {
+                shard->pcap = interface_open(iface->name, snaplen, promisc, capture_timeout);
+            }
+        }
+    }
 
     // Drop privileges
     (void) setgid(getgid());
     (void) setuid(getuid());
 
-    // Open the ipmap database and attach the malist database
-    db = db_ipmap_open(ifname, DB_READ_WRITE);
-    db_ma_attach(db);
+    // Open the malist database (shared by all interfaces)
+    ma_db = db_ma_open(DB_READ_ONLY);
+
+    // Open the ipmap databases and create the caches
+    //
+    // NB: Each database has a write connection for the writer thread, and a
+    //     read connection for each capture shard.
+    for (i = 0; i < iface_count; i++)
+    {
+        iface = &ifaces[i];
+        iface->db = db_ipmap_open(iface->name, DB_READ_WRITE);
+        iface->next_rowid = db_ipmap_get_max_rowid(iface->db) + 1;
+        iface->owner_rows = db_owner_any(iface->db);
+        iface->addr6_rows = db_addr6_any(iface->db);
+    }
+    for (i = 0; i < worker_count * iface_count; i++)
+    {
+        shard = &shards[i];
+        shard->read_db = db_ipmap_open(shard->iface->name, DB_READ_ONLY);
+        shard->cache = cache_create(shard->worker);
+        shard->observe = observe_create();
+        if (storm_threshold && neigh_source == 0)
+        {
+            shard->storm = storm_create(shard->iface->name);
+        }
+    }
 
     // Termination handler
     memset(&act, 0, sizeof(act));
@@ -299,6 +865,21 @@ int main(
     (void) sigaction(SIGTERM, &act, NULL);
     (void) sigaction(SIGINT, &act, NULL);
 
+    // Statistics report handler
+    act.sa_handler = report_handler;
+    (void) sigaction(SIGUSR1, &act, NULL);
+
+    // Reload handler
+    act.sa_handler = reload_handler;
+    (void) sigaction(SIGHUP, &act, NULL);
+
+    // Upgrade handler
+    if (replay_file == NULL)
+    {
+        act.sa_handler = upgrade_handler;
+        (void) sigaction(SIGUSR2, &act, NULL);
+    }
+
     // Ignore SIGCHLD
     act.sa_handler = SIG_IGN;
     if (sigaction(SIGCHLD, &act, NULL) != 0)
@@ -307,13 +888,14 @@ int main(
     }
 
     // Create pid file if requested
-    if (pidfile_name)
+    // NB: A successor writes the pid file once the handoff is complete
+    if (pidfile_name && upgrade_fd == -1)
     {
         pidfile_fd = create_pidfile();
     }
 
     // Self background
-    if (foreground == 0)
+    if (foreground == 0 && upgrade_fd == -1)
     {
         pid = fork();
 
@@ -336,8 +918,54 @@ int main(
         write_pidfile(pidfile_fd);
     }
 
-    // Start the pcap loop
-    interface_loop(pcap, user_filter, pcap_packet_callback, db);
+    // Start asynchronous logging if requested
+    // NB: The log thread is started after the fork, which it would not survive
+    if (async_logging)
+    {
+        logger_start();
+    }
+
+    // Start the database writer
+    // NB: When replaying, nothing is lost by waiting for the writer
+    if (replay_file)
+    {
+        writer_start(1, queue_size, batch_size ? batch_size : REPLAY_BATCH_SIZE, 1);
+    }
+    else
+    {
+        writer_start(worker_count, queue_size, batch_size, 0);
+    }
+
+    // Each worker has its own queue to the writer
+    for (i = 0; i < worker_count * iface_count; i++)
+    {
+        shards[i].queue = writer_get_queue(i / iface_count);
+    }
+
+    // Restore the caches from the snapshots, or load the current mappings,
+    // unless the caches are handed over in an upgrade
+    if (upgrade_fd == -1)
+    {
+        for (i = 0; i < iface_count; i++)
+        {
+            if (packet_restore(&shards[i], worker_count, iface_count) == 0)
+            {
+                packet_load(&shards[i], worker_count, iface_count);
+            }
+        }
+    }
+
+    // Replay the capture file
+    if (replay_file)
+    {
+        replay();
+        if (pidfile_name)
+        {
+            (void) unlink(pidfile_name);
+        }
+        exit(EXIT_SUCCESS);
+    }
 
-    return 0;
+    // Start the capture workers
+    start_workers();
 }
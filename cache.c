@@ -0,0 +1,536 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "andwatch.h"
+
+
+// Initial number of slots in the cache (must be a power of 2)
+#define CACHE_INITIAL_SLOTS     (1024)
+
+
+// Memory limit for the caches of each capture worker (bytes, 0 for no limit)
+unsigned long                   cache_limit = 0;
+
+
+// Memory used by the caches of a capture worker
+//
+// NB: The caches of a worker, for each of its interfaces and VLANs, are
+//     only used by the worker, so no locks are needed.
+typedef struct cache_budget
+{
+    __attribute__ ((aligned (64)))
+    unsigned long               bytes;
+} cache_budget_t;
+
+static cache_budget_t           cache_budgets[CAPTURE_WORKERS_MAX];
+
+
+//
+// Cache of the current hardware address for each ip address
+//
+// NB: The cache is an open addressing hash table using linear probing. The
+//     table is grown when it becomes half full, so probe sequences remain
+//     short. An iptype of DB_IPTYPE_ANY marks an empty slot.
+//
+// NB: If the memory limit of the capture worker would be exceeded by
+//     growing the table, an entry is evicted instead using the CLOCK
+//     algorithm. The limit is shared by all the caches of the worker. An
+//     entry is marked as referenced each time it is found, and the clock
+//     hand passes over referenced entries once, clearing the mark. Entries
+//     with a pending write are never evicted. An evicted entry is read from
+//     the database again when it is next seen.
+//
+struct cache
+{
+    // Table of entries
+    cache_entry_t *             entries;
+
+    // Number of slots in the table (always a power of 2)
+    unsigned long               slots;
+
+    // Number of slots in use
+    unsigned long               count;
+
+    // Memory used by the caches of the capture worker
+    cache_budget_t *            budget;
+
+    // Position of the clock hand
+    unsigned long               hand;
+
+    // Position of the writer queue up to which writes are committed
+    unsigned long               committed;
+
+    // Statistics
+    unsigned long               lookups;
+    unsigned long               hits;
+    unsigned long               evictions;
+};
+
+
+
+//
+// Hash an ip address
+//
+static unsigned long cache_hash(
+    db_iptype                   iptype,
+    const ip_addr_t *           addr)
+{
+    uint64_t                    a;
+    uint64_t                    b;
+    uint64_t                    h;
+
+    memcpy(&a, &addr->ipv6.s6_addr[0], sizeof(a));
+    memcpy(&b, &addr->ipv6.s6_addr[8], sizeof(b));
+
+    // Combine and mix (murmur3 finalizer)
+    h = a ^ (b * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) iptype;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (unsigned long) h;
+}
+
+
+//
+// Build an ip address key from a network address
+//
+static void cache_key(
+    db_iptype                   iptype,
+    const void *                addr,
+    ip_addr_t *                 key)
+{
+    memset(key, 0, sizeof(*key));
+    if (iptype == DB_IPTYPE_4)
+    {
+        memcpy(&key->ipv4, addr, sizeof(key->ipv4));
+    }
+    else
+    {
+        memcpy(&key->ipv6, addr, sizeof(key->ipv6));
+    }
+}
+
+
+//
+// Find the slot for an ip address (either the matching entry or an empty slot)
+//
+static cache_entry_t * cache_find_slot(
+    cache_entry_t *             entries,
+    unsigned long               slots,
+    db_iptype                   iptype,
+    const ip_addr_t *           key)
+{
+    cache_entry_t *             entry;
+    unsigned long               mask = slots - 1;
+    unsigned long               index;
+
+    index = cache_hash(iptype, key) & mask;
+    while (1)
+    {
+        entry = &entries[index];
+        if (entry->iptype == DB_IPTYPE_ANY)
+        {
+            return entry;
+        }
+        if (entry->iptype == iptype && memcmp(&entry->addr, key, sizeof(*key)) == 0)
+        {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+
+//
+// Rebuild the table with the given number of slots
+//
+// NB: If expire_time is non zero, entries with a utime at or before
+//     expire_time are dropped as part of the rebuild.
+//
+static void cache_rebuild(
+    cache_t *                   cache,
+    unsigned long               slots,
+    time_t                      expire_time)
+{
+    cache_entry_t *             entries;
+    cache_entry_t *             entry;
+    cache_entry_t *             slot;
+    unsigned long               count = 0;
+    unsigned long               index;
+
+    entries = calloc(slots, sizeof(cache_entry_t));
+    if (entries == NULL)
+    {
+        fatal("cannot allocate memory for cache\n");
+    }
+
+    for (index = 0; index < cache->slots; index++)
+    {
+        entry = &cache->entries[index];
+        if (entry->iptype == DB_IPTYPE_ANY)
+        {
+            continue;
+        }
+        if (expire_time && entry->utime <= expire_time)
+        {
+            continue;
+        }
+
+        slot = cache_find_slot(entries, slots, entry->iptype, &entry->addr);
+        *slot = *entry;
+        count++;
+    }
+
+    free(cache->entries);
+    cache->budget->bytes += (slots - cache->slots) * sizeof(cache_entry_t);
+    cache->entries = entries;
+    cache->slots = slots;
+    cache->count = count;
+}
+
+
+//
+// Check whether the table can be grown within the memory limit
+//
+static int cache_can_grow(
+    const cache_t *             cache)
+{
+    return (cache_limit == 0 || cache->budget->bytes + cache->slots * sizeof(cache_entry_t) <= cache_limit);
+}
+
+
+//
+// Check whether a cache entry has a pending write
+//
+static int cache_pending(
+    const cache_t *             cache,
+    const cache_entry_t *       entry)
+{
+    return (entry->dirty || cache_written(cache, entry) == 0);
+}
+
+
+//
+// Remove the entry in a slot
+//
+// NB: Entries later in the probe sequence are shifted back to fill the slot,
+//     so that no tombstone is needed.
+//
+static void cache_remove(
+    cache_t *                   cache,
+    unsigned long               index)
+{
+    cache_entry_t *             entries = cache->entries;
+    unsigned long               mask = cache->slots - 1;
+    unsigned long               next = index;
+    unsigned long               home;
+
+    while (1)
+    {
+        next = (next + 1) & mask;
+        if (entries[next].iptype == DB_IPTYPE_ANY)
+        {
+            break;
+        }
+
+        // Can the entry be moved back to the empty slot?
+        home = cache_hash(entries[next].iptype, &entries[next].addr) & mask;
+        if ((index <= next) ? (index < home && home <= next) : (index < home || home <= next))
+        {
+            continue;
+        }
+        entries[index] = entries[next];
+        index = next;
+    }
+
+    memset(&entries[index], 0, sizeof(cache_entry_t));
+    cache->count--;
+}
+
+
+//
+// Evict an entry to make room for another
+//
+// Returns 1 if an entry was evicted, or 0 if all entries have a pending write
+//
+static int cache_evict(
+    cache_t *                   cache)
+{
+    cache_entry_t *             entry;
+    unsigned long               mask = cache->slots - 1;
+    unsigned long               i;
+
+    // NB: Two passes of the hand clear the referenced marks
+    for (i = 0; i < 2 * cache->slots; i++)
+    {
+        entry = &cache->entries[cache->hand];
+        if (entry->iptype != DB_IPTYPE_ANY && cache_pending(cache, entry) == 0)
+        {
+            if (entry->referenced == 0)
+            {
+                // NB: The hand is left in place, as an entry may have been shifted into the slot
+                cache_remove(cache, cache->hand);
+                cache->evictions++;
+                return 1;
+            }
+            entry->referenced = 0;
+        }
+        cache->hand = (cache->hand + 1) & mask;
+    }
+
+    return 0;
+}
+
+
+//
+// Create a cache for a capture worker
+//
+// NB: The initial table is always allocated, even if the limit has been reached.
+//
+cache_t * cache_create(
+    unsigned int                worker)
+{
+    cache_t *                   cache;
+
+    cache = calloc(1, sizeof(cache_t));
+    if (cache == NULL)
+    {
+        fatal("cannot allocate memory for cache\n");
+    }
+
+    cache->entries = calloc(CACHE_INITIAL_SLOTS, sizeof(cache_entry_t));
+    if (cache->entries == NULL)
+    {
+        fatal("cannot allocate memory for cache\n");
+    }
+    cache->slots = CACHE_INITIAL_SLOTS;
+    cache->budget = &cache_budgets[worker];
+    cache->budget->bytes += CACHE_INITIAL_SLOTS * sizeof(cache_entry_t);
+
+    return cache;
+}
+
+
+//
+// Lookup the cache entry for an ip address
+//
+cache_entry_t * cache_lookup(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    cache_entry_t *             entry;
+    ip_addr_t                   key;
+
+    cache->lookups++;
+
+    cache_key(iptype, addr, &key);
+    entry = cache_find_slot(cache->entries, cache->slots, iptype, &key);
+    if (entry->iptype == DB_IPTYPE_ANY)
+    {
+        return NULL;
+    }
+
+    cache->hits++;
+    entry->referenced = 1;
+    return entry;
+}
+
+
+//
+// Insert (or find) the cache entry for an ip address
+//
+// NB: The returned pointer is only valid until the next call to cache_insert
+//     or cache_expire.
+//
+cache_entry_t * cache_insert(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    cache_entry_t *             entry;
+    ip_addr_t                   key;
+
+    cache_key(iptype, addr, &key);
+    entry = cache_find_slot(cache->entries, cache->slots, iptype, &key);
+    if (entry->iptype != DB_IPTYPE_ANY)
+    {
+        return entry;
+    }
+
+    // Make room if the table is half full
+    // NB: If every entry has a pending write, the table is grown beyond the limit
+    if (cache->count >= cache->slots / 2)
+    {
+        if (cache_can_grow(cache) || cache_evict(cache) == 0)
+        {
+            cache_rebuild(cache, cache->slots * 2, 0);
+        }
+        entry = cache_find_slot(cache->entries, cache->slots, iptype, &key);
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->iptype = iptype;
+    entry->addr = key;
+    entry->referenced = 1;
+    cache->count++;
+
+    return entry;
+}
+
+
+//
+// Delete the cache entry for an ip address
+//
+// Returns 1 if an entry was deleted, or 0 if the address is not cached
+//
+int cache_delete(
+    cache_t *                   cache,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    cache_entry_t *             entry;
+    ip_addr_t                   key;
+
+    cache_key(iptype, addr, &key);
+    entry = cache_find_slot(cache->entries, cache->slots, iptype, &key);
+    if (entry->iptype == DB_IPTYPE_ANY)
+    {
+        return 0;
+    }
+
+    cache_remove(cache, (unsigned long) (entry - cache->entries));
+    return 1;
+}
+
+
+//
+// Remove entries with an update time at or before a given time
+//
+// NB: With a memory limit, the table is shrunk once its entries fit in a
+//     smaller table, returning the memory to the other caches of the worker.
+//
+void cache_expire(
+    cache_t *                   cache,
+    time_t                      time)
+{
+    unsigned long               slots = cache->slots;
+
+    while (cache_limit && slots > CACHE_INITIAL_SLOTS && cache->count < slots / 4)
+    {
+        slots /= 2;
+    }
+
+    cache_rebuild(cache, slots, time);
+    cache->hand = 0;
+}
+
+
+//
+// Check whether the last write for a cache entry is committed
+//
+int cache_written(
+    const cache_t *             cache,
+    const cache_entry_t *       entry)
+{
+    return ((long) (entry->sequence - cache->committed) <= 0);
+}
+
+
+//
+// Check whether a cache has reached its memory limit
+//
+int cache_full(
+    const cache_t *             cache)
+{
+    return (cache->count >= cache->slots / 2 && cache_can_grow(cache) == 0);
+}
+
+
+//
+// Set the position of the writer queue up to which writes are committed
+//
+// NB: Entries written at or before the position may be evicted.
+//
+void cache_set_committed(
+    cache_t *                   cache,
+    unsigned long               committed)
+{
+    cache->committed = committed;
+}
+
+
+//
+// Get the statistics for a cache
+//
+void cache_stats(
+    const cache_t *             cache,
+    cache_stats_t *             stats)
+{
+    stats->entries = cache->count;
+    stats->bytes = sizeof(cache_t) + cache->slots * sizeof(cache_entry_t);
+    stats->lookups = cache->lookups;
+    stats->hits = cache->hits;
+    stats->evictions = cache->evictions;
+}
+
+
+//
+// Get the next entry in a cache
+//
+// NB: Index should be zero for the first call. Entries are returned in no
+//     particular order. The cache must not be changed while iterating.
+//
+// Returns the next entry, or NULL if there are no more entries
+//
+cache_entry_t * cache_next(
+    cache_t *                   cache,
+    unsigned long *             index)
+{
+    cache_entry_t *             entry;
+
+    while (*index < cache->slots)
+    {
+        entry = &cache->entries[(*index)++];
+        if (entry->iptype != DB_IPTYPE_ANY)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
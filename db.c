@@ -62,6 +62,45 @@
 #define COL_USEC                "usec"
 #define COL_UTIME               "utime"
 
+// Owner names
+#define TBL_OWNER               "owner"
+
+// IPv6 address group names
+#define TBL_ADDR6               "addr6"
+#define IDX_ADDR6_PREFIX        "addr6_prefix"
+
+// Hostname names
+#define TBL_HOSTNAME            "hostname"
+#define COL_HOSTNAME            "hostname"
+
+
+// Maximum number of cached prepared statements for a connection
+#define DB_STMT_CACHE_SIZE      (16)
+
+
+//
+// Prepared statements of a connection
+//
+// NB: Statements are found by the address of their SQL text, which is a
+//     string literal for each statement. The caches form a list that is
+//     only ever added to; the cache of a closed connection is released for
+//     reuse by clearing its connection. A connection is only used by one
+//     thread at a time.
+//
+typedef struct db_stmt_cache
+{
+    sqlite3 *                   db;
+    struct db_stmt_cache *      next;
+    unsigned int                count;
+    const char *                sql[DB_STMT_CACHE_SIZE];
+    sqlite3_stmt *              stmt[DB_STMT_CACHE_SIZE];
+} db_stmt_cache_t;
+
+static db_stmt_cache_t *        db_stmt_caches = NULL;
+
+// Statement cache last used by the thread
+static __thread db_stmt_cache_t * db_stmt_cache_last = NULL;
+
 
 //
 // Open a database
@@ -108,6 +147,121 @@ static sqlite3 * db_open(
 }
 
 
+//
+// Find the statement cache for a database connection
+//
+// Returns the cache, or NULL if the connection has no cache
+//
+static db_stmt_cache_t * db_stmt_cache_find(
+    sqlite3 *                   db)
+{
+    db_stmt_cache_t *           cache;
+
+    cache = db_stmt_cache_last;
+    if (cache && __atomic_load_n(&cache->db, __ATOMIC_ACQUIRE) == db)
+    {
+        return cache;
+    }
+
+    for (cache = __atomic_load_n(&db_stmt_caches, __ATOMIC_ACQUIRE); cache; cache = cache->next)
+    {
+        if (__atomic_load_n(&cache->db, __ATOMIC_ACQUIRE) == db)
+        {
+            db_stmt_cache_last = cache;
+            return cache;
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// Get the statement cache for a database connection, creating it if needed
+//
+static db_stmt_cache_t * db_stmt_cache_get(
+    sqlite3 *                   db)
+{
+    db_stmt_cache_t *           cache;
+    sqlite3 *                   unused;
+
+    cache = db_stmt_cache_find(db);
+    if (cache)
+    {
+        return cache;
+    }
+
+    // Reuse the cache of a closed connection
+    for (cache = __atomic_load_n(&db_stmt_caches, __ATOMIC_ACQUIRE); cache; cache = cache->next)
+    {
+        unused = NULL;
+        if (__atomic_compare_exchange_n(&cache->db, &unused, db, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            db_stmt_cache_last = cache;
+            return cache;
+        }
+    }
+
+    // Add a new cache
+    cache = calloc(1, sizeof(db_stmt_cache_t));
+    if (cache == NULL)
+    {
+        fatal("cannot allocate memory for statement cache\n");
+    }
+    cache->db = db;
+    cache->next = __atomic_load_n(&db_stmt_caches, __ATOMIC_RELAXED);
+    while (__atomic_compare_exchange_n(&db_stmt_caches, &cache->next, cache, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) == 0)
+    {
+        ;
+    }
+
+    db_stmt_cache_last = cache;
+    return cache;
+}
+
+
+//
+// Find or prepare a statement for a database connection
+//
+// NB: Each ipmap database has its own connection, so the prepared
+//     statements are held in a cache for the connection.
+//
+// Returns NULL if the statement cannot be prepared
+//
+static sqlite3_stmt * db_prepare_cached(
+    sqlite3 *                   db,
+    const char *                sql,
+    int                         sql_len)
+{
+    db_stmt_cache_t *           cache;
+    sqlite3_stmt *              stmt;
+    unsigned int                i;
+
+    cache = db_stmt_cache_get(db);
+    for (i = 0; i < cache->count; i++)
+    {
+        if (cache->sql[i] == sql)
+        {
+            return cache->stmt[i];
+        }
+    }
+    if (cache->count == DB_STMT_CACHE_SIZE)
+    {
+        fatal("statement cache is full\n");
+    }
+
+    if (sqlite3_prepare_v2(db, sql, sql_len, &stmt, NULL) != SQLITE_OK)
+    {
+        return NULL;
+    }
+    cache->sql[cache->count] = sql;
+    cache->stmt[cache->count] = stmt;
+    cache->count++;
+
+    return stmt;
+}
+
+
 //
 // Open an ipmap database
 //
@@ -133,18 +287,89 @@ sqlite3 * db_ipmap_open(
             COL_IPTYPE "," COL_IPADDR "," COL_SEC "," COL_USEC \
         ");"
 
+    // SQL to create the owner table
+    //
+    // NB: An ip address with multiple owners has a row for each owner, with
+    //     the time the owner was first seen and the time it was last seen,
+    //     rather than a row in the ipmap table for each change of owner.
+    //
+    #define SQL_OWNER_CREATE_TABLE \
+        "CREATE TABLE IF NOT EXISTS " TBL_OWNER " (" \
+            COL_IPTYPE " INTEGER NOT NULL," \
+            COL_IPADDR " TEXT NOT NULL," \
+            COL_HWADDR " TEXT NOT NULL," \
+            COL_SEC " INTEGER NOT NULL," \
+            COL_USEC " INTEGER NOT NULL," \
+            COL_UTIME " INTEGER NOT NULL," \
+            "PRIMARY KEY (" COL_IPTYPE "," COL_IPADDR "," COL_HWADDR ")" \
+        ");"
+
+    // SQL to create the addr6 table
+    //
+    // NB: When IPv6 addresses are grouped by hardware address and prefix, each
+    //     address has a row for each hardware address, with the time the
+    //     mapping was last changed and the time it was last seen, rather than
+    //     a row in the ipmap table for each change.
+    //
+    #define SQL_ADDR6_CREATE_TABLE \
+        "CREATE TABLE IF NOT EXISTS " TBL_ADDR6 " (" \
+            COL_IPTYPE " INTEGER NOT NULL," \
+            COL_IPADDR " TEXT NOT NULL," \
+            COL_PREFIX " TEXT NOT NULL," \
+            COL_HWADDR " TEXT NOT NULL," \
+            COL_SEC " INTEGER NOT NULL," \
+            COL_USEC " INTEGER NOT NULL," \
+            COL_UTIME " INTEGER NOT NULL," \
+            "PRIMARY KEY (" COL_IPADDR "," COL_HWADDR ")" \
+        ");" \
+        "CREATE INDEX IF NOT EXISTS " IDX_ADDR6_PREFIX " ON " TBL_ADDR6 "(" \
+            COL_HWADDR "," COL_PREFIX \
+        ");"
+
+    // SQL to create the hostname table
+    //
+    // NB: A hostname learned for a hardware address only has an empty ipaddr.
+    //
+    #define SQL_HOSTNAME_CREATE_TABLE \
+        "CREATE TABLE IF NOT EXISTS " TBL_HOSTNAME " (" \
+            COL_IPTYPE " INTEGER NOT NULL," \
+            COL_IPADDR " TEXT NOT NULL," \
+            COL_HWADDR " TEXT NOT NULL," \
+            COL_HOSTNAME " TEXT NOT NULL," \
+            COL_UTIME " INTEGER NOT NULL," \
+            "PRIMARY KEY (" COL_HWADDR "," COL_IPTYPE "," COL_IPADDR ")" \
+        ");"
+
+    // SQL to enable write-ahead logging
+    //
+    // NB: Write-ahead logging allows the capture thread to read the database
+    //     while the writer thread is writing or vacuuming it.
+    //
+    #define SQL_IPMAP_JOURNAL_MODE \
+        "PRAGMA journal_mode=WAL;"
+
     // Open the database
     db = db_open(filename, write);
     if (write == DB_READ_WRITE)
     {
         // Create the table if it does not exist
-        r = sqlite3_exec(db, SQL_IPMAP_CREATE_TABLE, NULL, NULL, NULL);
+        r = sqlite3_exec(db, SQL_IPMAP_CREATE_TABLE SQL_OWNER_CREATE_TABLE SQL_ADDR6_CREATE_TABLE SQL_HOSTNAME_CREATE_TABLE, NULL, NULL, NULL);
         if (r != SQLITE_OK)
         {
             fatal("sqlite3 create table failed: %s\n", sqlite3_errmsg(db));
         }
+
+        // Enable write-ahead logging
+        r = sqlite3_exec(db, SQL_IPMAP_JOURNAL_MODE, NULL, NULL, NULL);
+        if (r != SQLITE_OK)
+        {
+            fatal("sqlite3 journal mode failed: %s\n", sqlite3_errmsg(db));
+        }
     }
 
+    // Wait rather than fail if the database is locked
+    (void) sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT);
+
     return db;
 }
 
@@ -193,6 +418,12 @@ sqlite3 * db_ma_open(
     db_write_mode               write)
 {
     sqlite3 *                   db;
+    int                         r;
+
+    // SQL to confirm that the ma database has been initialized
+    //
+    #define SQL_MA_CONFIRM_INITIALIZED \
+        "SELECT EXISTS(SELECT 1 FROM " TBL_MA_U ")"
 
     // Open the database
     db = db_open(MA_DB_NAME, write);
@@ -201,6 +432,15 @@ sqlite3 * db_ma_open(
         // Create the tables if they do not exist
         db_ma_create_tables(db);
     }
+    else
+    {
+        // Confirm that the ma database has been initialized
+        r = sqlite3_exec(db, SQL_MA_CONFIRM_INITIALIZED, NULL, NULL, NULL);
+        if (r != SQLITE_OK)
+        {
+            fatal("the ma database (%s/%s%s) has not been initialized: run andwatch-update-ma\n", lib_dir, MA_DB_NAME, DB_SUFFIX);
+        }
+    }
 
     return db;
 }
@@ -228,9 +468,6 @@ void db_ma_attach(
     _Static_assert ((sizeof(SQL_MA_ATTACH) + ANDWATCH_PATH_BUFFER < sizeof(sql)),
         "SQL_MA_ATTACH exceeds sql buffer size");
 
-    #define SQL_MA_CONFIRM_INITIALIZED \
-        "SELECT EXISTS(SELECT 1 FROM " TBL_MA_U ")"
-
     // Safety check: ensure sql buffer is large enough
     _Static_assert ((sizeof(SQL_MA_CONFIRM_INITIALIZED)  < sizeof(sql)),
         "SQL_MA_CONFIRM_INITIALIZED exceeds sql buffer size");
@@ -321,6 +558,21 @@ void db_maintenance(
 void db_close(
     sqlite3 *                   db)
 {
+    db_stmt_cache_t *           cache;
+    unsigned int                i;
+
+    // Finalize the cached statements, and release the cache
+    cache = db_stmt_cache_find(db);
+    if (cache)
+    {
+        for (i = 0; i < cache->count; i++)
+        {
+            (void) sqlite3_finalize(cache->stmt[i]);
+        }
+        cache->count = 0;
+        __atomic_store_n(&cache->db, NULL, __ATOMIC_RELEASE);
+    }
+
     (void) sqlite3_close(db);
 }
 
@@ -352,7 +604,7 @@ void db_end_transaction(
     r =sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
     if (r != SQLITE_OK)
     {
-        fatal("begin transaction failed: %s\n", sqlite3_errmsg(db));
+        fatal("end transaction failed: %s\n", sqlite3_errmsg(db));
     }
 }
 
@@ -398,8 +650,12 @@ void db_ma_insert(
 //
 // Insert an entry into an ipmap database
 //
+// NB: The row id is assigned by the caller so that the row can be updated
+//     without waiting for the insert to complete.
+//
 void db_ipmap_insert(
     sqlite3 *                   db,
+    long                        rowid,
     db_iptype                   iptype,
     const char *                ipaddr,
     const char *                hwaddr,
@@ -411,6 +667,7 @@ void db_ipmap_insert(
     // SQL to insert an entry into the ipmap table
     //
     // Paramaters:
+    //      rowid               rowid (long integer)
     //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
     //      ipaddr              ip address (string)
     //      hwaddr              hardware address (string)
@@ -419,14 +676,15 @@ void db_ipmap_insert(
     //      update              last update epoch timestamp (long integer)
     //
     #define SQL_IPMAP_INSERT \
-        "INSERT INTO " TBL_IPMAP " VALUES (%d, '%s', '%s', %ld, %ld, %ld)"
+        "INSERT INTO " TBL_IPMAP " (" COL_ROWID "," COL_IPTYPE "," COL_IPADDR "," COL_HWADDR "," \
+            COL_SEC "," COL_USEC "," COL_UTIME ") VALUES (%ld, %d, '%s', '%s', %ld, %ld, %ld)"
 
     // Safety check: ensure sql buffer is large enough
-    _Static_assert ((sizeof(SQL_IPMAP_INSERT) + 1 + INET6_ADDRSTRLEN + ETH_ADDRSTRLEN + 10 + 10 < sizeof(sql)),
+    _Static_assert ((sizeof(SQL_IPMAP_INSERT) + 20 + 1 + INET6_ADDRSTRLEN + ETH_ADDRSTRLEN + 20 + 20 + 20 < sizeof(sql)),
         "SQL_IPMAP_INSERT exceeds sql buffer size");
 
     // Construct the sql
-    snprintf(sql, sizeof(sql), SQL_IPMAP_INSERT, iptype, ipaddr, hwaddr, timeval->tv_sec, (long) timeval->tv_usec, timeval->tv_sec);
+    snprintf(sql, sizeof(sql), SQL_IPMAP_INSERT, rowid, iptype, ipaddr, hwaddr, timeval->tv_sec, (long) timeval->tv_usec, timeval->tv_sec);
 
     // Execute
     r = sqlite3_exec(db, sql, NULL, NULL, NULL);
@@ -438,37 +696,71 @@ void db_ipmap_insert(
 
 
 //
-// Set the update time for a row
+// Set the update time for a set of rows
 //
-void db_ipmap_set_utime(
+// NB: The rows are set by a single statement for each batch of up to
+//     UPDATE_BATCH_SIZE rows. Unused parameters of a partial batch are NULL,
+//     which matches no row.
+//
+void db_ipmap_set_utimes(
     sqlite3 *                   db,
-    long                        rowid,
+    const long *                rowids,
+    unsigned int                count,
     time_t                      time)
 {
-    char                        sql[ANDWATCH_SQL_BUFFER];
+    sqlite3_stmt *              stmt;
+    unsigned int                batch;
+    unsigned int                i;
     int                         r;
 
-    // SQL to set the update time for a row
+    // SQL to set the update time for a batch of rows
     //
     // Paramaters:
     //      time                epoch time (long integer)
-    //      rowid               rowid (long integer)
+    //      rowid               rowid (long integer, UPDATE_BATCH_SIZE times)
     //
-    #define SQL_IPMAP_SET_UPTIME \
-        "UPDATE " TBL_IPMAP " SET " COL_UTIME " = %ld WHERE " COL_ROWID " = %ld"
+    #define SQL_ROWIDS_8        "?,?,?,?,?,?,?,?"
+    #define SQL_IPMAP_SET_UTIMES \
+        "UPDATE " TBL_IPMAP " SET " COL_UTIME " = ? WHERE " COL_ROWID " IN (" \
+            SQL_ROWIDS_8 "," SQL_ROWIDS_8 "," SQL_ROWIDS_8 "," SQL_ROWIDS_8 "," \
+            SQL_ROWIDS_8 "," SQL_ROWIDS_8 "," SQL_ROWIDS_8 "," SQL_ROWIDS_8 ")"
+
+    // Safety check: ensure the statement has a parameter for each row of a batch
+    _Static_assert (UPDATE_BATCH_SIZE == 64, "SQL_IPMAP_SET_UTIMES does not match UPDATE_BATCH_SIZE");
+
+    // Find or prepare the statement
+    stmt = db_prepare_cached(db, SQL_IPMAP_SET_UTIMES, sizeof(SQL_IPMAP_SET_UTIMES));
+    if (stmt == NULL)
+    {
+        logger("ipmap update prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
 
-    // Safety check: ensure sql buffer is large enough
-    _Static_assert ((sizeof(SQL_IPMAP_SET_UPTIME) + 10 + 10 < sizeof(sql)),
-        "SQL_IPMAP_SET_UPTIME exceeds sql buffer size");
+    while (count)
+    {
+        batch = (count < UPDATE_BATCH_SIZE) ? count : UPDATE_BATCH_SIZE;
 
-    // Construct the sql
-    snprintf(sql, sizeof(sql), SQL_IPMAP_SET_UPTIME, time, rowid);
+        // Bind and execute
+        r = sqlite3_bind_int64(stmt, 1, (sqlite3_int64) time);
+        for (i = 0; i < batch && r == SQLITE_OK; i++)
+        {
+            r = sqlite3_bind_int64(stmt, (int) i + 2, (sqlite3_int64) rowids[i]);
+        }
+        if (r == SQLITE_OK)
+        {
+            r = sqlite3_step(stmt);
+        }
+        if (r != SQLITE_DONE)
+        {
+            logger("ipmap update failed: %s\n", sqlite3_errmsg(db));
+        }
 
-    // Execute
-    r = sqlite3_exec(db, sql, NULL, NULL, NULL);
-    if (r != SQLITE_OK)
-    {
-        logger("ipmap update failed: %s\n", sqlite3_errmsg(db));
+        // Cleanup
+        (void) sqlite3_reset(stmt);
+        (void) sqlite3_clear_bindings(stmt);
+
+        rowids += batch;
+        count -= batch;
     }
 }
 
@@ -507,6 +799,203 @@ void db_ipmap_delete_old(
 }
 
 
+//
+// Get the highest row id in an ipmap database
+//
+// Returns 0 if the database is empty
+//
+long db_ipmap_get_max_rowid(
+    sqlite3 *                   db)
+{
+    sqlite3_stmt *              query_stmt;
+    long                        rowid = 0;
+    int                         r;
+
+    // SQL to get the highest row id
+    //
+    #define SQL_IPMAP_GET_MAX_ROWID \
+        "SELECT MAX(" COL_ROWID ") FROM " TBL_IPMAP
+
+    // Prepare
+    r = sqlite3_prepare_v2(db, SQL_IPMAP_GET_MAX_ROWID, sizeof(SQL_IPMAP_GET_MAX_ROWID), &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        fatal("ipmap get max rowid prepare failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Execute
+    r = sqlite3_step(query_stmt);
+    if (r == SQLITE_ROW)
+    {
+        rowid = (long) sqlite3_column_int64(query_stmt, 0);
+    }
+    else
+    {
+        fatal("ipmap get max rowid failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+
+    return rowid;
+}
+
+
+//
+// Load the current (last) values for all ip addresses
+//
+// NB: The ipmap_last index is scanned once in reverse, so the first row for
+//     each ip address is the current row. Ip addresses with multiple owners
+//     are skipped, as their current values are held in the owner table.
+//
+// NB: If recent is set, the current rows are instead returned in order of
+//     update time, most recent first. This requires a sort of the current
+//     rows, and is used when not all of them can be loaded.
+//
+// Returns the number of ip addresses loaded
+//
+unsigned long db_ipmap_load_current(
+    sqlite3 *                   db,
+    int                         recent,
+    ipmap_load_callback_t       callback,
+    void *                      context)
+{
+    sqlite3_stmt *              query_stmt;
+    ipmap_current_t             current;
+    db_iptype                   iptype;
+    db_iptype                   last_iptype = DB_IPTYPE_ANY;
+    const char *                ipaddr;
+    char                        last_ipaddr[INET6_ADDRSTRLEN] = "";
+    unsigned long               count = 0;
+    int                         r;
+
+    // SQL to get all rows, the current row first for each ip address
+    //
+    #define SQL_IPMAP_LOAD_CURRENT \
+        "SELECT " COL_IPTYPE "," COL_IPADDR "," COL_ROWID "," COL_UTIME "," COL_HWADDR " FROM " TBL_IPMAP "\n" \
+        "WHERE " COL_IPADDR " NOT IN (SELECT " COL_IPADDR " FROM " TBL_OWNER ")\n" \
+        "ORDER BY " COL_IPTYPE " DESC," COL_IPADDR " DESC," COL_SEC " DESC," COL_USEC " DESC"
+
+    // SQL to get the current row for each ip address, most recently updated first
+    //
+    // NB: With a max aggregate, SQLite takes the bare columns from the row
+    //     holding the maximum.
+    //
+    #define SQL_IPMAP_LOAD_RECENT \
+        "SELECT " COL_IPTYPE "," COL_IPADDR "," COL_ROWID "," COL_UTIME "," COL_HWADDR "," \
+        "MAX(" COL_SEC " * 1000000 + " COL_USEC ") FROM " TBL_IPMAP "\n" \
+        "WHERE " COL_IPADDR " NOT IN (SELECT " COL_IPADDR " FROM " TBL_OWNER ")\n" \
+        "GROUP BY " COL_IPTYPE "," COL_IPADDR "\n" \
+        "ORDER BY " COL_UTIME " DESC"
+
+    // Prepare
+    if (recent)
+    {
+        r = sqlite3_prepare_v2(db, SQL_IPMAP_LOAD_RECENT, sizeof(SQL_IPMAP_LOAD_RECENT), &query_stmt, NULL);
+    }
+    else
+    {
+        r = sqlite3_prepare_v2(db, SQL_IPMAP_LOAD_CURRENT, sizeof(SQL_IPMAP_LOAD_CURRENT), &query_stmt, NULL);
+    }
+    if (r != SQLITE_OK)
+    {
+        logger("ipmap load current prepare failed: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    // Execute
+    while ((r = sqlite3_step(query_stmt)) == SQLITE_ROW)
+    {
+        iptype = (db_iptype) sqlite3_column_int(query_stmt, 0);
+        ipaddr = (const char *) sqlite3_column_text(query_stmt, 1);
+
+        // Skip the older rows for the ip address
+        if (iptype == last_iptype && strcmp(ipaddr, last_ipaddr) == 0)
+        {
+            continue;
+        }
+        last_iptype = iptype;
+        safe_strncpy(last_ipaddr, ipaddr, sizeof(last_ipaddr));
+
+        current.rowid = sqlite3_column_int64(query_stmt, 2);
+        current.utime = (time_t) sqlite3_column_int64(query_stmt, 3);
+        safe_strncpy(current.hwaddr_str, (char *) sqlite3_column_text(query_stmt, 4), sizeof(current.hwaddr_str));
+        current.valid = 1;
+
+        callback(context, iptype, ipaddr, &current);
+        count++;
+    }
+    if (r != SQLITE_DONE)
+    {
+        logger("ipmap load current failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+
+    return count;
+}
+
+
+//
+// Load the ip addresses that have changed since a given row
+//
+// NB: An ip address has changed if it has a row in the ipmap table after
+//     the given row id, or has rows in the owner table.
+//
+// Returns the number of ip addresses loaded
+//
+unsigned long db_ipmap_load_changed(
+    sqlite3 *                   db,
+    long                        rowid,
+    ipmap_changed_callback_t    callback,
+    void *                      context)
+{
+    sqlite3_stmt *              query_stmt;
+    unsigned long               count = 0;
+    int                         r;
+
+    // SQL to get the ip addresses changed after a row
+    //
+    #define SQL_IPMAP_LOAD_CHANGED \
+        "SELECT " COL_IPTYPE "," COL_IPADDR " FROM " TBL_IPMAP " WHERE " COL_ROWID " > ?\n" \
+        "UNION SELECT " COL_IPTYPE "," COL_IPADDR " FROM " TBL_OWNER
+
+    // Prepare
+    r = sqlite3_prepare_v2(db, SQL_IPMAP_LOAD_CHANGED, sizeof(SQL_IPMAP_LOAD_CHANGED), &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("ipmap load changed prepare failed: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    // Bind
+    r = sqlite3_bind_int64(query_stmt, 1, (sqlite3_int64) rowid);
+    if (r != SQLITE_OK)
+    {
+        logger("ipmap load changed bind failed: %s\n", sqlite3_errmsg(db));
+        (void) sqlite3_finalize(query_stmt);
+        return 0;
+    }
+
+    // Execute
+    while ((r = sqlite3_step(query_stmt)) == SQLITE_ROW)
+    {
+        callback(context, (db_iptype) sqlite3_column_int(query_stmt, 0), (const char *) sqlite3_column_text(query_stmt, 1));
+        count++;
+    }
+    if (r != SQLITE_DONE)
+    {
+        logger("ipmap load changed failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+
+    return count;
+}
+
+
 //
 // Get the current (last) values for an ip address
 //
@@ -516,7 +1005,7 @@ void db_ipmap_get_current(
     const char *                ipaddr,
     ipmap_current_t *           current)
 {
-    static sqlite3_stmt *       query_stmt = NULL;
+    sqlite3_stmt *              query_stmt;
     int                         r;
 
     // Mark the current data as invalid
@@ -529,7 +1018,7 @@ void db_ipmap_get_current(
     //      ipaddr              ip address (string)
     //
     #define SQL_IPMAP_GET_CURRENT \
-        "SELECT " COL_ROWID ",(unixepoch() - " COL_UTIME ")," COL_HWADDR " FROM " TBL_IPMAP "\n" \
+        "SELECT " COL_ROWID "," COL_UTIME "," COL_HWADDR " FROM " TBL_IPMAP "\n" \
         "WHERE rowid = (\n" \
             "SELECT rowid\n" \
             "FROM " TBL_IPMAP "\n" \
@@ -538,15 +1027,12 @@ void db_ipmap_get_current(
             "LIMIT 1" \
         ")"
 
-    // If the statement is not prepared, prepare it
+    // Find or prepare the statement
+    query_stmt = db_prepare_cached(db, SQL_IPMAP_GET_CURRENT, sizeof(SQL_IPMAP_GET_CURRENT));
     if (query_stmt == NULL)
     {
-        r = sqlite3_prepare_v2(db, SQL_IPMAP_GET_CURRENT, sizeof(SQL_IPMAP_GET_CURRENT), &query_stmt, NULL);
-        if (r != SQLITE_OK)
-        {
-            logger("imap get current prepare failed: %s\n", sqlite3_errmsg(db));
-            return;
-        }
+        logger("imap get current prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
     }
 
     // Bind the IP type and IP address
@@ -568,7 +1054,7 @@ void db_ipmap_get_current(
     if (r == SQLITE_ROW)
     {
         current->rowid = sqlite3_column_int64(query_stmt, 0);
-        current->age = sqlite3_column_int64(query_stmt, 1);
+        current->utime = (time_t) sqlite3_column_int64(query_stmt, 1);
         safe_strncpy(current->hwaddr_str, (char *) sqlite3_column_text(query_stmt, 2), sizeof(current->hwaddr_str));
         current->valid = 1;
     }
@@ -579,6 +1065,697 @@ void db_ipmap_get_current(
 }
 
 
+//
+// Record an owner of an ip address with multiple owners
+//
+// NB: The time is the time the owner was first seen for a new owner, and
+//     the time it was last seen for an existing owner.
+//
+void db_owner_set(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    const struct timeval *      timeval)
+{
+    char                        sql[ANDWATCH_SQL_BUFFER];
+    int                         r;
+
+    // SQL to insert an owner, or set the update time of an existing owner
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //      hwaddr              hardware address (string)
+    //      seconds             seconds (long integer)
+    //      useconds            microseconds (long integer)
+    //      update              last update epoch timestamp (long integer)
+    //
+    #define SQL_OWNER_SET \
+        "INSERT INTO " TBL_OWNER " (" COL_IPTYPE "," COL_IPADDR "," COL_HWADDR "," \
+            COL_SEC "," COL_USEC "," COL_UTIME ") VALUES (%d, '%s', '%s', %ld, %ld, %ld)\n" \
+        "ON CONFLICT (" COL_IPTYPE "," COL_IPADDR "," COL_HWADDR ") DO UPDATE SET " COL_UTIME " = excluded." COL_UTIME
+
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_OWNER_SET) + 1 + INET6_ADDRSTRLEN + ETH_ADDRSTRLEN + 20 + 20 + 20 < sizeof(sql)),
+        "SQL_OWNER_SET exceeds sql buffer size");
+
+    // Construct the sql
+    snprintf(sql, sizeof(sql), SQL_OWNER_SET, iptype, ipaddr, hwaddr, timeval->tv_sec, (long) timeval->tv_usec, timeval->tv_sec);
+
+    // Execute
+    r = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("owner set failed: %s\n", sqlite3_errmsg(db));
+    }
+}
+
+
+//
+// Check whether the owner table has any rows
+//
+// Returns 1 if the table has rows or cannot be read, or 0 if it is empty
+//
+int db_owner_any(
+    sqlite3 *                   db)
+{
+    sqlite3_stmt *              query_stmt;
+    int                         any = 1;
+    int                         r;
+
+    // SQL to check for a row
+    //
+    #define SQL_OWNER_ANY \
+        "SELECT EXISTS (SELECT 1 FROM " TBL_OWNER ")"
+
+    // Prepare
+    r = sqlite3_prepare_v2(db, SQL_OWNER_ANY, sizeof(SQL_OWNER_ANY), &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("owner any prepare failed: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+
+    // Execute
+    r = sqlite3_step(query_stmt);
+    if (r == SQLITE_ROW)
+    {
+        any = sqlite3_column_int(query_stmt, 0);
+    }
+    else
+    {
+        logger("owner any failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+
+    return any;
+}
+
+
+//
+// Get the owner of an ip address with multiple owners seen most recently
+//
+// NB: The row id is not used for owners. If the ip address does not have
+//     multiple owners, the current data is marked as invalid.
+//
+void db_owner_get_current(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    ipmap_current_t *           current)
+{
+    sqlite3_stmt *              query_stmt;
+    int                         r;
+
+    // Mark the current data as invalid
+    current->valid = 0;
+
+    // SQL to get the owner seen most recently
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //
+    #define SQL_OWNER_GET_CURRENT \
+        "SELECT " COL_UTIME "," COL_HWADDR " FROM " TBL_OWNER "\n" \
+        "WHERE " COL_IPTYPE " == ? AND " COL_IPADDR " == ?\n" \
+        "ORDER BY " COL_UTIME " DESC\n" \
+        "LIMIT 1"
+
+    // Find or prepare the statement
+    query_stmt = db_prepare_cached(db, SQL_OWNER_GET_CURRENT, sizeof(SQL_OWNER_GET_CURRENT));
+    if (query_stmt == NULL)
+    {
+        logger("owner get current prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_int(query_stmt, 1, iptype);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(query_stmt, 2, ipaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK && sqlite3_step(query_stmt) == SQLITE_ROW)
+    {
+        current->rowid = 0;
+        current->utime = (time_t) sqlite3_column_int64(query_stmt, 0);
+        safe_strncpy(current->hwaddr_str, (char *) sqlite3_column_text(query_stmt, 1), sizeof(current->hwaddr_str));
+        current->valid = 1;
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(query_stmt);
+    (void) sqlite3_clear_bindings(query_stmt);
+}
+
+
+//
+// Get the update time of an owner of an ip address
+//
+// Returns the update time, or 0 if the hardware address is not an owner
+//
+time_t db_owner_get_utime(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr)
+{
+    sqlite3_stmt *              query_stmt;
+    time_t                      utime = 0;
+    int                         r;
+
+    // SQL to get the update time of an owner
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //      hwaddr              hardware address (string)
+    //
+    #define SQL_OWNER_GET_UTIME \
+        "SELECT " COL_UTIME " FROM " TBL_OWNER "\n" \
+        "WHERE " COL_IPTYPE " == ? AND " COL_IPADDR " == ? AND " COL_HWADDR " == ?"
+
+    // Find or prepare the statement
+    query_stmt = db_prepare_cached(db, SQL_OWNER_GET_UTIME, sizeof(SQL_OWNER_GET_UTIME));
+    if (query_stmt == NULL)
+    {
+        logger("owner get utime prepare failed: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_int(query_stmt, 1, iptype);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(query_stmt, 2, ipaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(query_stmt, 3, hwaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK && sqlite3_step(query_stmt) == SQLITE_ROW)
+    {
+        utime = (time_t) sqlite3_column_int64(query_stmt, 0);
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(query_stmt);
+    (void) sqlite3_clear_bindings(query_stmt);
+
+    return utime;
+}
+
+
+//
+// Delete owners older than a given time
+//
+void db_owner_delete_old(
+    sqlite3 *                   db,
+    time_t                      time)
+{
+    char                        sql[ANDWATCH_SQL_BUFFER];
+    int                         r;
+
+    // SQL to delete owners older than a given time
+    //
+    // Paramaters:
+    //      time                epoch time (long integer)
+    //
+    #define SQL_OWNER_DELETE_OLD \
+        "DELETE FROM " TBL_OWNER " WHERE " COL_UTIME " <= %ld"
+
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_OWNER_DELETE_OLD) + 10 < sizeof(sql)),
+        "SQL_OWNER_DELETE_OLD exceeds sql buffer size");
+
+    // Construct the sql
+    snprintf(sql, sizeof(sql), SQL_OWNER_DELETE_OLD, time);
+
+    // Execute
+    r = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("owner delete old records failed: %s\n", sqlite3_errmsg(db));
+    }
+}
+
+
+//
+// Record an IPv6 address grouped by hardware address and prefix
+//
+// NB: A change sets the time of the mapping, which is inserted if needed.
+//     Otherwise only the time the mapping was last seen is set, and the
+//     mapping is inserted with the current time if it is not yet recorded.
+//
+void db_addr6_set(
+    sqlite3 *                   db,
+    const char *                ipaddr,
+    const char *                prefix,
+    const char *                hwaddr,
+    const struct timeval *      timeval,
+    int                         change)
+{
+    sqlite3_stmt *              stmt;
+    int                         r;
+
+    // SQL to insert an address, or set the times of an existing address
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //      prefix              /64 prefix (string)
+    //      hwaddr              hardware address (string)
+    //      seconds             seconds (long integer)
+    //      useconds            microseconds (long integer)
+    //      update              last update epoch timestamp (long integer)
+    //
+    #define SQL_ADDR6_INSERT \
+        "INSERT INTO " TBL_ADDR6 " (" COL_IPTYPE "," COL_IPADDR "," COL_PREFIX "," COL_HWADDR "," \
+            COL_SEC "," COL_USEC "," COL_UTIME ") VALUES (?, ?, ?, ?, ?, ?, ?)\n"
+    #define SQL_ADDR6_SET_CHANGE \
+        SQL_ADDR6_INSERT \
+        "ON CONFLICT (" COL_IPADDR "," COL_HWADDR ") DO UPDATE SET " \
+            COL_SEC " = excluded." COL_SEC "," COL_USEC " = excluded." COL_USEC "," COL_UTIME " = excluded." COL_UTIME
+    #define SQL_ADDR6_SET_UTIME \
+        SQL_ADDR6_INSERT \
+        "ON CONFLICT (" COL_IPADDR "," COL_HWADDR ") DO UPDATE SET " COL_UTIME " = excluded." COL_UTIME
+
+    // Find or prepare the statement
+    if (change)
+    {
+        stmt = db_prepare_cached(db, SQL_ADDR6_SET_CHANGE, sizeof(SQL_ADDR6_SET_CHANGE));
+    }
+    else
+    {
+        stmt = db_prepare_cached(db, SQL_ADDR6_SET_UTIME, sizeof(SQL_ADDR6_SET_UTIME));
+    }
+    if (stmt == NULL)
+    {
+        logger("addr6 set prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_int(stmt, 1, DB_IPTYPE_6);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 2, ipaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 3, prefix, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 4, hwaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_int64(stmt, 5, (sqlite3_int64) timeval->tv_sec);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_int64(stmt, 6, (sqlite3_int64) timeval->tv_usec);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_int64(stmt, 7, (sqlite3_int64) timeval->tv_sec);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_step(stmt);
+    }
+    if (r != SQLITE_DONE)
+    {
+        logger("addr6 set failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(stmt);
+    (void) sqlite3_clear_bindings(stmt);
+}
+
+
+//
+// Check whether the addr6 table has any rows
+//
+// Returns 1 if the table has rows or cannot be read, or 0 if it is empty
+//
+int db_addr6_any(
+    sqlite3 *                   db)
+{
+    sqlite3_stmt *              query_stmt;
+    int                         any = 1;
+    int                         r;
+
+    // SQL to check for a row
+    //
+    #define SQL_ADDR6_ANY \
+        "SELECT EXISTS (SELECT 1 FROM " TBL_ADDR6 ")"
+
+    // Prepare
+    r = sqlite3_prepare_v2(db, SQL_ADDR6_ANY, sizeof(SQL_ADDR6_ANY), &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("addr6 any prepare failed: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+
+    // Execute
+    r = sqlite3_step(query_stmt);
+    if (r == SQLITE_ROW)
+    {
+        any = sqlite3_column_int(query_stmt, 0);
+    }
+    else
+    {
+        logger("addr6 any failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+
+    return any;
+}
+
+
+//
+// Get the current mapping of an IPv6 address grouped by hardware address and prefix
+//
+// NB: The row id is not used for grouped addresses. If the address is not
+//     grouped, the current data is marked as invalid.
+//
+void db_addr6_get_current(
+    sqlite3 *                   db,
+    const char *                ipaddr,
+    ipmap_current_t *           current)
+{
+    sqlite3_stmt *              query_stmt;
+    int                         r;
+
+    // Mark the current data as invalid
+    current->valid = 0;
+
+    // SQL to get the mapping changed most recently
+    //
+    // Paramaters:
+    //      ipaddr              ip address (string)
+    //
+    #define SQL_ADDR6_GET_CURRENT \
+        "SELECT " COL_UTIME "," COL_HWADDR " FROM " TBL_ADDR6 "\n" \
+        "WHERE " COL_IPADDR " == ?\n" \
+        "ORDER BY " COL_SEC " DESC," COL_USEC " DESC\n" \
+        "LIMIT 1"
+
+    // Find or prepare the statement
+    query_stmt = db_prepare_cached(db, SQL_ADDR6_GET_CURRENT, sizeof(SQL_ADDR6_GET_CURRENT));
+    if (query_stmt == NULL)
+    {
+        logger("addr6 get current prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_text(query_stmt, 1, ipaddr, -1, SQLITE_STATIC);
+    if (r == SQLITE_OK && sqlite3_step(query_stmt) == SQLITE_ROW)
+    {
+        current->rowid = 0;
+        current->utime = (time_t) sqlite3_column_int64(query_stmt, 0);
+        safe_strncpy(current->hwaddr_str, (char *) sqlite3_column_text(query_stmt, 1), sizeof(current->hwaddr_str));
+        current->valid = 1;
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(query_stmt);
+    (void) sqlite3_clear_bindings(query_stmt);
+}
+
+
+//
+// Get the time a hardware address was last seen with an address in a prefix
+//
+// Returns the update time, or 0 if the hardware address has not been seen
+// with an address in the prefix
+//
+time_t db_addr6_get_prefix_utime(
+    sqlite3 *                   db,
+    const char *                prefix,
+    const char *                hwaddr)
+{
+    sqlite3_stmt *              query_stmt;
+    time_t                      utime = 0;
+    int                         r;
+
+    // SQL to get the time the hardware address was last seen in the prefix
+    //
+    // Paramaters:
+    //      hwaddr              hardware address (string)
+    //      prefix              /64 prefix (string)
+    //
+    #define SQL_ADDR6_GET_PREFIX_UTIME \
+        "SELECT MAX(" COL_UTIME ") FROM " TBL_ADDR6 "\n" \
+        "WHERE " COL_HWADDR " == ? AND " COL_PREFIX " == ?"
+
+    // Find or prepare the statement
+    query_stmt = db_prepare_cached(db, SQL_ADDR6_GET_PREFIX_UTIME, sizeof(SQL_ADDR6_GET_PREFIX_UTIME));
+    if (query_stmt == NULL)
+    {
+        logger("addr6 get prefix utime prepare failed: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_text(query_stmt, 1, hwaddr, -1, SQLITE_STATIC);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(query_stmt, 2, prefix, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK && sqlite3_step(query_stmt) == SQLITE_ROW)
+    {
+        utime = (time_t) sqlite3_column_int64(query_stmt, 0);
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(query_stmt);
+    (void) sqlite3_clear_bindings(query_stmt);
+
+    return utime;
+}
+
+
+//
+// Delete grouped IPv6 addresses older than a given time
+//
+void db_addr6_delete_old(
+    sqlite3 *                   db,
+    time_t                      time)
+{
+    char                        sql[ANDWATCH_SQL_BUFFER];
+    int                         r;
+
+    // SQL to delete addresses older than a given time
+    //
+    // Paramaters:
+    //      time                epoch time (long integer)
+    //
+    #define SQL_ADDR6_DELETE_OLD \
+        "DELETE FROM " TBL_ADDR6 " WHERE " COL_UTIME " <= %ld"
+
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_ADDR6_DELETE_OLD) + 10 < sizeof(sql)),
+        "SQL_ADDR6_DELETE_OLD exceeds sql buffer size");
+
+    // Construct the sql
+    snprintf(sql, sizeof(sql), SQL_ADDR6_DELETE_OLD, time);
+
+    // Execute
+    r = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("addr6 delete old records failed: %s\n", sqlite3_errmsg(db));
+    }
+}
+
+
+//
+// Set the learned hostname for an ip address and hardware address
+//
+// NB: An empty ipaddr indicates a hostname learned for the hardware address
+//     only.
+//
+void db_hostname_set(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    const char *                hostname,
+    time_t                      time)
+{
+    sqlite3_stmt *              stmt;
+    int                         r;
+
+    // SQL to set the hostname
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //      hwaddr              hardware address (string)
+    //      hostname            hostname (string)
+    //      time                epoch time (long integer)
+    //
+    #define SQL_HOSTNAME_SET \
+        "INSERT OR REPLACE INTO " TBL_HOSTNAME " (" COL_IPTYPE "," COL_IPADDR "," COL_HWADDR "," \
+            COL_HOSTNAME "," COL_UTIME ") VALUES (?, ?, ?, ?, ?)"
+
+    // Find or prepare the statement
+    stmt = db_prepare_cached(db, SQL_HOSTNAME_SET, sizeof(SQL_HOSTNAME_SET));
+    if (stmt == NULL)
+    {
+        logger("hostname set prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_int(stmt, 1, iptype);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 2, ipaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 3, hwaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 4, hostname, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_int64(stmt, 5, (sqlite3_int64) time);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_step(stmt);
+    }
+    if (r != SQLITE_DONE)
+    {
+        logger("hostname set failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(stmt);
+    (void) sqlite3_clear_bindings(stmt);
+}
+
+
+//
+// Get the learned hostname for an ip address and hardware address
+//
+// A hostname learned for the ip address is preferred, followed by the most
+// recent hostname learned for the hardware address.
+//
+// NB: A database created before hostnames were learned has no hostname
+//     table, and is treated as having no hostnames.
+//
+// Returns 1 if a hostname was found, or 0 if not
+//
+int db_hostname_get(
+    sqlite3 *                   db,
+    db_iptype                   iptype,
+    const char *                ipaddr,
+    const char *                hwaddr,
+    char *                      hostname,
+    size_t                      hostname_len)
+{
+    sqlite3_stmt *              stmt;
+    int                         found = 0;
+    int                         r;
+
+    // SQL to get the hostname
+    //
+    // Paramaters:
+    //      iptype              DB_IPTYPE_4 or DB_IPTYPE_6 (integer)
+    //      ipaddr              ip address (string)
+    //      hwaddr              hardware address (string)
+    //
+    // Result columns:
+    //      0 hostname          hostname (string)
+    //
+    #define SQL_HOSTNAME_GET \
+        "SELECT " COL_HOSTNAME " FROM " TBL_HOSTNAME "\n" \
+        "WHERE " COL_HWADDR " == ?3\n" \
+        "ORDER BY (" COL_IPTYPE " == ?1 AND " COL_IPADDR " == ?2) DESC," COL_UTIME " DESC\n" \
+        "LIMIT 1"
+
+    // Find or prepare the statement
+    stmt = db_prepare_cached(db, SQL_HOSTNAME_GET, sizeof(SQL_HOSTNAME_GET));
+    if (stmt == NULL)
+    {
+        return 0;
+    }
+
+    // Bind and execute
+    r = sqlite3_bind_int(stmt, 1, iptype);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 2, ipaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_bind_text(stmt, 3, hwaddr, -1, SQLITE_STATIC);
+    }
+    if (r == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        safe_strncpy(hostname, (const char *) sqlite3_column_text(stmt, 0), hostname_len);
+        found = 1;
+    }
+
+    // Cleanup
+    (void) sqlite3_reset(stmt);
+    (void) sqlite3_clear_bindings(stmt);
+
+    return found;
+}
+
+
+//
+// Delete learned hostnames older than a given time
+//
+void db_hostname_delete_old(
+    sqlite3 *                   db,
+    time_t                      time)
+{
+    char                        sql[ANDWATCH_SQL_BUFFER];
+    int                         r;
+
+    // SQL to delete hostnames older than a given time
+    //
+    // Paramaters:
+    //      time                epoch time (long integer)
+    //
+    #define SQL_HOSTNAME_DELETE_OLD \
+        "DELETE FROM " TBL_HOSTNAME " WHERE " COL_UTIME " <= %ld"
+
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_HOSTNAME_DELETE_OLD) + 10 < sizeof(sql)),
+        "SQL_HOSTNAME_DELETE_OLD exceeds sql buffer size");
+
+    // Construct the sql
+    snprintf(sql, sizeof(sql), SQL_HOSTNAME_DELETE_OLD, time);
+
+    // Execute
+    r = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (r != SQLITE_OK)
+    {
+        logger("hostname delete old records failed: %s\n", sqlite3_errmsg(db));
+    }
+}
+
+
 //
 // Lookup the organization name for a mac address
 //
@@ -640,6 +1817,95 @@ void db_query_ma(
 }
 
 
+// SQL to create empty temporary tables in place of missing tables used by query reports
+#define SQL_OWNER_CREATE_TEMP \
+    "CREATE TEMP TABLE " TBL_OWNER " (" \
+        COL_IPTYPE "," COL_IPADDR "," COL_HWADDR "," COL_SEC "," COL_USEC "," COL_UTIME ")"
+#define SQL_ADDR6_CREATE_TEMP \
+    "CREATE TEMP TABLE " TBL_ADDR6 " (" \
+        COL_IPTYPE "," COL_IPADDR "," COL_PREFIX "," COL_HWADDR "," COL_SEC "," COL_USEC "," COL_UTIME ")"
+#define SQL_HOSTNAME_CREATE_TEMP \
+    "CREATE TEMP TABLE " TBL_HOSTNAME " (" \
+        COL_IPTYPE "," COL_IPADDR "," COL_HWADDR "," COL_HOSTNAME "," COL_UTIME ")"
+
+
+//
+// Ensure the tables used by query reports exist
+//
+// NB: A database created by an earlier version may not have the owner, addr6
+//     or hostname tables. Empty temporary tables are created in their place
+//     so that the same query can be used for all databases.
+//
+static void db_query_tables(
+    sqlite3 *                   db)
+{
+    static const char *         tables[][2] =
+    {
+        { TBL_OWNER, SQL_OWNER_CREATE_TEMP },
+        { TBL_ADDR6, SQL_ADDR6_CREATE_TEMP },
+        { TBL_HOSTNAME, SQL_HOSTNAME_CREATE_TEMP },
+    };
+    sqlite3_stmt *              query_stmt;
+    unsigned int                i;
+    int                         r;
+
+    // SQL to check whether a table exists
+    //
+    // Paramaters:
+    //      table               table name (string)
+    //
+    #define SQL_HAS_TABLE \
+        "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?"
+
+    // Prepare
+    r = sqlite3_prepare_v2(db, SQL_HAS_TABLE, sizeof(SQL_HAS_TABLE), &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        fatal("query tables prepare failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    for (i = 0; i < sizeof(tables) / sizeof(tables[0]); i++)
+    {
+        // Bind and execute
+        r = sqlite3_bind_text(query_stmt, 1, tables[i][0], -1, SQLITE_STATIC);
+        if (r == SQLITE_OK && sqlite3_step(query_stmt) != SQLITE_ROW)
+        {
+            r = sqlite3_exec(db, tables[i][1], NULL, NULL, NULL);
+            if (r != SQLITE_OK)
+            {
+                fatal("query tables create of %s failed: %s\n", tables[i][0], sqlite3_errmsg(db));
+            }
+        }
+        (void) sqlite3_reset(query_stmt);
+    }
+
+    // Cleanup
+    (void) sqlite3_finalize(query_stmt);
+}
+
+
+//
+// Check whether a query address is a hardware address
+//
+static int db_is_hwaddr(
+    const char *                addr,
+    int                         addr_len)
+{
+    return (addr_len == sizeof("00:00:00:00:00:00") - 1 &&
+            isxdigit(addr[0]) && isxdigit(addr[1]) &&
+            addr[2] == ':' &&
+            isxdigit(addr[3]) && isxdigit(addr[4]) &&
+            addr[5] == ':' &&
+            isxdigit(addr[6]) && isxdigit(addr[7]) &&
+            addr[8] == ':' &&
+            isxdigit(addr[9]) && isxdigit(addr[10]) &&
+            addr[11] == ':' &&
+            isxdigit(addr[12]) && isxdigit(addr[13]) &&
+            addr[14] == ':' &&
+            isxdigit(addr[15]) && isxdigit(addr[16]));
+}
+
+
 //
 // Query the imap table
 //
@@ -682,34 +1948,60 @@ void db_ipmap_query(
     #define SQL_QUERY_ORDER_BY \
         "ORDER BY " COL_SEC "," COL_USEC
 
+    // Columns of the rows of the ipmap, owner and addr6 tables used by query reports
+    #define SQL_QUERY_ROW_COLUMNS \
+        COL_SEC "," COL_USEC "," COL_UTIME "," COL_IPTYPE "," COL_IPADDR "," COL_HWADDR
+
     //
     // SQL to query all rows
     //
+    // NB: Rows are drawn from the ipmap table, the owners of ip addresses with
+    //     multiple owners, and the IPv6 addresses grouped by hardware address
+    //     and prefix.
+    //
     // Paramaters:
     //      where               where clause for query (string)
     //
     #define SQL_IPMAP_SELECT_ALL_ROWS \
         SQL_QUERY_SELECT_COLUMNS \
-        "FROM " TBL_IPMAP " %s\n" \
+        "FROM (\n" \
+            "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_IPMAP "\n" \
+            "UNION ALL\n" \
+            "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_OWNER "\n" \
+            "UNION ALL\n" \
+            "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_ADDR6 "\n" \
+        ") %s\n" \
         SQL_QUERY_ORDER_BY
 
     //
     // SQL to query current (last) rows
     //
+    // NB: The owners of an ip address with multiple owners are all current,
+    //     and replace the last row of the ip address.
+    //
     // Paramaters:
     //      where               where clause for query (string)
+    //      where               where clause for query (string)
     //
     #define SQL_IPMAP_SELECT_CURRENT_ROWS \
         SQL_QUERY_SELECT_COLUMNS \
         "FROM (\n" \
-            "SELECT " COL_SEC "," COL_USEC "," COL_UTIME "," COL_IPTYPE "," COL_IPADDR "," COL_HWADDR ",row_number()\n" \
-                "OVER (\n" \
-                    "PARTITION BY " COL_IPADDR "\n" \
-                    "ORDER BY " COL_SEC " DESC," COL_USEC " DESC\n" \
-                ") AS number\n" \
-            "FROM " TBL_IPMAP " %s\n"\
+            "SELECT " SQL_QUERY_ROW_COLUMNS " FROM (\n" \
+                "SELECT " SQL_QUERY_ROW_COLUMNS ",row_number()\n" \
+                    "OVER (\n" \
+                        "PARTITION BY " COL_IPADDR "\n" \
+                        "ORDER BY " COL_SEC " DESC," COL_USEC " DESC\n" \
+                    ") AS number\n" \
+                "FROM (\n" \
+                    "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_IPMAP "\n" \
+                    "UNION ALL\n" \
+                    "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_ADDR6 "\n" \
+                ") %s\n" \
+            ")\n" \
+            "WHERE number = 1 AND " COL_IPADDR " NOT IN (SELECT " COL_IPADDR " FROM " TBL_OWNER ")\n" \
+            "UNION ALL\n" \
+            "SELECT " SQL_QUERY_ROW_COLUMNS " FROM " TBL_OWNER " %s\n" \
         ")\n" \
-        "WHERE number = 1\n" \
         SQL_QUERY_ORDER_BY
 
     // Safety check: ensure where buffer is large enough
@@ -727,18 +2019,7 @@ void db_ipmap_query(
         }
 
         // Is it a hardware address?
-        if (addr_len == sizeof("00:00:00:00:00:00") - 1 &&
-            isxdigit(addr[0]) && isxdigit(addr[1]) &&
-            addr[2] == ':' &&
-            isxdigit(addr[3]) && isxdigit(addr[4]) &&
-            addr[5] == ':' &&
-            isxdigit(addr[6]) && isxdigit(addr[7]) &&
-            addr[8] == ':' &&
-            isxdigit(addr[9]) && isxdigit(addr[10]) &&
-            addr[11] == ':' &&
-            isxdigit(addr[12]) && isxdigit(addr[13]) &&
-            addr[14] == ':' &&
-            isxdigit(addr[15]) && isxdigit(addr[16]))
+        if (db_is_hwaddr(addr, addr_len))
         {
             int offset = snprintf(where, sizeof(where), "WHERE " COL_HWADDR " = '%s'", addr);
 
@@ -760,14 +2041,19 @@ void db_ipmap_query(
         }
     }
 
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_IPMAP_SELECT_CURRENT_ROWS) + 2 * sizeof(where) < sizeof(sql)),
+        "SQL_IPMAP_SELECT_CURRENT_ROWS exceeds sql buffer size");
+
     // Construct the sql
+    db_query_tables(db);
     if (all)
     {
         snprintf(sql, sizeof(sql), SQL_IPMAP_SELECT_ALL_ROWS, where);
     }
     else
     {
-        snprintf(sql, sizeof(sql), SQL_IPMAP_SELECT_CURRENT_ROWS, where);
+        snprintf(sql, sizeof(sql), SQL_IPMAP_SELECT_CURRENT_ROWS, where, where);
     }
 
     // Prepare the statement
@@ -780,9 +2066,16 @@ void db_ipmap_query(
     // Execute
     while (sqlite3_step(query_stmt) == SQLITE_ROW)
     {
-        reverse_paddr(sqlite3_column_int(query_stmt, 2),
-                      (char *) sqlite3_column_text(query_stmt, 3),
-                      hostname, sizeof(hostname));
+        // Use the learned hostname if there is one
+        if (db_hostname_get(db, sqlite3_column_int(query_stmt, 2),
+                            (const char *) sqlite3_column_text(query_stmt, 3),
+                            (const char *) sqlite3_column_text(query_stmt, 4),
+                            hostname, sizeof(hostname)) == 0)
+        {
+            reverse_paddr(sqlite3_column_int(query_stmt, 2),
+                          (char *) sqlite3_column_text(query_stmt, 3),
+                          hostname, sizeof(hostname));
+        }
 
         printf("%s %s %s %s %s %s\n", sqlite3_column_text(query_stmt, 0),
                sqlite3_column_text(query_stmt, 1),
@@ -799,3 +2092,114 @@ void db_ipmap_query(
         fatal("query failed: %s\n", sqlite3_errmsg(db));
     }
 }
+
+
+//
+// Query the IPv6 addresses grouped by hardware address and prefix
+//
+void db_addr6_query(
+    sqlite3 *                   db,
+    const char *                addr)
+{
+    int                         addr_len = 0;
+    char                        where[128] = "";
+    sqlite3_stmt *              query_stmt;
+    char                        sql[ANDWATCH_SQL_BUFFER];
+    char                        hostname[HOSTNAME_LEN];
+    int                         r;
+
+    // SQL to query the groups
+    //
+    // Result columns:
+    //      0 first_time        Timestamp when the group was first seen
+    //      1 age               Days since the group was last updated
+    //      2 prefix            /64 prefix (string)
+    //      3 hwaddr            hardware address (string)
+    //      4 org               Organization name for the hwaddr
+    //      5 count             Number of addresses in the group
+    //
+    // Paramaters:
+    //      where               where clause for query (string)
+    //
+    #define SQL_ADDR6_SELECT_GROUPS \
+        "SELECT datetime(MIN(" COL_SEC "),'unixepoch','localtime'),\n" \
+                "(unixepoch() - MAX(" COL_UTIME ")) / 86400,\n" \
+                COL_PREFIX "," COL_HWADDR ",\n" \
+            "coalesce(\n" \
+                "(SELECT " COL_ORG " FROM " TBL_MA_S " WHERE prefix = substr(hwaddr,1,13)),\n" \
+                "(SELECT " COL_ORG " FROM " TBL_MA_M " WHERE prefix = substr(hwaddr,1,10)),\n" \
+                "(SELECT " COL_ORG " FROM " TBL_MA_L " WHERE prefix = substr(hwaddr,1,8)),\n" \
+                "(SELECT " COL_ORG " FROM " TBL_MA_U " WHERE prefix = substr(hwaddr,2,1)),\n" \
+                "'(unknown)'\n" \
+            "),\n" \
+            "COUNT(*)\n" \
+        "FROM " TBL_ADDR6 " %s\n" \
+        "GROUP BY " COL_HWADDR "," COL_PREFIX "\n" \
+        "ORDER BY MIN(" COL_SEC ")"
+
+    // Safety check: ensure where buffer is large enough
+    _Static_assert ((sizeof("WHERE " COL_HWADDR " = ''") + ETH_ADDRSTRLEN < sizeof(where)) &&
+                    (sizeof("WHERE " COL_PREFIX " IN (SELECT " COL_PREFIX " FROM " TBL_ADDR6 " WHERE " COL_IPADDR " = '')") +
+                     INET6_ADDRSTRLEN < sizeof(where)),
+        "where clause exceeds where buffer size");
+
+    // Build the WHERE clause
+    if (addr)
+    {
+        addr_len = strlen(addr);
+        if (addr_len > INET6_ADDRSTRLEN)
+        {
+            fatal("invalid query address: \"%s\"\n", addr);
+        }
+
+        if (db_is_hwaddr(addr, addr_len))
+        {
+            snprintf(where, sizeof(where), "WHERE " COL_HWADDR " = '%s'", addr);
+        }
+        else
+        {
+            snprintf(where, sizeof(where), "WHERE " COL_PREFIX " IN (SELECT " COL_PREFIX " FROM " TBL_ADDR6 " WHERE " COL_IPADDR " = '%s')", addr);
+        }
+    }
+
+    // Safety check: ensure sql buffer is large enough
+    _Static_assert ((sizeof(SQL_ADDR6_SELECT_GROUPS) + sizeof(where) < sizeof(sql)),
+        "SQL_ADDR6_SELECT_GROUPS exceeds sql buffer size");
+
+    // Construct the sql
+    db_query_tables(db);
+    snprintf(sql, sizeof(sql), SQL_ADDR6_SELECT_GROUPS, where);
+
+    // Prepare the statement
+    r = sqlite3_prepare_v2(db, sql, -1, &query_stmt, NULL);
+    if (r != SQLITE_OK)
+    {
+        fatal("addr6 query prepare failed: %s\n", sqlite3_errmsg(db));
+    }
+
+    // Execute
+    while (sqlite3_step(query_stmt) == SQLITE_ROW)
+    {
+        // Use the hostname learned for the hardware address if there is one
+        if (db_hostname_get(db, DB_IPTYPE_6, "", (const char *) sqlite3_column_text(query_stmt, 3),
+                            hostname, sizeof(hostname)) == 0)
+        {
+            safe_strncpy(hostname, "(unknown)", sizeof(hostname));
+        }
+
+        printf("%s %s %s %s/64 %s %s %s\n", sqlite3_column_text(query_stmt, 0),
+               sqlite3_column_text(query_stmt, 1),
+               hostname,
+               sqlite3_column_text(query_stmt, 2),
+               sqlite3_column_text(query_stmt, 3),
+               sqlite3_column_text(query_stmt, 5),
+               sqlite3_column_text(query_stmt, 4));
+    }
+
+    // Cleanup
+    r = sqlite3_finalize(query_stmt);
+    if (r != SQLITE_OK)
+    {
+        fatal("addr6 query failed: %s\n", sqlite3_errmsg(db));
+    }
+}
@@ -0,0 +1,376 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "andwatch.h"
+
+
+#if defined(__linux__)
+
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <netinet/icmp6.h>
+
+// NB: Both pcap and linux define struct bpf_insn. The linux definition is
+//     renamed to avoid the conflict.
+#define bpf_insn                ebpf_insn
+#include <linux/bpf.h>
+#undef bpf_insn
+
+
+// Size of the buffer for the verifier log
+#define EBPF_LOG_SIZE           (65536)
+
+// Size of the dedup map key and value
+//
+// Key:     iptype (bits 0-7), outer VLAN id (bits 8-19) and inner VLAN id
+//          (bits 20-31) (u32), address (16 bytes, IPv4 is zero filled)
+// Value:   hardware address (u64), time of last pass in ns (u64)
+//
+#define EBPF_KEY_SIZE           (20)
+#define EBPF_VALUE_SIZE         (16)
+
+// Instruction construction
+#define EBPF_INSN(c, d, s, o, i) \
+    ((struct ebpf_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define EBPF_MOV64_REG(d, s)    EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define EBPF_MOV64_IMM(d, i)    EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define EBPF_ALU64_IMM(o, d, i) EBPF_INSN(BPF_ALU64 | (o) | BPF_K, d, 0, 0, i)
+#define EBPF_ALU64_REG(o, d, s) EBPF_INSN(BPF_ALU64 | (o) | BPF_X, d, s, 0, 0)
+#define EBPF_LD_ABS(z, i)       EBPF_INSN(BPF_LD | (z) | BPF_ABS, 0, 0, 0, i)
+#define EBPF_LD_IND(z, s, i)    EBPF_INSN(BPF_LD | (z) | BPF_IND, 0, s, 0, i)
+#define EBPF_ST_MEM(z, d, o, i) EBPF_INSN(BPF_ST | (z) | BPF_MEM, d, 0, o, i)
+#define EBPF_STX_MEM(z, d, s, o) EBPF_INSN(BPF_STX | (z) | BPF_MEM, d, s, o, 0)
+#define EBPF_LDX_MEM(z, d, s, o) EBPF_INSN(BPF_LDX | (z) | BPF_MEM, d, s, o, 0)
+#define EBPF_JMP_IMM(o, d, i, j) EBPF_INSN(BPF_JMP | (o) | BPF_K, d, 0, j, i)
+#define EBPF_JMP_REG(o, d, s, j) EBPF_INSN(BPF_JMP | (o) | BPF_X, d, s, j, 0)
+#define EBPF_JA(j)              EBPF_INSN(BPF_JMP | BPF_JA, 0, 0, j, 0)
+#define EBPF_CALL(f)            EBPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EBPF_EXIT()             EBPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define EBPF_LD_IMM64(d, s, i) \
+    EBPF_INSN(BPF_LD | BPF_DW | BPF_IMM, d, s, 0, (int32_t) (uint32_t) (i)), \
+    EBPF_INSN(0, 0, 0, 0, (int32_t) (uint32_t) ((uint64_t) (i) >> 32))
+
+
+
+//
+// Invoke the bpf system call
+//
+static int ebpf_syscall(
+    int                         cmd,
+    union bpf_attr *            attr)
+{
+    return (int) syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+//
+// Create the dedup map
+//
+static int ebpf_map_create(
+    const unsigned int          entries)
+{
+    union bpf_attr              attr;
+    struct rlimit               rlimit;
+    int                         map_fd;
+
+    // Older kernels charge maps and programs against the locked memory limit
+    rlimit.rlim_cur = RLIM_INFINITY;
+    rlimit.rlim_max = RLIM_INFINITY;
+    (void) setrlimit(RLIMIT_MEMLOCK, &rlimit);
+
+    // Create the map
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_LRU_HASH;
+    attr.key_size = EBPF_KEY_SIZE;
+    attr.value_size = EBPF_VALUE_SIZE;
+    attr.max_entries = entries;
+    map_fd = ebpf_syscall(BPF_MAP_CREATE, &attr);
+    if (map_fd == -1)
+    {
+        fatal("bpf map create failed: %s\n", strerror(errno));
+    }
+
+    return map_fd;
+}
+
+
+//
+// Load the dedup socket filter
+//
+// The program performs the checks of PCAP_FIXED_FILTER, and then drops
+// packets for an ip address whose hardware address is unchanged and that
+// passed within the dedup window. ARP probes and DAD solicitations, which
+// have no sender address, always pass. A packet for a new ip address, or with a
+// changed hardware address, always passes. Recently passed ip addresses are
+// held in an LRU hash map.
+//
+// NB: Packet offsets are relative to the ethernet header. LD_ABS loads
+//     return values in host byte order, which is consistent for the map key
+//     and value, but is not the network byte order of the address.
+//
+//     The kernel removes the outer VLAN tag before the filter is run. On a
+//     trunk, one remaining (inner) VLAN tag is also parsed, and both VLAN
+//     ids are part of the key so the same ip address on different VLANs is
+//     tracked separately. Otherwise a remaining tag is not matched.
+//
+//     The file descriptor of the map is returned in map_fd, so that an
+//     entry can be removed with ebpf_dedup_forget.
+//
+// Returns the file descriptor of the loaded program
+//
+int ebpf_dedup_open(
+    const int                   snaplen,
+    const unsigned int          window,
+    const unsigned int          entries,
+    const unsigned int          trunk,
+    int *                       map_fd_ret)
+{
+    union bpf_attr              attr;
+    char *                      log;
+    int                         prog_fd;
+    int                         err;
+    int                         map_fd = ebpf_map_create(entries);
+    uint64_t                    window_ns = (uint64_t) window * 1000000000ULL;
+    int                         vlan_type = trunk ? ETHERTYPE_VLAN : -1;
+    struct ebpf_insn            insns[] =
+    {
+        // VLAN id removed by the kernel, and ethernet type (0)
+        EBPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+        EBPF_MOV64_IMM(BPF_REG_7, 0),
+        EBPF_LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_6, offsetof(struct __sk_buff, vlan_tci)),
+        EBPF_ALU64_IMM(BPF_AND, BPF_REG_0, 0x0fff),
+        EBPF_ALU64_IMM(BPF_LSH, BPF_REG_0, 8),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -24),
+        EBPF_LD_ABS(BPF_H, 12),
+        EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, vlan_type, 8),                         // -> 16 (type)
+
+        // Trunk: inner VLAN id and ethernet type, offsets are shifted by r7 (8)
+        EBPF_LD_ABS(BPF_H, 14),
+        EBPF_ALU64_IMM(BPF_AND, BPF_REG_0, 0x0fff),
+        EBPF_ALU64_IMM(BPF_LSH, BPF_REG_0, 20),
+        EBPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_10, -24),
+        EBPF_ALU64_REG(BPF_OR, BPF_REG_1, BPF_REG_0),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_1, -24),
+        EBPF_MOV64_IMM(BPF_REG_7, 4),
+        EBPF_LD_ABS(BPF_H, 16),
+
+        // Network protocol (16)
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, ETHERTYPE_ARP, 2),                     // -> 19 (arp)
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, ETHERTYPE_IPV6, 11),                   // -> 29 (ipv6)
+        EBPF_JA(65),                                                            // -> 84 (drop)
+
+        // ARP: sender protocol address, zero for a probe (19)
+        EBPF_LD_IND(BPF_W, BPF_REG_7, 28),
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 61),                                // -> 82 (pass)
+        EBPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_10, -24),
+        EBPF_ALU64_IMM(BPF_OR, BPF_REG_1, DB_IPTYPE_4),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_1, -24),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -20),
+        EBPF_ST_MEM(BPF_W, BPF_REG_10, -16, 0),
+        EBPF_ST_MEM(BPF_W, BPF_REG_10, -12, 0),
+        EBPF_ST_MEM(BPF_W, BPF_REG_10, -8, 0),
+        EBPF_JA(21),                                                            // -> 50 (check)
+
+        // IPv6: neighbor solicit or advert, source address unspecified for DAD (29)
+        EBPF_LD_IND(BPF_B, BPF_REG_7, 20),
+        EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, IPPROTO_ICMPV6, 53),                   // -> 84 (drop)
+        EBPF_LD_IND(BPF_B, BPF_REG_7, 54),
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, ND_NEIGHBOR_SOLICIT, 1),               // -> 34
+        EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, ND_NEIGHBOR_ADVERT, 50),               // -> 84 (drop)
+        EBPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_10, -24),
+        EBPF_ALU64_IMM(BPF_OR, BPF_REG_1, DB_IPTYPE_6),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_1, -24),
+        EBPF_LD_IND(BPF_W, BPF_REG_7, 22),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -20),
+        EBPF_MOV64_REG(BPF_REG_9, BPF_REG_0),
+        EBPF_LD_IND(BPF_W, BPF_REG_7, 26),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -16),
+        EBPF_ALU64_REG(BPF_OR, BPF_REG_9, BPF_REG_0),
+        EBPF_LD_IND(BPF_W, BPF_REG_7, 30),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -12),
+        EBPF_ALU64_REG(BPF_OR, BPF_REG_9, BPF_REG_0),
+        EBPF_LD_IND(BPF_W, BPF_REG_7, 34),
+        EBPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -8),
+        EBPF_ALU64_REG(BPF_OR, BPF_REG_9, BPF_REG_0),
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_9, 0, 32),                                // -> 82 (pass)
+
+        // Check: hardware address in r8, current time in r9 (50)
+        EBPF_LD_ABS(BPF_H, 6),
+        EBPF_MOV64_REG(BPF_REG_8, BPF_REG_0),
+        EBPF_ALU64_IMM(BPF_LSH, BPF_REG_8, 32),
+        EBPF_LD_ABS(BPF_W, 8),
+        EBPF_ALU64_REG(BPF_OR, BPF_REG_8, BPF_REG_0),
+        EBPF_CALL(BPF_FUNC_ktime_get_ns),
+        EBPF_MOV64_REG(BPF_REG_9, BPF_REG_0),
+        EBPF_LD_IMM64(BPF_REG_1, BPF_PSEUDO_MAP_FD, map_fd),
+        EBPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+        EBPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -24),
+        EBPF_CALL(BPF_FUNC_map_lookup_elem),
+        EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 9),                                 // -> 72 (update)
+        EBPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_0, 0),
+        EBPF_JMP_REG(BPF_JNE, BPF_REG_1, BPF_REG_8, 7),                         // -> 72 (update)
+        EBPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_0, 8),
+        EBPF_MOV64_REG(BPF_REG_2, BPF_REG_9),
+        EBPF_ALU64_REG(BPF_SUB, BPF_REG_2, BPF_REG_1),
+        EBPF_LD_IMM64(BPF_REG_3, 0, window_ns),
+        EBPF_JMP_REG(BPF_JGE, BPF_REG_2, BPF_REG_3, 1),                         // -> 72 (update)
+        EBPF_JA(12),                                                            // -> 84 (drop)
+
+        // Update: record the hardware address and time, and pass the packet (72)
+        EBPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_8, -40),
+        EBPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_9, -32),
+        EBPF_LD_IMM64(BPF_REG_1, BPF_PSEUDO_MAP_FD, map_fd),
+        EBPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+        EBPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -24),
+        EBPF_MOV64_REG(BPF_REG_3, BPF_REG_10),
+        EBPF_ALU64_IMM(BPF_ADD, BPF_REG_3, -40),
+        EBPF_MOV64_IMM(BPF_REG_4, BPF_ANY),
+        EBPF_CALL(BPF_FUNC_map_update_elem),
+
+        // Pass (82)
+        EBPF_MOV64_IMM(BPF_REG_0, snaplen),
+        EBPF_EXIT(),
+
+        // Drop (84)
+        EBPF_MOV64_IMM(BPF_REG_0, 0),
+        EBPF_EXIT(),
+    };
+
+    // Load the program
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uintptr_t) insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t) "BSD";
+    prog_fd = ebpf_syscall(BPF_PROG_LOAD, &attr);
+    if (prog_fd == -1)
+    {
+        err = errno;
+
+        // Load again with the verifier log for diagnosis
+        log = calloc(1, EBPF_LOG_SIZE);
+        if (log)
+        {
+            attr.log_buf = (uintptr_t) log;
+            attr.log_size = EBPF_LOG_SIZE;
+            attr.log_level = 1;
+            (void) ebpf_syscall(BPF_PROG_LOAD, &attr);
+            logger("%s", log);
+        }
+        fatal("bpf program load failed: %s\n", strerror(err));
+    }
+
+    *map_fd_ret = map_fd;
+    return prog_fd;
+}
+
+
+//
+// Remove an ip address from the dedup map
+//
+// NB: The key is built as the program builds it. The VLAN ids are those of
+//     the key (bits 8-31), and each 32 bit word of the address is in host
+//     byte order, as loaded by LD_ABS.
+//
+void ebpf_dedup_forget(
+    const int                   map_fd,
+    const uint32_t              vlans,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    union bpf_attr              attr;
+    uint32_t                    key[EBPF_KEY_SIZE / sizeof(uint32_t)];
+    uint32_t                    words[4];
+    unsigned int                count;
+    unsigned int                i;
+
+    memset(key, 0, sizeof(key));
+    key[0] = vlans | (uint32_t) iptype;
+    count = (iptype == DB_IPTYPE_4) ? 1 : 4;
+    memcpy(words, addr, count * sizeof(uint32_t));
+    for (i = 0; i < count; i++)
+    {
+        key[i + 1] = ntohl(words[i]);
+    }
+
+    // NB: The entry may already have been evicted
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t) map_fd;
+    attr.key = (uintptr_t) key;
+    (void) ebpf_syscall(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+
+#else
+
+
+//
+// Load the dedup socket filter
+//
+int ebpf_dedup_open(
+    __attribute__ ((unused))
+    const int                   snaplen,
+    __attribute__ ((unused))
+    const unsigned int          window,
+    __attribute__ ((unused))
+    const unsigned int          entries,
+    __attribute__ ((unused))
+    const unsigned int          trunk,
+    __attribute__ ((unused))
+    int *                       map_fd_ret)
+{
+    fatal("ebpf filtering is not supported on this platform\n");
+}
+
+
+//
+// Remove an ip address from the dedup map
+//
+void ebpf_dedup_forget(
+    __attribute__ ((unused))
+    const int                   map_fd,
+    __attribute__ ((unused))
+    const uint32_t              vlans,
+    __attribute__ ((unused))
+    db_iptype                   iptype,
+    __attribute__ ((unused))
+    const void *                addr)
+{
+}
+
+
+#endif
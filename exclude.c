@@ -0,0 +1,892 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <pcap.h>
+
+#include "andwatch.h"
+
+
+// Maximum number of words in an exclusion key
+#define EXCLUDE_WORDS_MAX       (4)
+
+// Markers in the generated program, resolved when the program is applied
+#define EXCLUDE_ACCEPT          (0xffffffff)
+#define EXCLUDE_CONTINUE        (0xffffffff)
+
+// Maximum length of a line in the exclusion file
+#define EXCLUDE_LINE_MAX        (256)
+
+
+//
+// Exclusion prefix
+//
+// NB: Addresses are held as a series of words in host byte order, each of
+//     which matches a load by the filter program.
+//
+typedef struct exclude_prefix
+{
+    uint32_t                    words[EXCLUDE_WORDS_MAX];
+    unsigned int                len;
+} exclude_prefix_t;
+
+// Layout of an exclusion key within a packet
+typedef struct exclude_layout
+{
+    unsigned int                words;
+    unsigned int                width[EXCLUDE_WORDS_MAX];
+    unsigned int                size[EXCLUDE_WORDS_MAX];
+    unsigned int                offset[EXCLUDE_WORDS_MAX];
+    unsigned int                mode;
+} exclude_layout_t;
+
+// Interval of the value of a word, and the action for it
+typedef struct exclude_interval
+{
+    uint32_t                    lo;
+    uint32_t                    hi;
+
+    // Prefixes continuing into the next word (drop if count is zero)
+    exclude_prefix_t *          prefixes;
+    unsigned int                count;
+} exclude_interval_t;
+
+// Set of exclusion prefixes
+typedef struct exclude_set
+{
+    exclude_prefix_t *          hwaddr;
+    unsigned int                hwaddr_count;
+    exclude_prefix_t *          ipv4;
+    unsigned int                ipv4_count;
+    exclude_prefix_t *          ipv6;
+    unsigned int                ipv6_count;
+} exclude_set_t;
+
+// Growable program
+typedef struct exclude_code
+{
+    struct bpf_insn *           insns;
+    unsigned int                len;
+    unsigned int                size;
+} exclude_code_t;
+
+
+// Hardware address: ethernet source address (not affected by VLAN tags)
+static const exclude_layout_t   layout_hwaddr =
+{
+    2, { 16, 32 }, { BPF_H, BPF_W }, { 6, 8 }, BPF_ABS
+};
+
+// IPv4: ARP sender protocol address
+static const exclude_layout_t   layout_ipv4 =
+{
+    1, { 32 }, { BPF_W }, { 28 }, BPF_IND
+};
+
+// IPv6: source address
+static const exclude_layout_t   layout_ipv6 =
+{
+    4, { 32, 32, 32, 32 }, { BPF_W, BPF_W, BPF_W, BPF_W }, { 22, 26, 30, 34 }, BPF_IND
+};
+
+// Exclusion file
+static const char *             exclude_filename = NULL;
+
+// Generated program, and the program it replaced on the last reload
+static exclude_code_t           exclude_program;
+static exclude_code_t           exclude_previous;
+
+
+
+//
+// Append instructions to a program
+//
+static void code_append(
+    exclude_code_t *            code,
+    const struct bpf_insn *     insns,
+    unsigned int                len)
+{
+    unsigned int                size;
+
+    if (code->len + len > code->size)
+    {
+        size = code->size ? code->size * 2 : 64;
+        while (size < code->len + len)
+        {
+            size *= 2;
+        }
+
+        code->insns = realloc(code->insns, size * sizeof(struct bpf_insn));
+        if (code->insns == NULL)
+        {
+            fatal("cannot allocate memory for exclusion program\n");
+        }
+        code->size = size;
+    }
+
+    memcpy(code->insns + code->len, insns, len * sizeof(struct bpf_insn));
+    code->len += len;
+}
+
+
+//
+// Append a statement to a program
+//
+static void code_stmt(
+    exclude_code_t *            code,
+    unsigned int                op,
+    uint32_t                    k)
+{
+    struct bpf_insn             insn = BPF_STMT(op, k);
+
+    code_append(code, &insn, 1);
+}
+
+
+//
+// Number of instructions needed for a conditional jump
+//
+static unsigned int code_jump_len(
+    unsigned int                jt,
+    unsigned int                jf)
+{
+    return (jt > 255 || jf > 255) ? 3 : 1;
+}
+
+
+//
+// Append a conditional jump to a program
+//
+// NB: Jump offsets are relative to the end of the jump. Classic BPF offsets
+//     for conditional jumps are limited to 255 instructions. If an offset is
+//     larger, the jump is made through unconditional jumps, which are not.
+//
+static void code_jump(
+    exclude_code_t *            code,
+    unsigned int                op,
+    uint32_t                    k,
+    unsigned int                jt,
+    unsigned int                jf)
+{
+    struct bpf_insn             insns[3] =
+    {
+        BPF_JUMP(op, k, 0, 1),
+        BPF_STMT(BPF_JMP | BPF_JA, 0),
+        BPF_STMT(BPF_JMP | BPF_JA, 0),
+    };
+
+    if (code_jump_len(jt, jf) == 1)
+    {
+        insns[0].jt = (u_char) jt;
+        insns[0].jf = (u_char) jf;
+        code_append(code, insns, 1);
+        return;
+    }
+
+    insns[1].k = jt + 1;
+    insns[2].k = jf;
+    code_append(code, insns, 3);
+}
+
+
+//
+// Release a program
+//
+static void code_free(
+    exclude_code_t *            code)
+{
+    free(code->insns);
+    memset(code, 0, sizeof(*code));
+}
+
+
+//
+// Compare prefixes by one word
+//
+static unsigned int             compare_word;
+
+static int compare_prefixes(
+    const void *                a,
+    const void *                b)
+{
+    uint32_t                    wa = ((const exclude_prefix_t *) a)->words[compare_word];
+    uint32_t                    wb = ((const exclude_prefix_t *) b)->words[compare_word];
+
+    return (wa > wb) - (wa < wb);
+}
+
+
+//
+// Compare intervals
+//
+static int compare_intervals(
+    const void *                a,
+    const void *                b)
+{
+    uint32_t                    la = ((const exclude_interval_t *) a)->lo;
+    uint32_t                    lb = ((const exclude_interval_t *) b)->lo;
+
+    return (la > lb) - (la < lb);
+}
+
+
+static void gen_word(
+    exclude_code_t *            code,
+    const exclude_layout_t *    layout,
+    exclude_prefix_t *          prefixes,
+    unsigned int                count,
+    unsigned int                word,
+    unsigned int                base,
+    const struct bpf_insn *     pass);
+
+
+//
+// Generate a binary search over a sorted set of intervals
+//
+// NB: The word being tested is in the accumulator. A value within an
+//     interval is dropped, or continues to the next word. A value between
+//     intervals passes.
+//
+static void gen_search(
+    exclude_code_t *            code,
+    const exclude_layout_t *    layout,
+    exclude_interval_t *        intervals,
+    unsigned int                count,
+    unsigned int                word,
+    unsigned int                base,
+    uint32_t                    max,
+    const struct bpf_insn *     pass)
+{
+    exclude_code_t              action;
+    exclude_code_t              left;
+    exclude_code_t              right;
+    exclude_interval_t *        iv;
+    unsigned int                m;
+    unsigned int                above_len;
+
+    if (count == 0)
+    {
+        code_append(code, pass, 1);
+        return;
+    }
+
+    m = count / 2;
+    iv = &intervals[m];
+    memset(&action, 0, sizeof(action));
+    memset(&left, 0, sizeof(left));
+    memset(&right, 0, sizeof(right));
+
+    // Code for a value within the interval
+    if (iv->count)
+    {
+        gen_word(&action, layout, iv->prefixes, iv->count, word + 1, base + layout->width[word], pass);
+    }
+    else
+    {
+        code_stmt(&action, BPF_RET | BPF_K, 0);
+    }
+
+    // Code for values above and below the interval
+    gen_search(&right, layout, intervals + m + 1, count - m - 1, word, base, max, pass);
+    gen_search(&left, layout, intervals, m, word, base, max, pass);
+
+    // Assemble
+    // NB: There is nothing above an interval ending at the maximum value of
+    //     the word, or below an interval starting at zero
+    above_len = 0;
+    if (iv->hi < max)
+    {
+        above_len = code_jump_len(action.len, 0) + right.len;
+    }
+    if (iv->lo > 0)
+    {
+        code_jump(code, BPF_JMP | BPF_JGE | BPF_K, iv->lo, 0, above_len + action.len);
+    }
+    if (iv->hi < max)
+    {
+        code_jump(code, BPF_JMP | BPF_JGT | BPF_K, iv->hi, action.len, 0);
+    }
+    code_append(code, action.insns, action.len);
+    if (iv->hi < max)
+    {
+        code_append(code, right.insns, right.len);
+    }
+    if (iv->lo > 0)
+    {
+        code_append(code, left.insns, left.len);
+    }
+
+    code_free(&action);
+    code_free(&left);
+    code_free(&right);
+}
+
+
+//
+// Generate the test of one word of a key against a set of prefixes
+//
+// NB: Prefixes that end within the word become intervals of the word that
+//     are dropped. These are merged when they overlap or are adjacent.
+//     Longer prefixes are grouped by the value of the word, and continue to
+//     the next word unless the value is already dropped.
+//
+static void gen_word(
+    exclude_code_t *            code,
+    const exclude_layout_t *    layout,
+    exclude_prefix_t *          prefixes,
+    unsigned int                count,
+    unsigned int                word,
+    unsigned int                base,
+    const struct bpf_insn *     pass)
+{
+    exclude_interval_t *        intervals;
+    exclude_prefix_t *          longer;
+    unsigned int                width = layout->width[word];
+    uint32_t                    max = (width == 32) ? 0xffffffff : ((1U << width) - 1);
+    uint32_t                    mask;
+    unsigned int                interval_count = 0;
+    unsigned int                dropped;
+    unsigned int                longer_count = 0;
+    unsigned int                rem;
+    unsigned int                i;
+    unsigned int                j;
+
+    intervals = calloc(count, sizeof(exclude_interval_t));
+    longer = calloc(count, sizeof(exclude_prefix_t));
+    if (intervals == NULL || longer == NULL)
+    {
+        fatal("cannot allocate memory for exclusion program\n");
+    }
+
+    // Intervals for the prefixes ending within the word
+    for (i = 0; i < count; i++)
+    {
+        rem = prefixes[i].len - base;
+        if (rem > width)
+        {
+            longer[longer_count++] = prefixes[i];
+            continue;
+        }
+
+        mask = (rem == 0) ? 0 : (rem == width) ? max : (max & ~(max >> rem));
+        intervals[interval_count].lo = prefixes[i].words[word] & mask;
+        intervals[interval_count].hi = (prefixes[i].words[word] & mask) | (max & ~mask);
+        interval_count++;
+    }
+
+    // Merge the intervals
+    qsort(intervals, interval_count, sizeof(exclude_interval_t), compare_intervals);
+    for (i = 0, j = 0; i < interval_count; i++)
+    {
+        if (j && (intervals[j - 1].hi == max || intervals[i].lo <= intervals[j - 1].hi + 1))
+        {
+            if (intervals[i].hi > intervals[j - 1].hi)
+            {
+                intervals[j - 1].hi = intervals[i].hi;
+            }
+            continue;
+        }
+        intervals[j++] = intervals[i];
+    }
+    interval_count = j;
+    dropped = interval_count;
+
+    // Group the longer prefixes by the value of the word
+    compare_word = word;
+    qsort(longer, longer_count, sizeof(exclude_prefix_t), compare_prefixes);
+    for (i = 0; i < longer_count; i = j)
+    {
+        for (j = i + 1; j < longer_count && longer[j].words[word] == longer[i].words[word]; j++)
+        {
+            ;
+        }
+
+        // Is the value already dropped?
+        for (rem = 0; rem < dropped; rem++)
+        {
+            if (longer[i].words[word] >= intervals[rem].lo && longer[i].words[word] <= intervals[rem].hi)
+            {
+                break;
+            }
+        }
+        if (rem < dropped)
+        {
+            continue;
+        }
+
+        intervals[interval_count].lo = longer[i].words[word];
+        intervals[interval_count].hi = longer[i].words[word];
+        intervals[interval_count].prefixes = &longer[i];
+        intervals[interval_count].count = j - i;
+        interval_count++;
+    }
+    qsort(intervals, interval_count, sizeof(exclude_interval_t), compare_intervals);
+
+    // Load the word and search
+    code_stmt(code, BPF_LD | layout->size[word] | layout->mode, layout->offset[word]);
+    gen_search(code, layout, intervals, interval_count, word, base, max, pass);
+
+    free(intervals);
+    free(longer);
+}
+
+
+//
+// Generate the test of a key against a set of prefixes
+//
+static void gen_key(
+    exclude_code_t *            code,
+    const exclude_layout_t *    layout,
+    exclude_prefix_t *          prefixes,
+    unsigned int                count,
+    const struct bpf_insn *     pass)
+{
+    if (count == 0)
+    {
+        code_append(code, pass, 1);
+        return;
+    }
+
+    gen_word(code, layout, prefixes, count, 0, 0, pass);
+}
+
+
+//
+// Generate the exclusion program
+//
+// The program is appended to the compiled capture filter, and is entered
+// in place of each return that accepts the packet. The hardware address is
+// tested first, followed by the ARP sender or IPv6 source address. Excluded
+// packets are dropped, and others are accepted.
+//
+// NB: The index register holds the length of the VLAN tags, if any, so that
+//     the network header is found on a trunk.
+//
+static void gen_program(
+    exclude_code_t *            code,
+    const exclude_set_t *       set)
+{
+    static const struct bpf_insn trunk_insns[] =
+    {
+        BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_VLAN, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_QINQ, 0, 4),
+        BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 4),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 16),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_VLAN, 0, 1),
+        BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 8),
+    };
+    static const struct bpf_insn pass_insn = BPF_STMT(BPF_RET | BPF_K, EXCLUDE_ACCEPT);
+    static const struct bpf_insn continue_insn = BPF_STMT(BPF_JMP | BPF_JA, EXCLUDE_CONTINUE);
+    exclude_code_t              hwaddr;
+    exclude_code_t              ipv4;
+    exclude_code_t              ipv6;
+    unsigned int                i;
+
+    memset(&hwaddr, 0, sizeof(hwaddr));
+    memset(&ipv4, 0, sizeof(ipv4));
+    memset(&ipv6, 0, sizeof(ipv6));
+
+    // Length of the VLAN tags
+    if (vlan_trunk)
+    {
+        code_append(code, trunk_insns, sizeof(trunk_insns) / sizeof(trunk_insns[0]));
+    }
+    else
+    {
+        code_stmt(code, BPF_LDX | BPF_W | BPF_IMM, 0);
+    }
+
+    // Hardware address, continuing to the ip address
+    if (set->hwaddr_count)
+    {
+        gen_key(&hwaddr, &layout_hwaddr, set->hwaddr, set->hwaddr_count, &continue_insn);
+        for (i = 0; i < hwaddr.len; i++)
+        {
+            if (hwaddr.insns[i].code == (BPF_JMP | BPF_JA) && hwaddr.insns[i].k == EXCLUDE_CONTINUE)
+            {
+                hwaddr.insns[i].k = hwaddr.len - i - 1;
+            }
+        }
+        code_append(code, hwaddr.insns, hwaddr.len);
+    }
+
+    // IP address
+    gen_key(&ipv4, &layout_ipv4, set->ipv4, set->ipv4_count, &pass_insn);
+    gen_key(&ipv6, &layout_ipv6, set->ipv6, set->ipv6_count, &pass_insn);
+
+    code_stmt(code, BPF_LD | BPF_H | BPF_IND, 12);
+    code_jump(code, BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_ARP, code_jump_len(1 + ipv4.len, 0) + 1, 0);
+    code_jump(code, BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IPV6, 1 + ipv4.len, 0);
+    code_append(code, &pass_insn, 1);
+    code_append(code, ipv4.insns, ipv4.len);
+    code_append(code, ipv6.insns, ipv6.len);
+
+    code_free(&hwaddr);
+    code_free(&ipv4);
+    code_free(&ipv6);
+}
+
+
+//
+// Add a prefix to a set of prefixes
+//
+static void add_prefix(
+    exclude_prefix_t **         prefixes,
+    unsigned int *              count,
+    const exclude_prefix_t *    prefix)
+{
+    *prefixes = realloc(*prefixes, (*count + 1) * sizeof(exclude_prefix_t));
+    if (*prefixes == NULL)
+    {
+        fatal("cannot allocate memory for exclusions\n");
+    }
+    (*prefixes)[(*count)++] = *prefix;
+}
+
+
+//
+// Parse an exclusion entry
+//
+// An entry is an IPv4 or IPv6 address or prefix (CIDR), or a hardware
+// address with an optional prefix length (for example 00:11:22:00:00:00/24).
+//
+// Returns 1 if the entry is valid, or 0 if not
+//
+static int parse_entry(
+    exclude_set_t *             set,
+    char *                      entry)
+{
+    exclude_prefix_t            prefix;
+    struct in_addr              ipv4;
+    struct in6_addr             ipv6;
+    struct ether_addr           hwaddr;
+    const unsigned char *       octets;
+    char *                      slash;
+    char *                      p;
+    long                        len = -1;
+    unsigned int                i;
+
+    memset(&prefix, 0, sizeof(prefix));
+
+    // Split the prefix length
+    slash = strchr(entry, '/');
+    if (slash)
+    {
+        *slash = 0;
+        len = strtol(slash + 1, &p, 10);
+        if (*p != '\0' || slash[1] == '\0' || len < 0)
+        {
+            return 0;
+        }
+    }
+
+    if (inet_pton(AF_INET, entry, &ipv4) == 1)
+    {
+        prefix.len = (len == -1) ? 32 : (unsigned int) len;
+        if (prefix.len > 32)
+        {
+            return 0;
+        }
+        prefix.words[0] = ntohl(ipv4.s_addr);
+        add_prefix(&set->ipv4, &set->ipv4_count, &prefix);
+    }
+    else if (inet_pton(AF_INET6, entry, &ipv6) == 1)
+    {
+        prefix.len = (len == -1) ? 128 : (unsigned int) len;
+        if (prefix.len > 128)
+        {
+            return 0;
+        }
+        for (i = 0; i < 4; i++)
+        {
+            prefix.words[i] = ((uint32_t) ipv6.s6_addr[i * 4] << 24) | ((uint32_t) ipv6.s6_addr[i * 4 + 1] << 16) |
+                              ((uint32_t) ipv6.s6_addr[i * 4 + 2] << 8) | ipv6.s6_addr[i * 4 + 3];
+        }
+        add_prefix(&set->ipv6, &set->ipv6_count, &prefix);
+    }
+    else if (eth_pton(entry, &hwaddr))
+    {
+        prefix.len = (len == -1) ? 48 : (unsigned int) len;
+        if (prefix.len > 48)
+        {
+            return 0;
+        }
+        octets = (const unsigned char *) &hwaddr;
+        prefix.words[0] = ((uint32_t) octets[0] << 8) | octets[1];
+        prefix.words[1] = ((uint32_t) octets[2] << 24) | ((uint32_t) octets[3] << 16) |
+                          ((uint32_t) octets[4] << 8) | octets[5];
+        add_prefix(&set->hwaddr, &set->hwaddr_count, &prefix);
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+//
+// Read an exclusion file and generate its program
+//
+// The file contains one entry per line. Blank lines, and text following a
+// '#', are ignored.
+//
+// Returns 1 if the program was generated, or 0 if not
+//
+static int exclude_read(
+    const char *                filename,
+    exclude_code_t *            code)
+{
+    FILE *                      file;
+    exclude_set_t               set;
+    char                        line[EXCLUDE_LINE_MAX];
+    char *                      entry;
+    char *                      p;
+    unsigned int                line_number = 0;
+    int                         valid = 1;
+
+    memset(&set, 0, sizeof(set));
+    memset(code, 0, sizeof(*code));
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        logger("cannot open exclusion file %s: %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+
+        // Remove comments and whitespace
+        p = strchr(line, '#');
+        if (p)
+        {
+            *p = 0;
+        }
+        entry = line + strspn(line, " \t\r\n");
+        entry[strcspn(entry, " \t\r\n")] = 0;
+        if (*entry == 0)
+        {
+            continue;
+        }
+
+        if (parse_entry(&set, entry) == 0)
+        {
+            logger("invalid entry \"%s\" at line %u of exclusion file %s\n", entry, line_number, filename);
+            valid = 0;
+            break;
+        }
+    }
+    (void) fclose(file);
+
+    // Generate the program
+    if (valid)
+    {
+        gen_program(code, &set);
+        if (code->len >= BPF_MAXINSNS)
+        {
+            logger("exclusion program for %s is too large (%u instructions)\n", filename, code->len);
+            code_free(code);
+            valid = 0;
+        }
+        else
+        {
+            logger("exclusions: %u hardware, %u IPv4 and %u IPv6 entries compiled to %u BPF instructions\n",
+                set.hwaddr_count, set.ipv4_count, set.ipv6_count, code->len);
+        }
+    }
+
+    free(set.hwaddr);
+    free(set.ipv4);
+    free(set.ipv6);
+    return valid;
+}
+
+
+//
+// Load the exclusion file and generate the exclusion program
+//
+void exclude_load(
+    const char *                filename)
+{
+    if (exclude_read(filename, &exclude_program) == 0)
+    {
+        fatal("cannot load exclusion file %s\n", filename);
+    }
+    exclude_filename = filename;
+}
+
+
+//
+// Reload the exclusion file
+//
+// NB: The program is only replaced if it has changed. The program that was
+//     replaced is kept until the next reload so that the replacement can be
+//     reverted if it cannot be applied. The caller must ensure that the
+//     program is not being applied by another thread.
+//
+// Returns 1 if the program was replaced, 0 if it is unchanged, or -1 if the
+// file could not be read
+//
+int exclude_reload(void)
+{
+    exclude_code_t              code;
+
+    if (exclude_filename == NULL)
+    {
+        return 0;
+    }
+
+    if (exclude_read(exclude_filename, &code) == 0)
+    {
+        return -1;
+    }
+
+    // Is the program unchanged?
+    if (code.len == exclude_program.len &&
+        memcmp(code.insns, exclude_program.insns, code.len * sizeof(struct bpf_insn)) == 0)
+    {
+        code_free(&code);
+        return 0;
+    }
+
+    code_free(&exclude_previous);
+    exclude_previous = exclude_program;
+    exclude_program = code;
+    return 1;
+}
+
+
+//
+// Revert the replacement of the exclusion program by the last reload
+//
+void exclude_revert(void)
+{
+    code_free(&exclude_program);
+    exclude_program = exclude_previous;
+    memset(&exclude_previous, 0, sizeof(exclude_previous));
+}
+
+
+//
+// Apply the exclusion program to a compiled capture filter
+//
+// Returns 0 on success, or -1 if the combined program is too large
+//
+// NB: Each return in the capture filter that accepts the packet is replaced
+//     by a jump to the exclusion program, which returns the same value if the
+//     packet is not excluded.
+//
+int exclude_apply(
+    struct bpf_program *        program)
+{
+    struct bpf_insn *           insns;
+    unsigned int                len;
+    unsigned int                i;
+    uint32_t                    accept = 0;
+
+    if (exclude_program.len == 0)
+    {
+        return 0;
+    }
+
+    // Find the accept value of the capture filter
+    for (i = 0; i < program->bf_len; i++)
+    {
+        if (program->bf_insns[i].code == (BPF_RET | BPF_K) && program->bf_insns[i].k)
+        {
+            accept = program->bf_insns[i].k;
+            break;
+        }
+    }
+    if (accept == 0)
+    {
+        return 0;
+    }
+
+    // Safety check: ensure the combined program is not too large
+    len = program->bf_len + exclude_program.len;
+    if (len > BPF_MAXINSNS)
+    {
+        logger("capture filter with exclusions is too large (%u instructions)\n", len);
+        return -1;
+    }
+
+    insns = malloc(len * sizeof(struct bpf_insn));
+    if (insns == NULL)
+    {
+        fatal("cannot allocate memory for capture filter\n");
+    }
+
+    // Capture filter, entering the exclusion program in place of accepting
+    memcpy(insns, program->bf_insns, program->bf_len * sizeof(struct bpf_insn));
+    for (i = 0; i < program->bf_len; i++)
+    {
+        if (insns[i].code == (BPF_RET | BPF_K) && insns[i].k)
+        {
+            insns[i].code = BPF_JMP | BPF_JA;
+            insns[i].k = program->bf_len - i - 1;
+        }
+    }
+
+    // Exclusion program
+    memcpy(insns + program->bf_len, exclude_program.insns, exclude_program.len * sizeof(struct bpf_insn));
+    for (i = program->bf_len; i < len; i++)
+    {
+        if (insns[i].code == (BPF_RET | BPF_K) && insns[i].k == EXCLUDE_ACCEPT)
+        {
+            insns[i].k = accept;
+        }
+    }
+
+    // NB: The program is released by pcap_freecode
+    free(program->bf_insns);
+    program->bf_insns = insns;
+    program->bf_len = len;
+    return 0;
+}
+
+
+//
+// Is an exclusion program in use
+//
+int exclude_enabled(void)
+{
+    return exclude_program.len != 0;
+}
@@ -0,0 +1,780 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+#include "andwatch.h"
+
+
+// Number of entries in the table of hostnames recently learned by a shard
+// (must be a power of 2)
+#define HOSTNAME_ENTRIES        (256)
+
+// Interval after which an unchanged hostname is written again (seconds)
+#define HOSTNAME_UPDATE_INTERVAL (28800)
+
+// Maximum number of addresses learned from a single packet
+#define HOSTNAME_ADDRS_MAX      (8)
+
+// Maximum number of compression pointers followed in a DNS name
+#define DNS_POINTERS_MAX        (16)
+
+// UDP ports
+#define PORT_DHCP_SERVER        (67)
+#define PORT_DHCP6_CLIENT       (546)
+#define PORT_MDNS               (5353)
+
+// DHCPv4 message layout and options
+#define DHCP_OFF_OP             (0)
+#define DHCP_OFF_HTYPE          (1)
+#define DHCP_OFF_HLEN           (2)
+#define DHCP_OFF_CIADDR         (12)
+#define DHCP_OFF_CHADDR         (28)
+#define DHCP_OFF_COOKIE         (236)
+#define DHCP_OFF_OPTIONS        (240)
+#define DHCP_COOKIE             (0x63825363)
+#define DHCP_BOOTREQUEST        (1)
+#define DHCP_HTYPE_ETHER        (1)
+#define DHCP_OPT_PAD            (0)
+#define DHCP_OPT_HOSTNAME       (12)
+#define DHCP_OPT_REQUESTED_IP   (50)
+#define DHCP_OPT_MSG_TYPE       (53)
+#define DHCP_OPT_CLIENT_FQDN    (81)
+#define DHCP_OPT_END            (255)
+#define DHCP_REQUEST            (3)
+#define DHCP_INFORM             (8)
+#define DHCP_FQDN_E             (0x04)
+
+// DHCPv6 message types and options
+#define DHCP6_REQUEST           (3)
+#define DHCP6_CONFIRM           (4)
+#define DHCP6_RENEW             (5)
+#define DHCP6_REBIND            (6)
+#define DHCP6_OPT_IA_NA         (3)
+#define DHCP6_OPT_IA_TA         (4)
+#define DHCP6_OPT_IAADDR        (5)
+#define DHCP6_OPT_CLIENT_FQDN   (39)
+
+// DNS message layout and record types
+#define DNS_HEADER_LEN          (12)
+#define DNS_FLAG_QR             (0x8000)
+#define DNS_TYPE_A              (1)
+#define DNS_TYPE_AAAA           (28)
+#define DNS_CLASS_IN            (1)
+#define DNS_CLASS_MASK          (0x7fff)
+
+
+// Hostname learning enabled
+unsigned int                    hostname_enabled = 0;
+
+
+// A hostname recently learned
+typedef struct hostname_entry
+{
+    // IP address type (DB_IPTYPE_ANY indicates an unused entry)
+    db_iptype                   iptype;
+
+    // IP address (zero if learned for the hardware address only)
+    ip_addr_t                   addr;
+
+    // Hardware address
+    struct ether_addr           hwaddr;
+
+    // Hash of the hostname
+    uint32_t                    name_hash;
+
+    // Time last written
+    time_t                      time;
+} hostname_entry_t;
+
+
+//
+// Table of hostnames recently learned by a shard
+//
+// NB: The table is direct mapped, and only suppresses repeated writes of
+//     the same hostname. It is only allocated when the first hostname is
+//     learned.
+//
+struct hostnames
+{
+    hostname_entry_t            entries[HOSTNAME_ENTRIES];
+};
+
+
+
+//
+// FNV-1a hash of a block of bytes
+//
+static uint32_t hash_bytes(
+    uint32_t                    h,
+    const void *                data,
+    size_t                      len)
+{
+    const unsigned char *       p = data;
+    size_t                      i;
+
+    for (i = 0; i < len; i++)
+    {
+        h = (h ^ p[i]) * 16777619U;
+    }
+
+    return h;
+}
+
+
+//
+// Check that a hostname is printable and safe to store and pass to the
+// notify command
+//
+// NB: A trailing dot is removed.
+//
+// Returns 1 if the hostname is valid, or 0 if not
+//
+static int valid_name(
+    char *                      name)
+{
+    size_t                      len;
+    size_t                      i;
+
+    len = strlen(name);
+    if (len && name[len - 1] == '.')
+    {
+        name[--len] = '\0';
+    }
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_' && name[i] != '.')
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+//
+// Copy a hostname held as text
+//
+// Returns 1 if the hostname is valid, or 0 if not
+//
+static int text_name(
+    const unsigned char *       data,
+    unsigned int                len,
+    char *                      name)
+{
+    if (len >= HOSTNAME_LEN)
+    {
+        return 0;
+    }
+
+    memcpy(name, data, len);
+    name[len] = '\0';
+
+    return valid_name(name);
+}
+
+
+//
+// Decode a DNS name
+//
+// NB: Parameter name must be at least HOSTNAME_LEN characters. A name that
+//     runs to the end of the message is accepted, as the DHCP FQDN options
+//     may hold a partial name without a terminating label. The offset of
+//     the data following the name is returned in next.
+//
+// Returns 1 if the name is a valid hostname, 0 if it is not a hostname, or
+// -1 if the name is malformed
+//
+static int dns_name(
+    const unsigned char *       msg,
+    unsigned int                msg_len,
+    unsigned int                offset,
+    char *                      name,
+    unsigned int *              next)
+{
+    unsigned int                name_len = 0;
+    unsigned int                label_len;
+    unsigned int                pointers = 0;
+
+    *next = 0;
+    while (offset < msg_len)
+    {
+        label_len = msg[offset];
+
+        // End of the name
+        if (label_len == 0)
+        {
+            offset++;
+            break;
+        }
+
+        // Compression pointer
+        if ((label_len & 0xc0) == 0xc0)
+        {
+            if (offset + 1 >= msg_len || ++pointers > DNS_POINTERS_MAX)
+            {
+                return -1;
+            }
+            if (*next == 0)
+            {
+                *next = offset + 2;
+            }
+            offset = ((label_len & 0x3f) << 8) | msg[offset + 1];
+            continue;
+        }
+
+        // Reserved label types
+        if (label_len & 0xc0)
+        {
+            return -1;
+        }
+
+        offset++;
+        if (offset + label_len > msg_len || name_len + label_len + 1 >= HOSTNAME_LEN)
+        {
+            return -1;
+        }
+        if (name_len)
+        {
+            name[name_len++] = '.';
+        }
+        memcpy(name + name_len, msg + offset, label_len);
+        name_len += label_len;
+        offset += label_len;
+    }
+
+    if (*next == 0)
+    {
+        *next = offset;
+    }
+    name[name_len] = '\0';
+
+    return valid_name(name);
+}
+
+
+//
+// Learn the hostname of an ip address and hardware address
+//
+// NB: If addr is NULL, the hostname is learned for the hardware address
+//     only. If the writer queue is full, the hostname is learned again
+//     from a later packet.
+//
+static void learn_hostname(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr,
+    const char *                name,
+    const struct timeval *      timestamp)
+{
+    hostname_entry_t *          entry;
+    record_t                    record;
+    ip_addr_t                   key;
+    uint32_t                    name_hash;
+    uint32_t                    h;
+
+    memset(&key, 0, sizeof(key));
+    if (addr)
+    {
+        memcpy(&key, addr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+    }
+
+    if (shard->hostnames == NULL)
+    {
+        shard->hostnames = calloc(1, sizeof(hostnames_t));
+        if (shard->hostnames == NULL)
+        {
+            fatal("cannot allocate memory for hostname table\n");
+        }
+    }
+
+    // Has the hostname been written recently?
+    name_hash = hash_bytes(2166136261U, name, strlen(name));
+    h = hash_bytes(2166136261U, &key, sizeof(key));
+    h = hash_bytes(h, hwaddr, sizeof(*hwaddr));
+    h ^= h >> 16;
+    entry = &shard->hostnames->entries[h & (HOSTNAME_ENTRIES - 1)];
+    if (entry->iptype == iptype &&
+        entry->name_hash == name_hash &&
+        memcmp(&entry->addr, &key, sizeof(key)) == 0 &&
+        memcmp(&entry->hwaddr, hwaddr, sizeof(*hwaddr)) == 0 &&
+        timestamp->tv_sec - entry->time < HOSTNAME_UPDATE_INTERVAL)
+    {
+        return;
+    }
+
+    // Queue the hostname for the writer
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_HOSTNAME;
+    record.iface = shard->iface;
+    record.iptype = iptype;
+    record.addr = key;
+    record.hwaddr = *hwaddr;
+    record.timestamp = *timestamp;
+    record.hostname = strdup(name);
+    if (record.hostname == NULL)
+    {
+        fatal("cannot allocate memory for hostname\n");
+    }
+    if (writer_submit(shard->queue, &record) == 0)
+    {
+        free(record.hostname);
+        return;
+    }
+
+    entry->iptype = iptype;
+    entry->addr = key;
+    entry->hwaddr = *hwaddr;
+    entry->name_hash = name_hash;
+    entry->time = timestamp->tv_sec;
+    shard->learned++;
+}
+
+
+//
+// Process a DHCPv4 message from a client
+//
+// NB: The hostname is taken from the client FQDN option (81), or the
+//     hostname option (12). The address is the client address if the
+//     client has one, or the address requested. Only requests and informs
+//     are used, as the address in a discover has not yet been offered.
+//
+static void process_dhcp(
+    shard_t *                   shard,
+    const unsigned char *       msg,
+    unsigned int                msg_len,
+    const struct timeval *      timestamp)
+{
+    const unsigned char *       hostname_opt = NULL;
+    const unsigned char *       fqdn_opt = NULL;
+    const unsigned char *       requested_opt = NULL;
+    unsigned int                hostname_len = 0;
+    unsigned int                fqdn_len = 0;
+    unsigned int                msg_type = 0;
+    unsigned int                offset;
+    unsigned int                code;
+    unsigned int                len;
+    unsigned int                next;
+    uint32_t                    cookie;
+    struct in_addr              addr;
+    struct ether_addr           hwaddr;
+    char                        name[HOSTNAME_LEN];
+    int                         found = 0;
+
+    // Safety check: ensure the message is a request from an ethernet client
+    if (msg_len < DHCP_OFF_OPTIONS ||
+        msg[DHCP_OFF_OP] != DHCP_BOOTREQUEST ||
+        msg[DHCP_OFF_HTYPE] != DHCP_HTYPE_ETHER ||
+        msg[DHCP_OFF_HLEN] != sizeof(hwaddr))
+    {
+        return;
+    }
+    memcpy(&cookie, msg + DHCP_OFF_COOKIE, sizeof(cookie));
+    if (ntohl(cookie) != DHCP_COOKIE)
+    {
+        return;
+    }
+
+    // Find the options
+    offset = DHCP_OFF_OPTIONS;
+    while (offset < msg_len)
+    {
+        code = msg[offset++];
+        if (code == DHCP_OPT_PAD)
+        {
+            continue;
+        }
+        if (code == DHCP_OPT_END || offset >= msg_len)
+        {
+            break;
+        }
+        len = msg[offset++];
+        if (offset + len > msg_len)
+        {
+            break;
+        }
+
+        switch (code)
+        {
+        case DHCP_OPT_MSG_TYPE:
+            if (len == 1)
+            {
+                msg_type = msg[offset];
+            }
+            break;
+        case DHCP_OPT_HOSTNAME:
+            hostname_opt = msg + offset;
+            hostname_len = len;
+            break;
+        case DHCP_OPT_CLIENT_FQDN:
+            fqdn_opt = msg + offset;
+            fqdn_len = len;
+            break;
+        case DHCP_OPT_REQUESTED_IP:
+            if (len == sizeof(addr))
+            {
+                requested_opt = msg + offset;
+            }
+            break;
+        }
+        offset += len;
+    }
+
+    if (msg_type != DHCP_REQUEST && msg_type != DHCP_INFORM)
+    {
+        return;
+    }
+
+    // Get the hostname
+    // NB: The FQDN option holds flags and two obsolete rcode fields before
+    //     the name, which is in DNS format if the E flag is set
+    if (fqdn_opt && fqdn_len > 3)
+    {
+        if (fqdn_opt[0] & DHCP_FQDN_E)
+        {
+            found = (dns_name(fqdn_opt + 3, fqdn_len - 3, 0, name, &next) > 0);
+        }
+        else
+        {
+            found = text_name(fqdn_opt + 3, fqdn_len - 3, name);
+        }
+    }
+    if (found == 0 && hostname_opt)
+    {
+        found = text_name(hostname_opt, hostname_len, name);
+    }
+    if (found == 0)
+    {
+        return;
+    }
+
+    // Get the address
+    memcpy(&hwaddr, msg + DHCP_OFF_CHADDR, sizeof(hwaddr));
+    memcpy(&addr, msg + DHCP_OFF_CIADDR, sizeof(addr));
+    if (addr.s_addr == 0 && requested_opt)
+    {
+        memcpy(&addr, requested_opt, sizeof(addr));
+    }
+
+    learn_hostname(shard, DB_IPTYPE_4, addr.s_addr ? &addr : NULL, &hwaddr, name, timestamp);
+}
+
+
+//
+// Process a DHCPv6 message from a client
+//
+// NB: The hostname is taken from the client FQDN option (39), and the
+//     addresses from the IA_NA and IA_TA options. The client is identified
+//     by the ethernet source address. Only messages for addresses that the
+//     client has been offered or holds are used.
+//
+static void process_dhcp6(
+    shard_t *                   shard,
+    const struct ether_addr *   eth_src_addr,
+    const unsigned char *       msg,
+    unsigned int                msg_len,
+    const struct timeval *      timestamp)
+{
+    const unsigned char *       addrs[HOSTNAME_ADDRS_MAX];
+    unsigned int                addr_count = 0;
+    unsigned int                offset;
+    unsigned int                ia_offset;
+    unsigned int                ia_end;
+    unsigned int                code;
+    unsigned int                len;
+    unsigned int                next;
+    char                        name[HOSTNAME_LEN];
+    int                         found = 0;
+    unsigned int                i;
+
+    // Safety check: ensure the message is for addresses held or offered
+    if (msg_len < 4 ||
+        (msg[0] != DHCP6_REQUEST && msg[0] != DHCP6_CONFIRM && msg[0] != DHCP6_RENEW && msg[0] != DHCP6_REBIND))
+    {
+        return;
+    }
+
+    // Find the options
+    offset = 4;
+    while (offset + 4 <= msg_len)
+    {
+        code = (msg[offset] << 8) | msg[offset + 1];
+        len = (msg[offset + 2] << 8) | msg[offset + 3];
+        offset += 4;
+        if (offset + len > msg_len)
+        {
+            break;
+        }
+
+        if (code == DHCP6_OPT_CLIENT_FQDN && len > 1)
+        {
+            // NB: The name follows a flags field
+            found = (dns_name(msg + offset + 1, len - 1, 0, name, &next) > 0);
+        }
+        else if (code == DHCP6_OPT_IA_NA || code == DHCP6_OPT_IA_TA)
+        {
+            // NB: The options of an IA_NA follow the IAID, T1 and T2 fields,
+            //     and those of an IA_TA follow the IAID field
+            ia_offset = offset + ((code == DHCP6_OPT_IA_NA) ? 12 : 4);
+            ia_end = offset + len;
+            while (ia_offset + 4 <= ia_end)
+            {
+                code = (msg[ia_offset] << 8) | msg[ia_offset + 1];
+                len = (msg[ia_offset + 2] << 8) | msg[ia_offset + 3];
+                ia_offset += 4;
+                if (ia_offset + len > ia_end)
+                {
+                    break;
+                }
+                if (code == DHCP6_OPT_IAADDR && len >= sizeof(struct in6_addr) && addr_count < HOSTNAME_ADDRS_MAX)
+                {
+                    addrs[addr_count++] = msg + ia_offset;
+                }
+                ia_offset += len;
+            }
+            len = ia_end - offset;
+        }
+        offset += len;
+    }
+
+    if (found == 0)
+    {
+        return;
+    }
+
+    if (addr_count == 0)
+    {
+        learn_hostname(shard, DB_IPTYPE_6, NULL, eth_src_addr, name, timestamp);
+        return;
+    }
+    for (i = 0; i < addr_count; i++)
+    {
+        learn_hostname(shard, DB_IPTYPE_6, addrs[i], eth_src_addr, name, timestamp);
+    }
+}
+
+
+//
+// Process an mDNS response
+//
+// NB: The hostname of each address record (A or AAAA) in the response is
+//     learned for the address and the ethernet source address. Records
+//     with a zero TTL withdraw an address, and are ignored.
+//
+static void process_mdns(
+    shard_t *                   shard,
+    const struct ether_addr *   eth_src_addr,
+    const unsigned char *       msg,
+    unsigned int                msg_len,
+    const struct timeval *      timestamp)
+{
+    unsigned int                questions;
+    unsigned int                records;
+    unsigned int                learned = 0;
+    unsigned int                offset;
+    unsigned int                type;
+    unsigned int                class;
+    unsigned int                ttl;
+    unsigned int                len;
+    char                        name[HOSTNAME_LEN];
+    int                         valid;
+
+    // Safety check: ensure the message is a response
+    if (msg_len < DNS_HEADER_LEN || (((msg[2] << 8) | msg[3]) & DNS_FLAG_QR) == 0)
+    {
+        return;
+    }
+    questions = (msg[4] << 8) | msg[5];
+    records = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+
+    // Skip the questions
+    offset = DNS_HEADER_LEN;
+    while (questions--)
+    {
+        if (dns_name(msg, msg_len, offset, name, &offset) < 0)
+        {
+            return;
+        }
+        offset += 4;
+        if (offset > msg_len)
+        {
+            return;
+        }
+    }
+
+    // Process the records
+    while (records-- && learned < HOSTNAME_ADDRS_MAX)
+    {
+        valid = dns_name(msg, msg_len, offset, name, &offset);
+        if (valid < 0 || offset + 10 > msg_len)
+        {
+            return;
+        }
+        type = (msg[offset] << 8) | msg[offset + 1];
+        class = (msg[offset + 2] << 8) | msg[offset + 3];
+        ttl = ((unsigned int) msg[offset + 4] << 24) | (msg[offset + 5] << 16) | (msg[offset + 6] << 8) | msg[offset + 7];
+        len = (msg[offset + 8] << 8) | msg[offset + 9];
+        offset += 10;
+        if (offset + len > msg_len)
+        {
+            return;
+        }
+
+        if (valid > 0 && ttl && (class & DNS_CLASS_MASK) == DNS_CLASS_IN)
+        {
+            if (type == DNS_TYPE_A && len == sizeof(struct in_addr))
+            {
+                learn_hostname(shard, DB_IPTYPE_4, msg + offset, eth_src_addr, name, timestamp);
+                learned++;
+            }
+            else if (type == DNS_TYPE_AAAA && len == sizeof(struct in6_addr))
+            {
+                learn_hostname(shard, DB_IPTYPE_6, msg + offset, eth_src_addr, name, timestamp);
+                learned++;
+            }
+        }
+        offset += len;
+    }
+}
+
+
+//
+// Process a UDP packet carrying a hostname announcement
+//
+// NB: DHCPv4 and DHCPv6 messages from clients, and mDNS responses, are
+//     processed. Other packets, including fragments, and packets from a
+//     source that is being shed, are ignored.
+//
+// Returns 1 if the packet was UDP, or 0 if not
+//
+int hostname_packet(
+    shard_t *                   shard,
+    uint16_t                    eth_type,
+    const struct ether_addr *   eth_src_addr,
+    const unsigned char *       packet,
+    unsigned int                packet_len,
+    unsigned int                shed,
+    const struct timeval *      timestamp)
+{
+    const struct ip *           ip;
+    const struct ip6_hdr *      ip6;
+    const struct udphdr *       udp;
+    unsigned int                ip_len;
+    unsigned int                udp_len;
+    unsigned int                sport;
+    unsigned int                dport;
+
+    // Find the UDP header
+    if (eth_type == ETHERTYPE_IP)
+    {
+        ip = (const struct ip *) packet;
+        if (packet_len < sizeof(struct ip) || ip->ip_p != IPPROTO_UDP)
+        {
+            return 0;
+        }
+        ip_len = ip->ip_hl * 4;
+        if (ip_len < sizeof(struct ip) || packet_len < ip_len || (ntohs(ip->ip_off) & IP_OFFMASK))
+        {
+            return 1;
+        }
+    }
+    else if (eth_type == ETHERTYPE_IPV6)
+    {
+        ip6 = (const struct ip6_hdr *) packet;
+        if (packet_len < sizeof(struct ip6_hdr) || ip6->ip6_nxt != IPPROTO_UDP)
+        {
+            return 0;
+        }
+        ip_len = sizeof(struct ip6_hdr);
+    }
+    else
+    {
+        return 0;
+    }
+    if (shed)
+    {
+        return 1;
+    }
+    packet += ip_len;
+    packet_len -= ip_len;
+
+    // Parse the UDP header
+    if (packet_len < sizeof(struct udphdr))
+    {
+        return 1;
+    }
+    udp = (const struct udphdr *) packet;
+    sport = ntohs(udp->uh_sport);
+    dport = ntohs(udp->uh_dport);
+    udp_len = ntohs(udp->uh_ulen);
+    packet += sizeof(struct udphdr);
+    packet_len -= sizeof(struct udphdr);
+
+    // NB: The message is truncated to the length in the UDP header, and the
+    //     capture length
+    if (udp_len < sizeof(struct udphdr))
+    {
+        return 1;
+    }
+    if (udp_len - sizeof(struct udphdr) < packet_len)
+    {
+        packet_len = udp_len - sizeof(struct udphdr);
+    }
+
+    if (eth_type == ETHERTYPE_IP && dport == PORT_DHCP_SERVER)
+    {
+        process_dhcp(shard, packet, packet_len, timestamp);
+    }
+    else if (eth_type == ETHERTYPE_IPV6 && sport == PORT_DHCP6_CLIENT)
+    {
+        process_dhcp6(shard, eth_src_addr, packet, packet_len, timestamp);
+    }
+    else if (sport == PORT_MDNS)
+    {
+        process_mdns(shard, eth_src_addr, packet, packet_len, timestamp);
+    }
+
+    return 1;
+}
@@ -0,0 +1,478 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "andwatch.h"
+
+
+// Number of message classes tracked by each thread (must be a power of 2)
+#define LOG_CLASSES             (64)
+
+// Rate limit of each message class: a burst of up to LOG_BURST messages,
+// and then one message for each LOG_REFILL_INTERVAL seconds
+#define LOG_BURST               (10)
+#define LOG_REFILL_INTERVAL     (1)
+
+// Number of messages in the asynchronous log ring (must be a power of 2)
+#define LOG_RING_SIZE           (1024)
+
+// Maximum length of a message in the asynchronous log ring
+#define LOG_MESSAGE_MAX         (256)
+
+// Maximum time to wait for the log thread to empty the ring (milliseconds)
+#define LOG_DRAIN_TIMEOUT       (1000)
+
+
+//
+// Rate limit state of a message class
+//
+// NB: A message class is identified by its format string. Each thread has
+//     its own table, so no locks are needed. The table is direct mapped, and
+//     a colliding class replaces the previous occupant of the slot after
+//     reporting any messages it suppressed.
+//
+typedef struct log_class
+{
+    // Format string (NULL indicates an unused slot)
+    const char *                format;
+
+    // Tokens available, and the time they were last refilled
+    unsigned int                tokens;
+    time_t                      refill_time;
+
+    // Number of messages suppressed
+    unsigned long               suppressed;
+} log_class_t;
+
+static __thread log_class_t     log_classes[LOG_CLASSES];
+static __thread unsigned int    log_suppressing = 0;
+
+
+//
+// Asynchronous log ring
+//
+// NB: The ring is a bounded multiple producer / single consumer queue. Each
+//     slot has a sequence number: a producer claims a slot by advancing
+//     tail, writes the message, and then publishes the slot by setting its
+//     sequence. The log thread consumes slots in order, and returns each
+//     slot by setting its sequence for the next pass of the producers. The
+//     mutex and condition are only used to wake the log thread when it is
+//     waiting for an empty ring, so a producer takes no lock otherwise.
+//
+typedef struct log_slot
+{
+    unsigned long               sequence;
+    int                         priority;
+    char                        message[LOG_MESSAGE_MAX];
+} log_slot_t;
+
+static log_slot_t *             log_ring = NULL;
+
+__attribute__ ((aligned (64)))
+static unsigned long            log_head = 0;
+
+__attribute__ ((aligned (64)))
+static unsigned long            log_tail = 0;
+static unsigned long            log_dropped = 0;
+
+static pthread_t                log_thread;
+static pthread_mutex_t          log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           log_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int             log_waiting = 0;
+
+
+
+//
+// Get the current time in seconds for rate limiting
+//
+static time_t log_time(void)
+{
+    struct timespec             now;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+
+//
+// Report the messages suppressed for a message class
+//
+static void log_report_suppressed(
+    log_class_t *               class)
+{
+    size_t                      len;
+
+    if (class->suppressed == 0)
+    {
+        return;
+    }
+
+    // NB: The format string identifies the message, without its arguments
+    len = strlen(class->format);
+    if (len && class->format[len - 1] == '\n')
+    {
+        len--;
+    }
+    logger("%lu messages suppressed: %.*s\n", class->suppressed, (int) len, class->format);
+
+    class->suppressed = 0;
+    log_suppressing--;
+}
+
+
+//
+// Refill the tokens of a message class
+//
+static void log_refill(
+    log_class_t *               class,
+    time_t                      now)
+{
+    time_t                      tokens;
+
+    if (now <= class->refill_time)
+    {
+        return;
+    }
+
+    tokens = (now - class->refill_time) / LOG_REFILL_INTERVAL;
+    if (tokens)
+    {
+        class->tokens = (class->tokens + tokens > LOG_BURST) ? LOG_BURST : class->tokens + (unsigned int) tokens;
+        class->refill_time += tokens * LOG_REFILL_INTERVAL;
+    }
+}
+
+
+//
+// Log for abnormal events caused by packets, rate limited by message
+//
+// NB: Each message (format string) has its own token bucket. Messages beyond
+//     the limit are counted, and the count is reported before the next
+//     message that passes, or by logger_summary.
+//
+__attribute__ ((format (printf, 1, 2)))
+void logger_limited(
+    const char *                format,
+    ...)
+{
+    log_class_t *               class;
+    uintptr_t                   h = (uintptr_t) format;
+    time_t                      now = log_time();
+    va_list                     args;
+
+    class = &log_classes[(h ^ (h >> 7) ^ (h >> 13)) & (LOG_CLASSES - 1)];
+    if (class->format != format)
+    {
+        if (class->format)
+        {
+            log_report_suppressed(class);
+        }
+        class->format = format;
+        class->tokens = LOG_BURST;
+        class->refill_time = now;
+        class->suppressed = 0;
+    }
+
+    log_refill(class, now);
+    if (class->tokens == 0)
+    {
+        if (class->suppressed++ == 0)
+        {
+            log_suppressing++;
+        }
+        return;
+    }
+    class->tokens--;
+
+    log_report_suppressed(class);
+
+    va_start(args, format);
+    vlogger(format, args);
+    va_end(args);
+}
+
+
+//
+// Report messages suppressed by rate limiting on the calling thread
+//
+// NB: Called periodically by each capture worker, so that the count of
+//     suppressed messages is reported once the messages stop.
+//
+void logger_summary(void)
+{
+    log_class_t *               class;
+    time_t                      now;
+    unsigned int                i;
+
+    if (log_suppressing == 0)
+    {
+        return;
+    }
+
+    now = log_time();
+    for (i = 0; i < LOG_CLASSES && log_suppressing; i++)
+    {
+        class = &log_classes[i];
+        if (class->suppressed)
+        {
+            log_refill(class, now);
+            if (class->tokens)
+            {
+                class->tokens--;
+                log_report_suppressed(class);
+            }
+        }
+    }
+}
+
+
+//
+// Write a log message
+//
+static void log_write(
+    int                         priority,
+    const char *                message)
+{
+    if (flag_syslog)
+    {
+        syslog(priority, "%s", message);
+    }
+    else
+    {
+        (void) fputs(message, stderr);
+    }
+}
+
+
+//
+// Wait for the log thread to empty the ring
+//
+static void log_drain(void)
+{
+    struct timespec             delay = { 0, 1000000 };
+    unsigned int                i;
+
+    if (log_ring == NULL || pthread_equal(pthread_self(), log_thread))
+    {
+        return;
+    }
+
+    for (i = 0; i < LOG_DRAIN_TIMEOUT; i++)
+    {
+        if (__atomic_load_n(&log_head, __ATOMIC_ACQUIRE) == __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        (void) nanosleep(&delay, NULL);
+    }
+}
+
+
+//
+// Queue a log message for the log thread
+//
+// NB: The message is formatted by the caller, as the arguments may refer
+//     to memory of the caller. Fatal errors are written directly, once the
+//     messages queued before them have been written. If the ring is full,
+//     the message is dropped and counted.
+//
+__attribute__ ((format (printf, 2, 0)))
+static void log_queue(
+    int                         priority,
+    const char *                format,
+    va_list                     args)
+{
+    log_slot_t *                slot;
+    char                        message[LOG_MESSAGE_MAX];
+    unsigned long               tail;
+    unsigned long               sequence;
+    long                        diff;
+
+    if (priority == LOG_ERR)
+    {
+        (void) vsnprintf(message, sizeof(message), format, args);
+        log_drain();
+        log_write(priority, message);
+        return;
+    }
+
+    // Claim a slot
+    tail = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+    while (1)
+    {
+        slot = &log_ring[tail & (LOG_RING_SIZE - 1)];
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        diff = (long) (sequence - tail);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&log_tail, &tail, tail + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            tail = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Format the message and publish the slot
+    // NB: The slot is published, and log_waiting then read, sequentially
+    //     consistently. The log thread sets log_waiting and then checks the
+    //     ring in the same way, so either the log thread finds the message,
+    //     or the producer finds the log thread waiting.
+    slot->priority = priority;
+    (void) vsnprintf(slot->message, sizeof(slot->message), format, args);
+    __atomic_store_n(&slot->sequence, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&log_waiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&log_mutex);
+        pthread_cond_signal(&log_cond);
+        pthread_mutex_unlock(&log_mutex);
+    }
+}
+
+
+//
+// Log thread
+//
+static void * log_main(
+    __attribute__ ((unused))
+    void *                      arg)
+{
+    log_slot_t *                slot;
+    unsigned long               head;
+    unsigned long               dropped;
+    char                        message[LOG_MESSAGE_MAX];
+
+    while (1)
+    {
+        // Wait for messages
+        head = log_head;
+        pthread_mutex_lock(&log_mutex);
+        __atomic_store_n(&log_waiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&log_ring[head & (LOG_RING_SIZE - 1)].sequence, __ATOMIC_SEQ_CST) != head + 1)
+        {
+            pthread_cond_wait(&log_cond, &log_mutex);
+        }
+        __atomic_store_n(&log_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&log_mutex);
+
+        // Write the messages
+        while (1)
+        {
+            slot = &log_ring[head & (LOG_RING_SIZE - 1)];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != head + 1)
+            {
+                break;
+            }
+
+            log_write(slot->priority, slot->message);
+            __atomic_store_n(&slot->sequence, head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+            head++;
+            __atomic_store_n(&log_head, head, __ATOMIC_RELEASE);
+        }
+
+        // Report messages dropped because the ring was full
+        dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+        if (dropped)
+        {
+            (void) snprintf(message, sizeof(message), "%lu log messages dropped\n", dropped);
+            log_write(LOG_WARNING, message);
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// Write log messages directly in a child process
+//
+// NB: The log thread does not exist in a child, and the mutex may have been
+//     held by another thread at the fork.
+//
+static void log_atfork_child(void)
+{
+    logger_output = NULL;
+}
+
+
+//
+// Start the asynchronous log thread
+//
+// NB: Once started, log messages are formatted by the calling thread, and
+//     written by the log thread. Messages queued at exit are written before
+//     the process exits.
+//
+void logger_start(void)
+{
+    sigset_t                    sigset;
+    sigset_t                    old_sigset;
+    unsigned long               i;
+    int                         r;
+
+    log_ring = calloc(LOG_RING_SIZE, sizeof(log_slot_t));
+    if (log_ring == NULL)
+    {
+        fatal("cannot allocate memory for log ring\n");
+    }
+    for (i = 0; i < LOG_RING_SIZE; i++)
+    {
+        log_ring[i].sequence = i;
+    }
+
+    (void) sigfillset(&sigset);
+    (void) pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+    r = pthread_create(&log_thread, NULL, log_main, NULL);
+    (void) pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+    if (r != 0)
+    {
+        fatal("cannot create log thread: %s\n", strerror(r));
+    }
+
+    logger_output = log_queue;
+    (void) atexit(log_drain);
+    (void) pthread_atfork(NULL, NULL, log_atfork_child);
+}
@@ -0,0 +1,431 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "andwatch.h"
+
+
+#if defined(__linux__)
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+
+// Size of the receive buffer for netlink messages
+#define NEIGH_BUFFER_SIZE       (65536)
+
+// Size of the socket receive buffer
+#define NEIGH_RCVBUF_SIZE       (1048576)
+
+// Neighbor states that carry a valid hardware address
+#define NEIGH_NUD_VALID         (NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | NUD_PERMANENT)
+
+
+//
+// Kernel neighbor table source
+//
+// NB: The kernel neighbor table holds the hardware address of every host the
+//     system exchanges traffic with. Changes to the table are received as
+//     RTM_NEWNEIGH messages from the RTNLGRP_NEIGH multicast group, and the
+//     table is seeded from a dump when the source is started.
+//
+struct neigh
+{
+    // Netlink socket
+    int                         fd;
+
+    // Interface index
+    int                         ifindex;
+
+    // Sequence number of the last dump request
+    unsigned int                seq;
+
+    // Receive buffer
+    unsigned char *             buffer;
+};
+
+
+
+//
+// Allocate a kernel neighbor table source for an interface
+//
+static neigh_t * neigh_create(
+    const char *                interface)
+{
+    neigh_t *                   neigh;
+
+    neigh = calloc(1, sizeof(neigh_t));
+    if (neigh == NULL)
+    {
+        fatal("cannot allocate memory for neighbor source\n");
+    }
+    neigh->buffer = malloc(NEIGH_BUFFER_SIZE);
+    if (neigh->buffer == NULL)
+    {
+        fatal("cannot allocate memory for neighbor buffer\n");
+    }
+
+    // Look up the interface
+    neigh->ifindex = (int) if_nametoindex(interface);
+    if (neigh->ifindex == 0)
+    {
+        fatal("interface %s not found: %s\n", interface, strerror(errno));
+    }
+
+    return neigh;
+}
+
+
+//
+// Open a kernel neighbor table source for an interface
+//
+neigh_t * neigh_open(
+    const char *                interface)
+{
+    neigh_t *                   neigh;
+    struct sockaddr_nl          snl;
+    int                         rcvbuf = NEIGH_RCVBUF_SIZE;
+    int                         r;
+
+    neigh = neigh_create(interface);
+
+    // Create the netlink socket
+    neigh->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (neigh->fd == -1)
+    {
+        fatal("netlink socket for interface %s failed: %s\n", interface, strerror(errno));
+    }
+
+    // Increase the receive buffer to absorb bursts of changes
+    r = setsockopt(neigh->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (r == -1)
+    {
+        logger("setsockopt SO_RCVBUF for netlink failed: %s\n", strerror(errno));
+    }
+
+    // Subscribe to neighbor table changes
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = 1 << (RTNLGRP_NEIGH - 1);
+    r = bind(neigh->fd, (struct sockaddr *) &snl, sizeof(snl));
+    if (r == -1)
+    {
+        fatal("bind of netlink socket failed: %s\n", strerror(errno));
+    }
+
+    return neigh;
+}
+
+
+//
+// Adopt a kernel neighbor table source handed over by a predecessor
+//
+// NB: The socket is already subscribed to neighbor table changes, and the
+//     changes made while it is handed over are queued in the socket.
+//
+neigh_t * neigh_adopt(
+    const char *                interface,
+    int                         fd)
+{
+    neigh_t *                   neigh;
+
+    neigh = neigh_create(interface);
+    neigh->fd = fd;
+
+    return neigh;
+}
+
+
+//
+// Request a dump of the neighbor table
+//
+// NB: The dump is received through neigh_dispatch along with the changes.
+//     If a dump is already in progress, the request is not needed.
+//
+static void neigh_request_dump(
+    neigh_t *                   neigh)
+{
+    struct
+    {
+        struct nlmsghdr         nlh;
+        struct ndmsg            ndm;
+    }                           req;
+    struct sockaddr_nl          snl;
+    ssize_t                     rs;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+    req.nlh.nlmsg_type = RTM_GETNEIGH;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = ++neigh->seq;
+    req.ndm.ndm_family = AF_UNSPEC;
+    req.ndm.ndm_ifindex = neigh->ifindex;
+
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+
+    rs = sendto(neigh->fd, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *) &snl, sizeof(snl));
+    if (rs == -1 && errno != EBUSY)
+    {
+        fatal("netlink neighbor dump request failed: %s\n", strerror(errno));
+    }
+}
+
+
+//
+// Start the kernel neighbor table source
+//
+void neigh_start(
+    neigh_t *                   neigh)
+{
+    neigh_request_dump(neigh);
+}
+
+
+//
+// Get the selectable file descriptor for a kernel neighbor table source
+//
+int neigh_get_fd(
+    neigh_t *                   neigh)
+{
+    return neigh->fd;
+}
+
+
+//
+// Process a neighbor message
+//
+static void neigh_process(
+    neigh_t *                   neigh,
+    const struct nlmsghdr *     nlh,
+    shard_t *                   shard,
+    const struct timeval *      timestamp)
+{
+    const struct ndmsg *        ndm;
+    const struct rtattr *       rta;
+    int                         rta_len;
+    const void *                dst = NULL;
+    const void *                lladdr = NULL;
+    db_iptype                   iptype;
+    size_t                      addr_len;
+
+    // Safety check: ensure message length is sufficient
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ndmsg)))
+    {
+        logger_limited("received netlink neighbor message with length too short (%u)\n", nlh->nlmsg_len);
+        return;
+    }
+    ndm = NLMSG_DATA(nlh);
+
+    // Only entries for the interface
+    if (ndm->ndm_ifindex != neigh->ifindex)
+    {
+        return;
+    }
+
+    // Only entries with a valid hardware address
+    // NB: Entries for multicast and broadcast addresses are NUD_NOARP
+    if ((ndm->ndm_state & NEIGH_NUD_VALID) == 0)
+    {
+        return;
+    }
+
+    if (ndm->ndm_family == AF_INET)
+    {
+        iptype = DB_IPTYPE_4;
+        addr_len = sizeof(struct in_addr);
+    }
+    else if (ndm->ndm_family == AF_INET6)
+    {
+        iptype = DB_IPTYPE_6;
+        addr_len = sizeof(struct in6_addr);
+    }
+    else
+    {
+        return;
+    }
+
+    // Find the address attributes
+    rta = (const struct rtattr *) ((const unsigned char *) ndm + NLMSG_ALIGN(sizeof(struct ndmsg)));
+    rta_len = (int) (nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ndmsg)));
+    for (; RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len))
+    {
+        if (rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == addr_len)
+        {
+            dst = RTA_DATA(rta);
+        }
+        else if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == sizeof(struct ether_addr))
+        {
+            lladdr = RTA_DATA(rta);
+        }
+    }
+
+    if (dst == NULL || lladdr == NULL)
+    {
+        return;
+    }
+
+    packet_neighbor(shard, iptype, dst, lladdr, timestamp);
+}
+
+
+//
+// Process the messages ready on a kernel neighbor table source
+//
+// NB: Deletion of an entry (RTM_DELNEIGH) only means that the kernel no longer
+//     needs the address, not that the mapping has changed, so deletions are
+//     ignored. If the socket overflows, changes have been lost and the table
+//     is dumped again.
+//
+// Returns the number of messages processed
+//
+int neigh_dispatch(
+    neigh_t *                   neigh,
+    shard_t *                   shard)
+{
+    const struct nlmsghdr *     nlh;
+    const struct nlmsgerr *     err;
+    struct timeval              timestamp;
+    ssize_t                     len;
+    int                         count = 0;
+
+    while (1)
+    {
+        len = recv(neigh->fd, neigh->buffer, NEIGH_BUFFER_SIZE, 0);
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                break;
+            }
+            if (errno == ENOBUFS)
+            {
+                logger("netlink neighbor socket for %s overflowed, reloading neighbor table\n", shard->iface->name);
+                neigh_request_dump(neigh);
+                continue;
+            }
+            fatal("recv from netlink socket failed: %s\n", strerror(errno));
+        }
+
+        (void) gettimeofday(&timestamp, NULL);
+
+        for (nlh = (const struct nlmsghdr *) neigh->buffer; NLMSG_OK(nlh, (unsigned int) len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == RTM_NEWNEIGH)
+            {
+                neigh_process(neigh, nlh, shard, &timestamp);
+                count++;
+            }
+            else if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                err = NLMSG_DATA(nlh);
+                if (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr)) && err->error)
+                {
+                    logger("netlink neighbor request failed: %s\n", strerror(-err->error));
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+
+#else
+
+
+//
+// Open a kernel neighbor table source for an interface
+//
+neigh_t * neigh_open(
+    __attribute__ ((unused))
+    const char *                interface)
+{
+    fatal("neighbor table monitoring is not supported on this platform\n");
+}
+
+
+//
+// Adopt a kernel neighbor table source handed over by a predecessor
+//
+neigh_t * neigh_adopt(
+    __attribute__ ((unused))
+    const char *                interface,
+    __attribute__ ((unused))
+    int                         fd)
+{
+    fatal("neighbor table monitoring is not supported on this platform\n");
+}
+
+
+//
+// Start the kernel neighbor table source
+//
+void neigh_start(
+    __attribute__ ((unused))
+    neigh_t *                   neigh)
+{
+    fatal("neighbor table monitoring is not supported on this platform\n");
+}
+
+
+//
+// Get the selectable file descriptor for a kernel neighbor table source
+//
+int neigh_get_fd(
+    __attribute__ ((unused))
+    neigh_t *                   neigh)
+{
+    fatal("neighbor table monitoring is not supported on this platform\n");
+}
+
+
+//
+// Process the messages ready on a kernel neighbor table source
+//
+int neigh_dispatch(
+    __attribute__ ((unused))
+    neigh_t *                   neigh,
+    __attribute__ ((unused))
+    shard_t *                   shard)
+{
+    fatal("neighbor table monitoring is not supported on this platform\n");
+}
+
+
+#endif
@@ -33,92 +33,318 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
 
 #include "andwatch.h"
 
 
+extern char **                 environ;
+
+
+// Maximum number of notifications waiting to be run
+#define NOTIFY_QUEUE_MAX        (1024)
+
+// Time (seconds) allowed for a hostname to be registered in DNS before the
+// address is resolved
+#define NOTIFY_DNS_DELAY        (1)
+
+// Maximum time (seconds) to wait at exit for waiting notifications to be run
+#define NOTIFY_DRAIN_TIMEOUT    (10)
+
+// Maximum length of an interface name in a notification
+#define NOTIFY_NAME_MAX         (64)
+
+
 // External notify command
 const char *                    notify_cmd = NULL;
 
+// Notifications enabled
+unsigned int                    notify_enabled = 1;
+
+// MA database used for organization lookups (shared by all interfaces)
+sqlite3 *                       ma_db = NULL;
+
+
+//
+// Notification waiting to be run
+//
+// NB: Everything but the hostname is formatted by the writer thread. The
+//     hostname is resolved, and the command started, by the notify thread,
+//     so that neither a DNS lookup nor the delay before it blocks the
+//     writer. The command is started with posix_spawn rather than fork, as
+//     nothing but exec is safe in the child of a multithreaded process.
+//
+typedef struct notification
+{
+    struct notification *       next;
+
+    // Time (monotonic) at which the hostname is resolved
+    time_t                      resolve_time;
+
+    // Address to resolve if no hostname has been learned
+    int                         af_type;
+    ip_addr_t                   addr;
+    int                         resolve;
+
+    // Arguments of the command
+    char                        timestamp[71];
+    char                        ifname[NOTIFY_NAME_MAX];
+    char                        hostname[HOSTNAME_LEN];
+    char                        ipaddr[INET6_ADDRSTRLEN];
+    char                        new_hwaddr[ETH_ADDRSTRLEN];
+    char                        new_hwaddr_org[MA_ORG_NAME_LIMIT];
+    char                        old_hwaddr[ETH_ADDRSTRLEN];
+    char                        old_hwaddr_org[MA_ORG_NAME_LIMIT];
+} notification_t;
+
+// Notifications waiting to be run, and the number waiting or running
+static pthread_mutex_t          notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           notify_cond = PTHREAD_COND_INITIALIZER;
+static notification_t *         notify_head = NULL;
+static notification_t *         notify_tail = NULL;
+static unsigned int             notify_pending = 0;
+
+// Notify thread
+static pthread_once_t           notify_once = PTHREAD_ONCE_INIT;
+static pthread_t                notify_thread;
+
+
+
+//
+// Run the notify command
+//
+static void notify_run(
+    notification_t *            notification)
+{
+    posix_spawnattr_t           attr;
+    sigset_t                    sigset;
+    pid_t                       pid;
+    const char *                argv[10];
+    int                         r;
+
+    // Get the hostname
+    if (notification->resolve)
+    {
+        reverse_naddr(notification->af_type, &notification->addr, notification->hostname, sizeof(notification->hostname));
+    }
+
+    // Build the argv array
+    argv[0] = notify_cmd;
+    argv[1] = notification->timestamp;
+    argv[2] = notification->ifname;
+    argv[3] = notification->hostname;
+    argv[4] = notification->ipaddr;
+    argv[5] = notification->new_hwaddr;
+    argv[6] = notification->new_hwaddr_org;
+    argv[7] = notification->old_hwaddr;
+    argv[8] = notification->old_hwaddr_org;
+    argv[9] = NULL;
+
+    // The command starts with no signals blocked, and default signal handling
+    (void) posix_spawnattr_init(&attr);
+    (void) sigemptyset(&sigset);
+    (void) posix_spawnattr_setsigmask(&attr, &sigset);
+    (void) sigfillset(&sigset);
+    (void) posix_spawnattr_setsigdefault(&attr, &sigset);
+    (void) posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // Execute the command
+    // NB: Children are reaped automatically, as SIGCHLD is ignored
+    r = posix_spawn(&pid, notify_cmd, NULL, &attr, (char * const *) argv, environ);
+    if (r != 0)
+    {
+        logger("notify command %s failed: %s\n", notify_cmd, strerror(r));
+    }
+    (void) posix_spawnattr_destroy(&attr);
+}
+
+
+//
+// Notify thread
+//
+static void * notify_main(
+    __attribute__ ((unused))
+    void *                      arg)
+{
+    notification_t *            notification;
+    struct timespec             now;
+
+    while (1)
+    {
+        // Wait for a notification
+        pthread_mutex_lock(&notify_mutex);
+        while (notify_head == NULL)
+        {
+            pthread_cond_wait(&notify_cond, &notify_mutex);
+        }
+        notification = notify_head;
+        notify_head = notification->next;
+        if (notify_head == NULL)
+        {
+            notify_tail = NULL;
+        }
+        pthread_mutex_unlock(&notify_mutex);
+
+        // Allow time for the hostname to be registered in DNS
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        if (notification->resolve && now.tv_sec < notification->resolve_time)
+        {
+            sleep((unsigned int) (notification->resolve_time - now.tv_sec));
+        }
+
+        notify_run(notification);
+        free(notification);
+
+        pthread_mutex_lock(&notify_mutex);
+        notify_pending--;
+        pthread_cond_broadcast(&notify_cond);
+        pthread_mutex_unlock(&notify_mutex);
+    }
+
+    return NULL;
+}
+
+
+//
+// Wait for the waiting notifications to be run
+//
+// NB: Called at exit. The wait is limited, as a DNS lookup may hang.
+//
+static void notify_drain(void)
+{
+    struct timespec             deadline;
+
+    (void) clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += NOTIFY_DRAIN_TIMEOUT;
+
+    pthread_mutex_lock(&notify_mutex);
+    while (notify_pending)
+    {
+        if (pthread_cond_timedwait(&notify_cond, &notify_mutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&notify_mutex);
+}
+
+
+//
+// Start the notify thread
+//
+static void notify_start(void)
+{
+    sigset_t                    sigset;
+    sigset_t                    old_sigset;
+    int                         r;
+
+    (void) sigfillset(&sigset);
+    (void) pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+    r = pthread_create(&notify_thread, NULL, notify_main, NULL);
+    (void) pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+    if (r != 0)
+    {
+        fatal("cannot create notify thread: %s\n", strerror(r));
+    }
+
+    (void) atexit(notify_drain);
+}
+
 
 //
 // Change notifications
 //
 void change_notification(
-    sqlite3 *                   db,
+    const char *                ifname,
     const struct timeval *      timeval,
     int                         af_type,
     const void *                addr,
+    const char *                learned_hostname,
     const char *                ipaddr,
     const char *                new_hwaddr,
     const char *                old_hwaddr)
 {
-    struct tm *                 tm;
-    pid_t                       pid;
-    char                        new_hwaddr_org[MA_ORG_NAME_LIMIT] = "(none)";
-    char                        old_hwaddr_org[MA_ORG_NAME_LIMIT] = "(none)";
-    const char *                argv[10];
-    char                        timestamp[71];
-    char                        hostname[HOSTNAME_LEN];
+    notification_t *            notification;
+    struct tm                   tm;
+    struct timespec             now;
 
     // Log the change
-    logger("IP address %s changed from %s to %s\n", ipaddr, old_hwaddr, new_hwaddr);
+    logger("IP address %s on %s changed from %s to %s\n", ipaddr, ifname, old_hwaddr, new_hwaddr);
+
+    // If the notify command is not set, or notifications are disabled, return
+    if (notify_cmd == NULL || notify_enabled == 0)
+    {
+        return;
+    }
 
-    // If the notify command is not set, return
-    if (notify_cmd == NULL)
+    notification = calloc(1, sizeof(notification_t));
+    if (notification == NULL)
     {
+        logger("cannot allocate memory for notification\n");
         return;
     }
 
     // Format the timestamp
-    tm = localtime(&timeval->tv_sec);
-    snprintf(timestamp, sizeof(timestamp), "%04d-%02d-%02d %02d:%02d:%02d",
-        tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-        tm->tm_hour, tm->tm_min, tm->tm_sec);
+    (void) localtime_r(&timeval->tv_sec, &tm);
+    snprintf(notification->timestamp, sizeof(notification->timestamp), "%04d-%02d-%02d %02d:%02d:%02d",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+        tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+    safe_strncpy(notification->ifname, ifname, sizeof(notification->ifname));
+    safe_strncpy(notification->ipaddr, ipaddr, sizeof(notification->ipaddr));
+    safe_strncpy(notification->new_hwaddr, new_hwaddr, sizeof(notification->new_hwaddr));
+    safe_strncpy(notification->old_hwaddr, old_hwaddr, sizeof(notification->old_hwaddr));
 
     // Get the hardware orgs
+    safe_strncpy(notification->new_hwaddr_org, "(none)", sizeof(notification->new_hwaddr_org));
+    safe_strncpy(notification->old_hwaddr_org, "(none)", sizeof(notification->old_hwaddr_org));
     if (new_hwaddr[0] != '(')
     {
-        db_query_ma(db, new_hwaddr, new_hwaddr_org);
+        db_query_ma(ma_db, new_hwaddr, notification->new_hwaddr_org);
     }
     if (old_hwaddr[0] != '(')
     {
-        db_query_ma(db, old_hwaddr, old_hwaddr_org);
+        db_query_ma(ma_db, old_hwaddr, notification->old_hwaddr_org);
     }
 
-    // Fork a child process
-    pid = fork();
-    if (pid)
+    // Get the hostname
+    // NB: If no hostname has been learned, the address is resolved after a
+    //     pause in case the hostname is still being registered in DNS
+    if (learned_hostname)
     {
-        if (pid == -1)
-        {
-            logger("fork failed: %s\n", strerror(errno));
-        }
-        return;
+        safe_strncpy(notification->hostname, learned_hostname, sizeof(notification->hostname));
+    }
+    else
+    {
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        notification->resolve_time = now.tv_sec + NOTIFY_DNS_DELAY;
+        notification->af_type = af_type;
+        memcpy(&notification->addr, addr, (af_type == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+        notification->resolve = 1;
     }
 
-    // Pause for a second in case the hostname is still being registered
-    sleep(1);
-
-    // Get the hostname
-    reverse_naddr(af_type, addr, hostname, sizeof(hostname));
-
-    // Build the argv array
-    argv[0] = notify_cmd;
-    argv[1] = timestamp;
-    argv[2] = ifname;
-    argv[3] = hostname;
-    argv[4] = ipaddr;
-    argv[5] = new_hwaddr;
-    argv[6] = new_hwaddr_org;
-    argv[7] = old_hwaddr;
-    argv[8] = old_hwaddr_org;
-    argv[9] = NULL;
-
-    // Execute the command
-    execv(notify_cmd, (char * const *) argv);
-
-    // Error
-    logger("execv failed: %s\n", strerror(errno));
-    _exit(EXIT_FAILURE);
+    // Queue the notification for the notify thread
+    (void) pthread_once(&notify_once, notify_start);
+    pthread_mutex_lock(&notify_mutex);
+    if (notify_pending >= NOTIFY_QUEUE_MAX)
+    {
+        pthread_mutex_unlock(&notify_mutex);
+        logger_limited("notification for %s on %s dropped: too many notifications waiting\n", ipaddr, ifname);
+        free(notification);
+        return;
+    }
+    if (notify_tail)
+    {
+        notify_tail->next = notification;
+    }
+    else
+    {
+        notify_head = notification;
+    }
+    notify_tail = notification;
+    notify_pending++;
+    pthread_cond_broadcast(&notify_cond);
+    pthread_mutex_unlock(&notify_mutex);
 }
@@ -0,0 +1,212 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "andwatch.h"
+
+
+// Number of slots in the observation table (must be a power of 2)
+#define OBSERVE_SLOTS           (256)
+
+// Window in which repeated observations are collapsed (seconds)
+//
+// NB: An RFC 5227 host sends its probes and announcements at intervals of
+//     one to two seconds, and IPv6 DAD completes within a second or two.
+#define OBSERVE_WINDOW          (5)
+
+
+// Observation state of an ip address
+typedef enum observe_state
+{
+    OBSERVE_STATE_NONE = 0,
+    OBSERVE_STATE_PROBING,
+    OBSERVE_STATE_CLAIMED
+} observe_state;
+
+
+// Observation of an ip address
+typedef struct observe_slot
+{
+    // IP address type and address
+    db_iptype                   iptype;
+    ip_addr_t                   addr;
+
+    // State and the hardware address that caused it
+    observe_state               state;
+    struct ether_addr           hwaddr;
+
+    // Time the state was entered
+    time_t                      time;
+} observe_slot_t;
+
+
+//
+// Recent observations of ip addresses
+//
+// NB: The table is direct mapped. A colliding address replaces the previous
+//     occupant of the slot, which only costs a collapse that could otherwise
+//     have been made.
+//
+struct observe
+{
+    observe_slot_t              slots[OBSERVE_SLOTS];
+};
+
+
+
+//
+// Find the slot for an ip address
+//
+static observe_slot_t * observe_slot(
+    observe_t *                 observe,
+    db_iptype                   iptype,
+    const ip_addr_t *           key)
+{
+    uint32_t                    h = (uint32_t) iptype;
+    uint32_t                    w;
+    unsigned int                i;
+
+    // Combine and mix (FNV-1a over the words of the address)
+    for (i = 0; i < sizeof(*key); i += sizeof(w))
+    {
+        memcpy(&w, (const unsigned char *) key + i, sizeof(w));
+        h = (h ^ w) * 16777619U;
+    }
+    h ^= h >> 16;
+
+    return &observe->slots[h & (OBSERVE_SLOTS - 1)];
+}
+
+
+//
+// Create an observation table
+//
+observe_t * observe_create(void)
+{
+    observe_t *                 observe;
+
+    observe = calloc(1, sizeof(observe_t));
+    if (observe == NULL)
+    {
+        fatal("cannot allocate memory for observation table\n");
+    }
+
+    return observe;
+}
+
+
+//
+// Observe a packet for an ip address
+//
+// Probes and DAD solicitations make the address tentative for the hardware
+// address. Any other packet is a claim (or use) of the address. A repeat of
+// the current state by the same hardware address within the window is
+// collapsed. A claim by a different hardware address while a probe is in
+// progress is a defense of the address, and the hardware address of the
+// prober is returned in other.
+//
+observe_result observe_packet(
+    observe_t *                 observe,
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr,
+    observe_class               class,
+    time_t                      time,
+    struct ether_addr *         other)
+{
+    observe_slot_t *            slot;
+    ip_addr_t                   key;
+    observe_state               state;
+    int                         current;
+    int                         same_hwaddr;
+
+    memset(&key, 0, sizeof(key));
+    memcpy(&key, addr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+
+    slot = observe_slot(observe, iptype, &key);
+    current = slot->state != OBSERVE_STATE_NONE && slot->iptype == iptype &&
+              memcmp(&slot->addr, &key, sizeof(key)) == 0 &&
+              time >= slot->time && time - slot->time < OBSERVE_WINDOW;
+    same_hwaddr = memcmp(&slot->hwaddr, hwaddr, sizeof(slot->hwaddr)) == 0;
+
+    state = (class == OBSERVE_PROBE || class == OBSERVE_DAD) ? OBSERVE_STATE_PROBING : OBSERVE_STATE_CLAIMED;
+
+    // Repeat of the current state?
+    if (current && slot->state == state && same_hwaddr)
+    {
+        return OBSERVE_COLLAPSE;
+    }
+
+    // Defense against a probe?
+    if (current && slot->state == OBSERVE_STATE_PROBING && state == OBSERVE_STATE_CLAIMED && same_hwaddr == 0)
+    {
+        *other = slot->hwaddr;
+        slot->state = state;
+        slot->hwaddr = *hwaddr;
+        slot->time = time;
+        return OBSERVE_DEFEND;
+    }
+
+    slot->iptype = iptype;
+    slot->addr = key;
+    slot->state = state;
+    slot->hwaddr = *hwaddr;
+    slot->time = time;
+
+    return (state == OBSERVE_STATE_PROBING) ? OBSERVE_TENTATIVE : OBSERVE_UPDATE;
+}
+
+
+//
+// Forget the observation of an ip address
+//
+// NB: Used when an observation could not be processed, so that the next
+//     packet for the address is not collapsed.
+//
+void observe_forget(
+    observe_t *                 observe,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    observe_slot_t *            slot;
+    ip_addr_t                   key;
+
+    memset(&key, 0, sizeof(key));
+    memcpy(&key, addr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+
+    slot = observe_slot(observe, iptype, &key);
+    if (slot->iptype == iptype && memcmp(&slot->addr, &key, sizeof(key)) == 0)
+    {
+        slot->state = OBSERVE_STATE_NONE;
+    }
+}
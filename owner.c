@@ -0,0 +1,301 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+#include <arpa/inet.h>
+
+#include "andwatch.h"
+
+
+// Number of entries in an owner table, and the number of ways (entries per
+// set). Both must be powers of 2.
+#define OWNER_ENTRIES           (256)
+#define OWNER_WAYS              (4)
+
+
+// Prefix of ip addresses or hardware addresses with multiple owners
+typedef struct owner_prefix
+{
+    // IP address type (DB_IPTYPE_ANY for a hardware address)
+    db_iptype                   iptype;
+
+    // Address, in network byte order
+    unsigned char               addr[sizeof(struct in6_addr)];
+
+    // Prefix length (bits)
+    unsigned int                len;
+} owner_prefix_t;
+
+
+// Well known virtual hardware addresses of first hop redundancy protocols
+static const owner_prefix_t     owner_virtual[] =
+{
+    { DB_IPTYPE_ANY, { 0x00, 0x00, 0x5e, 0x00, 0x01 }, 40 },   // VRRP and CARP (IPv4)
+    { DB_IPTYPE_ANY, { 0x00, 0x00, 0x5e, 0x00, 0x02 }, 40 },   // VRRP (IPv6)
+    { DB_IPTYPE_ANY, { 0x00, 0x00, 0x0c, 0x07, 0xac }, 40 },   // HSRP version 1
+    { DB_IPTYPE_ANY, { 0x00, 0x00, 0x0c, 0x9f, 0xf0 }, 36 },   // HSRP version 2
+    { DB_IPTYPE_ANY, { 0x00, 0x07, 0xb4 }, 24 }                // GLBP
+};
+
+// Configured prefixes with multiple owners
+static owner_prefix_t *         owner_prefixes = NULL;
+static unsigned int             owner_prefix_count = 0;
+
+
+//
+// Table of the owners of ip addresses with multiple owners
+//
+// NB: The table is set associative. When a set is full, the entry written
+//     longest ago is evicted, and is read from the database if it is seen
+//     again. The table is only allocated when the first owner is seen.
+//
+struct owners
+{
+    owner_entry_t               entries[OWNER_ENTRIES];
+};
+
+
+
+//
+// Check an address against a prefix
+//
+static int prefix_match(
+    const owner_prefix_t *      prefix,
+    const void *                addr)
+{
+    const unsigned char *       octets = addr;
+    unsigned int                bytes = prefix->len / 8;
+    unsigned int                bits = prefix->len % 8;
+    unsigned char               mask;
+
+    if (memcmp(prefix->addr, octets, bytes) != 0)
+    {
+        return 0;
+    }
+    if (bits)
+    {
+        mask = (unsigned char) (0xff << (8 - bits));
+        if ((prefix->addr[bytes] & mask) != (octets[bytes] & mask))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+//
+// Parse a multiple owner address or prefix (ipaddr[/len] or hwaddr[/len])
+//
+// Returns 0 on success, or -1 if the address is invalid
+//
+int owner_parse(
+    const char *                spec)
+{
+    owner_prefix_t              prefix;
+    char                        addr[INET6_ADDRSTRLEN];
+    const char *                slash;
+    char *                      p;
+    long                        len = -1;
+    unsigned int                max_len;
+
+    memset(&prefix, 0, sizeof(prefix));
+
+    // Split the prefix length
+    slash = strchr(spec, '/');
+    if (slash)
+    {
+        len = strtol(slash + 1, &p, 10);
+        if (*p != '\0' || slash[1] == '\0' || len < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        slash = spec + strlen(spec);
+    }
+    if ((size_t) (slash - spec) >= sizeof(addr))
+    {
+        return -1;
+    }
+    memcpy(addr, spec, (size_t) (slash - spec));
+    addr[slash - spec] = '\0';
+
+    if (inet_pton(AF_INET, addr, prefix.addr) == 1)
+    {
+        prefix.iptype = DB_IPTYPE_4;
+        max_len = 32;
+    }
+    else if (inet_pton(AF_INET6, addr, prefix.addr) == 1)
+    {
+        prefix.iptype = DB_IPTYPE_6;
+        max_len = 128;
+    }
+    else if (eth_pton(addr, (struct ether_addr *) prefix.addr))
+    {
+        prefix.iptype = DB_IPTYPE_ANY;
+        max_len = 48;
+    }
+    else
+    {
+        return -1;
+    }
+
+    prefix.len = (len == -1) ? max_len : (unsigned int) len;
+    if (prefix.len > max_len)
+    {
+        return -1;
+    }
+
+    owner_prefixes = realloc(owner_prefixes, (owner_prefix_count + 1) * sizeof(owner_prefix_t));
+    if (owner_prefixes == NULL)
+    {
+        fatal("cannot allocate memory for multiple owner addresses\n");
+    }
+    owner_prefixes[owner_prefix_count++] = prefix;
+    return 0;
+}
+
+
+//
+// Check whether a mapping indicates an ip address with multiple owners
+//
+// An ip address has multiple owners if it has been configured as such, or
+// if the hardware address is configured or is a well known virtual address
+// of a first hop redundancy protocol (VRRP, CARP, HSRP or GLBP).
+//
+// Returns 1 if the ip address has multiple owners, or 0 if not
+//
+int owner_is_multiple(
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr)
+{
+    unsigned int                i;
+
+    for (i = 0; i < sizeof(owner_virtual) / sizeof(owner_virtual[0]); i++)
+    {
+        if (prefix_match(&owner_virtual[i], hwaddr))
+        {
+            return 1;
+        }
+    }
+
+    for (i = 0; i < owner_prefix_count; i++)
+    {
+        if (owner_prefixes[i].iptype == DB_IPTYPE_ANY)
+        {
+            if (prefix_match(&owner_prefixes[i], hwaddr))
+            {
+                return 1;
+            }
+        }
+        else if (owner_prefixes[i].iptype == iptype && prefix_match(&owner_prefixes[i], addr))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+//
+// Find the owner entry for an ip address and hardware address
+//
+// NB: If the owner is not in the table, an entry is made for it with an
+//     update time of zero. The table is created on first use.
+//
+owner_entry_t * owner_lookup(
+    owners_t **                 table,
+    db_iptype                   iptype,
+    const void *                addr,
+    const struct ether_addr *   hwaddr)
+{
+    owners_t *                  owners;
+    owner_entry_t *             set;
+    owner_entry_t *             victim;
+    ip_addr_t                   key;
+    uint32_t                    h = 2166136261U;
+    unsigned int                i;
+
+    owners = *table;
+    if (owners == NULL)
+    {
+        owners = calloc(1, sizeof(owners_t));
+        if (owners == NULL)
+        {
+            fatal("cannot allocate memory for owner table\n");
+        }
+        *table = owners;
+    }
+
+    memset(&key, 0, sizeof(key));
+    memcpy(&key, addr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+
+    // Find the set (FNV-1a over the ip address and hardware address)
+    for (i = 0; i < sizeof(key); i++)
+    {
+        h = (h ^ key.ipv6.s6_addr[i]) * 16777619U;
+    }
+    for (i = 0; i < sizeof(*hwaddr); i++)
+    {
+        h = (h ^ hwaddr->ether_addr_octet[i]) * 16777619U;
+    }
+    h ^= h >> 16;
+    set = &owners->entries[(h & (OWNER_ENTRIES / OWNER_WAYS - 1)) * OWNER_WAYS];
+
+    // Find the entry, or the entry to be replaced
+    victim = &set[0];
+    for (i = 0; i < OWNER_WAYS; i++)
+    {
+        if (set[i].iptype == iptype &&
+            memcmp(&set[i].addr, &key, sizeof(key)) == 0 &&
+            memcmp(&set[i].hwaddr, hwaddr, sizeof(*hwaddr)) == 0)
+        {
+            return &set[i];
+        }
+        if (victim->iptype != DB_IPTYPE_ANY && (set[i].iptype == DB_IPTYPE_ANY || set[i].utime < victim->utime))
+        {
+            victim = &set[i];
+        }
+    }
+
+    victim->iptype = iptype;
+    victim->addr = key;
+    victim->hwaddr = *hwaddr;
+    victim->utime = 0;
+    return victim;
+}
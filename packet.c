@@ -28,7 +28,11 @@
 //
 
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <memory.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
 #include <netinet/in.h>
@@ -42,24 +46,16 @@
 #include "andwatch.h"
 
 
-// For the character array in ether_addr, most systems use the name
-// ether_addr_octet. Some systems just use the name octet but provide
-// a #define for ether_addr_octet. FreeBSD uses octet, but currently
-// does not provide a #define.
-#if defined(__FreeBSD__)
-# if !defined(ether_addr_octet)
-#  define ether_addr_octet octet
-# endif
-#endif
-
-// How frequently to perform record updates and maintenance
+// How frequently to perform maintenance
 #define DB_UPDATE_INTERVAL      (28800)
 
 // Command line variables/flags
 long                            delete_days = DELETE_DAYS;
+long                            update_interval = UPDATE_INTERVAL;
+unsigned int                    vlan_trunk = 0;
 
-// Next time maintenance should be performed
-static time_t                   next_maintenance_time = 0;
+// Serializes creation of the interfaces for the VLANs on a trunk
+static pthread_mutex_t          vlan_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 //
 // Ethernet address constants
@@ -86,22 +82,575 @@ static int is_eth_addr_local_or_broadcast(
 
 
 //
-// Convert an ethernet address to a string
+// Check whether the update time of an unchanged mapping is due to be refreshed
+//
+// NB: The interval is shortened by up to an eighth for each ip address, so
+//     that the hosts first seen in a burst do not all come due together.
+//
+static int update_due(
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    time_t                      utime,
+    time_t                      now)
+{
+    const unsigned char *       octets = ipaddr;
+    unsigned int                len = (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    uint32_t                    h = 2166136261U;
+    time_t                      age = now - utime;
+    time_t                      jitter = update_interval / 8;
+    unsigned int                i;
+
+    if (age >= update_interval)
+    {
+        return 1;
+    }
+    if (age < update_interval - jitter)
+    {
+        return 0;
+    }
+
+    // Jitter for the ip address (FNV-1a)
+    for (i = 0; i < len; i++)
+    {
+        h = (h ^ octets[i]) * 16777619U;
+    }
+
+    return (age >= update_interval - (time_t) (h % (uint32_t) (jitter + 1)));
+}
+
+
+//
+// Load the current hardware address for an ip address from the database
+//
+// NB: The current information is added to the cache. Returns NULL if the
+//     ip address is not in the database. Rows that have been expired are
+//     ignored, as the writer thread may not yet have deleted them. For an
+//     ip address with multiple owners, the owner seen most recently is
+//     current. For a grouped IPv6 address, the mapping changed most recently
+//     is current.
+//
+static cache_entry_t * load_current(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const char *                ipaddr_str,
+    time_t                      expire_time)
+{
+    cache_entry_t *             entry;
+    ipmap_current_t             current;
+    struct ether_addr           hwaddr;
+    uint8_t                     multiple = 1;
+    uint8_t                     aggregated = 0;
+
+    // Get current information for the ip address from the database
+    // NB: The owner and addr6 tables are only read once they may have rows
+    current.valid = 0;
+    if (__atomic_load_n(&shard->iface->owner_rows, __ATOMIC_RELAXED))
+    {
+        db_owner_get_current(shard->read_db, iptype, ipaddr_str, &current);
+    }
+    if (current.valid == 0 || current.utime <= expire_time)
+    {
+        multiple = 0;
+        if (iptype == DB_IPTYPE_6 && aggregate_applies(ipaddr) &&
+            __atomic_load_n(&shard->iface->addr6_rows, __ATOMIC_RELAXED))
+        {
+            aggregated = 1;
+            db_addr6_get_current(shard->read_db, ipaddr_str, &current);
+        }
+    }
+    if (current.valid == 0 || current.utime <= expire_time)
+    {
+        aggregated = 0;
+        db_ipmap_get_current(shard->read_db, iptype, ipaddr_str, &current);
+    }
+    if (current.valid == 0 || current.utime <= expire_time)
+    {
+        return NULL;
+    }
+
+    if (eth_pton(current.hwaddr_str, &hwaddr) == 0)
+    {
+        logger("invalid hardware address %s in database for %s\n", current.hwaddr_str, ipaddr_str);
+        return NULL;
+    }
+
+    // Add it to the cache
+    entry = cache_insert(shard->cache, iptype, ipaddr);
+    entry->hwaddr = hwaddr;
+    entry->multiple = multiple;
+    entry->aggregated = aggregated;
+    entry->rowid = current.rowid;
+    entry->utime = current.utime;
+
+    return entry;
+}
+
+
+//
+// Update the mapping of an ip address with multiple owners
+//
+// NB: Each owner is recorded once, with the time it was last seen, rather
+//     than recording a change each time the ip address moves between owners.
+//     A new owner is recorded as a change. When an ip address is found to
+//     have multiple owners, its current hardware address becomes an owner
+//     without a change being recorded. The cache entry holds the owner seen
+//     most recently.
+//
+// Returns 1 if the mapping is current, or 0 if the writer did not accept it
+//
+static int update_owner(
+    shard_t *                   shard,
+    cache_entry_t *             entry,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    const struct timeval *      timestamp,
+    time_t                      expire_time)
+{
+    owner_entry_t *             owner;
+    owner_entry_t *             previous;
+    record_t                    record;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+
+    // The owner table may now have rows
+    __atomic_store_n(&shard->iface->owner_rows, 1, __ATOMIC_RELAXED);
+
+    // Find the owner, reading it from the database if it is not known
+    owner = owner_lookup(&shard->owners, iptype, ipaddr, hwaddr);
+    if (owner->utime == 0 && entry && entry->multiple)
+    {
+        (void) inet_ntop((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr, ipaddr_str, sizeof(ipaddr_str));
+        owner->utime = db_owner_get_utime(shard->read_db, iptype, ipaddr_str, eth_ntop(hwaddr, hwaddr_str, sizeof(hwaddr_str)));
+    }
+    if (owner->utime <= expire_time)
+    {
+        owner->utime = 0;
+    }
+
+    // Build the record
+    memset(&record, 0, sizeof(record));
+    record.iface = shard->iface;
+    record.iptype = iptype;
+    memcpy(&record.addr, ipaddr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+    record.hwaddr = *hwaddr;
+    record.timestamp = *timestamp;
+
+    // Does the current hardware address become an owner?
+    if (entry && entry->multiple == 0 && memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) != 0)
+    {
+        record.type = RECORD_OWNER_UTIME;
+        record.hwaddr = entry->hwaddr;
+        record.timestamp.tv_sec = entry->utime;
+        record.timestamp.tv_usec = 0;
+        if (writer_submit(shard->queue, &record) == 0)
+        {
+            return 0;
+        }
+        previous = owner_lookup(&shard->owners, iptype, ipaddr, &entry->hwaddr);
+        previous->utime = entry->utime;
+        entry->multiple = 1;
+
+        // NB: The lookup of the previous owner may have replaced the owner
+        owner = owner_lookup(&shard->owners, iptype, ipaddr, hwaddr);
+        record.hwaddr = *hwaddr;
+        record.timestamp = *timestamp;
+    }
+
+    if (owner->utime == 0 && (entry == NULL || memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) != 0))
+    {
+        // It's a new owner
+        record.type = RECORD_OWNER_INSERT;
+        if (entry)
+        {
+            record.old_hwaddr = entry->hwaddr;
+            record.old_valid = 1;
+        }
+        if (writer_submit(shard->queue, &record) == 0)
+        {
+            return 0;
+        }
+        owner->utime = timestamp->tv_sec;
+        shard->inserts++;
+    }
+    else if (owner->utime == 0 || update_due(iptype, ipaddr, owner->utime, timestamp->tv_sec))
+    {
+        // Record the owner, or the time it was last seen
+        record.type = RECORD_OWNER_UTIME;
+        if (writer_submit(shard->queue, &record) == 0)
+        {
+            return 0;
+        }
+        owner->utime = timestamp->tv_sec;
+        shard->updates++;
+    }
+
+    // Update the cache
+    if (entry == NULL)
+    {
+        entry = cache_insert(shard->cache, iptype, ipaddr);
+        entry->utime = 0;
+    }
+    entry->hwaddr = *hwaddr;
+    entry->multiple = 1;
+    entry->aggregated = 0;
+    entry->dirty = 0;
+    entry->sequence = queue_position(shard->queue);
+    entry->rowid = 0;
+    if (owner->utime > entry->utime)
+    {
+        entry->utime = owner->utime;
+    }
+
+    return 1;
+}
+
+
+//
+// Update the mapping of an IPv6 address grouped by hardware address and prefix
+//
+// NB: Hosts using temporary addresses generate a new address in each prefix
+//     every day or so. Each address is recorded once for each hardware
+//     address, with the time it was last seen, rather than as a row in the
+//     ipmap table. A new address is only recorded as a change if the
+//     hardware address has not been seen with another address in the prefix.
+//     A change of hardware address is always recorded as a change.
+//
+// Returns 1 if the mapping is current, or 0 if the writer did not accept it
+//
+static int update_aggregate(
+    shard_t *                   shard,
+    cache_entry_t *             entry,
+    const struct in6_addr *     ipaddr,
+    const struct ether_addr *   hwaddr,
+    const struct timeval *      timestamp,
+    time_t                      expire_time)
+{
+    record_t                    record;
+
+    // The addr6 table may now have rows
+    __atomic_store_n(&shard->iface->addr6_rows, 1, __ATOMIC_RELAXED);
+
+    // Build the record
+    memset(&record, 0, sizeof(record));
+    record.iface = shard->iface;
+    record.iptype = DB_IPTYPE_6;
+    record.addr.ipv6 = *ipaddr;
+    record.hwaddr = *hwaddr;
+    record.timestamp = *timestamp;
+
+    if (entry && memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) == 0)
+    {
+        // Time to update the row?
+        if (update_due(DB_IPTYPE_6, ipaddr, entry->utime, timestamp->tv_sec))
+        {
+            record.type = RECORD_ADDR6_UTIME;
+            if (writer_submit(shard->queue, &record) == 0)
+            {
+                return 0;
+            }
+            entry->utime = timestamp->tv_sec;
+            entry->sequence = queue_position(shard->queue);
+            aggregate_add(shard, ipaddr, hwaddr, timestamp->tv_sec);
+            shard->updates++;
+        }
+
+        return 1;
+    }
+
+    if (entry == NULL && aggregate_known(shard, ipaddr, hwaddr, expire_time))
+    {
+        // It's another address for a known hardware address and prefix
+        record.type = RECORD_ADDR6_UTIME;
+        if (writer_submit(shard->queue, &record) == 0)
+        {
+            return 0;
+        }
+        shard->updates++;
+    }
+    else
+    {
+        // It's a new hardware address for the prefix, or for the ip address
+        record.type = RECORD_ADDR6_INSERT;
+        if (entry)
+        {
+            record.old_hwaddr = entry->hwaddr;
+            record.old_valid = 1;
+        }
+        if (writer_submit(shard->queue, &record) == 0)
+        {
+            return 0;
+        }
+        shard->inserts++;
+    }
+    aggregate_add(shard, ipaddr, hwaddr, timestamp->tv_sec);
+
+    // Update the cache
+    entry = cache_insert(shard->cache, DB_IPTYPE_6, ipaddr);
+    entry->hwaddr = *hwaddr;
+    entry->aggregated = 1;
+    entry->dirty = 0;
+    entry->sequence = queue_position(shard->queue);
+    entry->rowid = 0;
+    entry->utime = timestamp->tv_sec;
+
+    return 1;
+}
+
+
+//
+// Update the mapping of an ip address to a hardware address
+//
+// NB: The cache is authoritative for the capture worker. Database writes
+//     and notifications are handed to the writer thread, and the cache is
+//     only updated once the writer has accepted the record. If the writer
+//     queue is full, the change will be detected again on the next packet
+//     (the caller removes the ip address from the dedup filter, so that the
+//     next packet is not dropped).
+//     The refreshed update time of an unchanged mapping is marked in the
+//     cache, and written later in a batch with those of other mappings.
+//     Each cache entry holds the writer queue position of its last write,
+//     so that it is not evicted before the write is committed.
+//
+// Returns 1 if the mapping is current, or 0 if the writer did not accept it
+//
+static int update_mapping(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    const struct timeval *      timestamp)
+{
+    iface_t *                   iface = shard->iface;
+    cache_entry_t *             entry;
+    record_t                    record;
+    time_t                      expire_time;
+    int                         admit = 1;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+
+    // Entries with committed writes may be evicted from the cache
+    cache_set_committed(shard->cache, queue_committed(shard->queue));
+
+    // Get current information for the ip address
+    //
+    // NB: Another worker may have expired the interface since this shard's
+    //     cache was last expired. Entries at or before the expire time are
+    //     treated as absent.
+    expire_time = __atomic_load_n(&iface->expire_time, __ATOMIC_ACQUIRE);
+    entry = cache_lookup(shard->cache, iptype, ipaddr);
+    if (entry == NULL)
+    {
+        // A new IPv6 address must complete probation before it is recorded
+        //
+        // NB: An address with a current mapping is not new, even if it is
+        //     not in the cache. So that a host cycling through random
+        //     addresses costs no database lookups, the database is only
+        //     consulted once an address is seen again with the same
+        //     hardware address.
+        if (iptype == DB_IPTYPE_6)
+        {
+            admit = probation_admit(&shard->probation, ipaddr, hwaddr, timestamp->tv_sec);
+            if (admit == -1)
+            {
+                shard->held++;
+                return 1;
+            }
+        }
+
+        (void) inet_ntop((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr, ipaddr_str, sizeof(ipaddr_str));
+        entry = load_current(shard, iptype, ipaddr, ipaddr_str, expire_time);
+        if (entry == NULL && admit == 0)
+        {
+            shard->held++;
+            return 1;
+        }
+    }
+    else if (entry->utime <= expire_time)
+    {
+        entry = NULL;
+    }
+
+    // Does the ip address have multiple owners?
+    if ((entry && entry->multiple) || owner_is_multiple(iptype, ipaddr, hwaddr) ||
+        (entry && owner_is_multiple(iptype, ipaddr, &entry->hwaddr)))
+    {
+        return update_owner(shard, entry, iptype, ipaddr, hwaddr, timestamp, expire_time);
+    }
+
+    // Is the ip address grouped by hardware address and prefix?
+    if (iptype == DB_IPTYPE_6 && (entry == NULL || entry->aggregated) && aggregate_applies(ipaddr))
+    {
+        return update_aggregate(shard, entry, ipaddr, hwaddr, timestamp, expire_time);
+    }
+
+    // Build the record
+    memset(&record, 0, sizeof(record));
+    record.iface = iface;
+    record.iptype = iptype;
+    memcpy(&record.addr, ipaddr, (iptype == DB_IPTYPE_4) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+    record.hwaddr = *hwaddr;
+    record.timestamp = *timestamp;
+
+    if (entry)
+    {
+        // Is the hardware address unchanged?
+        if (memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) == 0)
+        {
+            // Time to update the row?
+            // NB: The update time is written with those of other rows by the next flush
+            if (entry->dirty == 0 && update_due(iptype, ipaddr, entry->utime, timestamp->tv_sec))
+            {
+                entry->dirty = 1;
+                entry->utime = timestamp->tv_sec;
+                if (shard->dirty_time == 0)
+                {
+                    shard->dirty_time = timestamp->tv_sec;
+                }
+            }
+
+            return 1;
+        }
+
+        // It's a new hardware address
+        record.old_hwaddr = entry->hwaddr;
+        record.old_valid = 1;
+    }
+
+    // Insert the entry into the database
+    // NB: If the record is not accepted, the row id is simply not used
+    record.type = RECORD_INSERT;
+    record.rowid = __atomic_fetch_add(&iface->next_rowid, 1, __ATOMIC_RELAXED);
+    if (writer_submit(shard->queue, &record) == 0)
+    {
+        return 0;
+    }
+
+    // Update the cache
+    entry = cache_insert(shard->cache, iptype, ipaddr);
+    entry->hwaddr = *hwaddr;
+    entry->dirty = 0;
+    entry->sequence = queue_position(shard->queue);
+    entry->rowid = record.rowid;
+    entry->utime = timestamp->tv_sec;
+    shard->inserts++;
+
+    return 1;
+}
+
+
+//
+// Check a probe of an ip address against the current mapping
+//
+// NB: Only the cache is consulted, so a probe never costs a database lookup.
+//     A probe for an address that is currently mapped to a different
+//     hardware address is an attempt to take over the address.
+//
+static void check_probe(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    observe_class               class)
+{
+    cache_entry_t *             entry;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    char                        current_str[ETH_ADDRSTRLEN];
+
+    entry = cache_lookup(shard->cache, iptype, ipaddr);
+    if (entry == NULL || entry->utime <= __atomic_load_n(&shard->iface->expire_time, __ATOMIC_ACQUIRE) ||
+        memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) == 0)
+    {
+        return;
+    }
+
+    logger_limited("%s for %s on %s from %s, currently %s\n",
+        (class == OBSERVE_PROBE) ? "arp probe" : "duplicate address detection",
+        inet_ntop((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr, ipaddr_str, sizeof(ipaddr_str)),
+        shard->iface->name,
+        eth_ntop(hwaddr, hwaddr_str, sizeof(hwaddr_str)),
+        eth_ntop(&entry->hwaddr, current_str, sizeof(current_str)));
+}
+
+
+//
+// Observe a packet for an ip address
+//
+// NB: Probes and DAD solicitations do not change the mapping, as the address
+//     has not yet been claimed. Repeats of a probe or claim within a short
+//     window, such as a burst of gratuitous announcements, are collapsed
+//     into a single observation. A packet to be shed, from a source in a
+//     storm, is only processed if it changes a current mapping held in the
+//     cache. Only the cache is consulted, so that a storm causes no database
+//     lookups. The takeover of an address not in the cache is detected by
+//     the sampled packets of the storm that are processed in full.
 //
-static const char * eth_ntop(
-    const struct ether_addr *   eth_addr,
-    char *                      buf,
-    size_t                      buflen)
+static void observe_mapping(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    observe_class               class,
+    unsigned int                shed,
+    const struct timeval *      timestamp)
 {
-    snprintf(buf, buflen, "%02x:%02x:%02x:%02x:%02x:%02x",
-        eth_addr->ether_addr_octet[0],
-        eth_addr->ether_addr_octet[1],
-        eth_addr->ether_addr_octet[2],
-        eth_addr->ether_addr_octet[3],
-        eth_addr->ether_addr_octet[4],
-        eth_addr->ether_addr_octet[5]);
-
-    return buf;
+    observe_result              result;
+    cache_entry_t *             entry;
+    time_t                      expire_time;
+    struct ether_addr           prober;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    char                        prober_str[ETH_ADDRSTRLEN];
+
+    result = observe_packet(shard->observe, iptype, ipaddr, hwaddr, class, timestamp->tv_sec, &prober);
+    switch (result)
+    {
+    case OBSERVE_COLLAPSE:
+        shard->collapsed++;
+        return;
+
+    case OBSERVE_TENTATIVE:
+        check_probe(shard, iptype, ipaddr, hwaddr, class);
+        return;
+
+    case OBSERVE_DEFEND:
+        logger_limited("address conflict for %s on %s: probe from %s answered by %s\n",
+            inet_ntop((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr, ipaddr_str, sizeof(ipaddr_str)),
+            shard->iface->name,
+            eth_ntop(&prober, prober_str, sizeof(prober_str)),
+            eth_ntop(hwaddr, hwaddr_str, sizeof(hwaddr_str)));
+        break;
+
+    case OBSERVE_UPDATE:
+        break;
+    }
+
+    // Shed the packet?
+    if (shed)
+    {
+        expire_time = __atomic_load_n(&shard->iface->expire_time, __ATOMIC_ACQUIRE);
+        entry = cache_lookup(shard->cache, iptype, ipaddr);
+        if (entry == NULL || entry->utime <= expire_time ||
+            memcmp(hwaddr, &entry->hwaddr, sizeof(struct ether_addr)) == 0)
+        {
+            observe_forget(shard->observe, iptype, ipaddr);
+            shard->shed++;
+            return;
+        }
+    }
+
+    // Update the mapping
+    // NB: If the update was not accepted, the next packet must be neither
+    //     collapsed nor dropped by the dedup filter
+    if (update_mapping(shard, iptype, ipaddr, hwaddr, timestamp) == 0)
+    {
+        observe_forget(shard->observe, iptype, ipaddr);
+        if (shard->dedup)
+        {
+            ring_forget(shard->dedup, shard->dedup_vlans, iptype, ipaddr);
+        }
+    }
 }
 
 
@@ -109,10 +658,11 @@ static const char * eth_ntop(
 // Process IPv4 ARP packets
 //
 static void process_arp(
-    sqlite3 *                   db,
-    const char *                eth_src_addr_str,
+    shard_t *                   shard,
+    const struct ether_addr *   eth_src_addr,
     const unsigned char *       packet,
     unsigned int                packet_len,
+    unsigned int                shed,
     const struct timeval *      timestamp)
 {
     struct ether_arp *          arp;
@@ -123,19 +673,19 @@ static void process_arp(
     u_int16_t                   arp_opcode;
 
     struct ether_addr *         arp_sender_hwaddr;
-    struct in_addr *            arp_sender_ipaddr;
-    struct in_addr *            arp_target_ipaddr;
+    struct in_addr              arp_sender_ipaddr;
+    struct in_addr              arp_target_ipaddr;
+    observe_class               class;
 
+    char                        eth_src_addr_str[ETH_ADDRSTRLEN];
     char                        arp_sender_hwaddr_str[ETH_ADDRSTRLEN];
     char                        arp_sender_ipaddr_str[INET_ADDRSTRLEN];
-    char                        arp_target_ipaddr_str[INET_ADDRSTRLEN];
-    const char *                old_hwaddr_str = "(none)";
-    ipmap_current_t             current;
 
     // Safety check: ensure packet length is sufficient for ethernet arp
     if (packet_len < sizeof(struct ether_arp))
     {
-        logger("received packet from %s with length too short for an arp packet\n", eth_src_addr_str);
+        logger_limited("received packet from %s with length too short for an arp packet\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)));
         return;
     }
 
@@ -150,95 +700,83 @@ static void process_arp(
     // Safety check: we only process Ethernet and IEEE 802 hardware types
     if (arp_hardware_type != ARPHRD_ETHER && arp_hardware_type != ARPHRD_IEEE802)
     {
-        logger("received packet from %s with unexpected arp hardware type %d\n", eth_src_addr_str, arp_hardware_type);
+        logger_limited("received packet from %s with unexpected arp hardware type %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), arp_hardware_type);
         return;
     }
 
     // Safety check: we only process IP protocol type
     if (arp_protocol_type != ETHERTYPE_IP)
     {
-        logger("received packet from %s with unexpected arp protocol type %d\n", eth_src_addr_str, arp_protocol_type);
+        logger_limited("received packet from %s with unexpected arp protocol type %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), arp_protocol_type);
         return;
     }
 
     // Safety check: ensure hardware address length is expected for ethernet
     if (arp_hardware_len != sizeof(struct ether_addr))
     {
-        logger("received packet from %s with unexpected arp hardware lenth %d\n", eth_src_addr_str, arp_hardware_len);
+        logger_limited("received packet from %s with unexpected arp hardware lenth %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), arp_hardware_len);
         return;
     }
 
     // Safety check: ensure protocol length is as expected for IPv4
     if (arp_protocol_len != sizeof(struct in_addr))
     {
-        logger("received packet from %s with unexpected arp protocol length %d\n", eth_src_addr_str, arp_protocol_len);
+        logger_limited("received packet from %s with unexpected arp protocol length %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), arp_protocol_len);
         return;
     }
 
+    // NB: The sender protocol address is not aligned within the packet
     arp_sender_hwaddr = (struct ether_addr *) arp->arp_sha;
-    arp_sender_ipaddr = (struct in_addr *) arp->arp_spa;
-    arp_target_ipaddr = (struct in_addr *) arp->arp_tpa;
-
-    eth_ntop(arp_sender_hwaddr, arp_sender_hwaddr_str, sizeof(arp_sender_hwaddr_str));
-
-    if (inet_ntop(AF_INET, arp_sender_ipaddr, arp_sender_ipaddr_str, sizeof(arp_sender_ipaddr_str)) == NULL)
-    {
-        logger("received packet from %s with invalid arp sender ip address\n", eth_src_addr_str);
-        return;
-    }
-    if (inet_ntop(AF_INET, arp_target_ipaddr, arp_target_ipaddr_str, sizeof(arp_target_ipaddr_str)) == NULL)
-    {
-        logger("received packet from %s with invalid arp target ip address\n", eth_src_addr_str);
-        return;
-    }
+    memcpy(&arp_sender_ipaddr, arp->arp_spa, sizeof(arp_sender_ipaddr));
+    memcpy(&arp_target_ipaddr, arp->arp_tpa, sizeof(arp_target_ipaddr));
 
     // Safety check: ensure the packet is an ARP request or reply
     if (arp_opcode != ARPOP_REQUEST && arp_opcode != ARPOP_REPLY)
     {
-        logger("received packet from %s with unexpected arp opcode %d\n", eth_src_addr_str, arp_opcode);
+        logger_limited("received packet from %s with unexpected arp opcode %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), arp_opcode);
         return;
     }
 
     // Warn if the sender hardware address does not match the ethernet source address
-    if (strncmp(eth_src_addr_str, arp_sender_hwaddr_str, sizeof(arp_sender_hwaddr_str)) != 0)
+    if (memcmp(eth_src_addr, arp_sender_hwaddr, sizeof(struct ether_addr)) != 0)
     {
-            logger("received packet from %s with non matching arp sender hardware addr %s\n",
-                eth_src_addr_str, arp_sender_hwaddr_str);
+            logger_limited("received packet from %s with non matching arp sender hardware addr %s\n",
+                eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+                eth_ntop(arp_sender_hwaddr, arp_sender_hwaddr_str, sizeof(arp_sender_hwaddr_str)));
             return;
     }
 
-    // Safety check
-    if (arp_sender_ipaddr->s_addr == 0)
-    {
-        logger("received packet with unexpected arp sender address %s\n", arp_sender_ipaddr_str);
-        return;
-    }
-
-    // Get current information for the ip address
-    db_ipmap_get_current(db, DB_IPTYPE_4, arp_sender_ipaddr_str, &current);
-    if (current.valid)
+    // Is this a probe (RFC 5227)?
+    if (arp_sender_ipaddr.s_addr == 0)
     {
-        // Is the hardware address unchanged?
-        if (strncmp(arp_sender_hwaddr_str, current.hwaddr_str, ETH_ADDRSTRLEN) == 0)
+        // Safety check
+        if (arp_opcode != ARPOP_REQUEST || arp_target_ipaddr.s_addr == 0)
         {
-            // Time to update the row?
-            if (current.age >= DB_UPDATE_INTERVAL)
-            {
-                db_ipmap_set_utime(db, current.rowid, timestamp->tv_sec);
-            }
-
+            logger_limited("received packet with unexpected arp sender address %s\n",
+                inet_ntop(AF_INET, &arp_sender_ipaddr, arp_sender_ipaddr_str, sizeof(arp_sender_ipaddr_str)));
             return;
         }
 
-        // It's a new hardware address
-        old_hwaddr_str = current.hwaddr_str;
+        observe_mapping(shard, DB_IPTYPE_4, &arp_target_ipaddr, arp_sender_hwaddr, OBSERVE_PROBE, shed, timestamp);
+        return;
     }
 
-    // Insert the entry into the database
-    db_ipmap_insert(db, DB_IPTYPE_4, arp_sender_ipaddr_str, arp_sender_hwaddr_str, timestamp);
+    // Classify the packet
+    if (arp_sender_ipaddr.s_addr == arp_target_ipaddr.s_addr)
+    {
+        class = (arp_opcode == ARPOP_REQUEST) ? OBSERVE_ANNOUNCE : OBSERVE_GRATUITOUS;
+    }
+    else
+    {
+        class = (arp_opcode == ARPOP_REQUEST) ? OBSERVE_REQUEST : OBSERVE_REPLY;
+    }
 
-    // Notify
-    change_notification(db, timestamp, AF_INET, arp_sender_ipaddr, arp_sender_ipaddr_str, arp_sender_hwaddr_str, old_hwaddr_str);
+    observe_mapping(shard, DB_IPTYPE_4, &arp_sender_ipaddr, arp_sender_hwaddr, class, shed, timestamp);
 }
 
 
@@ -246,32 +784,35 @@ static void process_arp(
 // Process IPv6 ICMP packets
 //
 void process_icmp6(
-    sqlite3 *                   db,
-    const char *                eth_src_addr_str,
+    shard_t *                   shard,
+    const struct ether_addr *   eth_src_addr,
     const unsigned char *       packet,
     unsigned int                packet_len,
+    unsigned int                shed,
     const struct timeval *      timestamp)
 {
     const struct ip6_hdr *      ip6;
-    const struct in6_addr *     ip_src_addr;
+    struct in6_addr             ip_src_addr;
 
     const struct icmp6_hdr *    icmp6;
     unsigned long               icmp6_len;
+    const struct nd_neighbor_advert * nd;
+    struct in6_addr             nd_target;
+    observe_class               class;
 
-    const struct nd_neighbor_advert *    nd;
     const struct nd_opt_hdr *   nd_opt;
     unsigned long               nd_opt_len;
+    const struct ether_addr *   eth_opt_addr;
 
+    char                        eth_src_addr_str[ETH_ADDRSTRLEN];
+    char                        eth_opt_addr_str[ETH_ADDRSTRLEN];
     char                        ip_src_addr_str[INET6_ADDRSTRLEN];
-    char                        ip_target_addr_str[INET6_ADDRSTRLEN];
-    char                        eth_opt_addr_str[ETH_ADDRSTRLEN] = "\0";
-    const char *                old_hwaddr_str = "(none)";
-    ipmap_current_t             current;
 
     // Safety check: ensure packet length is sufficient for ip6
     if (packet_len < sizeof(struct ip6_hdr))
     {
-        logger("received packet from %s with length too short for ip6\n", eth_src_addr_str);
+        logger_limited("received packet from %s with length too short for ip6\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)));
         return;
     }
 
@@ -280,24 +821,24 @@ void process_icmp6(
     packet += sizeof(struct ip6_hdr);
     packet_len -= sizeof(struct ip6_hdr);
 
-    ip_src_addr = (void *) &ip6->ip6_src;
-    if (inet_ntop(AF_INET6, ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)) == NULL)
-    {
-        logger("received packet from %s with invalid source ip address\n", eth_src_addr_str);
-        return;
-    }
+    memcpy(&ip_src_addr, &ip6->ip6_src, sizeof(ip_src_addr));
 
     // Safety check: ensure the next header is ICMPv6
     if (ip6->ip6_nxt != IPPROTO_ICMPV6)
     {
-        logger("received packet from %s (%s) with unexpected ip6 next header (%d)\n", eth_src_addr_str, ip_src_addr_str, ip6->ip6_nxt);
+        logger_limited("received packet from %s (%s) with unexpected ip6 next header (%d)\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+            inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)),
+            ip6->ip6_nxt);
         return;
     }
 
     // Safety check: ensure packet length is sufficient for icmp6
     if (packet_len < sizeof(struct icmp6_hdr))
     {
-        logger("received packet from %s (%s) with length too short for icmp6\n", eth_src_addr_str, ip_src_addr_str);
+        logger_limited("received packet from %s (%s) with length too short for icmp6\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+            inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)));
         return;
     }
 
@@ -307,13 +848,16 @@ void process_icmp6(
     icmp6_len = ntohs(ip6->ip6_plen);
     if (packet_len < icmp6_len)
     {
-        logger("Warning: icmp6 packet truncated - increase snaplen by %lu bytes\n", icmp6_len - packet_len);
+        logger_limited("Warning: icmp6 packet truncated - increase snaplen by %lu bytes\n", icmp6_len - packet_len);
     }
 
     // Safety check: ensure we have a correct ICMPv6 type
     if (icmp6->icmp6_type != ND_NEIGHBOR_SOLICIT && icmp6->icmp6_type != ND_NEIGHBOR_ADVERT)
     {
-        logger("received packet from %s (%s) with unexpected ICMPv6 type %d\n", eth_src_addr_str, ip_src_addr_str, icmp6->icmp6_type);
+        logger_limited("received packet from %s (%s) with unexpected ICMPv6 type %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+            inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)),
+            icmp6->icmp6_type);
         return;
     }
 
@@ -324,20 +868,29 @@ void process_icmp6(
     // Safety check: ensure packet length is sufficient for neighbor discovery
     if (packet_len < sizeof(struct nd_neighbor_solicit))
     {
-        logger("received packet from %s (%s) with length too short for neighbor discovery\n", eth_src_addr_str, ip_src_addr_str);
+        logger_limited("received packet from %s (%s) with length too short for neighbor discovery\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+            inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)));
         return;
     }
 
-    // Parse the neighbor discovery header
-    nd = (const struct nd_neighbor_advert *) (packet);
-    packet += sizeof(struct nd_neighbor_advert);
-    packet_len -= sizeof(struct nd_neighbor_advert);
-    if (inet_ntop(AF_INET6, &nd->nd_na_target, ip_target_addr_str, sizeof(ip_target_addr_str)) == NULL)
+    // Classify the packet
+    // NB: A solicitation from the unspecified address is duplicate address detection
+    nd = (const struct nd_neighbor_advert *) packet;
+    memcpy(&nd_target, &nd->nd_na_target, sizeof(nd_target));
+    if (icmp6->icmp6_type == ND_NEIGHBOR_SOLICIT)
     {
-        logger("received packet from %s (%s) with invalid neighbor discovery target ip address\n", eth_src_addr_str, ip_src_addr_str);
-        return;
+        class = IN6_IS_ADDR_UNSPECIFIED(&ip_src_addr) ? OBSERVE_DAD : OBSERVE_REQUEST;
+    }
+    else
+    {
+        class = (nd->nd_na_flags_reserved & ND_NA_FLAG_SOLICITED) ? OBSERVE_REPLY : OBSERVE_ANNOUNCE;
     }
 
+    // Skip the neighbor discovery header
+    packet += sizeof(struct nd_neighbor_advert);
+    packet_len -= sizeof(struct nd_neighbor_advert);
+
     // Parse neighbor discovery options (if present)
     while (packet_len >= sizeof(struct nd_opt_hdr))
     {
@@ -347,7 +900,9 @@ void process_icmp6(
         // Safety check: ensure packet length is sufficient for the nd option
         if (nd_opt_len == 0 || packet_len < nd_opt_len)
         {
-            logger("received packet from %s (%s) with length too short for neighbor discovery option\n", eth_src_addr_str, ip_src_addr_str);
+            logger_limited("received packet from %s (%s) with length too short for neighbor discovery option\n",
+                eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+                inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)));
             return;
         }
 
@@ -357,21 +912,24 @@ void process_icmp6(
             // Safety check: ensure the link address length is as expected
             if (nd_opt_len != sizeof(struct nd_opt_hdr) + sizeof(struct ether_addr))
             {
-                logger("received packet from %s (%s) with unexpected option %s neighbor discovery link address length %lu\n",
-                    eth_src_addr_str, ip_src_addr_str,
+                logger_limited("received packet from %s (%s) with unexpected option %s neighbor discovery link address length %lu\n",
+                    eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+                    inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)),
                     nd_opt->nd_opt_type == ND_OPT_SOURCE_LINKADDR ? "source" : "target",
                     nd_opt_len - sizeof(struct nd_opt_hdr));
                 return;
             }
 
             // Parse the link layer address option
-            eth_ntop((const struct ether_addr *) (packet + sizeof(struct nd_opt_hdr)), eth_opt_addr_str, sizeof(eth_opt_addr_str));
+            eth_opt_addr = (const struct ether_addr *) (packet + sizeof(struct nd_opt_hdr));
 
             // Warn if the option address does not match the ethernet source address
-            if (strncmp(eth_src_addr_str, eth_opt_addr_str, sizeof(eth_opt_addr_str)) != 0)
+            if (memcmp(eth_src_addr, eth_opt_addr, sizeof(struct ether_addr)) != 0)
             {
-                logger("received packet from %s (%s) with non matching neighbor discovery option address %s\n",
-                    eth_src_addr_str, ip_src_addr_str, eth_opt_addr_str);
+                logger_limited("received packet from %s (%s) with non matching neighbor discovery option address %s\n",
+                    eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+                    inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)),
+                    eth_ntop(eth_opt_addr, eth_opt_addr_str, sizeof(eth_opt_addr_str)));
                 return;
             }
         }
@@ -381,63 +939,185 @@ void process_icmp6(
         packet_len -= nd_opt_len;
     }
 
-    // Safety check
-    if (IN6_IS_ADDR_UNSPECIFIED(ip_src_addr))
-    {
-        logger("received packet with unexpected source address %s\n", ip_src_addr_str);
-        return;
-    }
-
-    // Get current information for the ip address
-    db_ipmap_get_current(db, DB_IPTYPE_6, ip_src_addr_str, &current);
-    if (current.valid)
+    // Is this duplicate address detection?
+    if (class == OBSERVE_DAD)
     {
-        // Is the hardware address unchanged?
-        if (strncmp(eth_src_addr_str, current.hwaddr_str, ETH_ADDRSTRLEN) == 0)
+        // Safety check
+        if (IN6_IS_ADDR_UNSPECIFIED(&nd_target) || IN6_IS_ADDR_MULTICAST(&nd_target))
         {
-            // Time to update the row?
-            if (current.age >= DB_UPDATE_INTERVAL)
-            {
-                db_ipmap_set_utime(db, current.rowid, timestamp->tv_sec);
-            }
-
+            logger_limited("received duplicate address detection from %s with unexpected target address %s\n",
+                eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)),
+                inet_ntop(AF_INET6, &nd_target, ip_src_addr_str, sizeof(ip_src_addr_str)));
             return;
         }
 
-        // It's a new hardware address
-        old_hwaddr_str = current.hwaddr_str;
+        observe_mapping(shard, DB_IPTYPE_6, &nd_target, eth_src_addr, class, shed, timestamp);
+        return;
     }
 
-    // Insert the entry into the database
-    db_ipmap_insert(db, DB_IPTYPE_6, ip_src_addr_str, eth_src_addr_str, timestamp);
+    // Safety check
+    if (IN6_IS_ADDR_UNSPECIFIED(&ip_src_addr))
+    {
+        logger_limited("received packet with unexpected source address %s\n",
+            inet_ntop(AF_INET6, &ip_src_addr, ip_src_addr_str, sizeof(ip_src_addr_str)));
+        return;
+    }
 
-    // Notify
-    change_notification(db, timestamp, AF_INET6, ip_src_addr, ip_src_addr_str, eth_src_addr_str, old_hwaddr_str);
+    observe_mapping(shard, DB_IPTYPE_6, &ip_src_addr, eth_src_addr, class, shed, timestamp);
 }
 
 
 //
-// Pcap callback for processing packets
+// Get the interface for a VLAN on a trunk
 //
-void pcap_packet_callback(
-    u_char *                    closure,
-    const struct pcap_pkthdr *  pkthdr,
-    const unsigned char *       bytes)
+// NB: The interface for a VLAN is created when the first packet for the VLAN
+//     is seen by any capture worker. It is named for the VLAN in the same way
+//     as a Linux VLAN interface (ifname.vid), so it has its own database.
+//
+static iface_t * vlan_iface(
+    iface_t *                   iface,
+    unsigned int                vid)
 {
-    sqlite3 *                   db = (sqlite3 *) closure;
+    iface_t *                   vlan;
+    char *                      name;
+    size_t                      name_len;
 
-    const unsigned char *       packet = bytes;
-    int                         packet_len = pkthdr->caplen;
+    pthread_mutex_lock(&vlan_mutex);
 
-    struct ether_header *       eth;
-    u_int16_t                   eth_type;
+    if (iface->vlans == NULL)
+    {
+        iface->vlans = calloc(VLAN_ID_COUNT, sizeof(iface_t *));
+        if (iface->vlans == NULL)
+        {
+            fatal("cannot allocate memory for vlan interfaces\n");
+        }
+    }
+
+    vlan = iface->vlans[vid];
+    if (vlan == NULL)
+    {
+        vlan = calloc(1, sizeof(iface_t));
+        name_len = strlen(iface->name) + sizeof(".4095");
+        name = malloc(name_len);
+        if (vlan == NULL || name == NULL)
+        {
+            fatal("cannot allocate memory for vlan interface\n");
+        }
+        snprintf(name, name_len, "%s.%u", iface->name, vid);
+        vlan->name = name;
+
+        vlan->db = db_ipmap_open(vlan->name, DB_READ_WRITE);
+        vlan->next_rowid = db_ipmap_get_max_rowid(vlan->db) + 1;
+        vlan->owner_rows = db_owner_any(vlan->db);
+        vlan->addr6_rows = db_addr6_any(vlan->db);
+        iface->vlans[vid] = vlan;
+
+        logger("monitoring vlan %u on %s as %s\n", vid, iface->name, vlan->name);
+    }
+
+    pthread_mutex_unlock(&vlan_mutex);
+
+    return vlan;
+}
+
+
+//
+// Get the shard for a VLAN on a trunk
+//
+// NB: VLAN shards belong to the capture worker of the parent shard, and are
+//     created when the first packet for the VLAN is seen by the worker.
+//
+shard_t * packet_vlan_shard(
+    shard_t *                   shard,
+    unsigned int                vid)
+{
+    shard_t *                   vlan;
+
+    if (shard->vlans == NULL)
+    {
+        shard->vlans = calloc(VLAN_ID_COUNT, sizeof(shard_t *));
+        if (shard->vlans == NULL)
+        {
+            fatal("cannot allocate memory for vlan shards\n");
+        }
+    }
+
+    vlan = shard->vlans[vid];
+    if (vlan == NULL)
+    {
+        vlan = calloc(1, sizeof(shard_t));
+        if (vlan == NULL)
+        {
+            fatal("cannot allocate memory for vlan shard\n");
+        }
+
+        vlan->iface = vlan_iface(shard->iface, vid);
+        vlan->worker = shard->worker;
+        vlan->workers = shard->workers;
+        __atomic_or_fetch(&vlan->iface->workers, 1ULL << shard->worker, __ATOMIC_RELEASE);
+        vlan->read_db = db_ipmap_open(vlan->iface->name, DB_READ_ONLY);
+        vlan->cache = cache_create(shard->worker);
+        vlan->observe = observe_create();
+        vlan->queue = shard->queue;
+
+        // NB: The first VLAN id of the dedup key is that of the outer tag,
+        //     and the second that of the inner tag
+        vlan->dedup = shard->dedup;
+        vlan->dedup_vlans = shard->dedup_vlans | (vid << (shard->dedup_vlans ? 20 : 8));
+
+        vlan->vlan_next = shard->vlan_list;
+        shard->vlan_list = vlan;
+        shard->vlans[vid] = vlan;
+    }
+
+    return vlan;
+}
+
+
+//
+// Pcap callback for processing packets
+//
+void pcap_packet_callback(
+    u_char *                    closure,
+    const struct pcap_pkthdr *  pkthdr,
+    const unsigned char *       bytes)
+{
+    shard_t *                   shard = (shard_t *) closure;
+
+    const unsigned char *       packet = bytes;
+    int                         packet_len = pkthdr->caplen;
+
+    struct ether_header *       eth;
+    u_int16_t                   eth_type;
     struct ether_addr *         eth_src_addr;
     char                        eth_src_addr_str[ETH_ADDRSTRLEN];
 
+    unsigned int                vid;
+    unsigned int                tags;
+    unsigned int                shed = 0;
+
+    // Skip the packets already processed by the predecessor
+    // NB: A pcap session cannot be handed over on upgrade, so the sessions
+    //     of the predecessor and the successor overlap
+    if (shard->resume_time.tv_sec)
+    {
+        if (timercmp(&pkthdr->ts, &shard->resume_time, <=))
+        {
+            return;
+        }
+        shard->resume_time.tv_sec = 0;
+        shard->resume_time.tv_usec = 0;
+    }
+
+    // Update the packet count and time
+    shard->packets++;
+    shard->packet_time = pkthdr->ts.tv_sec;
+    shard->capture_time = pkthdr->ts;
+
     // Safety check: ensure packet length is sufficient
     if (pkthdr->caplen < sizeof(struct ether_header))
     {
-        logger("packet length (%d) is too short for an ethernet packet\n", pkthdr->caplen);
+        logger_limited("packet length (%d) is too short for an ethernet packet\n", pkthdr->caplen);
         return;
     }
 
@@ -448,38 +1128,736 @@ void pcap_packet_callback(
 
     eth_type = ntohs(eth->ether_type);
     eth_src_addr = (struct ether_addr *) &eth->ether_shost;
-    eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str));
 
     // Safety check: do not process packets from local or broadcast addresses
     if (is_eth_addr_local_or_broadcast(eth_src_addr))
     {
-        logger("received packet with ethernet src addr %s (local or braodcast)\n", eth_src_addr_str);
+        logger_limited("received packet with ethernet src addr %s (local or braodcast)\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)));
         return;
     }
 
+    // Is the source in a storm?
+    if (shard->storm)
+    {
+        shed = (unsigned int) storm_packet(shard->storm, eth_src_addr, pkthdr->ts.tv_sec);
+    }
+
+    // Parse the VLAN tags if monitoring a trunk
+    // NB: VLAN id 0 is a priority tag, and belongs to the parent
+    for (tags = 0; vlan_trunk && tags < VLAN_TAGS_MAX && (eth_type == ETHERTYPE_VLAN || eth_type == ETHERTYPE_QINQ); tags++)
+    {
+        // Safety check: ensure packet length is sufficient for the tag
+        if (packet_len < 4)
+        {
+            logger_limited("received packet from %s with length too short for a vlan tag\n",
+                eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)));
+            return;
+        }
+
+        vid = ((packet[0] << 8) | packet[1]) & 0x0fff;
+        eth_type = (u_int16_t) ((packet[2] << 8) | packet[3]);
+        packet += 4;
+        packet_len -= 4;
+
+        if (vid)
+        {
+            shard = packet_vlan_shard(shard, vid);
+            shard->packets++;
+            shard->packet_time = pkthdr->ts.tv_sec;
+        }
+    }
+
     if (eth_type == ETHERTYPE_ARP)
     {
-        process_arp(db, eth_src_addr_str, packet, packet_len, &pkthdr->ts);
+        process_arp(shard, eth_src_addr, packet, packet_len, shed, &pkthdr->ts);
+    }
+    else if (hostname_enabled && hostname_packet(shard, eth_type, eth_src_addr, packet, packet_len, shed, &pkthdr->ts))
+    {
+        // Hostname announcement
     }
     else if (eth_type == ETHERTYPE_IPV6)
     {
-        process_icmp6(db, eth_src_addr_str, packet, packet_len, &pkthdr->ts);
+        process_icmp6(shard, eth_src_addr, packet, packet_len, shed, &pkthdr->ts);
     }
     else
     {
-        logger("received packet from %s with unexpected ethernet type %d\n", eth_src_addr_str, eth_type);
+        logger_limited("received packet from %s with unexpected ethernet type %d\n",
+            eth_ntop(eth_src_addr, eth_src_addr_str, sizeof(eth_src_addr_str)), eth_type);
+    }
+}
+
+
+//
+// Process a neighbor observed in the kernel neighbor table
+//
+// NB: Entries for the local system, and entries without a hardware address,
+//     are not errors in the neighbor table, and are silently ignored.
+//
+void packet_neighbor(
+    shard_t *                   shard,
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    const struct ether_addr *   hwaddr,
+    const struct timeval *      timestamp)
+{
+    // Update the observation count and time
+    shard->packets++;
+    shard->packet_time = timestamp->tv_sec;
+
+    if (is_eth_addr_local_or_broadcast(hwaddr))
+    {
+        return;
+    }
+
+    // Update the mapping
+    (void) update_mapping(shard, iptype, ipaddr, hwaddr, timestamp);
+}
+
+
+//
+// Get the interval at which pending update times are written
+//
+static time_t flush_interval(void)
+{
+    return (update_interval < UPDATE_FLUSH_INTERVAL) ? (time_t) update_interval : UPDATE_FLUSH_INTERVAL;
+}
+
+
+//
+// Write the pending update times of a shard
+//
+// NB: The refreshed update times are written with the time of the flush,
+//     with a single statement for each batch of rows. If the writer does not
+//     accept a batch, the remaining update times stay pending.
+//
+// Returns 1 if all pending update times were accepted, or 0 if not
+//
+static int flush_updates(
+    shard_t *                   shard,
+    time_t                      now)
+{
+    cache_entry_t *             batch[UPDATE_BATCH_SIZE];
+    cache_entry_t *             entry;
+    record_t                    record;
+    unsigned long               next = 0;
+    unsigned int                count = 0;
+    unsigned int                i;
+
+    do
+    {
+        entry = cache_next(shard->cache, &next);
+        if (entry && entry->dirty)
+        {
+            batch[count++] = entry;
+        }
+
+        if (count == UPDATE_BATCH_SIZE || (entry == NULL && count))
+        {
+            memset(&record, 0, sizeof(record));
+            record.type = RECORD_UTIME;
+            record.iface = shard->iface;
+            record.timestamp.tv_sec = now;
+            record.rowids = malloc(count * sizeof(long));
+            if (record.rowids == NULL)
+            {
+                fatal("cannot allocate memory for update times\n");
+            }
+            for (i = 0; i < count; i++)
+            {
+                record.rowids[i] = batch[i]->rowid;
+            }
+            record.rowid_count = count;
+            if (writer_submit(shard->queue, &record) == 0)
+            {
+                free(record.rowids);
+                return 0;
+            }
+
+            for (i = 0; i < count; i++)
+            {
+                batch[i]->dirty = 0;
+                batch[i]->sequence = queue_position(shard->queue);
+                batch[i]->utime = now;
+            }
+            shard->updates += count;
+            count = 0;
+        }
+    } while (entry);
+
+    shard->dirty_time = 0;
+    return 1;
+}
+
+
+//
+// Get the capture worker that handles an ip address
+//
+// NB: Must match the fanout program in ring.c, which returns the address
+//     (IPv4) or the exclusive or of the words of the address (IPv6). The
+//     kernel selects the socket by the value modulo the number of sockets.
+//
+static unsigned int fanout_worker(
+    db_iptype                   iptype,
+    const void *                ipaddr,
+    unsigned int                workers)
+{
+    uint32_t                    words[4];
+    uint32_t                    value;
+
+    if (iptype == DB_IPTYPE_4)
+    {
+        memcpy(words, ipaddr, sizeof(struct in_addr));
+        value = ntohl(words[0]);
+    }
+    else
+    {
+        memcpy(words, ipaddr, sizeof(struct in6_addr));
+        value = ntohl(words[0]) ^ ntohl(words[1]) ^ ntohl(words[2]) ^ ntohl(words[3]);
+    }
+
+    return value % workers;
+}
+
+
+// Context for loading the mappings of an interface
+typedef struct load_context
+{
+    shard_t *                   shard;
+    unsigned int                workers;
+    unsigned int                stride;
+    time_t                      expire_time;
+    unsigned long               loaded;
+} load_context_t;
+
+
+//
+// Load the current mapping of an ip address into the cache of its shard
+//
+// NB: Grouped IPv6 addresses are left to be read when first seen, as their
+//     current mapping may be held in the addr6 table. Once the cache of a
+//     shard is full, further addresses for the shard are left to be read
+//     when first seen. As the mappings are loaded most recent first when
+//     the cache size is limited, these are the least recently seen.
+//
+static void load_mapping(
+    void *                      context,
+    db_iptype                   iptype,
+    const char *                ipaddr_str,
+    const ipmap_current_t *     current)
+{
+    load_context_t *            load = context;
+    shard_t *                   shard;
+    cache_entry_t *             entry;
+    ip_addr_t                   ipaddr;
+    struct ether_addr           hwaddr;
+
+    if (current->utime <= load->expire_time)
+    {
+        return;
+    }
+    if (inet_pton((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr_str, &ipaddr) != 1)
+    {
+        logger("invalid ip address %s in database\n", ipaddr_str);
+        return;
+    }
+    if (iptype == DB_IPTYPE_6 && aggregate_applies(&ipaddr.ipv6))
+    {
+        return;
+    }
+    if (eth_pton(current->hwaddr_str, &hwaddr) == 0)
+    {
+        logger("invalid hardware address %s in database for %s\n", current->hwaddr_str, ipaddr_str);
+        return;
+    }
+
+    shard = &load->shard[fanout_worker(iptype, &ipaddr, load->workers) * load->stride];
+    if (cache_full(shard->cache))
+    {
+        return;
+    }
+
+    entry = cache_insert(shard->cache, iptype, &ipaddr);
+    entry->hwaddr = hwaddr;
+    entry->rowid = current->rowid;
+    entry->utime = current->utime;
+    load->loaded++;
+}
+
+
+//
+// Load the current mappings for an interface into the caches of its shards
+//
+// NB: Used at startup, so that the first packet from each host does not
+//     require a database lookup. The database is read in a single scan, and
+//     each address is loaded into the cache of the worker that handles it.
+//     The shard for worker n is shard[n * stride].
+//
+// NB: No packets have been seen yet, so mappings are expired against the
+//     current time rather than the expire time of the interface.
+//
+void packet_load(
+    shard_t *                   shard,
+    unsigned int                workers,
+    unsigned int                stride)
+{
+    load_context_t              load;
+    struct timespec             start;
+    struct timespec             end;
+    unsigned long               count;
+
+    memset(&load, 0, sizeof(load));
+    load.shard = shard;
+    load.workers = workers;
+    load.stride = stride;
+    load.expire_time = time(NULL) - (delete_days * 86400);
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+    count = db_ipmap_load_current(shard->read_db, cache_limit != 0, load_mapping, &load);
+    (void) clock_gettime(CLOCK_MONOTONIC, &end);
+
+    logger("loaded %lu of %lu current mappings for %s in %.3f seconds\n",
+        load.loaded, count, shard->iface->name,
+        (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+
+//
+// Write a snapshot of the cache of a shard if one is due
+//
+// NB: Snapshots are driven by packet time, and are also written when capture
+//     stops. Only the mappings of the ipmap table whose writes have been
+//     committed are included, so that the snapshot never holds a mapping the
+//     database does not. A refreshed update time that is not yet written is
+//     included, and marked to be written after a restore.
+//
+// NB: The entries are copied here, and the file is written by the snapshot
+//     thread. No rows for the addresses in the snapshot are added by other
+//     workers, so every row added after the snapshot is taken has a row id
+//     above the last one assigned here.
+//
+void packet_snapshot(
+    shard_t *                   shard,
+    unsigned int                force)
+{
+    snapshot_writer_t *         writer;
+    snapshot_header_t           header;
+    snapshot_entry_t            out;
+    cache_entry_t *             entry;
+    unsigned long               next = 0;
+
+    // Time for a snapshot?
+    if (force == 0)
+    {
+        if (shard->packet_time == 0 || shard->packet_time < shard->snapshot_time)
+        {
+            return;
+        }
+        if (shard->snapshot_time == 0)
+        {
+            // Nothing is due until the first interval has passed
+            shard->snapshot_time = shard->packet_time + SNAPSHOT_INTERVAL;
+            return;
+        }
+    }
+    shard->snapshot_time = shard->packet_time + SNAPSHOT_INTERVAL;
+
+    memset(&header, 0, sizeof(header));
+    header.worker = shard->worker;
+    header.workers = shard->workers;
+    header.time = time(NULL);
+    header.max_rowid = __atomic_load_n(&shard->iface->next_rowid, __ATOMIC_RELAXED) - 1;
+
+    // Add the entries
+    writer = snapshot_create(shard->iface->name, shard->worker);
+    cache_set_committed(shard->cache, queue_committed(shard->queue));
+    while ((entry = cache_next(shard->cache, &next)))
+    {
+        if (entry->multiple || entry->aggregated || cache_written(shard->cache, entry) == 0)
+        {
+            continue;
+        }
+
+        memset(&out, 0, sizeof(out));
+        out.rowid = entry->rowid;
+        out.utime = entry->utime;
+        memcpy(out.addr, &entry->addr, sizeof(out.addr));
+        memcpy(out.hwaddr, &entry->hwaddr, sizeof(out.hwaddr));
+        out.iptype = (uint8_t) entry->iptype;
+        out.flags = entry->dirty ? SNAPSHOT_ENTRY_DIRTY : 0;
+        snapshot_add(writer, &out);
+    }
+
+    snapshot_commit(writer, &header);
+}
+
+
+//
+// Drop the restored mapping of an ip address that has changed since the snapshot
+//
+static void restore_changed(
+    void *                      context,
+    db_iptype                   iptype,
+    const char *                ipaddr_str)
+{
+    load_context_t *            load = context;
+    shard_t *                   shard;
+    ip_addr_t                   ipaddr;
+
+    if (inet_pton((iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6, ipaddr_str, &ipaddr) != 1)
+    {
+        return;
+    }
+
+    shard = &load->shard[fanout_worker(iptype, &ipaddr, load->workers) * load->stride];
+    if (cache_delete(shard->cache, iptype, &ipaddr))
+    {
+        load->loaded--;
+    }
+}
+
+
+//
+// Restore the caches of the shards for an interface from their snapshots
+//
+// NB: Used at startup in place of loading the current mappings from the
+//     database. The snapshots of all capture workers must be valid;
+//     otherwise nothing is restored. Entries are used in place from the
+//     mapped files, and each is restored to the cache of the worker that now
+//     handles it. The shard for worker n is shard[n * stride].
+//
+// NB: The database may have changed since the snapshots were written, such
+//     as after a crash. The mapping of any address with an ipmap row added
+//     after a snapshot was taken, or with owner rows, is dropped, and read
+//     when the address is first seen.
+//
+// NB: Rows lost in a crash may leave the highest row id in the database
+//     below that of a snapshot. Row ids are assigned from above the highest
+//     in any snapshot, so that rows added from here on are found as changes
+//     if the same snapshots are restored again.
+//
+// Returns 1 if the caches were restored, or 0 if not
+//
+int packet_restore(
+    shard_t *                   shard,
+    unsigned int                workers,
+    unsigned int                stride)
+{
+    snapshot_t                  snapshots[CAPTURE_WORKERS_MAX];
+    load_context_t              load;
+    const snapshot_entry_t *    in;
+    shard_t *                   target;
+    cache_entry_t *             entry;
+    struct timespec             start;
+    struct timespec             end;
+    long                        max_rowid;
+    unsigned long               count = 0;
+    unsigned long               restored;
+    unsigned int                snapshot_count;
+    unsigned int                i;
+    uint64_t                    j;
+    int                         valid = 1;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(snapshots, 0, sizeof(snapshots));
+
+    // Map the snapshots
+    if (snapshot_map(shard->iface->name, 0, &snapshots[0]) != 0)
+    {
+        return 0;
+    }
+    snapshot_count = snapshots[0].header->workers;
+    if (snapshot_count < 1 || snapshot_count > CAPTURE_WORKERS_MAX)
+    {
+        snapshot_unmap(&snapshots[0]);
+        return 0;
+    }
+    for (i = 1; i < snapshot_count; i++)
+    {
+        if (snapshot_map(shard->iface->name, i, &snapshots[i]) != 0)
+        {
+            valid = 0;
+            break;
+        }
+    }
+
+    // Do the snapshots belong together?
+    max_rowid = snapshots[0].header->max_rowid;
+    for (i = 0; i < snapshot_count && snapshots[i].header; i++)
+    {
+        if (snapshots[i].header->max_rowid >= shard->iface->next_rowid)
+        {
+            shard->iface->next_rowid = snapshots[i].header->max_rowid + 1;
+        }
+        if (snapshots[i].header->worker != i || snapshots[i].header->workers != snapshot_count)
+        {
+            valid = 0;
+        }
+        else if (snapshots[i].header->max_rowid < max_rowid)
+        {
+            max_rowid = snapshots[i].header->max_rowid;
+        }
+    }
+    if (valid == 0)
+    {
+        logger("snapshot for %s is incomplete, loading from the database\n", shard->iface->name);
+        for (i = 0; i < snapshot_count; i++)
+        {
+            snapshot_unmap(&snapshots[i]);
+        }
+        return 0;
+    }
+
+    // Restore the entries
+    // NB: No packets have been seen yet, so mappings are expired against the
+    //     current time. Grouped IPv6 addresses are left to be read when first
+    //     seen.
+    memset(&load, 0, sizeof(load));
+    load.shard = shard;
+    load.workers = workers;
+    load.stride = stride;
+    load.expire_time = time(NULL) - (delete_days * 86400);
+    for (i = 0; i < snapshot_count; i++)
+    {
+        for (j = 0; j < snapshots[i].header->count; j++)
+        {
+            in = &snapshots[i].entries[j];
+            count++;
+
+            if ((in->iptype != DB_IPTYPE_4 && in->iptype != DB_IPTYPE_6) || in->utime <= load.expire_time)
+            {
+                continue;
+            }
+            if (in->iptype == DB_IPTYPE_6 && aggregate_applies((const struct in6_addr *) in->addr))
+            {
+                continue;
+            }
+
+            target = &shard[fanout_worker((db_iptype) in->iptype, in->addr, workers) * stride];
+            if (cache_full(target->cache))
+            {
+                continue;
+            }
+
+            entry = cache_insert(target->cache, (db_iptype) in->iptype, in->addr);
+            memcpy(&entry->hwaddr, in->hwaddr, sizeof(entry->hwaddr));
+            entry->dirty = (in->flags & SNAPSHOT_ENTRY_DIRTY) != 0;
+            entry->rowid = in->rowid;
+            entry->utime = in->utime;
+            if (entry->dirty && (target->dirty_time == 0 || entry->utime < target->dirty_time))
+            {
+                target->dirty_time = entry->utime;
+            }
+            load.loaded++;
+        }
+        snapshot_unmap(&snapshots[i]);
+    }
+    restored = load.loaded;
+
+    // Drop the mappings that have changed since the snapshots
+    (void) db_ipmap_load_changed(shard->read_db, max_rowid, restore_changed, &load);
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &end);
+    logger("restored %lu of %lu mappings for %s from snapshot (%lu changed since) in %.3f seconds\n",
+        load.loaded, count, shard->iface->name, restored - load.loaded,
+        (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    return 1;
+}
+
+
+//
+// Report the cache statistics for a shard
+//
+static void shard_report(
+    shard_t *                   shard)
+{
+    cache_stats_t               stats;
+
+    cache_stats(shard->cache, &stats);
+    logger("cache for %s: entries %lu, bytes %lu, hit rate %.1f%%, evictions %lu\n",
+        shard->iface->name, stats.entries, stats.bytes,
+        stats.lookups ? (double) stats.hits * 100.0 / (double) stats.lookups : 0.0,
+        stats.evictions);
+}
+
+
+//
+// Acknowledge the expire time of the interface of a shard, and expire its cache
+//
+// NB: If the record is not accepted by the writer, it is tried again with
+//     the next packet, or when the capture loop is next idle.
+//
+// Returns 1 if the expire time was acknowledged, or 0 if not
+//
+static int shard_expire(
+    shard_t *                   shard)
+{
+    record_t                    record;
+    time_t                      expire_time;
+
+    expire_time = __atomic_load_n(&shard->iface->expire_time, __ATOMIC_ACQUIRE);
+    if (expire_time <= shard->expire_time)
+    {
+        return 0;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_MAINTENANCE;
+    record.iface = shard->iface;
+    record.timestamp.tv_sec = expire_time;
+    record.rowid = shard->worker;
+    if (writer_submit(shard->queue, &record) == 0)
+    {
+        return 0;
+    }
+
+    cache_expire(shard->cache, expire_time);
+    shard->expire_time = expire_time;
+
+    // Report the cache statistics
+    shard_report(shard);
+
+    return 1;
+}
+
+
+//
+// Schedule database maintenance for the interface of a shard if it is due
+//
+// NB: Maintenance is driven by packet time. Deleting the expired rows and
+//     the database maintenance itself are performed by the writer thread.
+//     With multiple capture workers, the first worker to find maintenance
+//     due publishes the expire time for the interface. Each worker then
+//     acknowledges the expire time through its queue, and expires its own
+//     cache. The writer only deletes rows once every worker has acknowledged
+//     the expire time, so that no update queued by a worker before it saw
+//     the expire time is written after the row has been deleted.
+//
+static void shard_maintenance(
+    shard_t *                   shard)
+{
+    iface_t *                   iface = shard->iface;
+    time_t                      next_time;
+    time_t                      expire_time;
+
+    // Time to write the pending update times?
+    if (shard->packet_time && shard->packet_time >= shard->flush_time &&
+        flush_updates(shard, shard->packet_time))
+    {
+        shard->flush_time = shard->packet_time + flush_interval();
     }
 
     // Time for database maintenance?
-    if (pkthdr->ts.tv_sec >= next_maintenance_time)
+    // NB: Nothing is due until the first packet has been seen
+    next_time = __atomic_load_n(&iface->next_maintenance_time, __ATOMIC_RELAXED);
+    if (shard->packet_time && shard->packet_time >= next_time &&
+        __atomic_compare_exchange_n(&iface->next_maintenance_time, &next_time, shard->packet_time + DB_UPDATE_INTERVAL,
+                                    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        // Delete old records
-        db_ipmap_delete_old(db, pkthdr->ts.tv_sec - (delete_days * 86400));
+        // Publish the expire time
+        expire_time = shard->packet_time - (delete_days * 86400);
+        if (expire_time > __atomic_load_n(&iface->expire_time, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&iface->expire_time, expire_time, __ATOMIC_RELEASE);
+        }
+
+        // Report the writer statistics
+        writer_report();
+    }
+
+    (void) shard_expire(shard);
+}
 
-        // Perform database maintenance
-        db_maintenance(db);
 
-        // Set the next maintenance time
-        next_maintenance_time = pkthdr->ts.tv_sec + DB_UPDATE_INTERVAL;
+//
+// Report the cache statistics for a shard and its VLANs
+//
+void packet_report(
+    shard_t *                   shard)
+{
+    shard_t *                   vlan;
+
+    shard_report(shard);
+    for (vlan = shard->vlan_list; vlan; vlan = vlan->vlan_next)
+    {
+        packet_report(vlan);
+    }
+}
+
+
+//
+// Schedule database maintenance for a shard and its VLANs if it is due
+//
+void packet_maintenance(
+    shard_t *                   shard)
+{
+    shard_t *                   vlan;
+
+    shard_maintenance(shard);
+    for (vlan = shard->vlan_list; vlan; vlan = vlan->vlan_next)
+    {
+        packet_maintenance(vlan);
+    }
+}
+
+
+//
+// Write the pending update times of a quiet shard and its VLANs
+//
+// NB: Pending update times are written as packet time advances, which it
+//     does not on a quiet interface. The capture loop calls this with the
+//     current time, so that update times pending for longer than the flush
+//     interval are written, and their entries may be evicted, regardless.
+//
+// NB: An expire time published by another worker is also acknowledged
+//     here, as the writer does not delete expired rows until every worker
+//     of the interface has done so, whether or not it sees any packets.
+//
+// Returns 1 if any records were handed to the writer, or 0 if not
+//
+int packet_idle(
+    shard_t *                   shard,
+    time_t                      now)
+{
+    shard_t *                   vlan;
+    int                         written = 0;
+
+    if (shard->dirty_time && now >= shard->dirty_time + flush_interval())
+    {
+        written = 1;
+        if (flush_updates(shard, now))
+        {
+            shard->flush_time = now + flush_interval();
+        }
+    }
+    written |= shard_expire(shard);
+    for (vlan = shard->vlan_list; vlan; vlan = vlan->vlan_next)
+    {
+        written |= packet_idle(vlan, now);
+    }
+
+    return written;
+}
+
+
+//
+// Write the pending update times for a shard and its VLANs
+//
+// NB: Used when capture stops. The writer is flushed until the queue has
+//     room for all of the pending update times.
+//
+void packet_flush(
+    shard_t *                   shard)
+{
+    shard_t *                   vlan;
+
+    while (flush_updates(shard, shard->packet_time) == 0)
+    {
+        writer_flush();
+    }
+    for (vlan = shard->vlan_list; vlan; vlan = vlan->vlan_next)
+    {
+        packet_flush(vlan);
     }
 }
@@ -28,29 +28,75 @@
 //
 
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <memory.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pcap.h>
 
 #include "andwatch.h"
 
 
-#define PCAP_FILTERBUF_SIZE     (sizeof(PCAP_FIXED_FILTER) + PCAP_FILTER_USER_MAX + sizeof(" and ()") - 1)
-
-#define PCAP_FIXED_FILTER       "((arp && not src 0) || " \
+// NB: ARP probes and DAD solicitations, which have no sender address, are
+//     included so that address claims can be observed from the start
+#define PCAP_FIXED_FILTER       "(arp || " \
                                  "(icmp6 && " \
                                    "(icmp6[icmp6type] == icmp6-neighborsolicit || " \
-                                    "icmp6[icmp6type] == icmp6-neighboradvert) && " \
-                                   "not src ::))"
+                                    "icmp6[icmp6type] == icmp6-neighboradvert)))"
+
+// Fixed filter when learning hostnames, adding DHCPv4 and DHCPv6 messages from
+// clients and mDNS responses
+#define PCAP_HOSTNAME_FILTER    "(" PCAP_FIXED_FILTER " || " \
+                                 "(udp && (dst port 67 || src port 546 || src port 5353)))"
+
+// Trunk filter, matching untagged, tagged and double tagged frames
+//
+// NB: Each vlan keyword shifts the offsets for the remainder of the filter,
+//     so the fixed and user filter is repeated at each level of tagging.
+//
+#define PCAP_TRUNK_FORMAT       "(%s) or (vlan and ((%s) or (vlan and (%s))))"
+
+// Interval at which capture workers check for a reloaded filter (milliseconds)
+#define PCAP_RELOAD_INTERVAL    (1000)
+
+
+// Reload of the filter requested (set by signal handler)
+volatile sig_atomic_t           interface_reload_requested = 0;
+
+// Termination requested (set by signal handler to the signal number)
+volatile sig_atomic_t           terminate_requested = 0;
+
+// Generation of the statistics report requested (incremented by signal handler)
+volatile sig_atomic_t           report_generation = 0;
+
+// Current user filter, and the file it is read from
+//
+// NB: The filter, and the exclusion program, are changed only with the
+//     filter mutex held. Each change increments the filter generation, and
+//     each capture worker sets the filters of its own shards when it sees
+//     the generation change.
+//
+static char *                   filter_user = NULL;
+static const char *             filter_filename = NULL;
+static unsigned int             filter_generation = 0;
+static pthread_mutex_t          filter_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 //
 // Open a pcap session
 //
+// NB: If timeout is zero, immediate mode is used. Otherwise packets are
+//     buffered and delivered when the buffer fills or the timeout expires.
+//
 pcap_t * interface_open(
     const char *                interface,
     const int                   snaplen,
-    const int                   promisc)
+    const int                   promisc,
+    const unsigned int          timeout)
 {
     pcap_t *                    pcap;
     int                         r;
@@ -77,10 +123,21 @@ pcap_t * interface_open(
     {
         fatal("pcap_set_promisc failed: %d\n", r);
     }
-    r = pcap_set_immediate_mode(pcap, 1);
-    if (r != 0)
+    if (timeout)
     {
-        fatal("pcap_set_immediate_mode failed: %d\n", r);
+        r = pcap_set_timeout(pcap, (int) timeout);
+        if (r != 0)
+        {
+            fatal("pcap_set_timeout failed: %d\n", r);
+        }
+    }
+    else
+    {
+        r = pcap_set_immediate_mode(pcap, 1);
+        if (r != 0)
+        {
+            fatal("pcap_set_immediate_mode failed: %d\n", r);
+        }
     }
 
     // Activate the pcap session
@@ -110,31 +167,172 @@ pcap_t * interface_open(
 
 
 //
-// Run the pcap interface loop
+// Open a capture file for replay
 //
-void interface_loop(
+pcap_t * interface_open_offline(
+    const char *                filename)
+{
+    pcap_t *                    pcap;
+    char                        errbuf[PCAP_ERRBUF_SIZE];
+
+    memset(errbuf, 0, sizeof(errbuf));
+
+    // Open the capture file
+    pcap = pcap_open_offline(filename, errbuf);
+    if (pcap == NULL)
+    {
+        fatal("pcap_open_offline for %s failed: %s\n", filename, errbuf);
+    }
+
+    // Safety check: ensure the capture file contains ethernet frames
+    if (pcap_datalink(pcap) != DLT_EN10MB)
+    {
+        fatal("capture file %s does not contain ethernet frames\n", filename);
+    }
+
+    return pcap;
+}
+
+
+//
+// Replay a capture file
+//
+// NB: Packets are processed as fast as possible. The writer thread is woken
+//     for each REPLAY_BATCH_SIZE packets, after the pending last seen times
+//     are written, and database maintenance is scheduled once at the end of
+//     the replay.
+//
+void interface_replay(
+    shard_t *                   shard,
+    pcap_handler                callback)
+{
+    int                         r;
+
+    // Set the filter
+    interface_setfilter(shard->pcap, filter_user);
+
+    // Process the file
+    while (1)
+    {
+        r = pcap_dispatch(shard->pcap, REPLAY_BATCH_SIZE, callback, (u_char *) shard);
+        packet_flush(shard);
+        writer_signal();
+
+        if (r == PCAP_ERROR)
+        {
+            fatal("pcap_dispatch for %s failed: %s\n", shard->iface->name, pcap_geterr(shard->pcap));
+        }
+        if (r == 0)
+        {
+            break;
+        }
+    }
+
+    // Perform database maintenance
+    packet_maintenance(shard);
+    writer_signal();
+}
+
+
+//
+// Compile the capture filter
+//
+// Returns 0 on success, or -1 if the filter is invalid
+//
+static int filter_compile(
     pcap_t *                    pcap,
     const char *                user_filter,
-    pcap_handler                callback,
-    void *                      closure)
+    struct bpf_program *        program)
 {
-    struct bpf_program          program;
-    char                        filter[PCAP_FILTERBUF_SIZE] = PCAP_FIXED_FILTER;
+    const char *                fixed_filter = hostname_enabled ? PCAP_HOSTNAME_FILTER : PCAP_FIXED_FILTER;
+    char *                      level;
+    char *                      filter;
+    size_t                      level_size;
+    size_t                      filter_size;
     int                         r;
 
+    level_size = strlen(fixed_filter) + 1 + (user_filter ? strlen(user_filter) + sizeof(" and ()") : 0);
+    filter_size = sizeof(PCAP_TRUNK_FORMAT) + 3 * level_size;
+    level = malloc(level_size);
+    filter = malloc(filter_size);
+    if (level == NULL || filter == NULL)
+    {
+        fatal("cannot allocate memory for capture filter\n");
+    }
+
     // If the user passed in a filter, append it
     if (user_filter)
     {
-        snprintf(filter + sizeof(PCAP_FIXED_FILTER) - 1, sizeof(filter) - sizeof(PCAP_FIXED_FILTER), " and (%s)", user_filter);
+        snprintf(level, level_size, "%s and (%s)", fixed_filter, user_filter);
+    }
+    else
+    {
+        safe_strncpy(level, fixed_filter, level_size);
+    }
+
+    // If monitoring a trunk, also match tagged frames
+    if (vlan_trunk)
+    {
+        snprintf(filter, filter_size, PCAP_TRUNK_FORMAT, level, level, level);
+    }
+    else
+    {
+        safe_strncpy(filter, level, filter_size);
     }
 
     // Compile the filter
-    r = pcap_compile(pcap, &program, filter, 1, PCAP_NETMASK_UNKNOWN);
+    r = pcap_compile(pcap, program, filter, 1, PCAP_NETMASK_UNKNOWN);
+    free(level);
+    free(filter);
     if (r == PCAP_ERROR)
     {
-        fatal("pcap_compile failed: %s\n", pcap_geterr(pcap));
+        logger("pcap_compile failed: %s\n", pcap_geterr(pcap));
+        return -1;
+    }
+
+    // Add the exclusions
+    r = exclude_apply(program);
+    if (r != 0)
+    {
+        pcap_freecode(program);
+        return -1;
     }
 
+    return 0;
+}
+
+
+//
+// Compile the capture filter
+//
+void interface_compile(
+    pcap_t *                    pcap,
+    const char *                user_filter,
+    struct bpf_program *        program)
+{
+    int                         r;
+
+    r = filter_compile(pcap, user_filter, program);
+    if (r != 0)
+    {
+        fatal("cannot compile capture filter\n");
+    }
+}
+
+
+//
+// Set the capture filter for a pcap session
+//
+void interface_setfilter(
+    pcap_t *                    pcap,
+    const char *                user_filter)
+{
+    struct bpf_program          program;
+    int                         r;
+
+    // Compile the filter
+    interface_compile(pcap, user_filter, &program);
+
     // Set the filter
     r = pcap_setfilter(pcap, &program);
     if (r != 0)
@@ -142,7 +340,491 @@ void interface_loop(
         fatal("pcap_setfilter failed: %s\n", pcap_geterr(pcap));
     }
     pcap_freecode(&program);
+}
+
+
+//
+// Set the filter and start capture for a shard
+//
+void interface_start(
+    shard_t *                   shard)
+{
+    char                        errbuf[PCAP_ERRBUF_SIZE];
+    int                         r;
+
+    if (shard->ring)
+    {
+        ring_start(shard->ring, filter_user);
+        shard->dedup = shard->ring;
+        return;
+    }
+    if (shard->neigh)
+    {
+        neigh_start(shard->neigh);
+        return;
+    }
+
+    interface_setfilter(shard->pcap, filter_user);
+
+    r = pcap_setnonblock(shard->pcap, 1, errbuf);
+    if (r == PCAP_ERROR)
+    {
+        fatal("pcap_setnonblock for interface %s failed: %s\n", shard->iface->name, errbuf);
+    }
+}
+
+
+//
+// Process the packets waiting in the pcap session of a shard
+//
+// NB: The session must be in non blocking mode.
+//
+void interface_drain(
+    shard_t *                   shard,
+    pcap_handler                callback)
+{
+    int                         r;
+
+    do
+    {
+        r = pcap_dispatch(shard->pcap, -1, callback, (u_char *) shard);
+    }
+    while (r > 0);
+
+    if (r == PCAP_ERROR)
+    {
+        logger("pcap_dispatch for interface %s failed: %s\n", shard->iface->name, pcap_geterr(shard->pcap));
+    }
+    writer_signal();
+}
+
+
+//
+// Set the filter for a capture adopted from a predecessor
+//
+// NB: The filter of the predecessor remains attached until it is replaced.
+//
+void interface_resume(
+    shard_t *                   shard)
+{
+    if (shard->ring)
+    {
+        ring_setfilter(shard->ring, filter_user);
+        shard->dedup = shard->ring;
+    }
+}
+
+
+//
+// Read the user filter from a file
+//
+// Lines are joined, and text following a '#' is ignored.
+//
+// Returns the filter, NULL if the file could not be read, or an empty string
+// if the file contains no filter
+//
+static char * filter_read(
+    const char *                filename)
+{
+    FILE *                      file;
+    char                        line[PCAP_FILTER_FILE_MAX];
+    char *                      filter;
+    char *                      p;
+    size_t                      len = 0;
+    size_t                      n;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        logger("cannot open filter file %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    filter = calloc(1, PCAP_FILTER_FILE_MAX);
+    if (filter == NULL)
+    {
+        fatal("cannot allocate memory for capture filter\n");
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        // Remove comments and whitespace
+        p = strchr(line, '#');
+        if (p)
+        {
+            *p = 0;
+        }
+        p = line + strspn(line, " \t\r\n");
+        n = strlen(p);
+        while (n && strchr(" \t\r\n", p[n - 1]))
+        {
+            n--;
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+
+        // Append the line
+        if (len + n + 2 > PCAP_FILTER_FILE_MAX)
+        {
+            logger("filter file %s exceeds maximum length of %d\n", filename, PCAP_FILTER_FILE_MAX);
+            free(filter);
+            filter = NULL;
+            break;
+        }
+        if (len)
+        {
+            filter[len++] = ' ';
+        }
+        memcpy(filter + len, p, n);
+        len += n;
+        filter[len] = 0;
+    }
+    (void) fclose(file);
+
+    return filter;
+}
+
+
+//
+// Set the user filter
+//
+// NB: If a filter file is given, the filter is read from the file, and is
+//     read again each time the filter is reloaded.
+//
+void interface_filter_init(
+    const char *                user_filter,
+    const char *                filename)
+{
+    if (filename)
+    {
+        filter_filename = filename;
+        filter_user = filter_read(filename);
+        if (filter_user == NULL)
+        {
+            fatal("cannot load filter file %s\n", filename);
+        }
+        if (*filter_user == 0)
+        {
+            free(filter_user);
+            filter_user = NULL;
+        }
+    }
+    else if (user_filter)
+    {
+        filter_user = strdup(user_filter);
+        if (filter_user == NULL)
+        {
+            fatal("cannot allocate memory for capture filter\n");
+        }
+    }
+}
+
+
+//
+// Reload the user filter and the exclusions
+//
+// NB: Only the settings that have changed are replaced. The new filter is
+//     compiled before it is accepted, and if it is invalid the current filter
+//     and exclusions remain in use. If anything has changed, the filter
+//     generation is incremented so that the capture workers set the new
+//     filter on their shards.
+//
+void interface_reload(void)
+{
+    char *                      user_filter = filter_user;
+    pcap_t *                    pcap;
+    struct bpf_program          program;
+    int                         filter_changed = 0;
+    int                         exclude_changed;
+    int                         r;
+
+    pthread_mutex_lock(&filter_mutex);
+
+    // Read the filter file
+    if (filter_filename)
+    {
+        user_filter = filter_read(filter_filename);
+        if (user_filter == NULL)
+        {
+            logger("reload failed: keeping the current filter and exclusions\n");
+            pthread_mutex_unlock(&filter_mutex);
+            return;
+        }
+        if (*user_filter == 0)
+        {
+            free(user_filter);
+            user_filter = NULL;
+        }
+
+        if ((user_filter == NULL) != (filter_user == NULL) ||
+            (user_filter && strcmp(user_filter, filter_user) != 0))
+        {
+            filter_changed = 1;
+        }
+    }
+
+    // Read the exclusion file
+    exclude_changed = exclude_reload();
+    if (exclude_changed == -1)
+    {
+        r = -1;
+    }
+    else if (filter_changed || exclude_changed)
+    {
+        // Ensure the new filter compiles
+        pcap = pcap_open_dead(DLT_EN10MB, PCAP_SNAPLEN);
+        if (pcap == NULL)
+        {
+            fatal("pcap_open_dead failed\n");
+        }
+        r = filter_compile(pcap, user_filter, &program);
+        if (r == 0)
+        {
+            pcap_freecode(&program);
+        }
+        pcap_close(pcap);
+
+        if (r != 0 && exclude_changed)
+        {
+            exclude_revert();
+        }
+    }
+    else
+    {
+        r = 0;
+    }
+
+    if (r != 0)
+    {
+        logger("reload failed: keeping the current filter and exclusions\n");
+        filter_changed = 0;
+    }
+    else if (filter_changed || exclude_changed)
+    {
+        if (filter_changed)
+        {
+            logger("filter reloaded from %s: %s\n", filter_filename, user_filter ? user_filter : "(none)");
+        }
+        __atomic_add_fetch(&filter_generation, 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        logger("reload: filter and exclusions are unchanged\n");
+    }
+
+    // Replace the user filter
+    if (filter_changed)
+    {
+        free(filter_user);
+        filter_user = user_filter;
+    }
+    else if (user_filter != filter_user)
+    {
+        free(user_filter);
+    }
+
+    pthread_mutex_unlock(&filter_mutex);
+}
+
+
+//
+// Set the current filter on a set of shards
+//
+static void interface_refilter(
+    shard_t *                   shards,
+    unsigned int                count)
+{
+    shard_t *                   shard;
+    unsigned int                i;
+
+    pthread_mutex_lock(&filter_mutex);
+
+    for (i = 0; i < count; i++)
+    {
+        shard = &shards[i];
+
+        if (shard->ring)
+        {
+            ring_setfilter(shard->ring, filter_user);
+        }
+        else if (shard->pcap)
+        {
+            interface_setfilter(shard->pcap, filter_user);
+        }
+    }
+
+    pthread_mutex_unlock(&filter_mutex);
+}
+
+
+//
+// Run the capture loop for a set of shards
+//
+// NB: If batch_size is non zero, up to batch_size packets are processed per
+//     wakeup (or all ready blocks for a ring). Database writes are queued
+//     for the writer thread, which is woken once per wakeup. Each capture
+//     worker runs its own loop over its own shards.
+//
+// NB: Signals are handled by the main thread, which runs the first worker.
+//     Other workers may not be woken by a signal, so the poll times out
+//     periodically to check whether the filter has been reloaded.
+//
+// NB: The loop returns when an upgrade or termination is requested.
+//
+void interface_loop(
+    shard_t *                   shards,
+    unsigned int                count,
+    unsigned int                batch_size,
+    pcap_handler                callback)
+{
+    struct pollfd *             pfds;
+    shard_t *                   shard;
+    unsigned int                generation;
+    sig_atomic_t                report;
+    time_t                      now;
+    int                         idle;
+    unsigned int                i;
+    int                         r;
+
+    generation = __atomic_load_n(&filter_generation, __ATOMIC_ACQUIRE);
+    report = report_generation;
+
+    pfds = calloc(count, sizeof(struct pollfd));
+    if (pfds == NULL)
+    {
+        fatal("cannot allocate memory for poll descriptors\n");
+    }
+
+    // Get the selectable file descriptors
+    for (i = 0; i < count; i++)
+    {
+        shard = &shards[i];
+
+        if (shard->ring)
+        {
+            pfds[i].fd = ring_get_fd(shard->ring);
+        }
+        else if (shard->neigh)
+        {
+            pfds[i].fd = neigh_get_fd(shard->neigh);
+        }
+        else
+        {
+            pfds[i].fd = pcap_get_selectable_fd(shard->pcap);
+            if (pfds[i].fd < 0)
+            {
+                fatal("interface %s does not provide a selectable fd\n", shard->iface->name);
+            }
+        }
+        pfds[i].events = POLLIN;
+    }
 
     // Start the party
-    pcap_loop(pcap, 0, callback, closure);
+    while (1)
+    {
+        r = poll(pfds, count, PCAP_RELOAD_INTERVAL);
+
+        // Statistics report requested?
+        if (writer_report_requested)
+        {
+            writer_report_requested = 0;
+            writer_report();
+        }
+
+        // Cache statistics report requested?
+        // NB: Each worker reports the caches of its own shards
+        if (report_generation != report)
+        {
+            report = report_generation;
+            for (i = 0; i < count; i++)
+            {
+                packet_report(&shards[i]);
+            }
+        }
+
+        // Filter reload requested?
+        if (interface_reload_requested)
+        {
+            interface_reload_requested = 0;
+            interface_reload();
+        }
+
+        // Filter changed?
+        if (__atomic_load_n(&filter_generation, __ATOMIC_ACQUIRE) != generation)
+        {
+            generation = __atomic_load_n(&filter_generation, __ATOMIC_ACQUIRE);
+            interface_refilter(shards, count);
+        }
+
+        // Upgrade or termination requested?
+        if (upgrade_requested || terminate_requested)
+        {
+            break;
+        }
+
+        // Report suppressed log messages
+        logger_summary();
+
+        // Write the update times pending on quiet interfaces
+        now = time(NULL);
+        idle = 0;
+        for (i = 0; i < count; i++)
+        {
+            idle |= packet_idle(&shards[i], now);
+        }
+        if (idle)
+        {
+            writer_signal();
+        }
+
+        if (r == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fatal("poll failed: %s\n", strerror(errno));
+        }
+        if (r == 0)
+        {
+            continue;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if (pfds[i].revents == 0)
+            {
+                continue;
+            }
+
+            shard = &shards[i];
+            if (shard->ring)
+            {
+                (void) ring_dispatch(shard->ring, callback, shard);
+            }
+            else if (shard->neigh)
+            {
+                (void) neigh_dispatch(shard->neigh, shard);
+            }
+            else
+            {
+                r = pcap_dispatch(shard->pcap, batch_size ? (int) batch_size : -1, callback, (u_char *) shard);
+                if (r == PCAP_ERROR)
+                {
+                    fatal("pcap_dispatch for interface %s failed: %s\n", shard->iface->name, pcap_geterr(shard->pcap));
+                }
+            }
+
+            // Time for database maintenance or a snapshot?
+            packet_maintenance(shard);
+            packet_snapshot(shard, 0);
+        }
+
+        // Wake the database writer
+        writer_signal();
+    }
+
+    free(pfds);
 }
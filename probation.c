@@ -0,0 +1,269 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+
+#include "andwatch.h"
+
+
+// Number of entries in a probation table, and the number of ways (entries
+// per set). Both must be powers of 2.
+#define PROBATION_ENTRIES       (1024)
+#define PROBATION_WAYS          (4)
+
+// Time after which an address that has not been admitted is forgotten (seconds)
+#define PROBATION_EXPIRE        (3600)
+
+
+// Admission requirements for each class of IPv6 address
+//
+// NB: The defaults admit link-local addresses immediately, and require
+//     global and unique local addresses to be seen twice. Because repeats
+//     within a few seconds are collapsed, two sightings are a few seconds
+//     apart.
+probation_config_t              probation_config[PROBATION_CLASSES] =
+{
+    [PROBATION_LINK_LOCAL]      = { 1, 0 },
+    [PROBATION_ULA]             = { 2, 0 },
+    [PROBATION_GLOBAL]          = { 2, 0 }
+};
+
+static const char *             probation_class_names[PROBATION_CLASSES] =
+{
+    [PROBATION_LINK_LOCAL]      = "link-local",
+    [PROBATION_ULA]             = "ula",
+    [PROBATION_GLOBAL]          = "global"
+};
+
+
+// An address on probation
+typedef struct probation_entry
+{
+    // IPv6 address
+    struct in6_addr             addr;
+
+    // Hardware address
+    struct ether_addr           hwaddr;
+
+    // Number of times seen (zero indicates an unused entry)
+    uint16_t                    count;
+
+    // Time first seen
+    time_t                      first;
+} probation_entry_t;
+
+
+//
+// Table of IPv6 addresses on probation
+//
+// NB: The table is set associative. When a set is full, the entry that was
+//     first seen longest ago is evicted. The table is only allocated when
+//     the first address is placed on probation.
+//
+struct probation
+{
+    probation_entry_t           entries[PROBATION_ENTRIES];
+};
+
+
+
+//
+// Parse a probation requirement (class:count[:secs])
+//
+// Returns 0 on success, or -1 if the requirement is invalid
+//
+int probation_parse(
+    const char *                spec)
+{
+    const char *                colon;
+    char *                      p;
+    unsigned long               count;
+    unsigned long               secs = 0;
+    size_t                      len;
+    unsigned int                i;
+
+    colon = strchr(spec, ':');
+    if (colon == NULL)
+    {
+        return -1;
+    }
+    len = (size_t) (colon - spec);
+
+    for (i = 0; i < PROBATION_CLASSES; i++)
+    {
+        if (strlen(probation_class_names[i]) == len && strncmp(spec, probation_class_names[i], len) == 0)
+        {
+            break;
+        }
+    }
+    if (i == PROBATION_CLASSES)
+    {
+        return -1;
+    }
+
+    count = strtoul(colon + 1, &p, 10);
+    if (p == colon + 1 || count < 1 || count > UINT16_MAX)
+    {
+        return -1;
+    }
+    if (*p == ':')
+    {
+        secs = strtoul(p + 1, &p, 10);
+        if (secs > PROBATION_EXPIRE)
+        {
+            return -1;
+        }
+    }
+    if (*p != '\0')
+    {
+        return -1;
+    }
+
+    probation_config[i].count = (unsigned int) count;
+    probation_config[i].secs = (unsigned int) secs;
+    return 0;
+}
+
+
+//
+// Get the probation class of an IPv6 address
+//
+static probation_class probation_classify(
+    const struct in6_addr *     addr)
+{
+    if (IN6_IS_ADDR_LINKLOCAL(addr))
+    {
+        return PROBATION_LINK_LOCAL;
+    }
+    if ((addr->s6_addr[0] & 0xfe) == 0xfc)
+    {
+        return PROBATION_ULA;
+    }
+    return PROBATION_GLOBAL;
+}
+
+
+//
+// Check admission of a new IPv6 address
+//
+// An address is admitted once it has been seen count times with the same
+// hardware address, or if it is seen again at least secs seconds after it
+// was first seen. The table is created on first use.
+//
+// Returns 1 if the address is admitted, 0 if it remains on probation, or -1
+// if it has just been placed on probation (first seen, or seen with a
+// different hardware address)
+//
+int probation_admit(
+    probation_t **              table,
+    const struct in6_addr *     addr,
+    const struct ether_addr *   hwaddr,
+    time_t                      now)
+{
+    const probation_config_t *  config;
+    probation_t *               probation;
+    probation_entry_t *         set;
+    probation_entry_t *         entry = NULL;
+    probation_entry_t *         victim;
+    uint32_t                    h = 2166136261U;
+    uint32_t                    w;
+    unsigned int                i;
+
+    config = &probation_config[probation_classify(addr)];
+    if (config->count <= 1)
+    {
+        return 1;
+    }
+
+    probation = *table;
+    if (probation == NULL)
+    {
+        probation = calloc(1, sizeof(probation_t));
+        if (probation == NULL)
+        {
+            fatal("cannot allocate memory for probation table\n");
+        }
+        *table = probation;
+    }
+
+    // Find the set (FNV-1a over the words of the address)
+    for (i = 0; i < sizeof(*addr); i += sizeof(w))
+    {
+        memcpy(&w, &addr->s6_addr[i], sizeof(w));
+        h = (h ^ w) * 16777619U;
+    }
+    h ^= h >> 16;
+    set = &probation->entries[(h & (PROBATION_ENTRIES / PROBATION_WAYS - 1)) * PROBATION_WAYS];
+
+    // Find the entry, or the entry to be replaced
+    victim = &set[0];
+    for (i = 0; i < PROBATION_WAYS; i++)
+    {
+        if (set[i].count && now - set[i].first >= PROBATION_EXPIRE)
+        {
+            set[i].count = 0;
+        }
+        if (set[i].count && memcmp(&set[i].addr, addr, sizeof(*addr)) == 0)
+        {
+            entry = &set[i];
+            break;
+        }
+        if (victim->count && (set[i].count == 0 || set[i].first < victim->first))
+        {
+            victim = &set[i];
+        }
+    }
+
+    // First seen, or seen with a different hardware address?
+    if (entry == NULL || memcmp(&entry->hwaddr, hwaddr, sizeof(*hwaddr)) != 0)
+    {
+        if (entry == NULL)
+        {
+            entry = victim;
+        }
+        entry->addr = *addr;
+        entry->hwaddr = *hwaddr;
+        entry->count = 1;
+        entry->first = now;
+        return -1;
+    }
+
+    entry->count++;
+    if (entry->count >= config->count || (config->secs && now - entry->first >= (time_t) config->secs))
+    {
+        entry->count = 0;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "andwatch.h"
+
+
+//
+// Bounded single producer / single consumer queue of records
+//
+// NB: The producer owns tail and the producer statistics, the consumer owns
+//     head and committed. Each side publishes its index with release semantics and reads
+//     the other side's index with acquire semantics, so no locks are needed.
+//     The indexes are kept on separate cache lines to avoid false sharing.
+//
+struct queue
+{
+    // Records
+    record_t *                  records;
+    unsigned long               size;
+    unsigned long               mask;
+
+    // Consumer index, and the index up to which records are committed
+    __attribute__ ((aligned (64)))
+    unsigned long               head;
+    unsigned long               committed;
+
+    // Producer index and statistics
+    __attribute__ ((aligned (64)))
+    unsigned long               tail;
+    unsigned long               high_water;
+    unsigned long               overflows;
+};
+
+
+
+//
+// Create a queue
+//
+// NB: The size is rounded up to a power of 2
+//
+queue_t * queue_create(
+    unsigned long               size)
+{
+    queue_t *                   queue;
+    unsigned long               actual_size = 1;
+
+    while (actual_size < size)
+    {
+        actual_size <<= 1;
+    }
+
+    queue = aligned_alloc(64, (sizeof(queue_t) + 63) & ~63UL);
+    if (queue == NULL)
+    {
+        fatal("cannot allocate memory for queue\n");
+    }
+    memset(queue, 0, sizeof(queue_t));
+
+    queue->records = calloc(actual_size, sizeof(record_t));
+    if (queue->records == NULL)
+    {
+        fatal("cannot allocate memory for queue\n");
+    }
+    queue->size = actual_size;
+    queue->mask = actual_size - 1;
+
+    return queue;
+}
+
+
+//
+// Add a record to a queue (producer)
+//
+// Returns 1 if the record was queued, or 0 if the queue is full
+//
+int queue_push(
+    queue_t *                   queue,
+    const record_t *            record)
+{
+    unsigned long               tail = queue->tail;
+    unsigned long               head;
+    unsigned long               depth;
+
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head >= queue->size)
+    {
+        __atomic_store_n(&queue->overflows, queue->overflows + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    queue->records[tail & queue->mask] = *record;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    depth = tail + 1 - head;
+    if (depth > queue->high_water)
+    {
+        __atomic_store_n(&queue->high_water, depth, __ATOMIC_RELAXED);
+    }
+
+    return 1;
+}
+
+
+//
+// Remove a record from a queue (consumer)
+//
+// Returns 1 if a record was removed, or 0 if the queue is empty
+//
+int queue_pop(
+    queue_t *                   queue,
+    record_t *                  record)
+{
+    unsigned long               head = queue->head;
+    unsigned long               tail;
+
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+        return 0;
+    }
+
+    *record = queue->records[head & queue->mask];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+
+//
+// Get the position of the next record to be added to a queue (producer)
+//
+unsigned long queue_position(
+    queue_t *                   queue)
+{
+    return queue->tail;
+}
+
+
+//
+// Mark all records removed from a queue as committed (consumer)
+//
+void queue_commit(
+    queue_t *                   queue)
+{
+    __atomic_store_n(&queue->committed, queue->head, __ATOMIC_RELEASE);
+}
+
+
+//
+// Get the position up to which records in a queue are committed
+//
+// NB: Records before the position have been removed from the queue and
+//     written to the database.
+//
+unsigned long queue_committed(
+    queue_t *                   queue)
+{
+    return __atomic_load_n(&queue->committed, __ATOMIC_ACQUIRE);
+}
+
+
+//
+// Get the statistics for a queue
+//
+// NB: May be called from any thread. The statistics are approximate.
+//
+void queue_stats(
+    queue_t *                   queue,
+    queue_stats_t *             stats)
+{
+    unsigned long               head;
+    unsigned long               tail;
+
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    stats->size = queue->size;
+    stats->depth = (tail > head) ? tail - head : 0;
+    stats->high_water = __atomic_load_n(&queue->high_water, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&queue->overflows, __ATOMIC_RELAXED);
+}
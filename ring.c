@@ -0,0 +1,876 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pcap.h>
+
+#include "andwatch.h"
+
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+
+// Number of blocks in the ring
+#define RING_BLOCK_COUNT        (8)
+
+// Minimum frame size in the ring
+#define RING_FRAME_SIZE         (2048)
+
+
+//
+// Fanout program
+//
+// NB: The return value of the program, modulo the number of sockets in the
+//     fanout group, selects the socket that receives the packet. The value
+//     is taken from the sender protocol address for ARP and from the source
+//     address for IPv6, so a given ip address is always handled by the same
+//     worker. For an ARP probe or a DAD solicitation, which have no sender
+//     address, the value is taken from the target address instead, so the
+//     probe is handled by the worker that holds the current state for the
+//     address. Offsets are relative to the network header. On a trunk, the
+//     outer VLAN tag has been removed by the kernel, and frames that carry
+//     a second (inner) tag are all handled by the same worker.
+//
+static struct sock_filter       fanout_insns[] =
+{
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_ARP, 0, 4),
+
+    // ARP: sender protocol address, or target protocol address for a probe
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 24),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 30),
+
+    // IPv6: is the source address unspecified?
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 17),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 15),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 13),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 11),
+
+    // IPv6 DAD: exclusive or of the words of the target address
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 48),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 52),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 56),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 60),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+
+    // IPv6: exclusive or of the words of the source address
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+
+    // Other
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+// Program that accepts no packets
+static struct sock_filter       drop_insns[] =
+{
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+
+//
+// Memory mapped TPACKET_V3 receive ring
+//
+// NB: The kernel fills blocks of frames and hands each block to user space
+//     when it is full, or when the block retire timeout expires. Frames are
+//     processed in place, and the block is returned to the kernel once all
+//     of its frames have been processed.
+//
+struct ring
+{
+    // Packet socket
+    int                         fd;
+
+    // Interface index
+    int                         ifindex;
+
+    // Mapped ring
+    unsigned char *             map;
+    size_t                      map_len;
+
+    // Block information
+    unsigned int                block_size;
+    unsigned int                block_count;
+    unsigned int                block_index;
+
+    // Snapshot length
+    int                         snaplen;
+
+    // Part of a fanout group (zero if not)
+    unsigned int                fanout;
+
+    // Dedup filter program and map (-1 if not used)
+    int                         dedup_fd;
+    int                         dedup_map_fd;
+
+    // User filter and exclusions, applied in user space when the dedup
+    // filter is used
+    struct bpf_program          user_program;
+    int                         user_program_valid;
+
+    // Buffer for reinserting the VLAN tag of a frame on a trunk
+    unsigned char *             vlan_frame;
+};
+
+
+//
+// Fanout group of an interface
+//
+typedef struct ring_fanout
+{
+    struct ring_fanout *        next;
+    int                         ifindex;
+    unsigned int                id;
+} ring_fanout_t;
+
+// Fanout groups created (main thread)
+static ring_fanout_t *          ring_fanouts = NULL;
+
+
+
+//
+// Allocate a ring for an interface
+//
+static ring_t * ring_create(
+    const char *                interface,
+    const int                   snaplen,
+    const unsigned int          fanout)
+{
+    ring_t *                    ring;
+
+    ring = calloc(1, sizeof(ring_t));
+    if (ring == NULL)
+    {
+        fatal("cannot allocate memory for ring\n");
+    }
+    ring->snaplen = snaplen;
+    ring->fanout = fanout;
+    ring->dedup_fd = -1;
+    ring->dedup_map_fd = -1;
+
+    // Allocate the buffer for reinserting VLAN tags
+    if (vlan_trunk)
+    {
+        ring->vlan_frame = malloc((size_t) snaplen + 4);
+        if (ring->vlan_frame == NULL)
+        {
+            fatal("cannot allocate memory for ring vlan frame\n");
+        }
+    }
+
+    // Look up the interface
+    ring->ifindex = (int) if_nametoindex(interface);
+    if (ring->ifindex == 0)
+    {
+        fatal("interface %s not found: %s\n", interface, strerror(errno));
+    }
+
+    return ring;
+}
+
+
+//
+// Map the blocks of a ring
+//
+static void ring_map(
+    ring_t *                    ring)
+{
+    ring->map_len = (size_t) ring->block_size * ring->block_count;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED)
+    {
+        fatal("mmap of packet ring failed: %s\n", strerror(errno));
+    }
+}
+
+
+//
+// Open a TPACKET_V3 ring on an interface
+//
+ring_t * ring_open(
+    const char *                interface,
+    const int                   snaplen,
+    const int                   promisc,
+    const unsigned int          block_size,
+    const unsigned int          timeout,
+    const unsigned int          fanout,
+    const unsigned int          dedup_window)
+{
+    ring_t *                    ring;
+    struct tpacket_req3         req;
+    struct packet_mreq          mreq;
+    unsigned int                frame_size;
+    unsigned int                page_size;
+    int                         version = TPACKET_V3;
+    int                         r;
+
+    ring = ring_create(interface, snaplen, fanout);
+
+    // Load the dedup filter
+    // NB: Loading requires privileges, so it is done here rather than in ring_start
+    if (dedup_window)
+    {
+        ring->dedup_fd = ebpf_dedup_open(snaplen, dedup_window, RING_DEDUP_ENTRIES, vlan_trunk, &ring->dedup_map_fd);
+    }
+
+    // Create the packet socket
+    //
+    // NB: The socket is created with a protocol of zero so that no packets
+    //     are received until the filter is attached and the socket is bound
+    //     in ring_start.
+    ring->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (ring->fd == -1)
+    {
+        fatal("packet socket for interface %s failed: %s\n", interface, strerror(errno));
+    }
+
+    // Select TPACKET_V3
+    r = setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+    if (r == -1)
+    {
+        fatal("setsockopt PACKET_VERSION failed: %s\n", strerror(errno));
+    }
+
+    // Determine the frame and block sizes
+    //
+    // NB: The block size must be a multiple of the page size, and must hold
+    //     at least one frame.
+    frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + snaplen);
+    if (frame_size < RING_FRAME_SIZE)
+    {
+        frame_size = RING_FRAME_SIZE;
+    }
+    page_size = (unsigned int) sysconf(_SC_PAGESIZE);
+    ring->block_size = (block_size + page_size - 1) / page_size * page_size;
+    if (ring->block_size < frame_size)
+    {
+        ring->block_size = (frame_size + page_size - 1) / page_size * page_size;
+    }
+    ring->block_count = RING_BLOCK_COUNT;
+
+    // Create the ring
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ring->block_size;
+    req.tp_block_nr = ring->block_count;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (ring->block_size / frame_size) * ring->block_count;
+    req.tp_retire_blk_tov = timeout;
+    r = setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    if (r == -1)
+    {
+        fatal("setsockopt PACKET_RX_RING failed: %s\n", strerror(errno));
+    }
+
+    // Map the ring
+    ring_map(ring);
+
+    // Enable promiscuous mode if requested
+    if (promisc)
+    {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ring->ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        r = setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+        if (r == -1)
+        {
+            fatal("setsockopt PACKET_ADD_MEMBERSHIP failed: %s\n", strerror(errno));
+        }
+    }
+
+    return ring;
+}
+
+
+//
+// Attach a program to the ring socket
+//
+static void ring_attach(
+    ring_t *                    ring,
+    struct sock_filter *        insns,
+    unsigned short              len)
+{
+    struct sock_fprog           fprog;
+    int                         r;
+
+    fprog.len = len;
+    fprog.filter = insns;
+    r = setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+    if (r == -1)
+    {
+        fatal("setsockopt SO_ATTACH_FILTER failed: %s\n", strerror(errno));
+    }
+}
+
+
+//
+// Set the capture filter for a ring
+//
+// NB: When the dedup filter is used, it replaces the fixed filter in the
+//     kernel. An eBPF program cannot be combined with the classic program
+//     for the user filter, so the user filter is applied in user space to
+//     the packets that pass the dedup filter.
+//
+// NB: Attaching a filter atomically replaces any filter already attached,
+//     so the filter may be changed while capture is running.
+//
+void ring_setfilter(
+    ring_t *                    ring,
+    const char *                user_filter)
+{
+    pcap_t *                    pcap;
+    struct bpf_program          program;
+    int                         r;
+
+    // Compile the filter
+    pcap = pcap_open_dead(DLT_EN10MB, ring->snaplen);
+    if (pcap == NULL)
+    {
+        fatal("pcap_open_dead failed\n");
+    }
+    interface_compile(pcap, user_filter, &program);
+
+    if (ring->dedup_fd == -1)
+    {
+        // NB: The layout of struct bpf_insn is identical to struct sock_filter
+        ring_attach(ring, (struct sock_filter *) program.bf_insns, (unsigned short) program.bf_len);
+        pcap_freecode(&program);
+    }
+    else
+    {
+        r = setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_BPF, &ring->dedup_fd, sizeof(ring->dedup_fd));
+        if (r == -1)
+        {
+            fatal("setsockopt SO_ATTACH_BPF failed: %s\n", strerror(errno));
+        }
+
+        if (ring->user_program_valid)
+        {
+            pcap_freecode(&ring->user_program);
+            ring->user_program_valid = 0;
+        }
+
+        if (user_filter || exclude_enabled())
+        {
+            ring->user_program = program;
+            ring->user_program_valid = 1;
+        }
+        else
+        {
+            pcap_freecode(&program);
+        }
+    }
+
+    pcap_close(pcap);
+}
+
+
+//
+// Process all the frames in a block
+//
+static void ring_process_block(
+    ring_t *                    ring,
+    struct tpacket_block_desc * block,
+    pcap_handler                callback,
+    void *                      closure)
+{
+    struct tpacket3_hdr *       hdr;
+    struct pcap_pkthdr          pkthdr;
+    const unsigned char *       packet;
+    unsigned int                tpid;
+    unsigned int                num_pkts;
+    unsigned int                i;
+
+    num_pkts = block->hdr.bh1.num_pkts;
+    hdr = (struct tpacket3_hdr *) ((unsigned char *) block + block->hdr.bh1.offset_to_first_pkt);
+
+    for (i = 0; i < num_pkts; i++)
+    {
+        pkthdr.ts.tv_sec = hdr->tp_sec;
+        pkthdr.ts.tv_usec = hdr->tp_nsec / 1000;
+        pkthdr.caplen = hdr->tp_snaplen;
+        pkthdr.len = hdr->tp_len;
+        packet = (unsigned char *) hdr + hdr->tp_mac;
+
+        // NB: The kernel removes the outer VLAN tag of a frame before it is
+        //     captured. When monitoring a trunk, the tag is reinserted so the
+        //     frame is seen as it was on the wire. Otherwise the frame belongs
+        //     to a tagged segment rather than the segment being monitored,
+        //     and is ignored.
+        if (hdr->tp_status & TP_STATUS_VLAN_VALID)
+        {
+            if (ring->vlan_frame && pkthdr.caplen >= 12 && pkthdr.caplen <= (unsigned int) ring->snaplen)
+            {
+                tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+                memcpy(ring->vlan_frame, packet, 12);
+                ring->vlan_frame[12] = (unsigned char) (tpid >> 8);
+                ring->vlan_frame[13] = (unsigned char) tpid;
+                ring->vlan_frame[14] = (unsigned char) (hdr->hv1.tp_vlan_tci >> 8);
+                ring->vlan_frame[15] = (unsigned char) hdr->hv1.tp_vlan_tci;
+                memcpy(ring->vlan_frame + 16, packet + 12, pkthdr.caplen - 12);
+                pkthdr.caplen += 4;
+                pkthdr.len += 4;
+                packet = ring->vlan_frame;
+            }
+            else
+            {
+                packet = NULL;
+            }
+        }
+
+        if (packet && (ring->user_program_valid == 0 ||
+                       pcap_offline_filter(&ring->user_program, &pkthdr, packet)))
+        {
+            callback(closure, &pkthdr, packet);
+        }
+
+        hdr = (struct tpacket3_hdr *) ((unsigned char *) hdr + hdr->tp_next_offset);
+    }
+}
+
+
+//
+// Join the fanout group for a ring
+//
+// NB: Group ids are shared by all processes in the network namespace. The
+//     first ring on an interface has the kernel create the group with an
+//     id that is not in use, and the other rings on the interface join the
+//     group with that id.
+//
+static void ring_join_fanout(
+    ring_t *                    ring)
+{
+    struct sock_fprog           fprog;
+    ring_fanout_t *             fanout;
+    int                         fanout_arg;
+    socklen_t                   len;
+    int                         r;
+
+    for (fanout = ring_fanouts; fanout; fanout = fanout->next)
+    {
+        if (fanout->ifindex == ring->ifindex)
+        {
+            break;
+        }
+    }
+
+    if (fanout)
+    {
+        fanout_arg = (int) (fanout->id | (PACKET_FANOUT_CBPF << 16));
+        r = setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg));
+        if (r == -1)
+        {
+            fatal("setsockopt PACKET_FANOUT failed: %s\n", strerror(errno));
+        }
+    }
+    else
+    {
+        fanout_arg = (int) ((PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_UNIQUEID) << 16);
+        r = setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg));
+        if (r == -1)
+        {
+            fatal("setsockopt PACKET_FANOUT failed: %s\n", strerror(errno));
+        }
+
+        // Get the id assigned by the kernel
+        len = sizeof(fanout_arg);
+        r = getsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, &len);
+        if (r == -1)
+        {
+            fatal("getsockopt PACKET_FANOUT failed: %s\n", strerror(errno));
+        }
+
+        fanout = calloc(1, sizeof(ring_fanout_t));
+        if (fanout == NULL)
+        {
+            fatal("cannot allocate memory for fanout group\n");
+        }
+        fanout->ifindex = ring->ifindex;
+        fanout->id = (unsigned int) fanout_arg & 0xffff;
+        fanout->next = ring_fanouts;
+        ring_fanouts = fanout;
+    }
+
+    fprog.len = sizeof(fanout_insns) / sizeof(fanout_insns[0]);
+    fprog.filter = fanout_insns;
+    r = setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT_DATA, &fprog, sizeof(fprog));
+    if (r == -1)
+    {
+        fatal("setsockopt PACKET_FANOUT_DATA failed: %s\n", strerror(errno));
+    }
+}
+
+
+//
+// Attach the capture filter and start capture on a ring
+//
+// NB: A socket must be bound before it can join a fanout group. To avoid
+//     receiving packets that belong to other members of the group, a socket
+//     joining a group accepts nothing until it has joined.
+//
+void ring_start(
+    ring_t *                    ring,
+    const char *                user_filter)
+{
+    struct sockaddr_ll          sll;
+    int                         r;
+
+    // Attach the filter
+    if (ring->fanout)
+    {
+        ring_attach(ring, drop_insns, sizeof(drop_insns) / sizeof(drop_insns[0]));
+    }
+    else
+    {
+        ring_setfilter(ring, user_filter);
+    }
+
+    // Bind the socket to the interface
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ring->ifindex;
+    r = bind(ring->fd, (struct sockaddr *) &sll, sizeof(sll));
+    if (r == -1)
+    {
+        fatal("bind of packet socket failed: %s\n", strerror(errno));
+    }
+
+    // Join the fanout group and attach the filter
+    if (ring->fanout)
+    {
+        ring_join_fanout(ring);
+        ring_setfilter(ring, user_filter);
+    }
+}
+
+
+//
+// Get the selectable file descriptor for a ring
+//
+int ring_get_fd(
+    ring_t *                    ring)
+{
+    return ring->fd;
+}
+
+
+//
+// Process the frames in all blocks ready in a ring
+//
+// Returns the number of blocks processed
+//
+int ring_dispatch(
+    ring_t *                    ring,
+    pcap_handler                callback,
+    void *                      closure)
+{
+    struct tpacket_block_desc * block;
+    int                         blocks = 0;
+
+    while (1)
+    {
+        block = (struct tpacket_block_desc *) (ring->map + (size_t) ring->block_index * ring->block_size);
+
+        // Has the kernel handed over the block?
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        {
+            break;
+        }
+
+        // Process the block
+        ring_process_block(ring, block, callback, closure);
+
+        // Return the block to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->block_index = (ring->block_index + 1) % ring->block_count;
+        blocks++;
+    }
+
+    return blocks;
+}
+
+
+//
+// Remove an ip address from the dedup filter of a ring
+//
+// NB: Used when a packet that passed the filter could not be processed, so
+//     that the next packet for the ip address is not dropped by the filter.
+//
+void ring_forget(
+    ring_t *                    ring,
+    uint32_t                    vlans,
+    db_iptype                   iptype,
+    const void *                addr)
+{
+    if (ring->dedup_map_fd != -1)
+    {
+        ebpf_dedup_forget(ring->dedup_map_fd, vlans, iptype, addr);
+    }
+}
+
+
+//
+// Get the state of a ring to hand to a successor
+//
+// The file descriptors handed over are the packet socket, and the dedup
+// filter program and map if used.
+//
+// Returns the number of file descriptors
+//
+int ring_handoff(
+    ring_t *                    ring,
+    ring_handoff_t *            handoff,
+    int *                       fds)
+{
+    memset(handoff, 0, sizeof(*handoff));
+    handoff->block_size = ring->block_size;
+    handoff->block_count = ring->block_count;
+    handoff->block_index = ring->block_index;
+    handoff->fanout = ring->fanout;
+
+    fds[0] = ring->fd;
+    if (ring->dedup_fd == -1)
+    {
+        return 1;
+    }
+    fds[1] = ring->dedup_fd;
+    fds[2] = ring->dedup_map_fd;
+    return 3;
+}
+
+
+//
+// Adopt a ring handed over by a predecessor
+//
+// NB: The socket is already bound, has its filter attached, and has joined
+//     its fanout group. The kernel continues to fill the ring while it is
+//     handed over, and processing resumes with the block the predecessor
+//     would have processed next.
+//
+ring_t * ring_adopt(
+    const char *                interface,
+    const int                   snaplen,
+    const ring_handoff_t *      handoff,
+    const int *                 fds,
+    unsigned int                fd_count)
+{
+    ring_t *                    ring;
+
+    // Safety check: ensure the state is usable
+    if (fd_count < 1 || handoff->block_count == 0 || handoff->block_index >= handoff->block_count)
+    {
+        fatal("invalid ring state handed over for interface %s\n", interface);
+    }
+
+    ring = ring_create(interface, snaplen, handoff->fanout);
+    ring->fd = fds[0];
+    if (fd_count > 1)
+    {
+        ring->dedup_fd = fds[1];
+    }
+    if (fd_count > 2)
+    {
+        ring->dedup_map_fd = fds[2];
+    }
+    ring->block_size = handoff->block_size;
+    ring->block_count = handoff->block_count;
+    ring->block_index = handoff->block_index;
+
+    // Map the ring
+    ring_map(ring);
+
+    return ring;
+}
+
+
+#else
+
+
+//
+// Open a TPACKET_V3 ring on an interface
+//
+ring_t * ring_open(
+    __attribute__ ((unused))
+    const char *                interface,
+    __attribute__ ((unused))
+    const int                   snaplen,
+    __attribute__ ((unused))
+    const int                   promisc,
+    __attribute__ ((unused))
+    const unsigned int          block_size,
+    __attribute__ ((unused))
+    const unsigned int          timeout,
+    __attribute__ ((unused))
+    const unsigned int          fanout,
+    __attribute__ ((unused))
+    const unsigned int          dedup_window)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Set the capture filter for a ring
+//
+void ring_setfilter(
+    __attribute__ ((unused))
+    ring_t *                    ring,
+    __attribute__ ((unused))
+    const char *                user_filter)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Attach the capture filter and start capture on a ring
+//
+void ring_start(
+    __attribute__ ((unused))
+    ring_t *                    ring,
+    __attribute__ ((unused))
+    const char *                user_filter)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Get the selectable file descriptor for a ring
+//
+int ring_get_fd(
+    __attribute__ ((unused))
+    ring_t *                    ring)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Process the frames in all blocks ready in a ring
+//
+int ring_dispatch(
+    __attribute__ ((unused))
+    ring_t *                    ring,
+    __attribute__ ((unused))
+    pcap_handler                callback,
+    __attribute__ ((unused))
+    void *                      closure)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Remove an ip address from the dedup filter of a ring
+//
+void ring_forget(
+    __attribute__ ((unused))
+    ring_t *                    ring,
+    __attribute__ ((unused))
+    uint32_t                    vlans,
+    __attribute__ ((unused))
+    db_iptype                   iptype,
+    __attribute__ ((unused))
+    const void *                addr)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Get the state of a ring to hand to a successor
+//
+int ring_handoff(
+    __attribute__ ((unused))
+    ring_t *                    ring,
+    __attribute__ ((unused))
+    ring_handoff_t *            handoff,
+    __attribute__ ((unused))
+    int *                       fds)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+//
+// Adopt a ring handed over by a predecessor
+//
+ring_t * ring_adopt(
+    __attribute__ ((unused))
+    const char *                interface,
+    __attribute__ ((unused))
+    const int                   snaplen,
+    __attribute__ ((unused))
+    const ring_handoff_t *      handoff,
+    __attribute__ ((unused))
+    const int *                 fds,
+    __attribute__ ((unused))
+    unsigned int                fd_count)
+{
+    fatal("ring capture is not supported on this platform\n");
+}
+
+
+#endif
@@ -0,0 +1,492 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "andwatch.h"
+
+
+// Identification of snapshot files
+#define SNAPSHOT_MAGIC          (0x4157534e)
+#define SNAPSHOT_VERSION        (2)
+
+// FNV-1a parameters
+#define FNV_OFFSET_BASIS        (0xcbf29ce484222325ULL)
+#define FNV_PRIME               (0x100000001b3ULL)
+
+// Initial number of entries allocated for a snapshot
+#define SNAPSHOT_INITIAL_ENTRIES (1024)
+
+
+//
+// Snapshot being written
+//
+// NB: The entries are collected in memory by the capture worker, and the
+//     file is written by the snapshot thread. The snapshot is written to a
+//     temporary file, which is renamed over the previous snapshot once it is
+//     complete, so a snapshot file is always either the previous or the new
+//     snapshot.
+//
+struct snapshot_writer
+{
+    struct snapshot_writer *    next;
+    char                        filename[ANDWATCH_PATH_BUFFER];
+    char                        filename_tmp[ANDWATCH_PATH_BUFFER];
+    snapshot_header_t           header;
+    snapshot_entry_t *          entries;
+    uint64_t                    count;
+    uint64_t                    size;
+};
+
+// Snapshots waiting to be written, and the number waiting or being written
+static pthread_mutex_t          snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           snapshot_cond = PTHREAD_COND_INITIALIZER;
+static snapshot_writer_t *      snapshot_head = NULL;
+static snapshot_writer_t *      snapshot_tail = NULL;
+static unsigned int             snapshot_pending = 0;
+
+// Snapshot thread
+static pthread_once_t           snapshot_once = PTHREAD_ONCE_INIT;
+static pthread_t                snapshot_thread;
+
+
+
+//
+// Hash a block of memory (FNV-1a)
+//
+static uint64_t snapshot_hash(
+    uint64_t                    hash,
+    const void *                data,
+    size_t                      len)
+{
+    const uint8_t *             p = data;
+    size_t                      i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+//
+// Get the checksum of a header
+//
+// NB: The checksum of the entries is continued with the header, taken with
+//     the checksum set to zero.
+//
+static uint64_t snapshot_header_hash(
+    uint64_t                    hash,
+    const snapshot_header_t *   header)
+{
+    snapshot_header_t           copy = *header;
+
+    copy.checksum = 0;
+    return snapshot_hash(hash, &copy, sizeof(copy));
+}
+
+
+//
+// Get the file name of the snapshot of a capture worker for an interface
+//
+void snapshot_filename(
+    char *                      filename,
+    size_t                      len,
+    const char *                name,
+    unsigned int                worker)
+{
+    snprintf(filename, len, "%s/%s-%u%s", lib_dir, name, worker, SNAPSHOT_SUFFIX);
+}
+
+
+//
+// Create a snapshot
+//
+// Returns the snapshot writer
+//
+snapshot_writer_t * snapshot_create(
+    const char *                name,
+    unsigned int                worker)
+{
+    snapshot_writer_t *         writer;
+
+    writer = calloc(1, sizeof(snapshot_writer_t));
+    if (writer == NULL)
+    {
+        fatal("cannot allocate memory for snapshot\n");
+    }
+
+    // Construct the file names
+    snapshot_filename(writer->filename, sizeof(writer->filename), name, worker);
+    snprintf(writer->filename_tmp, sizeof(writer->filename_tmp), "%s/%s-%u%s%s", lib_dir, name, worker, SNAPSHOT_SUFFIX, TMP_SUFFIX);
+
+    return writer;
+}
+
+
+//
+// Add an entry to a snapshot
+//
+void snapshot_add(
+    snapshot_writer_t *         writer,
+    const snapshot_entry_t *    entry)
+{
+    snapshot_entry_t *          entries;
+    uint64_t                    size;
+
+    if (writer->count == writer->size)
+    {
+        size = writer->size ? writer->size * 2 : SNAPSHOT_INITIAL_ENTRIES;
+        entries = realloc(writer->entries, size * sizeof(snapshot_entry_t));
+        if (entries == NULL)
+        {
+            fatal("cannot allocate memory for snapshot\n");
+        }
+        writer->entries = entries;
+        writer->size = size;
+    }
+
+    writer->entries[writer->count++] = *entry;
+}
+
+
+//
+// Free a snapshot writer
+//
+static void snapshot_free(
+    snapshot_writer_t *         writer)
+{
+    free(writer->entries);
+    free(writer);
+}
+
+
+//
+// Write a snapshot file
+//
+// NB: The file is on disk before it is renamed, and the rename is on disk
+//     before the snapshot is considered written. If the snapshot cannot be
+//     written, the previous snapshot is kept.
+//
+static void snapshot_write(
+    snapshot_writer_t *         writer)
+{
+    snapshot_header_t *         header = &writer->header;
+    FILE *                      file;
+    int                         fd;
+    int                         r = -1;
+
+    header->checksum = snapshot_header_hash(
+        snapshot_hash(FNV_OFFSET_BASIS, writer->entries, writer->count * sizeof(snapshot_entry_t)), header);
+
+    // Write the tmp file
+    file = fopen(writer->filename_tmp, "w");
+    if (file == NULL)
+    {
+        logger("failed to open %s: %s\n", writer->filename_tmp, strerror(errno));
+        return;
+    }
+    if (fwrite(header, sizeof(*header), 1, file) == 1 &&
+        fwrite(writer->entries, sizeof(snapshot_entry_t), writer->count, file) == writer->count &&
+        fflush(file) == 0 &&
+        fsync(fileno(file)) == 0)
+    {
+        r = 0;
+    }
+    if (fclose(file) != 0)
+    {
+        r = -1;
+    }
+
+    // Rename the tmp file to the final name
+    if (r == 0 && rename(writer->filename_tmp, writer->filename) != 0)
+    {
+        r = -1;
+    }
+    if (r != 0)
+    {
+        logger("failed to write snapshot %s: %s\n", writer->filename, strerror(errno));
+        (void) unlink(writer->filename_tmp);
+        return;
+    }
+
+    // Ensure the rename is on disk
+    fd = open(lib_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fsync(fd) != 0)
+    {
+        logger("failed to sync %s: %s\n", lib_dir, strerror(errno));
+    }
+    if (fd != -1)
+    {
+        (void) close(fd);
+    }
+}
+
+
+//
+// Snapshot thread
+//
+static void * snapshot_main(
+    __attribute__ ((unused))
+    void *                      arg)
+{
+    snapshot_writer_t *         writer;
+
+    pthread_mutex_lock(&snapshot_mutex);
+    while (1)
+    {
+        while (snapshot_head == NULL)
+        {
+            pthread_cond_wait(&snapshot_cond, &snapshot_mutex);
+        }
+        writer = snapshot_head;
+        snapshot_head = writer->next;
+        if (snapshot_head == NULL)
+        {
+            snapshot_tail = NULL;
+        }
+        pthread_mutex_unlock(&snapshot_mutex);
+
+        snapshot_write(writer);
+        snapshot_free(writer);
+
+        pthread_mutex_lock(&snapshot_mutex);
+        snapshot_pending--;
+        pthread_cond_broadcast(&snapshot_cond);
+    }
+
+    return NULL;
+}
+
+
+//
+// Wait for the pending snapshots to be written at exit
+//
+static void snapshot_drain(void)
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    while (snapshot_pending)
+    {
+        pthread_cond_wait(&snapshot_cond, &snapshot_mutex);
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+
+//
+// Start the snapshot thread
+//
+static void snapshot_start(void)
+{
+    sigset_t                    sigset;
+    sigset_t                    old_sigset;
+    int                         r;
+
+    (void) sigfillset(&sigset);
+    (void) pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+    r = pthread_create(&snapshot_thread, NULL, snapshot_main, NULL);
+    (void) pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+    if (r != 0)
+    {
+        fatal("cannot create snapshot thread: %s\n", strerror(r));
+    }
+
+    (void) atexit(snapshot_drain);
+}
+
+
+//
+// Complete a snapshot
+//
+// NB: The identification, sizes and count of the header are set, and the
+//     snapshot is handed to the snapshot thread to be written. A snapshot
+//     of the same file that is still waiting is replaced. The writer is
+//     freed once the snapshot is written, and snapshots pending at exit are
+//     written before the process exits.
+//
+void snapshot_commit(
+    snapshot_writer_t *         writer,
+    const snapshot_header_t *   header)
+{
+    snapshot_writer_t **        prev;
+    snapshot_writer_t *         replaced = NULL;
+
+    writer->header = *header;
+    writer->header.magic = SNAPSHOT_MAGIC;
+    writer->header.version = SNAPSHOT_VERSION;
+    writer->header.header_size = sizeof(snapshot_header_t);
+    writer->header.entry_size = sizeof(snapshot_entry_t);
+    writer->header.count = writer->count;
+    writer->next = NULL;
+
+    (void) pthread_once(&snapshot_once, snapshot_start);
+
+    pthread_mutex_lock(&snapshot_mutex);
+    for (prev = &snapshot_head; *prev; prev = &(*prev)->next)
+    {
+        if (strcmp((*prev)->filename, writer->filename) == 0)
+        {
+            replaced = *prev;
+            writer->next = replaced->next;
+            *prev = writer;
+            if (snapshot_tail == replaced)
+            {
+                snapshot_tail = writer;
+            }
+            break;
+        }
+    }
+    if (replaced == NULL)
+    {
+        if (snapshot_tail)
+        {
+            snapshot_tail->next = writer;
+        }
+        else
+        {
+            snapshot_head = writer;
+        }
+        snapshot_tail = writer;
+        snapshot_pending++;
+        pthread_cond_broadcast(&snapshot_cond);
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+
+    if (replaced)
+    {
+        snapshot_free(replaced);
+    }
+}
+
+
+//
+// Map the snapshot of a capture worker for an interface
+//
+// NB: A snapshot that is damaged, or was written by a different version, is
+//     reported and not used.
+//
+// Returns 0 if the snapshot is mapped, or -1 if it is not present or not valid
+//
+int snapshot_map(
+    const char *                name,
+    unsigned int                worker,
+    snapshot_t *                snapshot)
+{
+    char                        filename[ANDWATCH_PATH_BUFFER];
+    const snapshot_header_t *   header;
+    struct stat                 st;
+    void *                      map;
+    int                         fd;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot_filename(filename, sizeof(filename), name, worker);
+
+    // Map the file
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+        {
+            logger("failed to open %s: %s\n", filename, strerror(errno));
+        }
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snapshot_header_t))
+    {
+        logger("snapshot %s is truncated\n", filename);
+        (void) close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (map == MAP_FAILED)
+    {
+        logger("failed to map %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    snapshot->map = map;
+    snapshot->size = (size_t) st.st_size;
+
+    // Check the header
+    header = map;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->header_size != sizeof(snapshot_header_t) || header->entry_size != sizeof(snapshot_entry_t))
+    {
+        logger("snapshot %s has an unknown format or version\n", filename);
+        snapshot_unmap(snapshot);
+        return -1;
+    }
+    if (header->count > (snapshot->size - sizeof(snapshot_header_t)) / sizeof(snapshot_entry_t) ||
+        snapshot->size != sizeof(snapshot_header_t) + header->count * sizeof(snapshot_entry_t))
+    {
+        logger("snapshot %s is truncated\n", filename);
+        snapshot_unmap(snapshot);
+        return -1;
+    }
+    snapshot->header = header;
+    snapshot->entries = (const snapshot_entry_t *) (header + 1);
+
+    // Check the checksum
+    if (snapshot_header_hash(snapshot_hash(FNV_OFFSET_BASIS, snapshot->entries, header->count * sizeof(snapshot_entry_t)), header) !=
+        header->checksum)
+    {
+        logger("snapshot %s has an invalid checksum\n", filename);
+        snapshot_unmap(snapshot);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//
+// Unmap a snapshot
+//
+void snapshot_unmap(
+    snapshot_t *                snapshot)
+{
+    if (snapshot->map)
+    {
+        (void) munmap(snapshot->map, snapshot->size);
+    }
+    memset(snapshot, 0, sizeof(*snapshot));
+}
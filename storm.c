@@ -0,0 +1,271 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include "andwatch.h"
+
+
+// Dimensions of the count-min sketch (width must be a power of 2)
+#define STORM_DEPTH             (4)
+#define STORM_WIDTH             (1024)
+
+// Number of storms tracked for reporting
+#define STORM_TRACKED           (16)
+
+// A source in a storm has one in every STORM_SAMPLE packets fully processed
+#define STORM_SAMPLE            (16)
+
+// Command line variables/flags
+unsigned long                   storm_threshold = STORM_THRESHOLD;
+
+
+// Hash seeds for the rows of the sketch
+static const uint64_t           storm_seeds[STORM_DEPTH] =
+{
+    0x9e3779b97f4a7c15ULL,
+    0xc2b2ae3d27d4eb4fULL,
+    0x165667b19e3779f9ULL,
+    0xd6e8feb86659fd93ULL
+};
+
+
+// A storm being reported
+typedef struct storm_source
+{
+    // Source hardware address (all zero indicates an unused entry)
+    struct ether_addr           hwaddr;
+
+    // Packets in the current interval, and packets shed during the storm
+    unsigned long               packets;
+    unsigned long               shed;
+
+    // Peak rate of the storm (packets per second)
+    unsigned long               peak;
+} storm_source_t;
+
+
+//
+// Storm detection for a capture
+//
+// NB: The packet rate of each source hardware address is estimated by a
+//     count-min sketch of the packets in the current one second interval
+//     of packet time, using conservative update. The sketch is cleared at
+//     the start of each interval, so memory is constant regardless of the
+//     number of sources. Estimates never undercount, so a source below the
+//     threshold is never shed.
+//
+struct storm
+{
+    // Interface name, for reporting
+    const char *                ifname;
+
+    // Start of the current interval
+    time_t                      interval;
+
+    // Counters of the sketch
+    uint32_t                    counters[STORM_DEPTH][STORM_WIDTH];
+
+    // Storms being reported
+    storm_source_t              sources[STORM_TRACKED];
+};
+
+
+
+//
+// Create storm detection for a capture
+//
+storm_t * storm_create(
+    const char *                ifname)
+{
+    storm_t *                   storm;
+
+    storm = calloc(1, sizeof(storm_t));
+    if (storm == NULL)
+    {
+        fatal("cannot allocate memory for storm detection\n");
+    }
+    storm->ifname = ifname;
+
+    return storm;
+}
+
+
+//
+// Start a new interval
+//
+// NB: A tracked storm that fell below the threshold in the interval that
+//     just ended is reported as over.
+//
+static void storm_interval(
+    storm_t *                   storm,
+    time_t                      now)
+{
+    storm_source_t *            source;
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    unsigned int                i;
+
+    for (i = 0; i < STORM_TRACKED; i++)
+    {
+        source = &storm->sources[i];
+        if (source->peak == 0)
+        {
+            continue;
+        }
+
+        // NB: A gap of more than one interval means the storm has stopped
+        if (source->packets < storm_threshold || now > storm->interval + 1)
+        {
+            logger("storm from %s on %s ended: peak %lu packets per second, %lu packets shed\n",
+                eth_ntop(&source->hwaddr, hwaddr_str, sizeof(hwaddr_str)),
+                storm->ifname, source->peak, source->shed);
+            memset(source, 0, sizeof(*source));
+            continue;
+        }
+
+        source->packets = 0;
+    }
+
+    memset(storm->counters, 0, sizeof(storm->counters));
+    storm->interval = now;
+}
+
+
+//
+// Track a storm for reporting
+//
+static void storm_track(
+    storm_t *                   storm,
+    const struct ether_addr *   hwaddr,
+    unsigned long               estimate,
+    unsigned int                shed)
+{
+    storm_source_t *            source;
+    storm_source_t *            unused = NULL;
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    unsigned int                i;
+
+    for (i = 0; i < STORM_TRACKED; i++)
+    {
+        source = &storm->sources[i];
+        if (source->peak == 0)
+        {
+            if (unused == NULL)
+            {
+                unused = source;
+            }
+            continue;
+        }
+
+        // NB: The estimate counts all the packets of the source in the
+        //     interval, including those before it reached the threshold
+        if (memcmp(&source->hwaddr, hwaddr, sizeof(source->hwaddr)) == 0)
+        {
+            source->packets = estimate;
+            source->shed += shed;
+            if (source->packets > source->peak)
+            {
+                source->peak = source->packets;
+            }
+            return;
+        }
+    }
+
+    // A new storm
+    // NB: If too many storms are in progress, the new one is shed but not reported
+    if (unused)
+    {
+        unused->hwaddr = *hwaddr;
+        unused->packets = estimate;
+        unused->peak = estimate;
+        unused->shed = shed;
+
+        logger("storm from %s on %s: more than %lu packets per second, shedding\n",
+            eth_ntop(hwaddr, hwaddr_str, sizeof(hwaddr_str)), storm->ifname, storm_threshold);
+    }
+}
+
+
+//
+// Count a packet from a source hardware address
+//
+// Returns 1 if the source is in a storm and the packet should be shed, or 0
+// if the packet should be fully processed
+//
+int storm_packet(
+    storm_t *                   storm,
+    const struct ether_addr *   hwaddr,
+    time_t                      now)
+{
+    uint32_t *                  counters[STORM_DEPTH];
+    uint64_t                    key = 0;
+    uint32_t                    estimate = UINT32_MAX;
+    unsigned int                shed;
+    unsigned int                i;
+
+    if (now != storm->interval)
+    {
+        storm_interval(storm, now);
+    }
+
+    // Find the counters, and the estimate
+    memcpy(&key, hwaddr, sizeof(*hwaddr));
+    for (i = 0; i < STORM_DEPTH; i++)
+    {
+        counters[i] = &storm->counters[i][((key * storm_seeds[i]) >> 40) & (STORM_WIDTH - 1)];
+        if (*counters[i] < estimate)
+        {
+            estimate = *counters[i];
+        }
+    }
+
+    // Conservative update: only the counters at the estimate are incremented
+    for (i = 0; i < STORM_DEPTH; i++)
+    {
+        if (*counters[i] == estimate)
+        {
+            (*counters[i])++;
+        }
+    }
+    estimate++;
+
+    if (estimate <= storm_threshold)
+    {
+        return 0;
+    }
+
+    // Sample the packets of the source
+    shed = (estimate % STORM_SAMPLE) != 0;
+    storm_track(storm, hwaddr, estimate, shed);
+
+    return (int) shed;
+}
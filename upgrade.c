@@ -0,0 +1,768 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "andwatch.h"
+
+
+// Identification of upgrade messages
+#define UPGRADE_MAGIC           (0x41575550)
+#define UPGRADE_VERSION         (3)
+
+// Maximum number of file descriptors in a message
+#define UPGRADE_FDS_MAX         (3)
+
+// Maximum number of cache entries in a message
+#define UPGRADE_ENTRIES_MAX     (1024)
+
+// Maximum length of an interface name in a message
+#define UPGRADE_NAME_MAX        (64)
+
+// Cache entry flags
+#define UPGRADE_ENTRY_MULTIPLE  (0x01)
+#define UPGRADE_ENTRY_AGGREGATED (0x02)
+#define UPGRADE_ENTRY_DIRTY     (0x04)
+
+#if !defined(MSG_CMSG_CLOEXEC)
+#define MSG_CMSG_CLOEXEC        (0)
+#endif
+
+
+//
+// Upgrade protocol
+//
+// NB: On upgrade, the running process (the predecessor) starts its successor
+//     with one end of a SOCK_SEQPACKET socket pair. The successor starts any
+//     pcap captures, and reports that it is ready. The predecessor then stops
+//     capture, writes all pending records, and hands over the configuration,
+//     the capture sockets (SCM_RIGHTS), and the state of each shard and its
+//     cache. The state includes the timestamp of the last packet processed,
+//     so that the successor skips the packets its own pcap sessions captured
+//     that the predecessor has already processed. A refreshed update time
+//     that is not yet written is handed over with its entry, and written by
+//     the successor. The successor reports when
+//     it has adopted everything, and the predecessor exits. If anything
+//     fails, the predecessor resumes capture.
+//
+typedef enum upgrade_type
+{
+    UPGRADE_READY = 1,
+    UPGRADE_CONFIG = 2,
+    UPGRADE_SHARD = 3,
+    UPGRADE_STATE = 4,
+    UPGRADE_ENTRIES = 5,
+    UPGRADE_END = 6,
+    UPGRADE_DONE = 7
+} upgrade_type;
+
+// Message header
+typedef struct upgrade_header
+{
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint32_t                    type;
+    uint32_t                    length;
+} upgrade_header_t;
+
+// Capture of a shard (with the capture sockets)
+typedef struct upgrade_shard
+{
+    uint32_t                    index;
+    char                        name[UPGRADE_NAME_MAX];
+    ring_handoff_t              ring;
+} upgrade_shard_t;
+
+// State of a shard, or of the shard for a VLAN (vids are zero if unused)
+typedef struct upgrade_state
+{
+    uint32_t                    index;
+    uint32_t                    vids[VLAN_TAGS_MAX];
+    int64_t                     next_rowid;
+    int64_t                     next_maintenance_time;
+    int64_t                     iface_expire_time;
+    int64_t                     expire_time;
+    int64_t                     packet_time;
+    int64_t                     dirty_time;
+    int64_t                     capture_sec;
+    int64_t                     capture_usec;
+} upgrade_state_t;
+
+// Cache entries of the shard of the last state message
+typedef struct upgrade_entry
+{
+    int64_t                     rowid;
+    int64_t                     utime;
+    uint8_t                     addr[16];
+    uint8_t                     hwaddr[6];
+    uint8_t                     iptype;
+    uint8_t                     flags;
+} upgrade_entry_t;
+
+typedef struct upgrade_entries
+{
+    uint32_t                    count;
+    uint32_t                    reserved;
+    upgrade_entry_t             entries[UPGRADE_ENTRIES_MAX];
+} upgrade_entries_t;
+
+
+// Upgrade requested (set by signal handler)
+volatile sig_atomic_t           upgrade_requested = 0;
+
+
+
+//
+// Send a message
+//
+// Returns 0 on success, or -1 on failure
+//
+static int upgrade_send(
+    int                         sock,
+    upgrade_type                type,
+    const void *                payload,
+    size_t                      length,
+    const int *                 fds,
+    unsigned int                fd_count)
+{
+    upgrade_header_t            header;
+    struct iovec                iov[2];
+    struct msghdr               msg;
+    struct cmsghdr *            cmsg;
+    union
+    {
+        struct cmsghdr          align;
+        char                    buf[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_MAX)];
+    }                           control;
+    ssize_t                     rs;
+
+    header.magic = UPGRADE_MAGIC;
+    header.version = UPGRADE_VERSION;
+    header.type = type;
+    header.length = (uint32_t) length;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length ? 2 : 1;
+
+    // Attach the file descriptors
+    if (fd_count)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    rs = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (rs != (ssize_t) (sizeof(header) + length))
+    {
+        logger("upgrade: send failed: %s\n", rs == -1 ? strerror(errno) : "short write");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//
+// Receive a message
+//
+// NB: Up to UPGRADE_FDS_MAX file descriptors are received. If fds is NULL,
+//     any file descriptors received are closed.
+//
+// Returns the length of the payload, or -1 on failure
+//
+static ssize_t upgrade_recv(
+    int                         sock,
+    upgrade_type *              type,
+    void *                      payload,
+    size_t                      size,
+    int *                       fds,
+    unsigned int *              fd_count)
+{
+    upgrade_header_t            header;
+    struct iovec                iov[2];
+    struct msghdr               msg;
+    struct cmsghdr *            cmsg;
+    union
+    {
+        struct cmsghdr          align;
+        char                    buf[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_MAX)];
+    }                           control;
+    unsigned int                count = 0;
+    unsigned int                n;
+    unsigned int                i;
+    int                         fd;
+    ssize_t                     rs;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = size;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size ? 2 : 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    rs = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (rs <= 0)
+    {
+        logger("upgrade: receive failed: %s\n", rs == 0 ? "connection closed" :
+            (errno == EAGAIN || errno == EWOULDBLOCK) ? "timed out" : strerror(errno));
+        return -1;
+    }
+
+    // Collect the file descriptors
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+
+        n = (unsigned int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (i = 0; i < n; i++)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (fds && count < UPGRADE_FDS_MAX)
+            {
+                (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+                fds[count++] = fd;
+            }
+            else
+            {
+                (void) close(fd);
+            }
+        }
+    }
+    if (fd_count)
+    {
+        *fd_count = count;
+    }
+
+    // Safety check: ensure the message is complete and intact
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || (size_t) rs < sizeof(header) ||
+        header.magic != UPGRADE_MAGIC || header.version != UPGRADE_VERSION ||
+        header.length != (size_t) rs - sizeof(header))
+    {
+        logger("upgrade: invalid message received\n");
+        for (i = 0; i < count; i++)
+        {
+            (void) close(fds[i]);
+        }
+        return -1;
+    }
+
+    *type = (upgrade_type) header.type;
+    return (ssize_t) header.length;
+}
+
+
+//
+// Send the state of a shard, its cache, and its VLANs
+//
+// Returns 0 on success, or -1 on failure
+//
+static int send_state(
+    int                         sock,
+    shard_t *                   shard,
+    uint32_t                    index,
+    uint32_t *                  vids,
+    unsigned int                depth,
+    upgrade_entries_t *         entries)
+{
+    iface_t *                   iface = shard->iface;
+    upgrade_state_t             state;
+    upgrade_entry_t *           out;
+    cache_entry_t *             entry;
+    unsigned long               next = 0;
+    unsigned int                vid;
+
+    // State of the shard
+    memset(&state, 0, sizeof(state));
+    state.index = index;
+    memcpy(state.vids, vids, sizeof(state.vids));
+    state.next_rowid = __atomic_load_n(&iface->next_rowid, __ATOMIC_RELAXED);
+    state.next_maintenance_time = __atomic_load_n(&iface->next_maintenance_time, __ATOMIC_RELAXED);
+    state.iface_expire_time = __atomic_load_n(&iface->expire_time, __ATOMIC_RELAXED);
+    state.expire_time = shard->expire_time;
+    state.packet_time = shard->packet_time;
+    state.dirty_time = shard->dirty_time;
+    state.capture_sec = shard->capture_time.tv_sec;
+    state.capture_usec = shard->capture_time.tv_usec;
+    if (upgrade_send(sock, UPGRADE_STATE, &state, sizeof(state), NULL, 0))
+    {
+        return -1;
+    }
+
+    // Cache entries
+    entries->count = 0;
+    while (1)
+    {
+        entry = cache_next(shard->cache, &next);
+        if (entry)
+        {
+            out = &entries->entries[entries->count++];
+            memset(out, 0, sizeof(*out));
+            out->rowid = entry->rowid;
+            out->utime = entry->utime;
+            memcpy(out->addr, &entry->addr, sizeof(out->addr));
+            memcpy(out->hwaddr, &entry->hwaddr, sizeof(out->hwaddr));
+            out->iptype = (uint8_t) entry->iptype;
+            if (entry->multiple)
+            {
+                out->flags |= UPGRADE_ENTRY_MULTIPLE;
+            }
+            if (entry->aggregated)
+            {
+                out->flags |= UPGRADE_ENTRY_AGGREGATED;
+            }
+            if (entry->dirty)
+            {
+                out->flags |= UPGRADE_ENTRY_DIRTY;
+            }
+        }
+
+        if (entries->count == UPGRADE_ENTRIES_MAX || (entry == NULL && entries->count))
+        {
+            if (upgrade_send(sock, UPGRADE_ENTRIES, entries,
+                             offsetof(upgrade_entries_t, entries) + entries->count * sizeof(upgrade_entry_t), NULL, 0))
+            {
+                return -1;
+            }
+            entries->count = 0;
+        }
+
+        if (entry == NULL)
+        {
+            break;
+        }
+    }
+
+    // VLANs
+    if (shard->vlans && depth < VLAN_TAGS_MAX)
+    {
+        for (vid = 1; vid < VLAN_ID_COUNT; vid++)
+        {
+            if (shard->vlans[vid] == NULL)
+            {
+                continue;
+            }
+
+            vids[depth] = vid;
+            if (send_state(sock, shard->vlans[vid], index, vids, depth + 1, entries))
+            {
+                return -1;
+            }
+            vids[depth] = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+//
+// Hand the captures and state to a successor over the upgrade socket
+//
+// Returns 0 on success, or -1 on failure
+//
+static int upgrade_handoff(
+    int                         sock,
+    const upgrade_config_t *    config,
+    shard_t *                   shards,
+    unsigned int                count)
+{
+    upgrade_type                type;
+    upgrade_shard_t             message;
+    upgrade_entries_t *         entries;
+    uint32_t                    vids[VLAN_TAGS_MAX];
+    int                         fds[UPGRADE_FDS_MAX];
+    unsigned int                fd_count;
+    unsigned int                i;
+    int                         r = 0;
+
+    // Wait for the successor to start
+    if (upgrade_recv(sock, &type, NULL, 0, NULL, NULL) != 0 || type != UPGRADE_READY)
+    {
+        return -1;
+    }
+
+    // Process the packets waiting in pcap sessions, and write all pending records
+    // NB: A pcap session cannot be handed over. The successor has its own,
+    //     which has been capturing since it reported ready.
+    for (i = 0; i < count; i++)
+    {
+        if (shards[i].pcap)
+        {
+            interface_drain(&shards[i], pcap_packet_callback);
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        packet_flush(&shards[i]);
+    }
+    writer_flush();
+
+    // Configuration
+    if (upgrade_send(sock, UPGRADE_CONFIG, config, sizeof(*config), NULL, 0))
+    {
+        return -1;
+    }
+
+    // Captures
+    for (i = 0; i < count; i++)
+    {
+        memset(&message, 0, sizeof(message));
+        message.index = i;
+        safe_strncpy(message.name, shards[i].iface->name, sizeof(message.name));
+
+        fd_count = 0;
+        if (shards[i].ring)
+        {
+            fd_count = (unsigned int) ring_handoff(shards[i].ring, &message.ring, fds);
+        }
+        else if (shards[i].neigh)
+        {
+            fds[0] = neigh_get_fd(shards[i].neigh);
+            fd_count = 1;
+        }
+
+        if (upgrade_send(sock, UPGRADE_SHARD, &message, sizeof(message), fds, fd_count))
+        {
+            return -1;
+        }
+    }
+
+    // State
+    entries = malloc(sizeof(upgrade_entries_t));
+    if (entries == NULL)
+    {
+        fatal("cannot allocate memory for upgrade\n");
+    }
+    for (i = 0; i < count && r == 0; i++)
+    {
+        memset(vids, 0, sizeof(vids));
+        r = send_state(sock, &shards[i], i, vids, 0, entries);
+    }
+    free(entries);
+    if (r)
+    {
+        return -1;
+    }
+
+    // End
+    if (upgrade_send(sock, UPGRADE_END, NULL, 0, NULL, 0))
+    {
+        return -1;
+    }
+
+    // Wait for the successor to adopt everything
+    if (upgrade_recv(sock, &type, NULL, 0, NULL, NULL) != 0 || type != UPGRADE_DONE)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//
+// Hand the captures and state to a successor
+//
+// The successor is started by executing argv. Capture must be stopped on all
+// workers before this is called.
+//
+// Returns 1 if the successor has taken over, or 0 if capture should resume
+//
+int upgrade_start(
+    char * const                argv[],
+    const upgrade_config_t *    config,
+    shard_t *                   shards,
+    unsigned int                count)
+{
+    struct timeval              timeout = { UPGRADE_TIMEOUT, 0 };
+    char                        env[16];
+    int                         sv[2];
+    pid_t                       pid;
+    int                         r;
+
+    logger("upgrade: starting successor %s\n", argv[0]);
+
+    r = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+    if (r == -1)
+    {
+        logger("upgrade: socketpair failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    // Start the successor
+    // NB: The environment is set before the fork, so that the successor does
+    //     nothing other than exec.
+    (void) snprintf(env, sizeof(env), "%d", sv[1]);
+    (void) setenv(UPGRADE_ENV, env, 1);
+    pid = fork();
+    if (pid == 0)
+    {
+        (void) fcntl(sv[1], F_SETFD, 0);
+        (void) execvp(argv[0], argv);
+        _exit(EXIT_FAILURE);
+    }
+    (void) unsetenv(UPGRADE_ENV);
+    (void) close(sv[1]);
+    if (pid == -1)
+    {
+        logger("upgrade: fork failed: %s\n", strerror(errno));
+        (void) close(sv[0]);
+        return 0;
+    }
+
+    (void) setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    (void) setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Hand over
+    r = upgrade_handoff(sv[0], config, shards, count);
+    (void) close(sv[0]);
+    if (r)
+    {
+        // Ensure the successor does not capture alongside us
+        (void) kill(pid, SIGKILL);
+        return 0;
+    }
+
+    logger("upgrade: captures and state handed to process %d\n", (int) pid);
+    return 1;
+}
+
+
+//
+// Adopt the captures and state of a predecessor
+//
+// NB: Any failure is fatal. The predecessor resumes capture when the socket
+//     is closed.
+//
+void upgrade_receive(
+    int                         sock,
+    const upgrade_config_t *    config,
+    shard_t *                   shards,
+    unsigned int                count)
+{
+    upgrade_type                type;
+    upgrade_config_t            predecessor;
+    upgrade_shard_t             message;
+    upgrade_state_t             state;
+    upgrade_entries_t *         entries;
+    upgrade_entry_t *           in;
+    shard_t *                   shard = NULL;
+    cache_entry_t *             entry;
+    int                         fds[UPGRADE_FDS_MAX];
+    unsigned int                fd_count;
+    unsigned int                i;
+    unsigned int                j;
+    ssize_t                     len;
+
+    // Start the pcap captures, so that they overlap those of the predecessor
+    for (i = 0; i < count; i++)
+    {
+        if (shards[i].pcap)
+        {
+            interface_start(&shards[i]);
+        }
+    }
+
+    if (upgrade_send(sock, UPGRADE_READY, NULL, 0, NULL, 0))
+    {
+        fatal("upgrade: cannot contact predecessor\n");
+    }
+
+    // Configuration
+    len = upgrade_recv(sock, &type, &predecessor, sizeof(predecessor), NULL, NULL);
+    if (len != sizeof(predecessor) || type != UPGRADE_CONFIG)
+    {
+        fatal("upgrade: configuration not received\n");
+    }
+    if (memcmp(&predecessor, config, sizeof(predecessor)) != 0)
+    {
+        fatal("upgrade: configuration does not match the predecessor\n");
+    }
+
+    // Captures
+    for (i = 0; i < count; i++)
+    {
+        len = upgrade_recv(sock, &type, &message, sizeof(message), fds, &fd_count);
+        if (len != sizeof(message) || type != UPGRADE_SHARD || message.index != i ||
+            strncmp(message.name, shards[i].iface->name, sizeof(message.name)) != 0)
+        {
+            fatal("upgrade: capture for interface %s not received\n", shards[i].iface->name);
+        }
+
+        if (config->source == CAPTURE_RING)
+        {
+            shards[i].ring = ring_adopt(shards[i].iface->name, (int) config->snaplen, &message.ring, fds, fd_count);
+        }
+        else if (config->source == CAPTURE_NEIGH)
+        {
+            if (fd_count != 1)
+            {
+                fatal("upgrade: neighbor source for interface %s not received\n", shards[i].iface->name);
+            }
+            shards[i].neigh = neigh_adopt(shards[i].iface->name, fds[0]);
+        }
+    }
+
+    // State
+    entries = malloc(sizeof(upgrade_entries_t));
+    if (entries == NULL)
+    {
+        fatal("cannot allocate memory for upgrade\n");
+    }
+    while (1)
+    {
+        len = upgrade_recv(sock, &type, entries, sizeof(upgrade_entries_t), fds, &fd_count);
+        if (len == -1)
+        {
+            fatal("upgrade: state not received\n");
+        }
+
+        if (type == UPGRADE_STATE)
+        {
+            if ((size_t) len != sizeof(state))
+            {
+                fatal("upgrade: invalid state received\n");
+            }
+            memcpy(&state, entries, sizeof(state));
+            if (state.index >= count)
+            {
+                fatal("upgrade: invalid state received\n");
+            }
+
+            // Find the shard, creating it if it is for a VLAN
+            shard = &shards[state.index];
+            for (j = 0; j < VLAN_TAGS_MAX && state.vids[j]; j++)
+            {
+                if (state.vids[j] >= VLAN_ID_COUNT)
+                {
+                    fatal("upgrade: invalid state received\n");
+                }
+                shard = packet_vlan_shard(shard, state.vids[j]);
+            }
+
+            if (state.next_rowid > shard->iface->next_rowid)
+            {
+                shard->iface->next_rowid = state.next_rowid;
+            }
+            shard->iface->next_maintenance_time = state.next_maintenance_time;
+            shard->iface->expire_time = state.iface_expire_time;
+            shard->expire_time = state.expire_time;
+            shard->packet_time = state.packet_time;
+            shard->dirty_time = (time_t) state.dirty_time;
+
+            // Packets captured by the pcap session at or before the last
+            // packet processed by the predecessor are skipped
+            if (shard->pcap)
+            {
+                shard->resume_time.tv_sec = (time_t) state.capture_sec;
+                shard->resume_time.tv_usec = (suseconds_t) state.capture_usec;
+            }
+        }
+        else if (type == UPGRADE_ENTRIES)
+        {
+            if (shard == NULL || (size_t) len < offsetof(upgrade_entries_t, entries) ||
+                entries->count > UPGRADE_ENTRIES_MAX ||
+                (size_t) len != offsetof(upgrade_entries_t, entries) + entries->count * sizeof(upgrade_entry_t))
+            {
+                fatal("upgrade: invalid cache entries received\n");
+            }
+
+            for (j = 0; j < entries->count; j++)
+            {
+                in = &entries->entries[j];
+                if (in->iptype != DB_IPTYPE_4 && in->iptype != DB_IPTYPE_6)
+                {
+                    fatal("upgrade: invalid cache entries received\n");
+                }
+                entry = cache_insert(shard->cache, (db_iptype) in->iptype, in->addr);
+                memcpy(&entry->hwaddr, in->hwaddr, sizeof(entry->hwaddr));
+                entry->multiple = (in->flags & UPGRADE_ENTRY_MULTIPLE) != 0;
+                entry->aggregated = (in->flags & UPGRADE_ENTRY_AGGREGATED) != 0;
+                entry->dirty = (in->flags & UPGRADE_ENTRY_DIRTY) != 0;
+                entry->rowid = (long) in->rowid;
+                entry->utime = (time_t) in->utime;
+                if (entry->dirty && (shard->dirty_time == 0 || entry->utime < shard->dirty_time))
+                {
+                    shard->dirty_time = entry->utime;
+                }
+            }
+        }
+        else if (type == UPGRADE_END)
+        {
+            break;
+        }
+        else
+        {
+            fatal("upgrade: unexpected message received\n");
+        }
+    }
+    free(entries);
+
+    if (upgrade_send(sock, UPGRADE_DONE, NULL, 0, NULL, 0))
+    {
+        fatal("upgrade: cannot contact predecessor\n");
+    }
+    (void) close(sock);
+
+    // Set the filters
+    for (i = 0; i < count; i++)
+    {
+        interface_resume(&shards[i]);
+    }
+
+    logger("upgrade: captures and state adopted from predecessor\n");
+}
@@ -37,25 +37,40 @@
 #include "andwatch.h"
 
 
+// For the character array in ether_addr, most systems use the name
+// ether_addr_octet. Some systems just use the name octet but provide
+// a #define for ether_addr_octet. FreeBSD uses octet, but currently
+// does not provide a #define.
+#if defined(__FreeBSD__)
+# if !defined(ether_addr_octet)
+#  define ether_addr_octet octet
+# endif
+#endif
+
+
 // Command line variables/flags
 const char *                    lib_dir = LIB_DIR;
 const char *                    ifname = NULL;
 unsigned int                    flag_syslog = 0;
 
+// Alternate output for log messages (asynchronous logging in andwatchd)
+logger_output_t                 logger_output = NULL;
+
 
 
 //
 // Log abnormal events
 //
-__attribute__ ((format (printf, 1, 2)))
-void logger(
+__attribute__ ((format (printf, 1, 0)))
+void vlogger(
     const char *                format,
-    ...)
+    va_list                     args)
 {
-    va_list                     args;
-
-    va_start(args, format);
-    if (flag_syslog)
+    if (logger_output)
+    {
+        logger_output(LOG_WARNING, format, args);
+    }
+    else if (flag_syslog)
     {
         vsyslog(LOG_WARNING, format, args);
     }
@@ -63,6 +78,21 @@ void logger(
     {
         vfprintf(stderr, format, args);
     }
+}
+
+
+//
+// Log abnormal events
+//
+__attribute__ ((format (printf, 1, 2)))
+void logger(
+    const char *                format,
+    ...)
+{
+    va_list                     args;
+
+    va_start(args, format);
+    vlogger(format, args);
     va_end(args);
 }
 
@@ -78,7 +108,11 @@ void fatal(
     va_list                     args;
 
     va_start(args, format);
-    if (flag_syslog)
+    if (logger_output)
+    {
+        logger_output(LOG_ERR, format, args);
+    }
+    else if (flag_syslog)
     {
         vsyslog(LOG_ERR, format, args);
     }
@@ -112,6 +146,56 @@ void safe_strncpy(
 }
 
 
+//
+// Convert an ethernet address to printable (text) form
+//
+const char * eth_ntop(
+    const struct ether_addr *   eth_addr,
+    char *                      buf,
+    size_t                      buflen)
+{
+    snprintf(buf, buflen, "%02x:%02x:%02x:%02x:%02x:%02x",
+        eth_addr->ether_addr_octet[0],
+        eth_addr->ether_addr_octet[1],
+        eth_addr->ether_addr_octet[2],
+        eth_addr->ether_addr_octet[3],
+        eth_addr->ether_addr_octet[4],
+        eth_addr->ether_addr_octet[5]);
+
+    return buf;
+}
+
+
+//
+// Convert a printable (text) ethernet address to binary
+//
+// Returns 1 on success, 0 if the string is not a valid ethernet address
+//
+int eth_pton(
+    const char *                str,
+    struct ether_addr *         eth_addr)
+{
+    unsigned int                octets[6];
+    unsigned char *             p = (unsigned char *) eth_addr;
+    char                        extra;
+    int                         i;
+
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%c",
+               &octets[0], &octets[1], &octets[2],
+               &octets[3], &octets[4], &octets[5], &extra) != 6)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < 6; i++)
+    {
+        p[i] = (unsigned char) octets[i];
+    }
+
+    return 1;
+}
+
+
 //
 // Do a reverse lookup on a network address
 //
@@ -0,0 +1,551 @@
+
+//
+// Copyright (c) 2025-2026, Denny Page
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "andwatch.h"
+
+
+// Time (ns) for the capture thread to wait for space in a full queue
+#define WRITER_WAIT_NSEC        (1000000)
+
+// Statistics report requested (set by signal handler)
+volatile sig_atomic_t           writer_report_requested = 0;
+
+// Writer state
+static iface_t *                writer_transactions_open = NULL;
+static unsigned int             writer_batch_size = WRITER_BATCH_SIZE;
+static int                      writer_wait_when_full = 0;
+static queue_t **               writer_queues = NULL;
+static unsigned int             writer_queue_count = 0;
+static unsigned int             writer_queue_next = 0;
+static pthread_t                writer_thread;
+
+// Writer wakeup
+static pthread_mutex_t          writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           writer_cond = PTHREAD_COND_INITIALIZER;
+static int                      writer_wakeup = 0;
+static int                      writer_stopping = 0;
+
+// Writer flush (the sequence of the last flush requested, and of the last
+// flush completed)
+static pthread_cond_t           writer_flushed_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long            writer_flush_requested = 0;
+static unsigned long            writer_flush_completed = 0;
+
+// Writer statistics (writer thread)
+static unsigned long            writer_records = 0;
+static unsigned long            writer_transactions = 0;
+
+
+
+//
+// End all open transactions
+//
+// NB: Interfaces with an open transaction are kept on a list, as the
+//     interfaces for the VLANs on a trunk are created as they are seen.
+//
+static void end_transactions(void)
+{
+    iface_t *                   iface;
+
+    while (writer_transactions_open)
+    {
+        iface = writer_transactions_open;
+        writer_transactions_open = iface->transaction_next;
+
+        db_end_transaction(iface->db);
+        iface->transaction = 0;
+        iface->transaction_next = NULL;
+        __atomic_add_fetch(&writer_transactions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+//
+// Write an insert or owner insert record
+//
+// NB: For an ip address with multiple owners, the owner is recorded in the
+//     owner table rather than inserting a row in the ipmap table.
+//
+static void write_insert(
+    const record_t *            record)
+{
+    iface_t *                   iface = record->iface;
+    int                         af_type = (record->iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+    char                        old_hwaddr_str[ETH_ADDRSTRLEN] = "(none)";
+    char                        prefix_str[INET6_ADDRSTRLEN];
+    char                        hostname[HOSTNAME_LEN];
+    const char *                learned_hostname = NULL;
+
+    // Convert the addresses to text
+    (void) inet_ntop(af_type, &record->addr, ipaddr_str, sizeof(ipaddr_str));
+    eth_ntop(&record->hwaddr, hwaddr_str, sizeof(hwaddr_str));
+    if (record->old_valid)
+    {
+        eth_ntop(&record->old_hwaddr, old_hwaddr_str, sizeof(old_hwaddr_str));
+    }
+
+    // Insert the entry into the database
+    if (record->type == RECORD_OWNER_INSERT)
+    {
+        db_owner_set(iface->db, record->iptype, ipaddr_str, hwaddr_str, &record->timestamp);
+    }
+    else if (record->type == RECORD_ADDR6_INSERT)
+    {
+        db_addr6_set(iface->db, ipaddr_str, aggregate_prefix(&record->addr.ipv6, prefix_str, sizeof(prefix_str)),
+                     hwaddr_str, &record->timestamp, 1);
+    }
+    else
+    {
+        db_ipmap_insert(iface->db, record->rowid, record->iptype, ipaddr_str, hwaddr_str, &record->timestamp);
+    }
+
+    // Use the learned hostname for the notification if there is one
+    if (notify_enabled && notify_cmd &&
+        db_hostname_get(iface->db, record->iptype, ipaddr_str, hwaddr_str, hostname, sizeof(hostname)))
+    {
+        learned_hostname = hostname;
+    }
+
+    // Notify
+    change_notification(iface->name, &record->timestamp, af_type, &record->addr, learned_hostname,
+                        ipaddr_str, hwaddr_str, old_hwaddr_str);
+}
+
+
+//
+// Write an owner update time record
+//
+// NB: If the owner is not yet recorded, it is inserted without notification.
+//
+static void write_owner_utime(
+    const record_t *            record)
+{
+    int                         af_type = (record->iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6;
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+
+    (void) inet_ntop(af_type, &record->addr, ipaddr_str, sizeof(ipaddr_str));
+    eth_ntop(&record->hwaddr, hwaddr_str, sizeof(hwaddr_str));
+
+    db_owner_set(record->iface->db, record->iptype, ipaddr_str, hwaddr_str, &record->timestamp);
+}
+
+
+//
+// Write an addr6 update time record
+//
+// NB: If the address is not yet recorded, it is inserted without notification.
+//
+static void write_addr6_utime(
+    const record_t *            record)
+{
+    char                        ipaddr_str[INET6_ADDRSTRLEN];
+    char                        prefix_str[INET6_ADDRSTRLEN];
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+
+    (void) inet_ntop(AF_INET6, &record->addr, ipaddr_str, sizeof(ipaddr_str));
+    aggregate_prefix(&record->addr.ipv6, prefix_str, sizeof(prefix_str));
+    eth_ntop(&record->hwaddr, hwaddr_str, sizeof(hwaddr_str));
+
+    db_addr6_set(record->iface->db, ipaddr_str, prefix_str, hwaddr_str, &record->timestamp, 0);
+}
+
+
+//
+// Write a hostname record
+//
+// NB: A zero address indicates a hostname learned for the hardware address
+//     only. The hostname is owned by the record, and is freed here.
+//
+static void write_hostname(
+    const record_t *            record)
+{
+    static const ip_addr_t      addr_zero;
+    int                         af_type = (record->iptype == DB_IPTYPE_4) ? AF_INET : AF_INET6;
+    char                        ipaddr_str[INET6_ADDRSTRLEN] = "";
+    char                        hwaddr_str[ETH_ADDRSTRLEN];
+
+    // Convert the addresses to text
+    if (memcmp(&record->addr, &addr_zero, sizeof(addr_zero)) != 0)
+    {
+        (void) inet_ntop(af_type, &record->addr, ipaddr_str, sizeof(ipaddr_str));
+    }
+    eth_ntop(&record->hwaddr, hwaddr_str, sizeof(hwaddr_str));
+
+    db_hostname_set(record->iface->db, record->iptype, ipaddr_str, hwaddr_str, record->hostname, record->timestamp.tv_sec);
+    free(record->hostname);
+}
+
+
+//
+// Write a maintenance record
+//
+// NB: The record acknowledges the expire time of the interface for a
+//     capture worker. Rows are deleted to the earliest expire time
+//     acknowledged by all the workers holding a shard of the interface.
+//     Maintenance must be performed outside of a transaction.
+//
+static void write_maintenance(
+    const record_t *            record)
+{
+    iface_t *                   iface = record->iface;
+    uint64_t                    workers;
+    time_t                      delete_time = record->timestamp.tv_sec;
+    unsigned int                w;
+
+    if (record->timestamp.tv_sec > iface->expire_acked[record->rowid])
+    {
+        iface->expire_acked[record->rowid] = record->timestamp.tv_sec;
+    }
+
+    workers = __atomic_load_n(&iface->workers, __ATOMIC_ACQUIRE);
+    for (w = 0; w < CAPTURE_WORKERS_MAX; w++)
+    {
+        if ((workers & (1ULL << w)) && iface->expire_acked[w] < delete_time)
+        {
+            delete_time = iface->expire_acked[w];
+        }
+    }
+    if (delete_time <= iface->delete_time)
+    {
+        return;
+    }
+    iface->delete_time = delete_time;
+
+    end_transactions();
+    db_ipmap_delete_old(iface->db, delete_time);
+    db_owner_delete_old(iface->db, delete_time);
+    db_addr6_delete_old(iface->db, delete_time);
+    db_hostname_delete_old(iface->db, delete_time);
+    db_maintenance(iface->db);
+}
+
+
+//
+// Write a record to the database
+//
+static void write_record(
+    const record_t *            record)
+{
+    iface_t *                   iface = record->iface;
+
+    if (record->type == RECORD_MAINTENANCE)
+    {
+        write_maintenance(record);
+        return;
+    }
+
+    // Open a transaction if needed
+    if (iface->transaction == 0)
+    {
+        db_begin_transaction(iface->db);
+        iface->transaction = 1;
+        iface->transaction_next = writer_transactions_open;
+        writer_transactions_open = iface;
+    }
+
+    switch (record->type)
+    {
+    case RECORD_INSERT:
+    case RECORD_OWNER_INSERT:
+    case RECORD_ADDR6_INSERT:
+        write_insert(record);
+        break;
+    case RECORD_OWNER_UTIME:
+        write_owner_utime(record);
+        break;
+    case RECORD_ADDR6_UTIME:
+        write_addr6_utime(record);
+        break;
+    case RECORD_HOSTNAME:
+        write_hostname(record);
+        break;
+    default:
+        db_ipmap_set_utimes(iface->db, record->rowids, record->rowid_count, record->timestamp.tv_sec);
+        free(record->rowids);
+        break;
+    }
+}
+
+
+//
+// Write a batch of records from the queues
+//
+// NB: The queues are drained in turn, starting with a different queue for
+//     each batch so that no queue is starved.
+//
+// Returns the number of records written
+//
+static unsigned int write_batch(void)
+{
+    record_t                    record;
+    queue_t *                   queue;
+    unsigned int                count = 0;
+    unsigned int                i;
+
+    // Write the records
+    for (i = 0; i < writer_queue_count && count < writer_batch_size; i++)
+    {
+        queue = writer_queues[(writer_queue_next + i) % writer_queue_count];
+        while (count < writer_batch_size && queue_pop(queue, &record))
+        {
+            write_record(&record);
+            count++;
+        }
+    }
+    writer_queue_next = (writer_queue_next + 1) % writer_queue_count;
+
+    // Close the transactions
+    end_transactions();
+
+    // The records removed from the queues are now committed
+    for (i = 0; i < writer_queue_count; i++)
+    {
+        queue_commit(writer_queues[i]);
+    }
+
+    __atomic_add_fetch(&writer_records, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+
+//
+// Database writer thread
+//
+static void * writer_main(
+    __attribute__ ((unused))
+    void *                      arg)
+{
+    unsigned long               flush;
+    int                         stopping;
+
+    while (1)
+    {
+        // Wait for work
+        pthread_mutex_lock(&writer_mutex);
+        while (writer_wakeup == 0 && writer_stopping == 0)
+        {
+            pthread_cond_wait(&writer_cond, &writer_mutex);
+        }
+        writer_wakeup = 0;
+        stopping = writer_stopping;
+        flush = writer_flush_requested;
+        pthread_mutex_unlock(&writer_mutex);
+
+        // Empty the queue
+        while (write_batch())
+        {
+            ;
+        }
+
+        // Report the flush complete
+        if (flush != writer_flush_completed)
+        {
+            pthread_mutex_lock(&writer_mutex);
+            writer_flush_completed = flush;
+            pthread_cond_broadcast(&writer_flushed_cond);
+            pthread_mutex_unlock(&writer_mutex);
+        }
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// Start the database writer thread
+//
+// NB: If wait_when_full is set, the capture thread waits for space when the
+//     queue is full rather than dropping the record. This is only suitable
+//     when no packets can be lost by waiting, such as when replaying a file.
+//     Each capture worker has its own queue.
+//
+void writer_start(
+    unsigned int                queue_count,
+    unsigned long               queue_size,
+    unsigned int                batch_size,
+    int                         wait_when_full)
+{
+    sigset_t                    sigset;
+    sigset_t                    old_sigset;
+    unsigned int                i;
+    int                         r;
+
+    writer_wait_when_full = wait_when_full;
+    if (batch_size)
+    {
+        writer_batch_size = batch_size;
+    }
+
+    // Create the queues
+    writer_queues = calloc(queue_count, sizeof(queue_t *));
+    if (writer_queues == NULL)
+    {
+        fatal("cannot allocate memory for writer queues\n");
+    }
+    for (i = 0; i < queue_count; i++)
+    {
+        writer_queues[i] = queue_create(queue_size);
+    }
+    writer_queue_count = queue_count;
+
+    // Signals are handled by the capture thread
+    (void) sigfillset(&sigset);
+    (void) pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+
+    r = pthread_create(&writer_thread, NULL, writer_main, NULL);
+    if (r != 0)
+    {
+        fatal("cannot create writer thread: %s\n", strerror(r));
+    }
+
+    (void) pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+}
+
+
+//
+// Get a queue to the database writer
+//
+queue_t * writer_get_queue(
+    unsigned int                index)
+{
+    return writer_queues[index];
+}
+
+
+//
+// Submit a record to the database writer
+//
+// Returns 1 if the record was queued, or 0 if the queue is full
+//
+int writer_submit(
+    queue_t *                   queue,
+    const record_t *            record)
+{
+    struct timespec             wait = { 0, WRITER_WAIT_NSEC };
+
+    while (queue_push(queue, record) == 0)
+    {
+        if (writer_wait_when_full == 0)
+        {
+            return 0;
+        }
+
+        writer_signal();
+        (void) nanosleep(&wait, NULL);
+    }
+
+    return 1;
+}
+
+
+//
+// Wake the database writer
+//
+void writer_signal(void)
+{
+    pthread_mutex_lock(&writer_mutex);
+    writer_wakeup = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+
+//
+// Wait for the database writer to write all queued records
+//
+// NB: Records queued before the call are written and committed before it
+//     returns. The writer thread continues to run.
+//
+void writer_flush(void)
+{
+    unsigned long               flush;
+
+    pthread_mutex_lock(&writer_mutex);
+    flush = ++writer_flush_requested;
+    writer_wakeup = 1;
+    pthread_cond_signal(&writer_cond);
+    while (writer_flush_completed < flush)
+    {
+        pthread_cond_wait(&writer_flushed_cond, &writer_mutex);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+
+//
+// Stop the database writer thread after writing all queued records
+//
+void writer_stop(void)
+{
+    pthread_mutex_lock(&writer_mutex);
+    writer_stopping = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+
+    (void) pthread_join(writer_thread, NULL);
+}
+
+
+//
+// Report database writer statistics
+//
+// NB: May be called from any capture worker. The statistics are maintained
+//     by other threads and are approximate.
+//
+void writer_report(void)
+{
+    queue_stats_t               stats;
+    unsigned int                i;
+
+    for (i = 0; i < writer_queue_count; i++)
+    {
+        queue_stats(writer_queues[i], &stats);
+        logger("writer queue %u: size %lu, depth %lu, high water %lu, overflows %lu\n",
+            i, stats.size, stats.depth, stats.high_water, stats.overflows);
+    }
+    logger("writer: records %lu, transactions %lu\n",
+        __atomic_load_n(&writer_records, __ATOMIC_RELAXED),
+        __atomic_load_n(&writer_transactions, __ATOMIC_RELAXED));
+}